@@ -0,0 +1,83 @@
+#ifndef __CACHE_SNAPSHOT_HPP
+#define __CACHE_SNAPSHOT_HPP
+
+#include "http_cache.hpp"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace azugate {
+
+// Entries of the HTTP cache written to a file, read back by the next
+// process so it doesn't start cold. The times are stored as wall clock
+// times, the entries that expired while the gateway was down are dropped
+// when the snapshot is opened.
+//
+// Opening only indexes the keys: the file is memory-mapped and an entry
+// of the memory tier is decoded on its first lookup. The entries of the
+// disk tier are records of where their body is in the segment files,
+// they're restored at once.
+class CacheSnapshot {
+public:
+    // Entry of the disk tier, its body is `length` bytes at `offset` in
+    // the segment `segment_id`
+    struct DiskRecord {
+        CacheKey key;
+        std::shared_ptr<CacheEntry> entry;
+        uint64_t segment_id = 0;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+
+    ~CacheSnapshot();
+    CacheSnapshot(const CacheSnapshot&) = delete;
+    CacheSnapshot& operator=(const CacheSnapshot&) = delete;
+
+    // Writes `entries` to a temporary file renamed to `path` once complete.
+    // The records of `pending` that weren't taken yet, and aren't in
+    // `entries`, are copied over.
+    static bool write(const std::string& path,
+                      const std::vector<std::pair<CacheKey, std::shared_ptr<CacheEntry>>>& entries,
+                      CacheSnapshot* pending = nullptr);
+    // Null if there's no snapshot at `path` or it can't be used
+    static std::unique_ptr<CacheSnapshot> open(const std::string& path);
+
+    // Decodes the entry of `key` and forgets it, null if there's none or
+    // it can't be served anymore
+    std::shared_ptr<CacheEntry> take(const CacheKey& key);
+    std::vector<DiskRecord> take_disk_records();
+    // Forgets the entries that can't be served anymore
+    size_t drop_unusable();
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Record {
+        size_t offset = 0;          // Of the payload, after the length
+        size_t length = 0;
+        bool on_disk = false;
+        // Past this, the entry is neither fresh, stale nor revalidatable
+        std::chrono::steady_clock::time_point usable_until{};
+    };
+
+    CacheSnapshot(void* mapping, size_t size);
+
+    // The caller holds mutex_
+    bool decode(const Record& record, CacheKey& key, std::shared_ptr<CacheEntry>& entry,
+                DiskRecord* disk) const;
+
+    void* mapping_;
+    const char* data_;
+    size_t size_;
+    mutable std::mutex mutex_;
+    std::unordered_map<CacheKey, Record, CacheKeyHash> index_;
+};
+
+} // namespace azugate
+
+#endif // __CACHE_SNAPSHOT_HPP
@@ -1,17 +1,21 @@
 #ifndef __CIRCUIT_BREAKER_HPP
 #define __CIRCUIT_BREAKER_HPP
 
+#include "sliding_window.hpp"
 #include <atomic>
 #include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <spdlog/spdlog.h>
 
+namespace YAML {
+class Node;
+}
+
 namespace azugate {
 
 // Circuit breaker states following the classic pattern
@@ -33,6 +37,7 @@ struct CircuitBreakerConfig {
     std::chrono::milliseconds timeout{5000};     // Request timeout (failure if exceeded)
     std::chrono::milliseconds recovery_timeout{30000};  // Time to wait before HALF_OPEN
     std::chrono::milliseconds metrics_window{60000};    // Rolling window for metrics
+    uint32_t metrics_window_buckets = 10;        // Counters the window is split in
     
     // Half-open state configuration
     uint32_t half_open_max_requests = 5;         // Max requests allowed in HALF_OPEN
@@ -59,9 +64,9 @@ struct CircuitBreakerStats {
     std::atomic<uint32_t> consecutive_failures{0};
     std::atomic<uint32_t> consecutive_successes{0};
     
-    std::chrono::steady_clock::time_point last_failure_time;
-    std::chrono::steady_clock::time_point last_success_time;
-    std::chrono::steady_clock::time_point last_state_change;
+    std::atomic<std::chrono::steady_clock::time_point> last_failure_time{};
+    std::atomic<std::chrono::steady_clock::time_point> last_success_time{};
+    std::atomic<std::chrono::steady_clock::time_point> last_state_change{};
     
     // Default constructor
     CircuitBreakerStats() = default;
@@ -75,9 +80,9 @@ struct CircuitBreakerStats {
           timeout_requests(other.timeout_requests.load()),
           consecutive_failures(other.consecutive_failures.load()),
           consecutive_successes(other.consecutive_successes.load()),
-          last_failure_time(other.last_failure_time),
-          last_success_time(other.last_success_time),
-          last_state_change(other.last_state_change) {
+          last_failure_time(other.last_failure_time.load()),
+          last_success_time(other.last_success_time.load()),
+          last_state_change(other.last_state_change.load()) {
     }
     
     // Move assignment
@@ -90,9 +95,9 @@ struct CircuitBreakerStats {
             timeout_requests.store(other.timeout_requests.load());
             consecutive_failures.store(other.consecutive_failures.load());
             consecutive_successes.store(other.consecutive_successes.load());
-            last_failure_time = other.last_failure_time;
-            last_success_time = other.last_success_time;
-            last_state_change = other.last_state_change;
+            last_failure_time.store(other.last_failure_time.load());
+            last_success_time.store(other.last_success_time.load());
+            last_state_change.store(other.last_state_change.load());
         }
         return *this;
     }
@@ -116,6 +121,8 @@ enum class CircuitBreakerResult {
 };
 
 // Individual circuit breaker instance
+// Recording an outcome takes no lock: a few relaxed atomic adds on the
+// lifetime counters and on the current bucket of the rolling window.
 class CircuitBreaker {
 public:
     explicit CircuitBreaker(const std::string& name, 
@@ -124,16 +131,24 @@ public:
     ~CircuitBreaker() = default;
     
     // Main circuit breaker operations
-    bool can_proceed();  // Check if request can proceed
+    bool can_proceed();  // Check if request can proceed, counts rejections
     void record_success(std::chrono::milliseconds response_time = std::chrono::milliseconds(0));
     void record_failure();
     void record_timeout();
+    // Classifies a response by failure_status_codes and timeout, the
+    // request must have been admitted by can_proceed() before
+    CircuitBreakerResult record_response(int status_code, std::chrono::milliseconds response_time);
+    // Gives back the admission of a request that never reached the service
+    void record_cancelled();
+    
+    // Whether can_proceed() would admit a request now, without taking a
+    // half-open slot. Lets load balancers skip open upstreams.
+    bool allows_requests() const;
     
     // Template method for automatic result handling
     template<typename Func>
     auto execute(Func&& func) -> decltype(func()) {
         if (!can_proceed()) {
-            stats_.rejected_requests++;
             throw std::runtime_error("Circuit breaker is OPEN - request rejected");
         }
         
@@ -145,7 +160,7 @@ public:
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
                 end_time - start_time);
             
-            if (duration > config_.timeout) {
+            if (duration > get_config()->timeout) {
                 record_timeout();
             } else {
                 record_success(duration);
@@ -161,10 +176,15 @@ public:
     // State and configuration
     CircuitBreakerState get_state() const { return state_.load(); }
     const std::string& get_name() const { return name_; }
-    const CircuitBreakerConfig& get_config() const { return config_; }
+    std::shared_ptr<const CircuitBreakerConfig> get_config() const {
+        return config_.load(std::memory_order_acquire);
+    }
     const CircuitBreakerStats& get_stats() const { return stats_; }
+    // Outcomes within the rolling metrics window
+    SlidingWindow::Totals get_window_totals() const;
     
-    // Configuration updates
+    // Configuration updates, the metrics window keeps the size it was
+    // created with
     void update_config(const CircuitBreakerConfig& new_config);
     void reset();  // Reset all stats and close circuit
     
@@ -174,32 +194,33 @@ public:
     void force_half_open();
 
 private:
-    void transition_to_open();
-    void transition_to_half_open();
-    void transition_to_closed();
-    void update_failure_rate();
-    bool should_open_circuit();
-    bool should_close_circuit();
-    std::chrono::milliseconds calculate_recovery_timeout();
+    // Each call loads the config once and hands it down
+    void record_success(const CircuitBreakerConfig& config,
+                        std::chrono::milliseconds response_time);
+    void record_failure(const CircuitBreakerConfig& config);
+    void transition_to_open(const CircuitBreakerConfig& config);
+    void transition_to_half_open(const CircuitBreakerConfig& config);
+    void transition_to_closed(const CircuitBreakerConfig& config);
+    bool should_open_circuit(const CircuitBreakerConfig& config,
+                             uint32_t consecutive_failures, int64_t now_ns);
+    bool should_close_circuit(const CircuitBreakerConfig& config,
+                              uint32_t consecutive_successes);
+    std::chrono::milliseconds calculate_recovery_timeout(const CircuitBreakerConfig& config) const;
     
     std::string name_;
-    CircuitBreakerConfig config_;
+    // Replaced whole by update_config(), requests only load it
+    std::atomic<std::shared_ptr<const CircuitBreakerConfig>> config_;
     std::atomic<CircuitBreakerState> state_{CircuitBreakerState::CLOSED};
     
-    mutable std::mutex stats_mutex_;
+    // Serializes reset(), never taken by requests
+    std::mutex config_mutex_;
     CircuitBreakerStats stats_;
     
     std::atomic<uint32_t> half_open_requests_{0};
-    std::chrono::steady_clock::time_point last_attempt_time_;
-    uint32_t current_backoff_count_{0};
-    
-    // Rolling window for failure rate calculation
-    struct RequestRecord {
-        std::chrono::steady_clock::time_point timestamp;
-        bool success;
-    };
-    std::vector<RequestRecord> request_history_;
-    mutable std::mutex history_mutex_;
+    std::atomic<uint32_t> current_backoff_count_{0};
+    
+    // Rolling window for the failure rate, rotated lazily
+    SlidingWindow window_;
 };
 
 // Circuit breaker registry for managing multiple circuit breakers
@@ -224,6 +245,18 @@ public:
     void set_default_config(const CircuitBreakerConfig& config);
     const CircuitBreakerConfig& get_default_config() const;
     
+    // circuit_breaker: {enabled, failure_threshold, failure_rate_threshold,
+    // timeout, recovery_timeout, failure_status_codes, ...}. Existing
+    // breakers keep their state and take the new config.
+    bool load_from_config(const YAML::Node& config);
+    void configure(bool enabled, const CircuitBreakerConfig& config);
+    // Whether the proxy consults the upstream breakers
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    
+    // Breaker shared by every route to host:port, created with the
+    // default config
+    std::shared_ptr<CircuitBreaker> get_for_upstream(const std::string& host, uint16_t port);
+    
     // Monitoring and diagnostics
     size_t count() const;
     std::string get_health_report() const;
@@ -232,11 +265,17 @@ public:
     std::string export_metrics_json() const;
 
 private:
+    using BreakerMap = std::unordered_map<std::string, std::shared_ptr<CircuitBreaker>>;
+    
     CircuitBreakerRegistry() = default;
     
-    mutable std::shared_mutex registry_mutex_;
-    std::unordered_map<std::string, std::shared_ptr<CircuitBreaker>> breakers_;
+    // Copy on write: lookups only load the current map, changes publish
+    // a new one under write_mutex_
+    std::atomic<std::shared_ptr<const BreakerMap>> breakers_{
+        std::make_shared<const BreakerMap>()};
+    mutable std::mutex write_mutex_;
     CircuitBreakerConfig default_config_;
+    std::atomic<bool> enabled_{false};
 };
 
 // Utility class for HTTP-specific circuit breaking
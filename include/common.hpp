@@ -5,8 +5,9 @@
 #include <cstdint>
 #include <iomanip>
 #include <iostream>
-#include <map>
+#include <optional>
 #include <sstream>
+#include <string>
 #include <string_view>
 
 namespace azugate {
@@ -47,43 +48,68 @@ static constexpr uint32_t HashConstantString(const std::string_view &str) {
 
 namespace network {
 
-// return an empty string if target not found in the url.
-inline std::string ExtractParamFromUrl(const std::string &url,
-                                       const std::string &key) {
-  // find the position of the query string in the URL.
-  size_t query_start = url.find("?");
-  if (query_start == std::string::npos) {
-    return "";
+// zero-copy scan of the query string in `url` for `key`, the returned view
+// points into `url`. the value is NOT percent-decoded. a key without '='
+// yields an empty value. a repeated key yields its last value, like the
+// map based parser this replaced.
+inline std::optional<std::string_view> FindQueryParam(std::string_view url,
+                                                      std::string_view key) {
+  size_t query_start = url.find('?');
+  if (query_start == std::string_view::npos) {
+    return std::nullopt;
   }
-  // extract the query string (substring after '?').
-  std::string query = url.substr(query_start + 1);
-  // split the query string by '&' to get individual key-value pairs.
-  std::map<std::string, std::string> params;
-  size_t pos = 0;
-  while ((pos = query.find("&")) != std::string::npos) {
-    std::string param = query.substr(0, pos);
-    size_t eq_pos = param.find("=");
-    if (eq_pos != std::string::npos) {
-      std::string param_key = param.substr(0, eq_pos);
-      std::string param_value = param.substr(eq_pos + 1);
-      params[param_key] = param_value;
+  std::string_view query = url.substr(query_start + 1);
+  // drop the fragment if any.
+  query = query.substr(0, query.find('#'));
+  std::optional<std::string_view> value;
+  while (!query.empty()) {
+    size_t amp = query.find('&');
+    std::string_view param = query.substr(0, amp);
+    query = amp == std::string_view::npos ? std::string_view{}
+                                          : query.substr(amp + 1);
+    size_t eq_pos = param.find('=');
+    if (param.substr(0, eq_pos) != key) {
+      continue;
     }
-    query.erase(0, pos + 1);
-  }
-  // handle the last parameter (if any).
-  size_t eq_pos = query.find("=");
-  if (eq_pos != std::string::npos) {
-    std::string param_key = query.substr(0, eq_pos);
-    std::string param_value = query.substr(eq_pos + 1);
-    params[param_key] = param_value;
+    value = eq_pos == std::string_view::npos ? std::string_view{}
+                                             : param.substr(eq_pos + 1);
   }
-  // return the value for the requested key if found, otherwise return empty
-  // string.
-  auto it = params.find(key);
-  if (it != params.end()) {
-    return it->second;
+  return value;
+}
+
+// zero-copy scan of a Cookie header ("a=1; b=2") for `name`.
+inline std::optional<std::string_view>
+FindCookie(std::string_view cookie_header, std::string_view name) {
+  while (!cookie_header.empty()) {
+    size_t semi = cookie_header.find(';');
+    std::string_view pair = cookie_header.substr(0, semi);
+    cookie_header = semi == std::string_view::npos
+                        ? std::string_view{}
+                        : cookie_header.substr(semi + 1);
+    while (!pair.empty() && (pair.front() == ' ' || pair.front() == '\t')) {
+      pair.remove_prefix(1);
+    }
+    size_t eq_pos = pair.find('=');
+    if (eq_pos == std::string_view::npos || pair.substr(0, eq_pos) != name) {
+      continue;
+    }
+    std::string_view value = pair.substr(eq_pos + 1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+      value.remove_suffix(1);
+    }
+    // cookie values may be quoted.
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+      value = value.substr(1, value.size() - 2);
+    }
+    return value;
   }
-  return "";
+  return std::nullopt;
+}
+
+// return an empty string if target not found in the url.
+inline std::string ExtractParamFromUrl(const std::string &url,
+                                       const std::string &key) {
+  return std::string(FindQueryParam(url, key).value_or(std::string_view{}));
 }
 
 } // namespace network
@@ -0,0 +1,149 @@
+#ifndef __CONCURRENCY_LIMITER_H
+#define __CONCURRENCY_LIMITER_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace YAML {
+class Node;
+}
+
+namespace azugate {
+
+enum class ConcurrencyLimitAlgorithm {
+  // grows while the latency stays close to its long term average and
+  // shrinks proportionally as it inflates, see Netflix's Gradient2.
+  kGradient,
+  // additive increase, multiplicative decrease on drops or slow responses.
+  kAimd,
+};
+
+enum class ConcurrencyQueueOrder {
+  kFifo,
+  // serves the newest waiter first, the oldest ones are the likeliest to
+  // have been given up by their client already.
+  kLifo,
+};
+
+struct ConcurrencyLimiterConfig {
+  ConcurrencyLimitAlgorithm algorithm = ConcurrencyLimitAlgorithm::kGradient;
+  size_t initial_limit = 20;
+  size_t min_limit = 1;
+  size_t max_limit = 1000;
+  // gradient: weight of a new limit estimate.
+  double smoothing = 0.2;
+  // gradient: how much the latency may exceed its long term average
+  // before the limit shrinks.
+  double rtt_tolerance = 1.5;
+  // gradient: number of samples the long term average spans.
+  size_t long_window = 600;
+  // aimd: factor applied to the limit on a drop.
+  double backoff_ratio = 0.9;
+  // aimd: a response slower than this counts as a drop.
+  std::chrono::milliseconds latency_threshold{2000};
+  // requests waiting for a slot, 0 sheds right away.
+  size_t queue_size = 100;
+  ConcurrencyQueueOrder queue_order = ConcurrencyQueueOrder::kFifo;
+  std::chrono::milliseconds queue_timeout{1000};
+
+  bool operator==(const ConcurrencyLimiterConfig &other) const = default;
+};
+
+bool ParseConcurrencyLimitAlgorithm(std::string_view spec,
+                                    ConcurrencyLimitAlgorithm &algorithm);
+bool ParseConcurrencyQueueOrder(std::string_view spec,
+                                ConcurrencyQueueOrder &order);
+
+// adaptive limit on the number of requests in flight to one upstream.
+// the limit follows the measured latency, requests above it wait in a
+// bounded queue until a slot frees up or their deadline passes, then
+// they are shed.
+class ConcurrencyLimiter
+    : public std::enable_shared_from_this<ConcurrencyLimiter> {
+public:
+  // called with true once the request may proceed, false if it's shed.
+  using Callback = std::function<void(bool admitted)>;
+
+  ConcurrencyLimiter(std::string name, const ConcurrencyLimiterConfig &config);
+
+  // runs `callback` inline if a slot is free or the queue is full,
+  // otherwise it's posted to `io_context` when the request is dequeued or
+  // times out.
+  void Acquire(boost::asio::io_context &io_context, Callback callback);
+
+  // must be called exactly once for every admitted request. `dropped`
+  // tells the request failed because the upstream is overloaded or down.
+  void Release(std::chrono::nanoseconds latency, bool dropped);
+
+  const std::string &Name() const { return name_; }
+  size_t Limit() const;
+  size_t InFlight() const;
+  size_t QueueDepth() const;
+
+private:
+  struct Waiter {
+    boost::asio::io_context *io_context;
+    Callback callback;
+    std::unique_ptr<boost::asio::steady_timer> timer;
+    // set once the waiter left the queue, either way.
+    bool done = false;
+  };
+
+  // the caller must hold mutex_.
+  void updateLimit(double latency_ns, bool dropped, size_t in_flight);
+  size_t effectiveLimit() const;
+  void publishMetrics(size_t limit, size_t in_flight, size_t queue_depth);
+  void onQueueTimeout(const std::shared_ptr<Waiter> &waiter);
+
+  std::string name_;
+  ConcurrencyLimiterConfig config_;
+  mutable std::mutex mutex_;
+  double limit_;
+  size_t in_flight_ = 0;
+  // long term average latency in nanoseconds, 0 until the first sample.
+  double long_rtt_ = 0;
+  std::deque<std::shared_ptr<Waiter>> queue_;
+};
+
+// one limiter per upstream, created on first use.
+class ConcurrencyLimiterRegistry {
+public:
+  static ConcurrencyLimiterRegistry &Instance();
+
+  // concurrency_limiter: {enabled, algorithm, initial_limit, min_limit,
+  // max_limit, queue: {size, order, timeout_ms}}. a changed config drops
+  // the existing limiters, requests they admitted still release into them.
+  // an unchanged one keeps them and the limits they learned.
+  bool LoadFromConfig(const YAML::Node &config);
+
+  void Configure(bool enabled, const ConcurrencyLimiterConfig &config);
+
+  // nullptr if concurrency limiting is disabled.
+  std::shared_ptr<ConcurrencyLimiter> Get(const std::string &name);
+
+  bool Enabled() const;
+
+private:
+  ConcurrencyLimiterRegistry() = default;
+
+  mutable std::shared_mutex mutex_;
+  bool enabled_ = false;
+  ConcurrencyLimiterConfig config_;
+  std::unordered_map<std::string, std::shared_ptr<ConcurrencyLimiter>>
+      limiters_;
+};
+
+} // namespace azugate
+
+#endif
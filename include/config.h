@@ -3,15 +3,34 @@
 #define AZUGATE_VERSION_STRING "azugate/1.0"
 
 #include "protocols.h"
+#include "route_matcher.hpp"
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_set>
 
+namespace YAML {
+class Node;
+}
+
 namespace azugate {
+class LoadBalancer;
+class UpstreamServer;
+enum class LoadBalancingStrategy;
+struct OutlierDetectionConfig;
+struct HealthCheckConfig;
+struct SlowStartConfig;
+struct RetryPolicy;
+struct HedgePolicy;
+class RouteHedging;
+struct RouteCachePolicy;
+
 // http server
 constexpr size_t kNumMaxListen = 5;
 constexpr size_t kDefaultBufSize = 1024 * 4;
@@ -60,10 +79,13 @@ extern bool g_http_external_authorization;
 // used for generating and verifying tokens.
 extern std::string g_authorization_token_secret;
 
-// rate limitor.
-extern bool g_enable_rate_limiter;
+// rate limitor, flipped by config reloads while serving.
+extern std::atomic<bool> g_enable_rate_limiter;
 extern size_t g_num_token_per_sec;
 extern size_t g_num_token_max;
+// see ParseRateLimitKey().
+extern std::string g_rate_limiter_key;
+extern std::string g_rate_limiter_shm_path;
 
 // io
 extern size_t g_num_threads;
@@ -98,6 +120,12 @@ void ConfigRateLimitor(size_t num_token_max, size_t num_token_per_sec);
 // return g_num_token_max and g_num_token_per_sec.
 std::pair<size_t, size_t> GetRateLimitorConfig();
 
+void SetRateLimitorKey(const std::string &key);
+std::string GetRateLimitorKey();
+// an empty path keeps the rate limiter state private to this process.
+void SetRateLimitorSharedMemory(const std::string &path);
+std::string GetRateLimitorSharedMemory();
+
 void AddHealthzList(std::string &&addr);
 const std::vector<std::string> &GetHealthzList();
 
@@ -105,22 +133,79 @@ const std::vector<std::string> &GetHealthzList();
 struct ConnectionInfo {
   ProtocolType type;
   // currently IPv4.
-  std::string address;
+  std::string address = "";
   uint16_t port = 0;
-  std::string http_url;
+  std::string http_url = "";
   // access local file or remote endpoint.
-  bool remote;
+  bool remote = false;
+  // normalized Host header, used for selecting the virtual host.
+  // routes with an empty host belong to the default virtual host.
+  std::string host = "";
+  // share of the traffic of a load balanced target.
+  int weight = 1;
+  // set on remote targets returned by GetTargetRoute(), the proxy reports
+  // the outcome of the request to them. `upstream` is null if no server
+  // of the route is available.
+  std::shared_ptr<LoadBalancer> load_balancer = nullptr;
+  std::shared_ptr<UpstreamServer> upstream = nullptr;
+  // retries of the route, null if it has none.
+  std::shared_ptr<const RetryPolicy> retry_policy = nullptr;
+  // hedging of the route, null if its requests aren't hedged.
+  std::shared_ptr<RouteHedging> hedging = nullptr;
+  // cache settings of the route, null to use the cache's own.
+  std::shared_ptr<const RouteCachePolicy> cache_policy = nullptr;
   bool operator==(const ConnectionInfo &other) const;
 };
 
+// how the remote targets of a route are balanced, see load_balancer.hpp.
+struct BalancingPolicy {
+  // round robin if unset.
+  std::optional<LoadBalancingStrategy> strategy = std::nullopt;
+  // maglev and ring_hash: "client_ip", "path", "header:<name>" or
+  // "cookie:<name>", client_ip if empty.
+  std::string hash_key = "";
+  // bounded load of maglev and ring_hash, 0 disables it.
+  std::optional<double> hash_balance_factor = std::nullopt;
+  // passive health checking from the proxied requests, left as is if null.
+  std::shared_ptr<const OutlierDetectionConfig> outlier_detection = nullptr;
+  // active health checks of the targets, left as is if null.
+  std::shared_ptr<const HealthCheckConfig> health_check = nullptr;
+  // traffic ramp of new and recovered targets, left as is if null.
+  std::shared_ptr<const SlowStartConfig> slow_start = nullptr;
+  // retries of the requests that failed on a target, left as is if null.
+  std::shared_ptr<const RetryPolicy> retry = nullptr;
+  // second copies of the requests slow to answer, left as is if null.
+  std::shared_ptr<const HedgePolicy> hedge = nullptr;
+  // how the responses of the route are cached, left as is if null.
+  std::shared_ptr<const RouteCachePolicy> cache = nullptr;
+};
+
 void AddRoute(ConnectionInfo &&source, ConnectionInfo &&target);
 
-std::optional<ConnectionInfo> GetTargetRoute(const ConnectionInfo &source);
+// the route only applies to requests accepted by `matcher`. conditional
+// routes are tried in insertion order before the plain ones of the same
+// virtual host.
+// `policy` balances the remote targets of the route.
+void AddRoute(ConnectionInfo &&source, ConnectionInfo &&target,
+              RequestMatcher &&matcher, const BalancingPolicy &policy = {});
+
+// `request` is only needed by conditional routes and may be null.
+std::optional<ConnectionInfo>
+GetTargetRoute(const ConnectionInfo &source,
+               const RequestView *request = nullptr);
 
 size_t GetRouterTableSize();
 
+size_t GetVirtualHostCount();
+
+// register the routes declared in the `routes` section of the config.
+bool LoadRoutesFromConfig(const YAML::Node &config);
+
 bool LoadServerConfig(const std::string &path_config_file);
 
+// "500ms", "30s", "5m", "1h" or "2d", a bare number counts seconds.
+std::optional<std::chrono::milliseconds> ParseDuration(std::string_view spec);
+
 } // namespace azugate
 
 #endif
@@ -85,6 +85,9 @@ private:
     ValidationResult validate_metrics_config(const YAML::Node& config);
     ValidationResult validate_circuit_breaker_config(const YAML::Node& config);
     ValidationResult validate_load_balancer_config(const YAML::Node& config);
+    ValidationResult validate_concurrency_limiter_config(const YAML::Node& config);
+    ValidationResult validate_retry_config(const YAML::Node& config);
+    ValidationResult validate_hedge_config(const YAML::Node& config);
     
     // File watching
     void start_file_watcher();
@@ -74,6 +74,9 @@ constexpr std::string_view kHeaderFieldHost = "host";
 constexpr std::string_view kHeaderFieldReferer = "referer";
 constexpr std::string_view kHeaderFieldAccept = "accept";
 constexpr std::string_view kHeaderFieldXGrpcWeb = "x-grpc-web";
+// HTTP/2 pseudo header, the counterpart of "host".
+constexpr std::string_view kHeaderFieldAuthority = ":authority";
+constexpr std::string_view kHeaderFieldXForwardedHost = "x-forwarded-host";
 
 // http connection.
 constexpr std::string_view kConnectionClose = "Close";
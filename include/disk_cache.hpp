@@ -0,0 +1,126 @@
+#ifndef __DISK_CACHE_HPP
+#define __DISK_CACHE_HPP
+
+#include "http_cache.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace azugate {
+
+// Append-only file holding the bodies of the disk tier. It's dropped as a
+// whole once it's the oldest and the tier is full, the entries pointing
+// into it keep the descriptor open while they're being served.
+struct DiskSegment {
+    DiskSegment(uint64_t id, std::string path, int fd)
+        : id(id), path(std::move(path)), fd(fd) {}
+    ~DiskSegment();
+
+    const uint64_t id;
+    const std::string path;
+    const int fd;
+    // Guarded by the DiskCache mutex
+    size_t used_bytes = 0;
+    std::vector<CacheKey> keys;
+    std::atomic<bool> dropped{false};
+};
+
+// Where the body of a disk tier entry is, its status line and headers stay
+// in CacheEntry::head
+struct DiskBody {
+    std::shared_ptr<DiskSegment> segment;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+// Second tier of the HTTP cache for the responses too large to be kept in
+// memory. Bodies are appended to fixed-size segment files in slabs, the
+// index and the headers stay in memory. Space is reclaimed a segment at a
+// time, oldest first, so the SSD only sees sequential writes.
+class DiskCache {
+public:
+    struct Stats {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> write_errors{0};
+        std::atomic<uint64_t> rejected{0};          // Not admitted yet
+        std::atomic<uint64_t> dropped_segments{0};
+        std::atomic<size_t> current_entries{0};
+        std::atomic<size_t> current_size_bytes{0};  // Slabs of the live segments
+    };
+
+    explicit DiskCache(const DiskCacheConfig& config);
+    ~DiskCache() = default;
+
+    // False if the directory or the first segment couldn't be set up, the
+    // tier is then left out. The segments of a previous run are removed,
+    // unless `keep_segments` for a snapshot to restore its entries from.
+    bool open(bool keep_segments = false);
+    // Entry of a previous run whose body is `length` bytes at `offset` in
+    // the kept segment `segment_id`, false if that segment is gone
+    bool restore(const CacheKey& key, std::shared_ptr<CacheEntry> entry, uint64_t segment_id,
+                 uint64_t offset, uint64_t length);
+    // Once restored, removes the kept segments no entry points into
+    void drop_unreferenced_segments();
+    // Copy of the index, for a snapshot
+    std::vector<std::pair<CacheKey, std::shared_ptr<CacheEntry>>> entries() const;
+
+    // Entry with its body on disk, null if the key isn't in the tier
+    std::shared_ptr<CacheEntry> get(const CacheKey& key);
+    // Writes the body of a complete in-memory response, false if it wasn't
+    // admitted or couldn't be written
+    bool put(const CacheKey& key, const CacheEntry& entry);
+    // Replaces the entry of a body already on disk, after a revalidation
+    bool update(const CacheKey& key, std::shared_ptr<CacheEntry> entry);
+    // Only if the key still maps to `expected`, when given
+    bool remove(const CacheKey& key, const CacheEntry* expected = nullptr);
+    void clear();
+    // Drops the entries that can't be served anymore, their slabs are
+    // reclaimed with their segment
+    size_t cleanup_unusable_entries();
+
+    // Only the limits apply, the path and the segment size are fixed
+    void update_config(const DiskCacheConfig& config);
+
+    const Stats& get_stats() const { return stats_; }
+    size_t size() const { return stats_.current_entries.load(); }
+    size_t disk_usage() const { return stats_.current_size_bytes.load(); }
+
+private:
+    // Admission between the tiers: a large response is only written once
+    // its key was offered `admit_after` times, one-off downloads don't wear
+    // the SSD out. The counters are halved every kAdmissionWindow offers.
+    bool admit(const CacheKey& key);
+
+    // The caller holds mutex_
+    std::shared_ptr<DiskSegment> open_segment();
+    bool reserve(size_t bytes, std::shared_ptr<DiskSegment>& segment, uint64_t& offset);
+    void drop_oldest_segment();
+    std::deque<std::shared_ptr<DiskSegment>>::iterator drop_segment(
+        std::deque<std::shared_ptr<DiskSegment>>::iterator it);
+    void erase(std::unordered_map<CacheKey, std::shared_ptr<CacheEntry>, CacheKeyHash>::iterator it);
+
+    static constexpr size_t kAdmissionCounters = 1 << 16;
+    static constexpr size_t kAdmissionWindow = 10 * kAdmissionCounters;
+
+    DiskCacheConfig config_;
+    mutable std::mutex mutex_;
+    std::unordered_map<CacheKey, std::shared_ptr<CacheEntry>, CacheKeyHash> index_;
+    // Oldest first, the last one is being appended to
+    std::deque<std::shared_ptr<DiskSegment>> segments_;
+    uint64_t next_segment_id_ = 0;
+    // Segments below it were kept from a previous run
+    uint64_t first_segment_id_ = 0;
+    std::vector<uint8_t> admission_counters_;
+    size_t admission_offers_ = 0;
+    Stats stats_;
+};
+
+} // namespace azugate
+
+#endif // __DISK_CACHE_HPP
@@ -6,6 +6,7 @@
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <memory>
 
 namespace azugate {
 boost::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
@@ -14,7 +15,7 @@ SslHandshake(boost::shared_ptr<boost::asio::ip::tcp::socket> sock_ptr);
 void Dispatch(boost::shared_ptr<boost::asio::io_context> io_context_ptr,
               boost::shared_ptr<boost::asio::ip::tcp::socket> sock_ptr,
               ConnectionInfo &&source_connection_info,
-              TokenBucketRateLimiter &rate_limiter,
+              std::shared_ptr<TokenBucketRateLimiter> rate_limiter,
               std::function<void()> callback);
 } // namespace azugate
 #endif
\ No newline at end of file
@@ -7,9 +7,11 @@
 #include <spdlog/spdlog.h>
 
 namespace azugate {
+// matches the raw peer address against the IpFilter snapshot, the
+// address is only formatted when the connection gets rejected.
 bool Filter(
     const boost::shared_ptr<boost::asio::ip::tcp::socket> &accepted_sock_ptr,
-    azugate::ConnectionInfo &connection_info);
+    const boost::asio::ip::tcp::endpoint &source_endpoint);
 
 }
 
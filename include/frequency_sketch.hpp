@@ -0,0 +1,55 @@
+#ifndef __FREQUENCY_SKETCH_HPP
+#define __FREQUENCY_SKETCH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace azugate {
+
+// Approximate access frequency of the keys seen recently, for TinyLFU
+// admission. A key's first access only sets its bits in the doorkeeper
+// bloom filter, the following ones go to a count-min sketch of 4-bit
+// counters. Once 10 accesses per tracked key were counted, every counter
+// is halved and the doorkeeper cleared, old popularity fades away.
+//
+// Thread-safe without locks: the counters are updated with relaxed atomic
+// operations, an increment racing with the aging may be lost. The keys
+// are the 64-bit hashes the cache already computes.
+// ref: https://arxiv.org/abs/1512.00727
+class FrequencySketch {
+public:
+    // Sized for `capacity` keys, the number of entries the cache can hold
+    explicit FrequencySketch(size_t capacity);
+
+    void record(uint64_t hash);
+    // At most 16: 15 from the sketch, 1 from the doorkeeper
+    unsigned estimate(uint64_t hash) const;
+
+    void clear();
+
+private:
+    static constexpr int kDepth = 4;
+
+    // Index of the counter of `hash` in row `row`
+    size_t counter_index(uint64_t hash, int row) const;
+    // Doorkeeper bits of `hash`, set if they all were
+    bool doorkeeper_test_and_set(uint64_t hash);
+    bool doorkeeper_contains(uint64_t hash) const;
+    // Ages the sketch once sample_size_ records were counted
+    void count_sample();
+    // Halves the counters and clears the doorkeeper
+    void age();
+
+    size_t table_mask_;       // Counters, 16 per word
+    size_t doorkeeper_mask_;  // Bits, 64 per word
+    size_t sample_size_;
+    std::unique_ptr<std::atomic<uint64_t>[]> table_;
+    std::unique_ptr<std::atomic<uint64_t>[]> doorkeeper_;
+    std::atomic<size_t> samples_{0};
+};
+
+} // namespace azugate
+
+#endif // __FREQUENCY_SKETCH_HPP
@@ -0,0 +1,161 @@
+#ifndef __HEALTH_CHECK_H
+#define __HEALTH_CHECK_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace YAML {
+class Node;
+}
+
+namespace azugate {
+
+// resolution of the timer wheel, probes fire at most one tick late.
+constexpr std::chrono::milliseconds kHealthCheckTick{100};
+// 512 slots of 100ms span 51.2s, longer intervals wait extra rounds.
+constexpr size_t kHealthCheckWheelSlots = 512;
+// probes in flight over all the targets, the others wait their turn.
+constexpr size_t kDftMaxConcurrentProbes = 64;
+// every interval is stretched or shrunk by up to this share, so targets
+// registered together drift apart instead of probing in lockstep.
+constexpr double kDftHealthCheckJitter = 0.1;
+constexpr size_t kMaxHealthCheckBodySize = 64 * 1024;
+
+// health status of an upstream server.
+enum class HealthStatus {
+  Unknown = 0,
+  Healthy = 1,
+  Unhealthy = 2,
+  // in recovery state, limited traffic.
+  Recovering = 3,
+  // taken out by the outlier detection for a while.
+  Ejected = 4
+};
+
+enum class HealthCheckType {
+  // GET `path` over a kept alive HTTP/1.1 connection.
+  kHttp,
+  // the server is healthy if it accepts a connection.
+  kTcp,
+  // grpc.health.v1.Health/Check over cleartext HTTP/2.
+  kGrpc,
+};
+
+struct HealthCheckConfig {
+  bool enabled = true;
+  HealthCheckType type = HealthCheckType::kHttp;
+  // http: endpoint probed.
+  std::string path = "/health";
+  std::chrono::milliseconds interval{5000};
+  // of one probe, connecting included.
+  std::chrono::milliseconds timeout{2000};
+  // consecutive successes to mark an unhealthy server healthy again, an
+  // unknown one is healthy after its first success.
+  int healthy_threshold = 2;
+  // consecutive failures to mark a server unhealthy.
+  int unhealthy_threshold = 3;
+  // http: expected status code and, if not empty, body.
+  unsigned expected_status = 200;
+  std::string expected_body = "";
+  // grpc: service asked about, empty for the whole server.
+  std::string grpc_service = "";
+  bool operator==(const HealthCheckConfig &other) const = default;
+};
+
+bool ParseHealthCheckType(std::string_view spec, HealthCheckType &type);
+
+struct HealthCheckResult {
+  bool success = false;
+  // after applying the thresholds.
+  HealthStatus status = HealthStatus::Unknown;
+  bool status_changed = false;
+  std::chrono::nanoseconds latency{0};
+};
+
+// active health checks of every upstream on one timer: a hashed timer
+// wheel holds the next probe of each target, a single steady_timer
+// advances it every tick and moves the due targets to a FIFO that is
+// drained up to the concurrency bound. HTTP and gRPC targets keep their
+// probe connection alive between checks.
+// ref: http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+class HealthCheckScheduler {
+public:
+  // called from the io_context after every probe of the target.
+  using Callback = std::function<void(const HealthCheckResult &)>;
+
+  static HealthCheckScheduler &Instance();
+
+  // load_balancer.health_checks: {max_concurrent, jitter}.
+  bool LoadFromConfig(const YAML::Node &config);
+
+  void Configure(size_t max_concurrent, double jitter);
+
+  // targets registered before are probed once it runs.
+  void Start(boost::asio::io_context &io_context);
+  void Stop();
+
+  // the first probe happens at a random point of the first interval.
+  // returns the id to unregister the target with.
+  uint64_t Register(const std::string &address, uint16_t port,
+                    const HealthCheckConfig &config, Callback callback);
+  // a probe in flight completes without calling back.
+  void Unregister(uint64_t id);
+
+  size_t NumTargets() const;
+  size_t NumInFlight() const;
+
+private:
+  struct Connection;
+  struct Target;
+  class Probe;
+
+  HealthCheckScheduler() = default;
+
+  // the caller must hold mutex_.
+  void schedule(const std::shared_ptr<Target> &target,
+                std::chrono::nanoseconds delay);
+  std::chrono::nanoseconds jittered(std::chrono::milliseconds interval);
+  void armTimer();
+  void onTick();
+  // pops ready targets while probes are allowed, the caller must hold
+  // mutex_ and start them once it's released.
+  void takeReady(std::vector<std::shared_ptr<Probe>> &probes);
+  void onProbeDone(const std::shared_ptr<Target> &target,
+                   std::shared_ptr<Connection> connection, bool success,
+                   std::chrono::nanoseconds latency);
+
+  mutable std::mutex mutex_;
+  boost::asio::io_context *io_context_ = nullptr;
+  std::unique_ptr<boost::asio::steady_timer> timer_;
+  bool running_ = false;
+  size_t max_concurrent_ = kDftMaxConcurrentProbes;
+  double jitter_ = kDftHealthCheckJitter;
+  std::mt19937_64 rng_{std::random_device{}()};
+  uint64_t next_id_ = 1;
+  std::unordered_map<uint64_t, std::shared_ptr<Target>> targets_;
+  // targets stay in their slot until due, unregistered ones are dropped
+  // when their slot comes up.
+  std::vector<std::vector<std::shared_ptr<Target>>> wheel_ =
+      std::vector<std::vector<std::shared_ptr<Target>>>(
+          kHealthCheckWheelSlots);
+  size_t current_slot_ = 0;
+  std::chrono::steady_clock::time_point last_tick_;
+  std::deque<std::shared_ptr<Target>> ready_;
+  size_t in_flight_ = 0;
+};
+
+} // namespace azugate
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __HEDGING_H
+#define __HEDGING_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace YAML {
+class Node;
+}
+
+namespace azugate {
+
+// share of the active requests that may have a hedge in flight.
+constexpr double kDftHedgeBudgetPercent = 10.0;
+// hedges always allowed whatever the traffic.
+constexpr size_t kDftMinHedgeConcurrency = 1;
+// the percentile of a route is trusted once it saw that many responses,
+// the fixed delay is used before.
+constexpr uint64_t kMinHedgeLatencySamples = 100;
+// the latency histogram is halved every that many samples, so the
+// percentile follows the recent traffic.
+constexpr uint64_t kHedgeLatencyDecaySamples = 10000;
+
+struct HedgePolicy {
+  bool enabled = false;
+  // hedge once this percentile of the latency the route observed passed,
+  // 0 to always wait `delay`.
+  double percentile = 0;
+  // fixed delay, also used while the route has too few samples.
+  std::chrono::milliseconds delay{50};
+  // floor of the percentile based delay, a fast route must not hedge
+  // every request.
+  std::chrono::milliseconds min_delay{5};
+  bool operator==(const HedgePolicy &other) const = default;
+};
+
+// parses a hedge delay: a duration ("50ms") or a percentile ("p95").
+bool ParseHedgeDelay(std::string_view spec, HedgePolicy &policy);
+
+// time to the response headers, in log-linear buckets of 4 per power of
+// two from 1us. recording is lock free, the counts may be slightly off
+// while the histogram is being decayed.
+class LatencyHistogram {
+public:
+  static constexpr size_t kNumBuckets = 4 * 40;
+
+  void Record(std::chrono::nanoseconds latency);
+  // upper bound of the bucket holding the `percentile`, nullopt if fewer
+  // than `min_samples` were recorded.
+  std::optional<std::chrono::nanoseconds>
+  Percentile(double percentile, uint64_t min_samples) const;
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+  void decay();
+
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> since_decay_{0};
+};
+
+// hedging of one route: its policy and the latency of its upstreams.
+class RouteHedging {
+public:
+  explicit RouteHedging(const HedgePolicy &policy) : policy_(policy) {}
+
+  const HedgePolicy &Policy() const { return policy_; }
+  // how long the first attempt may go without response headers before a
+  // second copy is sent.
+  std::chrono::nanoseconds Delay() const;
+  void RecordLatency(std::chrono::nanoseconds latency) {
+    histogram_.Record(latency);
+  }
+
+private:
+  const HedgePolicy policy_;
+  LatencyHistogram histogram_;
+};
+
+// caps the hedges in flight over all the routes to a share of the active
+// requests, like the retry budget, so that a slow upstream doesn't double
+// the load of the others.
+class HedgeBudget {
+public:
+  static HedgeBudget &Instance();
+
+  // hedge: {budget: {percent, min_concurrency}}.
+  bool LoadFromConfig(const YAML::Node &config);
+
+  void Configure(double budget_percent, size_t min_hedge_concurrency);
+
+  // takes a hedge slot if the budget allows, it must be given back with
+  // ReleaseHedge() once the hedged request completed.
+  bool TryAcquireHedge();
+  void ReleaseHedge() {
+    active_hedges_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  size_t ActiveHedges() const {
+    return active_hedges_.load(std::memory_order_relaxed);
+  }
+
+private:
+  HedgeBudget() = default;
+
+  std::atomic<double> budget_percent_{kDftHedgeBudgetPercent};
+  std::atomic<size_t> min_hedge_concurrency_{kDftMinHedgeConcurrency};
+  std::atomic<size_t> active_hedges_{0};
+};
+
+} // namespace azugate
+
+#endif
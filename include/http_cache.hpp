@@ -1,23 +1,74 @@
 #ifndef __HTTP_CACHE_HPP
 #define __HTTP_CACHE_HPP
 
+#include <algorithm>
 #include <boost/beast/http.hpp>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include <spdlog/spdlog.h>
 #include <atomic>
 
+namespace YAML {
+class Node;
+}
+
 namespace azugate {
 
+struct DiskBody;
+class CacheSnapshot;
+class DiskCache;
+class FrequencySketch;
+
+// Which new entries make it into the memory tier once it's full
+enum class CacheAdmission {
+    None,     // All of them, SIEVE evicts whatever it picks
+    TinyLfu   // Those accessed more often than the entry they'd evict
+};
+
+// Cache settings of a route, the fields left unset fall back to the
+// HttpCacheConfig ones
+struct RouteCachePolicy {
+    // RFC 5861 windows used when the response has no such directive
+    std::optional<std::chrono::seconds> stale_while_revalidate;
+    std::optional<std::chrono::seconds> stale_if_error;
+    // Slice mode, the object is fetched and cached in ranges of this size
+    std::optional<size_t> slice_size;
+    bool operator==(const RouteCachePolicy& other) const = default;
+};
+
+// Immutable run of body bytes in a buffer shared by the entries made from
+// the same response, hits write it to the socket as is
+struct BodySegment {
+    std::shared_ptr<const std::string> buffer;
+    size_t offset = 0;
+    size_t length = 0;
+    
+    std::string_view view() const {
+        return std::string_view(*buffer).substr(offset, length);
+    }
+};
+
 // Cache entry representing a cached HTTP response
 struct CacheEntry {
-    std::string response_data;                    // Complete HTTP response
+    // Status line and headers, serialized once with the Content-Length line
+    // first. Date and Age are left out and the blank line too, they're
+    // written with every response.
+    std::string head;
+    size_t fields_at = 0;                        // End of the status line
+    size_t range_fields_at = 0;                  // End of the Content-Length line
+    std::vector<BodySegment> body;               // Empty for the disk tier
+    bool accept_ranges = false;                  // Body with a known length, 200 only
     std::chrono::steady_clock::time_point created_at;
     std::chrono::steady_clock::time_point expires_at;
     std::string etag;                            // For conditional requests
@@ -29,8 +80,19 @@ struct CacheEntry {
     bool no_store;                              // Cache-Control: no-store
     bool must_revalidate;                       // Cache-Control: must-revalidate
     int status_code;
-    size_t hit_count;                           // Number of times served from cache
+    std::atomic<size_t> hit_count;              // Number of times served from cache
     size_t size_bytes;                          // Memory usage
+    // How long after expires_at the entry may still be served, RFC 5861
+    std::chrono::seconds stale_while_revalidate{0};  // While it's refreshed in the background
+    std::chrono::seconds stale_if_error{0};          // When the upstream fails
+    // Has a validator the upstream can confirm with a 304, kept once expired
+    bool revalidatable = false;
+    // Set for the disk tier instead of the body segments
+    std::shared_ptr<const DiskBody> disk_body;
+    // Slice mode: a 206 holding the bytes from slice_offset of an object
+    // of object_size bytes
+    uint64_t slice_offset = 0;
+    uint64_t object_size = 0;
     
     CacheEntry() : created_at(std::chrono::steady_clock::now()),
                    expires_at(std::chrono::steady_clock::now()),
@@ -42,14 +104,75 @@ struct CacheEntry {
         return std::chrono::steady_clock::now() >= expires_at;
     }
     
+    bool can_serve_while_revalidating() const {
+        return std::chrono::steady_clock::now() < expires_at + stale_while_revalidate;
+    }
+    
+    bool can_serve_if_error() const {
+        return std::chrono::steady_clock::now() < expires_at + stale_if_error;
+    }
+    
+    // Expired, past both stale windows and not revalidatable, it can be dropped
+    bool is_unusable() const {
+        return !revalidatable &&
+               std::chrono::steady_clock::now() >=
+                   expires_at + std::max(stale_while_revalidate, stale_if_error);
+    }
+    
+    bool is_slice() const {
+        return status_code == 206;
+    }
+    
     bool is_cacheable() const {
-        return !no_store && status_code == 200;
+        return !no_store && (status_code == 200 || is_slice());
     }
     
     std::chrono::seconds age() const {
         auto now = std::chrono::steady_clock::now();
         return std::chrono::duration_cast<std::chrono::seconds>(now - created_at);
     }
+    
+    // In memory or on disk
+    uint64_t body_size() const;
+    // Views of the body segments covering `length` bytes from `offset`
+    std::vector<std::string_view> body_slices(uint64_t offset, uint64_t length) const;
+};
+
+// Byte range a request asks for, RFC 9110 section 14.1.2
+struct ByteRange {
+    uint64_t first = 0;
+    uint64_t length = 0;
+    bool satisfiable = true;        // A 416 otherwise
+};
+
+// What a hit writes: the pre-serialized head of the entry, the few headers
+// set for each response and a byte range of the body. The views point into
+// the entry or static storage, the entry must outlive them.
+struct CachedResponse {
+    std::string_view status_line;
+    std::string_view fields;        // Of the entry, Date and Age aside
+    std::string extra_fields;       // Date, Age, Content-Range, the blank line
+    uint64_t body_offset = 0;
+    uint64_t body_length = 0;
+};
+
+// Disk tier for the responses larger than HttpCacheConfig::max_response_size
+struct DiskCacheConfig {
+    bool enabled = false;
+    std::string path = "./cache";                   // Directory of the segment files
+    size_t max_size_bytes = 10ULL * 1024 * 1024 * 1024;
+    size_t segment_size = 256 * 1024 * 1024;        // Reclaimed as a whole, oldest first
+    size_t max_object_size = 100 * 1024 * 1024;     // At most segment_size
+    size_t slab_size = 4096;                        // Bodies start on slab boundaries
+    unsigned admit_after = 2;                       // Fetches of a key before it's written
+};
+
+// Warm restarts: the entries are written to `path` on shutdown, and every
+// `interval` when set, then read back by the next process
+struct CacheSnapshotConfig {
+    bool enabled = false;
+    std::string path = "./cache/snapshot.bin";
+    std::chrono::seconds interval{0};               // 0 writes it on shutdown only
 };
 
 // Configuration for HTTP cache behavior
@@ -58,14 +181,24 @@ struct HttpCacheConfig {
     size_t max_entries = 10000;                     // Maximum number of entries
     std::chrono::seconds default_ttl{300};          // 5 minutes default TTL
     std::chrono::seconds max_ttl{3600};             // 1 hour maximum TTL
-    std::chrono::seconds min_ttl{60};               // 1 minute minimum TTL
+    std::chrono::seconds min_ttl{60};               // Floor of the heuristic TTL
     bool respect_cache_control = true;              // Honor Cache-Control headers
     bool enable_conditional_requests = true;        // Support ETag/Last-Modified
     std::vector<std::string> cacheable_methods = {"GET", "HEAD"};
     std::vector<int> cacheable_status_codes = {200, 203, 300, 301, 302, 404, 410};
-    size_t max_response_size = 1024 * 1024;        // 1MB max response size to cache
+    size_t max_response_size = 1024 * 1024;        // 1MB max response size to keep in memory
     bool cache_private_responses = false;           // Don't cache private responses
     std::vector<std::string> cache_bypass_headers = {"Authorization"};
+    size_t num_shards = 16;                         // Rounded up to a power of two, fixed at construction
+    bool coalesce_misses = true;                    // Concurrent misses of a key wait for one fetch
+    std::chrono::milliseconds lock_timeout{5000};   // Then the waiting requests fetch themselves
+    std::chrono::seconds stale_while_revalidate{0}; // Unless the route or the response says otherwise
+    std::chrono::seconds stale_if_error{0};
+    size_t slice_size = 0;                          // Slice mode unless a route says otherwise, 0 disables it
+    CacheAdmission admission = CacheAdmission::TinyLfu;
+    double admission_window = 0.01;                 // Share of the memory tier new entries start in
+    DiskCacheConfig disk;                           // Fixed at construction but for its limits
+    CacheSnapshotConfig snapshot;                   // Fixed at construction but for the interval
     
     // Paths or patterns to never cache
     std::vector<std::string> no_cache_paths = {"/api/auth/", "/admin/"};
@@ -79,35 +212,70 @@ struct CacheKey {
     std::string method;
     std::string url;
     std::string query_params;
-    std::string vary_headers;  // Headers that affect response variation
+    std::string vary_headers;  // Vary of the stored response and the request's values
+    std::optional<uint64_t> slice;  // Index of the slice in slice mode
+    // Set by finalize() once the fields are filled in, lookups and shard
+    // selection use it instead of hashing the strings again
+    uint64_t hash = 0;
+    
+    void finalize();
     
+    // For logging, it builds a new string
     std::string to_string() const {
-        return method + ":" + url + "?" + query_params + "#" + vary_headers;
+        return method + ":" + url + "?" + query_params + "#" + vary_headers +
+               (slice ? "@" + std::to_string(*slice) : "");
     }
     
     bool operator==(const CacheKey& other) const {
-        return method == other.method && 
+        return hash == other.hash &&
+               method == other.method && 
                url == other.url && 
                query_params == other.query_params &&
-               vary_headers == other.vary_headers;
+               vary_headers == other.vary_headers &&
+               slice == other.slice;
     }
 };
 
 // Hash function for CacheKey
 struct CacheKeyHash {
     std::size_t operator()(const CacheKey& key) const {
-        return std::hash<std::string>{}(key.to_string());
+        return key.hash;
     }
 };
 
-// LRU Cache implementation for HTTP responses
+// Fetch of a missing response from the upstream, the other requests
+// missing the same key wait for it instead of fetching it too
+class CacheFlight {
+public:
+    // Called once with the entry stored by the fetch, or null if the
+    // response wasn't cacheable and the waiters have to fetch themselves
+    using Waiter = std::function<void(std::shared_ptr<CacheEntry>)>;
+    
+    // Called right away if the fetch already completed
+    void wait(Waiter waiter);
+    void complete(std::shared_ptr<CacheEntry> entry);
+    
+private:
+    std::mutex mutex_;
+    bool done_ = false;
+    std::shared_ptr<CacheEntry> entry_;
+    std::vector<Waiter> waiters_;
+};
+
+// Cache of HTTP responses split into shards by the key hash, each with its
+// own lock and SIEVE eviction: a hit only sets the visited bit of its entry
+// under the shard's shared lock, the exclusive lock is left to insertions
+// and evictions.
+// ref: https://www.usenix.org/conference/nsdi24/presentation/zhang-yazhuo
 class HttpCache {
 public:
     explicit HttpCache(const HttpCacheConfig& config = HttpCacheConfig{});
-    ~HttpCache() = default;
+    ~HttpCache();
     
-    // Main cache operations
-    std::optional<std::shared_ptr<CacheEntry>> get(const CacheKey& key);
+    // Main cache operations. An expired entry still within one of its
+    // stale windows is a miss, it's handed out through `stale` if given
+    std::optional<std::shared_ptr<CacheEntry>> get(const CacheKey& key,
+                                                   std::shared_ptr<CacheEntry>* stale = nullptr);
     bool put(const CacheKey& key, std::shared_ptr<CacheEntry> entry);
     bool remove(const CacheKey& key);
     void clear();
@@ -123,10 +291,19 @@ public:
     
     std::chrono::seconds calculate_ttl(const std::unordered_map<std::string, std::string>& headers) const;
     
+    // `route` may override the stale windows of the config. Null if the
+    // status line and the headers can't be parsed
     std::shared_ptr<CacheEntry> create_cache_entry(
-        const std::string& response_data,
+        std::string response_data,
         int status_code,
-        const std::unordered_map<std::string, std::string>& headers) const;
+        const std::unordered_map<std::string, std::string>& headers,
+        const RouteCachePolicy* route = nullptr) const;
+    
+    // Entry for a complete upstream response, status line and headers
+    // included, its buffer is taken over without a copy. Null if the
+    // response must not be cached, `response` is then left untouched
+    std::shared_ptr<CacheEntry> create_cache_entry(std::string&& response,
+                                                   const RouteCachePolicy* route = nullptr) const;
     
     CacheKey create_cache_key(const std::string& method,
                              const std::string& url,
@@ -139,6 +316,61 @@ public:
     
     std::string create_conditional_request_headers(const std::shared_ptr<CacheEntry>& entry) const;
     
+    // Whether the validators of a request match the entry, it's then
+    // answered with create_not_modified_response()
+    bool not_modified(const CacheEntry& entry,
+                      const std::unordered_map<std::string, std::string>& request_headers) const;
+    std::string create_not_modified_response(const CacheEntry& entry) const;
+    
+    // Response of a hit on `entry`. A GET with a single satisfiable Range,
+    // whose If-Range matches if sent, gets a 206 with the range of the body,
+    // an unsatisfiable one a 416 (RFC 9110 section 14). Any other gets the
+    // whole entry
+    CachedResponse create_cached_response(const CacheEntry& entry, std::string_view method,
+                                          const std::unordered_map<std::string, std::string>& request_headers) const;
+    
+    // The single range of `size` bytes the Range header asks for, unless
+    // If-Range doesn't match the validators of `entry`. Nullopt for the
+    // whole body, several ranges included
+    std::optional<ByteRange> requested_range(const CacheEntry& entry, uint64_t size,
+                                             const std::unordered_map<std::string, std::string>& request_headers) const;
+    
+    // Slice mode: large objects are fetched from the upstream in aligned
+    // ranges of slice_size() bytes, each cached under the key of the object
+    // with CacheKey::slice set. 0 if the route doesn't use it
+    size_t slice_size(const RouteCachePolicy* route = nullptr) const;
+    // First byte of the requested range, before the size of the object is
+    // known. Suffix ranges start at 0 until then
+    uint64_t requested_range_start(const std::unordered_map<std::string, std::string>& request_headers) const;
+    // Entry of the upstream's 206 for the slice at `offset`, null if it's
+    // not a 206 of that slice. It's returned even if it must not be stored,
+    // `cacheable` tells
+    std::shared_ptr<CacheEntry> create_slice_entry(std::string&& response, uint64_t offset,
+                                                   bool& cacheable,
+                                                   const RouteCachePolicy* route = nullptr) const;
+    // Head of the response for the object `slice` is part of: a 200 for
+    // the whole object, a 206 for `range` or a 416. The body, the bytes
+    // [body_offset, body_offset + body_length) of the object, is written
+    // from the slices
+    CachedResponse create_sliced_response(const CacheEntry& slice,
+                                          const std::optional<ByteRange>& range) const;
+    
+    // Copy of `stale` with the headers of the upstream's 304 merged in and
+    // a new TTL, RFC 9111 section 4.3.4. Null if the updated response must
+    // not be cached
+    std::shared_ptr<CacheEntry> refresh_entry(const CacheEntry& stale,
+                                              std::string_view not_modified_response,
+                                              const RouteCachePolicy* route = nullptr) const;
+    
+    // Single-flight for misses: the first caller for a key becomes the
+    // leader (`leader` set) and must call finish_flight() once its fetch is
+    // done, the others get the same flight to wait on
+    std::shared_ptr<CacheFlight> join_flight(const CacheKey& key, bool& leader);
+    void finish_flight(const CacheKey& key, const std::shared_ptr<CacheFlight>& flight,
+                       std::shared_ptr<CacheEntry> entry);
+    // A flight led by the caller, null if one is already in progress
+    std::shared_ptr<CacheFlight> start_flight(const CacheKey& key);
+    
     // Cache statistics and management
     struct CacheStats {
         std::atomic<uint64_t> hits{0};
@@ -146,6 +378,13 @@ public:
         std::atomic<uint64_t> stores{0};
         std::atomic<uint64_t> evictions{0};
         std::atomic<uint64_t> expired_entries{0};
+        std::atomic<uint64_t> coalesced{0};         // Misses that waited for another fetch
+        std::atomic<uint64_t> stale_served{0};      // Expired entries served within a stale window
+        std::atomic<uint64_t> revalidated{0};       // Expired entries refreshed by a 304
+        std::atomic<uint64_t> partial_hits{0};      // Hits answered with a 206
+        std::atomic<uint64_t> slice_fetches{0};     // Slices fetched from the upstream
+        std::atomic<uint64_t> admission_rejections{0}; // Dropped by TinyLFU instead of a main entry
+        std::atomic<uint64_t> restored{0};          // Entries read back from the snapshot
         std::atomic<size_t> current_size_bytes{0};
         std::atomic<size_t> current_entries{0};
         
@@ -156,60 +395,159 @@ public:
     };
     
     const CacheStats& get_stats() const { return stats_; }
+    void record_stale_served() { stats_.stale_served++; }
     void reset_stats();
     
-    // Configuration
+    // Configuration, the number of shards stays the one it was built with
     void update_config(const HttpCacheConfig& config);
-    const HttpCacheConfig& get_config() const { return config_; }
+    std::shared_ptr<const HttpCacheConfig> get_config() const {
+        return config_.load(std::memory_order_acquire);
+    }
     
     // Maintenance operations
     void cleanup_expired_entries();
-    void force_evict_lru(size_t count = 1);
+    // Writes both tiers to the snapshot path, with the entries of the
+    // previous snapshot that weren't looked up yet. False if snapshots are
+    // off or it couldn't be written.
+    bool save_snapshot();
+    bool snapshots_enabled() const { return !snapshot_path_.empty(); }
+    // Evicts up to `count` entries, taking turns over the shards
+    void force_evict(size_t count = 1);
     
     // Thread-safe size information
     size_t size() const;
     size_t memory_usage() const;
     bool is_full() const;
+    size_t num_shards() const { return shards_.size(); }
+    // Null unless the disk tier is enabled
+    const DiskCache* disk() const { return disk_.get(); }
 
 private:
-    // LRU list node
-    using LRUNode = std::pair<CacheKey, std::shared_ptr<CacheEntry>>;
-    using LRUList = std::list<LRUNode>;
-    using LRUIterator = LRUList::iterator;
-    
-    // Internal methods
-    void move_to_front(LRUIterator it);
-    void evict_lru();
-    void evict_if_needed();
+    struct Node {
+        Node(const CacheKey& key, std::shared_ptr<CacheEntry> entry)
+            : key(key), entry(std::move(entry)) {}
+        
+        CacheKey key;
+        std::shared_ptr<CacheEntry> entry;
+        // Set by hits, cleared by the eviction hand passing over the node
+        std::atomic<bool> visited{false};
+        bool in_window = false;
+    };
+    using Queue = std::list<Node>;
+    
+    // W-TinyLFU: new entries go through a small FIFO window, then compete
+    // with SIEVE's victim for a place in the main queue, the one accessed
+    // more often according to the sketch stays.
+    struct Shard {
+        explicit Shard(size_t capacity);
+        ~Shard();
+        
+        mutable std::shared_mutex mutex;
+        // Newest entries at the front, the hand walks from the back to the front
+        Queue queue;
+        // Admission window, newest at the front
+        Queue window;
+        std::unordered_map<CacheKey, Queue::iterator, CacheKeyHash> index;
+        // Next node the hand looks at, queue.end() to start over from the back
+        Queue::iterator hand;
+        size_t size_bytes = 0;    // Both queues
+        size_t window_bytes = 0;
+        // Lookups of the shard's keys, hits and misses, sized at construction
+        std::unique_ptr<FrequencySketch> sketch;
+        // Fetches in progress, apart from the entries so hits don't contend on it
+        std::mutex flights_mutex;
+        std::unordered_map<CacheKey, std::shared_ptr<CacheFlight>, CacheKeyHash> flights;
+    };
+    
+    Shard& shard_for(const CacheKey& key) const {
+        // The low bits pick the bucket inside the shard's map. Two shifts,
+        // a single one by 64 with one shard would be undefined
+        return *shards_[(key.hash >> 1) >> (shard_shift_ - 1)];
+    }
+    
+    std::optional<std::shared_ptr<CacheEntry>> get_from_disk(const CacheKey& key,
+                                                             std::shared_ptr<CacheEntry>* stale);
+    // Opens the snapshot of the previous run: its disk tier entries are
+    // restored now, the memory ones by take_from_snapshot()
+    void restore_snapshot();
+    // The entry of `key` the snapshot still holds, moved into the memory tier
+    std::shared_ptr<CacheEntry> take_from_snapshot(const CacheKey& key);
+    // Largest response either tier takes
+    size_t max_object_size(const HttpCacheConfig& config) const;
+    bool remove_from_memory(const CacheKey& key);
+    
+    // Every shard gets an equal share of the limits, split between the
+    // window and the main queue
+    struct ShardLimits {
+        size_t window_entries = 0;
+        size_t window_bytes = 0;
+        size_t main_entries = 1;
+        size_t main_bytes = 1;
+    };
+    ShardLimits shard_limits(const HttpCacheConfig& config) const;
+    
+    // Internal methods, the caller holds the shard's exclusive lock
+    void erase(Shard& shard, Queue::iterator it);
+    // Node SIEVE would evict next from the main queue, which isn't empty
+    Queue::iterator sieve_victim(Shard& shard);
+    bool evict_one(Shard& shard);
+    // Moves the window's overflow to the main queue, or drops it
+    void drain_window(Shard& shard, const HttpCacheConfig& config, const ShardLimits& limits);
+    // Evicts from the main queue until `candidate` fits, false without
+    // evicting a live entry if it loses against the first one
+    bool make_room(Shard& shard, const HttpCacheConfig& config, const ShardLimits& limits,
+                   const Node& candidate);
+    void evict_if_needed(Shard& shard, const HttpCacheConfig& config);
     bool is_path_cacheable(const std::string& path) const;
     bool is_path_force_cached(const std::string& path) const;
+    // Secondary key of a request, `vary_header` is a normalized Vary
     std::string extract_vary_headers(const std::unordered_map<std::string, std::string>& request_headers,
                                    const std::string& vary_header) const;
+    // The keys of the URL of `key` get the request's values of `vary`
+    void remember_vary(const CacheKey& key, const std::string& vary);
     
-    // Thread synchronization
-    mutable std::shared_mutex mutex_;
-    
-    // Cache data structures
-    HttpCacheConfig config_;
-    LRUList lru_list_;
-    std::unordered_map<CacheKey, LRUIterator, CacheKeyHash> cache_map_;
+    std::atomic<std::shared_ptr<const HttpCacheConfig>> config_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    unsigned shard_shift_;
+    std::unique_ptr<DiskCache> disk_;
+    std::string snapshot_path_;                     // Empty when snapshots are off
+    // Until every entry was taken, or couldn't be served anymore
+    std::atomic<std::shared_ptr<CacheSnapshot>> snapshot_;
+    // Normalized Vary of the stored responses by URL, see primary_key().
+    // Cleared once it holds max_entries URLs.
+    mutable std::shared_mutex vary_mutex_;
+    std::unordered_map<std::string, std::string> vary_;
     
     // Statistics
     mutable CacheStats stats_;
     
     // Background cleanup
-    std::chrono::steady_clock::time_point last_cleanup_;
+    std::atomic<std::chrono::steady_clock::rep> last_cleanup_;
 };
 
 // Utility functions for HTTP cache integration
 class HttpCacheManager {
 public:
     static HttpCacheManager& instance();
+    ~HttpCacheManager();
     
     void initialize(const HttpCacheConfig& config = HttpCacheConfig{});
+    // Writes the snapshot first when snapshots are on, the disk tier's
+    // segments are then kept for the next process
     void shutdown();
     
-    std::shared_ptr<HttpCache> get_cache() { return cache_; }
+    // cache: {enabled, max_size, max_entries, ttl, max_response_size, shards,
+    // admission, admission_window, coalesce_misses, lock_timeout,
+    // stale_while_revalidate, stale_if_error, slice_size,
+    // disk: {enabled, path, max_size, segment_size, max_object_size,
+    // admit_after}, snapshot: {enabled, path, interval}}.
+    // No section or enabled: false turns the cache off.
+    bool load_from_config(const YAML::Node& config);
+    
+    // Null while the cache is off
+    std::shared_ptr<HttpCache> get_cache() const {
+        return cache_.load(std::memory_order_acquire);
+    }
     
     // Helper methods for integration with HTTP handlers
     static bool is_cacheable_method(const std::string& method);
@@ -226,15 +564,27 @@ public:
         bool is_public = false;
         std::optional<std::chrono::seconds> max_age;
         std::optional<std::chrono::seconds> s_maxage;
+        std::optional<std::chrono::seconds> stale_while_revalidate;
+        std::optional<std::chrono::seconds> stale_if_error;
     };
     
     static CacheControlDirectives parse_cache_control(const std::string& cache_control_header);
     static std::chrono::seconds parse_expires_header(const std::string& expires_header);
+    // "100MB", "512K", "1GB" or a number of bytes
+    static std::optional<size_t> parse_size(const std::string& spec);
 
 private:
-    std::shared_ptr<HttpCache> cache_;
+    // Drops the expired entries of the cache once a minute and writes the
+    // snapshot every snapshot.interval of the current config
+    void start_maintenance_thread();
+    void stop_maintenance_thread();
+    
+    std::atomic<std::shared_ptr<HttpCache>> cache_;
     std::mutex init_mutex_;
-    bool initialized_ = false;
+    std::thread maintenance_thread_;
+    std::mutex maintenance_mutex_;
+    std::condition_variable maintenance_cv_;
+    bool maintenance_stop_ = false;
 };
 
 // Macro for easy integration in HTTP handlers
@@ -0,0 +1,464 @@
+#ifndef __HTTP_EXCHANGE_H
+#define __HTTP_EXCHANGE_H
+
+#include "circuit_breaker.hpp"
+#include "config.h"
+#include "hedging.hpp"
+#include "load_balancer.hpp"
+#include "metrics.hpp"
+#include "retry_policy.hpp"
+#include "route_matcher.hpp"
+#include <boost/asio/connect.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/stream_traits.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <fmt/format.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace azugate {
+
+using ExchangeExecutor =
+    boost::asio::strand<boost::asio::io_context::executor_type>;
+
+// one asynchronous request to an upstream over a connection of its own,
+// closed once the response was read. all its handlers run on the
+// executor it was created with, Cancel() must be called from there too.
+template <typename T>
+class HttpExchange : public std::enable_shared_from_this<HttpExchange<T>> {
+public:
+  struct Result {
+    UpstreamFailure failure = UpstreamFailure::kNone;
+    // 0 if no response was received.
+    int status = 0;
+    std::string response;
+  };
+  using HeadersCallback = std::function<void()>;
+  using DoneCallback = std::function<void(Result)>;
+
+  static constexpr bool kIsSsl =
+      std::is_same_v<T,
+                     boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>;
+
+  // `request` is sent as is, header and body.
+  HttpExchange(ExchangeExecutor executor, std::string host, uint16_t port,
+               std::string request)
+      : host_(std::move(host)), port_(port), request_(std::move(request)),
+        resolver_(executor) {
+    if constexpr (kIsSsl) {
+      ssl_ctx_ = std::make_unique<boost::asio::ssl::context>(
+          boost::asio::ssl::context::sslv23_client);
+      stream_ = std::make_unique<T>(executor, *ssl_ctx_);
+    } else {
+      stream_ = std::make_unique<T>(executor);
+    }
+    parser_.body_limit(kMaxBodyBufferSize);
+  }
+
+  // `on_headers` runs once the response headers arrived, `on_done` once
+  // the response was read or the exchange failed. neither runs after
+  // Cancel().
+  void Start(HeadersCallback on_headers, DoneCallback on_done) {
+    on_headers_ = std::move(on_headers);
+    on_done_ = std::move(on_done);
+    resolver_.async_resolve(
+        host_, std::to_string(port_),
+        [self = this->shared_from_this()](
+            const boost::system::error_code &ec,
+            boost::asio::ip::tcp::resolver::results_type results) {
+          self->onResolved(ec, std::move(results));
+        });
+  }
+
+  void Cancel() {
+    if (cancelled_) {
+      return;
+    }
+    cancelled_ = true;
+    on_headers_ = nullptr;
+    on_done_ = nullptr;
+    resolver_.cancel();
+    close();
+  }
+
+private:
+  void onResolved(const boost::system::error_code &ec,
+                  boost::asio::ip::tcp::resolver::results_type results) {
+    if (cancelled_) {
+      return;
+    }
+    if (ec) {
+      SPDLOG_ERROR("resolver failed: {}", ec.message());
+      complete({.failure = UpstreamFailure::kConnectFailure});
+      return;
+    }
+    boost::asio::async_connect(
+        boost::beast::get_lowest_layer(*stream_), results,
+        [self = this->shared_from_this()](
+            const boost::system::error_code &ec,
+            const boost::asio::ip::tcp::endpoint &) {
+          self->onConnected(ec);
+        });
+  }
+
+  void onConnected(const boost::system::error_code &ec) {
+    if (cancelled_) {
+      return;
+    }
+    if (ec) {
+      SPDLOG_ERROR("TCP connect failed: {}", ec.message());
+      complete({.failure = UpstreamFailure::kConnectFailure});
+      return;
+    }
+    if constexpr (kIsSsl) {
+      stream_->async_handshake(
+          boost::asio::ssl::stream_base::client,
+          [self = this->shared_from_this()](
+              const boost::system::error_code &ec) {
+            if (self->cancelled_) {
+              return;
+            }
+            if (ec) {
+              SPDLOG_ERROR("SSL handshake failed: {}", ec.message());
+              self->complete({.failure = UpstreamFailure::kConnectFailure});
+              return;
+            }
+            self->write();
+          });
+    } else {
+      write();
+    }
+  }
+
+  void write() {
+    boost::asio::async_write(
+        *stream_, boost::asio::buffer(request_),
+        [self = this->shared_from_this()](const boost::system::error_code &ec,
+                                          size_t) { self->onWritten(ec); });
+  }
+
+  void onWritten(const boost::system::error_code &ec) {
+    if (cancelled_) {
+      return;
+    }
+    if (ec) {
+      SPDLOG_ERROR("write request failed: {}", ec.message());
+      complete({.failure = UpstreamFailure::kReset});
+      return;
+    }
+    boost::beast::http::async_read_header(
+        *stream_, buffer_, parser_,
+        [self = this->shared_from_this()](const boost::system::error_code &ec,
+                                          size_t) { self->onHeaders(ec); });
+  }
+
+  void onHeaders(const boost::system::error_code &ec) {
+    if (cancelled_) {
+      return;
+    }
+    if (ec) {
+      SPDLOG_ERROR("http read header failed: {}", ec.message());
+      complete({.failure = UpstreamFailure::kReset});
+      return;
+    }
+    if (auto on_headers = std::move(on_headers_)) {
+      on_headers();
+    }
+    boost::beast::http::async_read(
+        *stream_, buffer_, parser_,
+        [self = this->shared_from_this()](const boost::system::error_code &ec,
+                                          size_t) { self->onBody(ec); });
+  }
+
+  void onBody(const boost::system::error_code &ec) {
+    if (cancelled_) {
+      return;
+    }
+    if (ec && ec != boost::beast::http::error::end_of_stream) {
+      SPDLOG_ERROR("http read failed: {}", ec.message());
+      complete({.failure = UpstreamFailure::kReset});
+      return;
+    }
+    std::stringstream ss;
+    ss << parser_.get();
+    complete({.status = static_cast<int>(parser_.get().result_int()),
+              .response = ss.str()});
+  }
+
+  void complete(Result result) {
+    close();
+    on_headers_ = nullptr;
+    if (auto on_done = std::move(on_done_)) {
+      on_done_ = nullptr;
+      on_done(std::move(result));
+    }
+  }
+
+  void close() {
+    boost::system::error_code ec;
+    boost::beast::get_lowest_layer(*stream_).close(ec);
+  }
+
+  std::string host_;
+  uint16_t port_;
+  std::string request_;
+  boost::asio::ip::tcp::resolver resolver_;
+  // outlives the stream using it.
+  std::unique_ptr<boost::asio::ssl::context> ssl_ctx_;
+  std::unique_ptr<T> stream_;
+  boost::beast::flat_buffer buffer_;
+  boost::beast::http::response_parser<boost::beast::http::dynamic_body>
+      parser_;
+  HeadersCallback on_headers_;
+  DoneCallback on_done_;
+  bool cancelled_ = false;
+};
+
+// sends a request to an upstream and, if its response headers haven't
+// arrived after the route's hedge delay, a second copy to another upstream
+// of the route. the first copy to get its response headers wins, the
+// other one is cancelled.
+// ref: https://research.google/pubs/the-tail-at-scale/
+template <typename T>
+class HedgedHttpRequest
+    : public std::enable_shared_from_this<HedgedHttpRequest<T>> {
+public:
+  struct Outcome {
+    // the upstream that answered, or the last one that failed.
+    std::shared_ptr<UpstreamServer> upstream;
+    UpstreamFailure failure = UpstreamFailure::kNone;
+    int status = 0;
+    std::string response;
+  };
+  // serializes the request for the upstream at `host`.
+  using RequestBuilder = std::function<std::string(const std::string &host)>;
+  using DoneCallback = std::function<void(Outcome)>;
+
+  // `request` must stay valid until the request is done.
+  HedgedHttpRequest(boost::asio::io_context &io_context,
+                    std::shared_ptr<RouteHedging> hedging,
+                    std::shared_ptr<LoadBalancer> load_balancer,
+                    std::string client_ip, RequestView request,
+                    RequestBuilder build_request)
+      : strand_(boost::asio::make_strand(io_context)), timer_(strand_),
+        hedging_(std::move(hedging)), load_balancer_(std::move(load_balancer)),
+        client_ip_(std::move(client_ip)), request_(request),
+        build_request_(std::move(build_request)) {
+    attempts_.reserve(2);
+  }
+
+  ~HedgedHttpRequest() { releaseHedge(); }
+
+  // `upstream` was picked by the load balancer and admitted by
+  // `breaker`, if any. `on_done` is called once, from one of the threads
+  // running the io_context.
+  void Start(std::shared_ptr<UpstreamServer> upstream,
+             std::shared_ptr<CircuitBreaker> breaker, DoneCallback on_done) {
+    on_done_ = std::move(on_done);
+    boost::asio::dispatch(
+        strand_, [self = this->shared_from_this(),
+                  upstream = std::move(upstream),
+                  breaker = std::move(breaker)]() mutable {
+          self->launch(std::move(upstream), std::move(breaker));
+          self->timer_.expires_after(self->hedging_->Delay());
+          self->timer_.async_wait(
+              [self](const boost::system::error_code &ec) {
+                if (!ec) {
+                  self->hedge();
+                }
+              });
+        });
+  }
+
+private:
+  struct Attempt {
+    std::shared_ptr<UpstreamServer> upstream;
+    std::shared_ptr<CircuitBreaker> breaker;
+    std::shared_ptr<HttpExchange<T>> exchange;
+    std::chrono::steady_clock::time_point start;
+    bool finished = false;
+  };
+
+  void launch(std::shared_ptr<UpstreamServer> upstream,
+              std::shared_ptr<CircuitBreaker> breaker) {
+    size_t index = attempts_.size();
+    auto &attempt = attempts_.emplace_back(Attempt{
+        .upstream = std::move(upstream),
+        .breaker = std::move(breaker),
+        .start = std::chrono::steady_clock::now(),
+    });
+    load_balancer_->on_request_start(attempt.upstream);
+    attempt.exchange = std::make_shared<HttpExchange<T>>(
+        strand_, attempt.upstream->address(), attempt.upstream->port(),
+        build_request_(attempt.upstream->address()));
+    attempt.exchange->Start(
+        [self = this->shared_from_this(), index] { self->onHeaders(index); },
+        [self = this->shared_from_this(),
+         index](typename HttpExchange<T>::Result result) {
+          self->onDone(index, std::move(result));
+        });
+  }
+
+  // the first attempt is late, sends a copy elsewhere if the budget and
+  // the route allow it.
+  void hedge() {
+    if (winner_ || attempts_.front().finished) {
+      return;
+    }
+    auto &metrics = GatewayMetrics::instance();
+    auto &primary = attempts_.front().upstream;
+    auto slow_upstream =
+        fmt::format("{}:{}", primary->address(), primary->port());
+    if (!HedgeBudget::Instance().TryAcquireHedge()) {
+      SPDLOG_DEBUG("hedge budget exhausted, not hedging {}", slow_upstream);
+      metrics.record_upstream_hedge(slow_upstream, "budget_exhausted");
+      return;
+    }
+    hedge_in_flight_ = true;
+    auto server =
+        load_balancer_->get_retry_server(primary, client_ip_, &request_);
+    if (!server || server == primary) {
+      metrics.record_upstream_hedge(slow_upstream, "no_upstream");
+      releaseHedge();
+      return;
+    }
+    std::shared_ptr<CircuitBreaker> breaker;
+    if (CircuitBreakerRegistry::instance().enabled()) {
+      breaker = server->circuit_breaker();
+      if (!breaker->can_proceed()) {
+        metrics.record_upstream_hedge(slow_upstream, "circuit_open");
+        releaseHedge();
+        return;
+      }
+    }
+    metrics.record_upstream_hedge(slow_upstream, "sent");
+    SPDLOG_DEBUG("hedging {} on {}:{}", slow_upstream, server->address(),
+                 server->port());
+    launch(std::move(server), std::move(breaker));
+  }
+
+  void onHeaders(size_t index) {
+    if (winner_) {
+      return;
+    }
+    winner_ = index;
+    timer_.cancel();
+    // the histogram is the latency of the first attempt whether it wins or
+    // not, a winning hedge only ever samples the fast tail. a primary that
+    // lost is cancelled now, its elapsed time is a lower bound of its own.
+    auto &primary_attempt = attempts_.front();
+    if (index == 0 || !primary_attempt.finished) {
+      hedging_->RecordLatency(std::chrono::steady_clock::now() -
+                              primary_attempt.start);
+    }
+    if (attempts_.size() > 1) {
+      auto &primary = attempts_.front().upstream;
+      GatewayMetrics::instance().record_upstream_hedge(
+          fmt::format("{}:{}", primary->address(), primary->port()),
+          index == 0 ? "lost" : "won");
+    }
+    for (size_t i = 0; i < attempts_.size(); ++i) {
+      if (i != index) {
+        cancel(i);
+      }
+    }
+  }
+
+  // the loser neither succeeded nor failed, it only gives its
+  // connection and its breaker slot back.
+  void cancel(size_t index) {
+    auto &attempt = attempts_[index];
+    if (attempt.finished) {
+      return;
+    }
+    attempt.finished = true;
+    attempt.exchange->Cancel();
+    load_balancer_->on_request_cancelled(attempt.upstream);
+    if (attempt.breaker) {
+      attempt.breaker->record_cancelled();
+    }
+  }
+
+  void onDone(size_t index, typename HttpExchange<T>::Result result) {
+    auto &attempt = attempts_[index];
+    attempt.finished = true;
+    auto elapsed = std::chrono::steady_clock::now() - attempt.start;
+    load_balancer_->on_request_complete(
+        attempt.upstream, elapsed, result.status != 0 && result.status < 500);
+    if (auto breaker = std::move(attempt.breaker)) {
+      if (result.status == 0) {
+        breaker->record_failure();
+      } else {
+        breaker->record_response(
+            result.status,
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed));
+      }
+    }
+    if (!winner_) {
+      // failed before its headers, the other copy may still answer. a
+      // first attempt failing before the hedge delay is left to the
+      // retry policy.
+      for (const auto &other : attempts_) {
+        if (!other.finished) {
+          return;
+        }
+      }
+      timer_.cancel();
+    }
+    complete(Outcome{
+        .upstream = attempt.upstream,
+        .failure = result.failure,
+        .status = result.status,
+        .response = std::move(result.response),
+    });
+  }
+
+  void complete(Outcome outcome) {
+    releaseHedge();
+    if (auto on_done = std::move(on_done_)) {
+      on_done_ = nullptr;
+      on_done(std::move(outcome));
+    }
+  }
+
+  void releaseHedge() {
+    if (hedge_in_flight_) {
+      hedge_in_flight_ = false;
+      HedgeBudget::Instance().ReleaseHedge();
+    }
+  }
+
+  ExchangeExecutor strand_;
+  boost::asio::steady_timer timer_;
+  std::shared_ptr<RouteHedging> hedging_;
+  std::shared_ptr<LoadBalancer> load_balancer_;
+  std::string client_ip_;
+  RequestView request_;
+  RequestBuilder build_request_;
+  DoneCallback on_done_;
+  // the first attempt, then the hedge if it was sent.
+  std::vector<Attempt> attempts_;
+  // the attempt whose response headers came first.
+  std::optional<size_t> winner_;
+  // holds a slot of the hedge budget until the request is done.
+  bool hedge_in_flight_ = false;
+};
+
+} // namespace azugate
+
+#endif
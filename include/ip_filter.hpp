@@ -0,0 +1,148 @@
+#ifndef __IP_FILTER_H
+#define __IP_FILTER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct sockaddr;
+
+namespace YAML {
+class Node;
+}
+
+namespace azugate {
+
+enum class IpAction : uint8_t {
+  kNone = 0,
+  kAllow = 1,
+  kDeny = 2,
+};
+
+// a CIDR rule in binary form, IPv4 addresses use the first 4 bytes.
+struct IpRule {
+  std::array<uint8_t, 16> addr{};
+  uint8_t prefix_len = 0;
+  bool v6 = false;
+  IpAction action = IpAction::kNone;
+  bool operator==(const IpRule &other) const = default;
+};
+
+// parse "10.0.0.0/8", "2001:db8::/32" or a plain address (a host route).
+// the host bits are cleared, IPv4-mapped IPv6 addresses become IPv4.
+bool ParseCidr(std::string_view cidr, IpAction action, IpRule &rule);
+
+// immutable lookup table compiled from a set of rules.
+// - host routes (/32, /128) are kept in sorted arrays, so that huge
+//   blocklists of single addresses stay compact.
+// - the other prefixes are expanded into a stride-8 multibit trie, at most
+//   4 (IPv4) or 16 (IPv6) memory accesses per lookup.
+// the most specific rule wins, deny wins over allow for the same prefix.
+//
+// a trie node is about 1.5 KB and the nodes are not path compressed, so
+// every IPv6 prefix longer than /8 costs up to 15 nodes of its own. the
+// IPv6 trie is capped at kMaxV6TrieNodes (~24 MB), a rule set that needs
+// more is refused as a whole. the IPv4 trie is bounded by its depth.
+class IpFilterTable {
+public:
+  static constexpr size_t kMaxV6TrieNodes = 16384;
+
+  explicit IpFilterTable(const std::vector<IpRule> &rules);
+
+  // false if some rules didn't fit in the trie, the table must not be used.
+  bool Complete() const { return complete_; }
+
+  // `addr` is 4 or 16 bytes in network order.
+  IpAction Lookup(const uint8_t *addr, bool v6) const;
+
+  bool HasAllowRules() const { return has_allow_rules_; }
+
+private:
+  struct Node {
+    // index into nodes_, 0 means no child since the root is never a child.
+    uint32_t children[256];
+    IpAction actions[256];
+    // length of the prefix that set actions[i], longer ones overwrite.
+    uint8_t prefix_lens[256];
+  };
+
+  struct Trie {
+    explicit Trie(size_t max_nodes) : nodes(1), max_nodes(max_nodes) {}
+    // false if the rule needs more than max_nodes nodes.
+    bool Insert(const IpRule &rule);
+    IpAction Lookup(const uint8_t *addr, size_t len) const;
+    std::vector<Node> nodes;
+    size_t max_nodes;
+    // action of the /0 rule if any.
+    IpAction default_action = IpAction::kNone;
+  };
+
+  struct HostV6 {
+    std::array<uint8_t, 16> addr;
+    IpAction action;
+  };
+
+  Trie v4_;
+  Trie v6_;
+  bool complete_ = true;
+  // sorted by address.
+  std::vector<uint32_t> hosts_v4_;
+  std::vector<IpAction> hosts_v4_actions_;
+  std::vector<HostV6> hosts_v6_;
+  bool has_allow_rules_ = false;
+};
+
+// connection level access control. the rules live behind a mutex and every
+// change publishes a freshly built IpFilterTable, so that IsAllowed() only
+// loads a snapshot and never blocks writers or formats the address.
+// the rules of the config file are kept apart from the ones added at
+// runtime (e.g. the admin blacklist), a reload only replaces the former.
+// a change that can't be applied as a whole leaves the table untouched.
+// without any allow rule everything that is not denied is allowed,
+// otherwise only explicitly allowed addresses are.
+class IpFilter {
+public:
+  static IpFilter &Instance();
+
+  // runtime rules.
+  bool AddRule(std::string_view cidr, IpAction action);
+  // removes a runtime rule or a rule of the config until the next reload.
+  bool RemoveRule(std::string_view cidr, IpAction action);
+  // batch update with a single rebuild, invalid entries are skipped.
+  // returns the number of rules added.
+  size_t AddRules(const std::vector<std::string> &cidrs, IpAction action);
+  // one CIDR per line, empty lines and '#' comments are ignored.
+  // returns false if the file can't be read.
+  bool LoadFromFile(const std::string &path, IpAction action);
+  // security.ip_filter: {allow: [], deny: [], allow_file: "", deny_file: ""}.
+  // replaces the rules of the previous config in a single swap, the old
+  // ones stay if a list can't be read or the rules don't fit.
+  bool LoadFromConfig(const YAML::Node &config);
+  void Clear();
+
+  bool IsAllowed(const sockaddr *addr) const;
+
+  size_t Size() const;
+
+private:
+  IpFilter();
+  // builds the table of config_rules_ and rules_ and swaps it in, false if
+  // they don't fit. the caller must hold mutex_.
+  bool publish();
+
+  mutable std::mutex mutex_;
+  std::vector<IpRule> config_rules_;
+  // added at runtime, kept across reloads.
+  std::vector<IpRule> rules_;
+  std::atomic<std::shared_ptr<const IpFilterTable>> table_;
+};
+
+} // namespace azugate
+
+#endif
@@ -1,27 +1,48 @@
 #ifndef __LOAD_BALANCER_HPP
 #define __LOAD_BALANCER_HPP
 
+#include "circuit_breaker.hpp"
 #include "config.h"
+#include "health_check.hpp"
+#include "sliding_window.hpp"
 #include <boost/asio.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/http.hpp>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <mutex>
-#include <random>
+#include <optional>
 #include <spdlog/spdlog.h>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace azugate {
 
-// Health status of an upstream server
-enum class HealthStatus {
-  Unknown = 0,
-  Healthy = 1,
-  Unhealthy = 2,
-  Recovering = 3  // In recovery state, limited traffic
-};
+// Upper bound of the precomputed weighted round robin schedule.
+constexpr int64_t kMaxWeightedScheduleSize = 64 * 1024;
+// Picks get_retry_server() makes before giving up on the strategy.
+constexpr int kMaxRetryPicks = 3;
+// Weight of the newest sample in the latency EWMA.
+constexpr double kLatencyEwmaAlpha = 0.3;
+// Every recent error adds this much to the P2C score multiplier, the
+// penalty halves every kErrorPenaltyHalfLife.
+constexpr double kErrorPenaltyWeight = 1.0;
+constexpr std::chrono::seconds kErrorPenaltyHalfLife{5};
+// Maglev lookup table size, must be a prime much larger than the number
+// of servers: the share of each server is within ~n/M of its weight.
+constexpr size_t kMaglevTableSize = 65537;
+// Virtual nodes on the hash ring per unit of weight. It doesn't depend on
+// the other servers, or a membership change would move keys between the
+// remaining ones.
+constexpr int64_t kRingHashNodesPerWeight = 160;
+constexpr int64_t kMaxRingHashSize = 1024 * 1024;
+// Bounded load of the consistent hash strategies: a server takes at most
+// this factor times the average number of requests in flight, the rest
+// spills over to the next server of the key.
+constexpr double kDftHashBalanceFactor = 1.25;
+// Request outcomes the passive outlier detection looks at.
+constexpr std::chrono::seconds kOutlierDetectionWindow{10};
 
 // Load balancing strategies
 enum class LoadBalancingStrategy {
@@ -29,36 +50,99 @@ enum class LoadBalancingStrategy {
   LeastConnections = 1,
   WeightedRoundRobin = 2,
   Random = 3,
-  IpHash = 4
+  IpHash = 4,
+  // Power of two choices: the better scored of two random servers.
+  PowerOfTwoChoices = 5,
+  // Consistent hashing of the route's hash key, a membership change only
+  // moves the keys of the servers that came or left.
+  Maglev = 6,
+  RingHash = 7
+};
+
+// What the consistent hash strategies hash. A request without the header
+// or cookie falls back to its client IP.
+struct HashKey {
+  enum Type {
+    kClientIp,
+    // The path without the query string.
+    kPath,
+    kHeader,
+    kCookie,
+  };
+  Type type = kClientIp;
+  // Header (lowercase) or cookie name.
+  std::string name = "";
 };
 
-// Configuration for health checks
-struct HealthCheckConfig {
-  std::string path = "/health";  // Health check endpoint
-  std::chrono::milliseconds interval{5000};  // Check interval
-  std::chrono::milliseconds timeout{2000};   // Request timeout
-  int healthy_threshold = 2;     // Consecutive successes to mark healthy
-  int unhealthy_threshold = 3;   // Consecutive failures to mark unhealthy
-  int expected_status = 200;     // Expected HTTP status code
-  std::string expected_body = "";  // Expected response body (optional)
+// Passive health checking: the outcomes of the proxied requests eject
+// misbehaving servers for a while, as Envoy's outlier detection.
+struct OutlierDetectionConfig {
+  bool enabled = true;
+  // Gateway errors (5xx, connection failures) in a row that eject a
+  // server right away, 0 disables the check.
+  int consecutive_errors = 5;
+  // How often the success rate and latency of the servers are compared.
+  std::chrono::milliseconds interval{10000};
+  // The n-th ejection in a row lasts n times the base, up to the max.
+  std::chrono::milliseconds base_ejection_time{30000};
+  std::chrono::milliseconds max_ejection_time{300000};
+  // Ejections stop once this share of the servers is out.
+  int max_ejection_percent = 10;
+  // Servers below mean - factor * stdev of the success rates are
+  // ejected. Only servers with enough requests in the window count, and
+  // only if there are enough of them.
+  int success_rate_minimum_hosts = 5;
+  int success_rate_request_volume = 100;
+  double success_rate_stdev_factor = 1.9;
+  // Servers failing at least this percentage of their requests are
+  // ejected, 0 disables the check.
+  int failure_percentage_threshold = 0;
+  // Servers whose mean latency exceeds this factor times the median of
+  // the servers are ejected (same host and volume minimums as the
+  // success rate), 0 disables the check.
+  double latency_factor = 0;
+  bool operator==(const OutlierDetectionConfig& other) const = default;
 };
 
+// Slow start: a server that was just added or came back healthy gets a
+// share of its weight growing over `window`, as Envoy's slow start:
+// weight * max(min_weight_percent / 100, (elapsed / window)^(1 / aggression)).
+struct SlowStartConfig {
+  bool enabled = true;
+  std::chrono::milliseconds window{30000};
+  // 1 ramps linearly, higher values give more traffic early on.
+  double aggression = 1.0;
+  int min_weight_percent = 10;
+  bool operator==(const SlowStartConfig& other) const = default;
+};
+
+// Parses "round_robin", "least_connections", "weighted" (or
+// "weighted_round_robin"), "random", "ip_hash" and "p2c" (or
+// "power_of_two_choices"), "maglev" and "ring_hash".
+std::optional<LoadBalancingStrategy>
+parse_load_balancing_strategy(std::string_view name);
+
+// Parses "client_ip", "path", "header:<name>" and "cookie:<name>".
+std::optional<HashKey> parse_hash_key(std::string_view spec);
+
 // Individual upstream server
+// The counters read by the balancing strategies are atomics, so selection
+// never takes a lock; only the health check bookkeeping is mutex protected.
 class UpstreamServer {
 public:
   UpstreamServer(const std::string& address, uint16_t port, int weight = 1);
+  // Stands for a route target, handed back by GetTargetRoute() when picked.
+  UpstreamServer(const ConnectionInfo& target, int weight = 1);
   
   // Getters
-  const std::string& address() const { return address_; }
-  uint16_t port() const { return port_; }
+  const std::string& address() const { return target_.address; }
+  uint16_t port() const { return target_.port; }
   int weight() const { return weight_; }
-  HealthStatus health_status() const { 
-    std::lock_guard<std::mutex> lock(mutex_);
-    return health_status_; 
-  }
+  const ConnectionInfo& target() const { return target_; }
+  // Ejected while the outlier detection keeps the server out.
+  HealthStatus health_status() const;
   int active_connections() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return active_connections_;
+    return active_connections_.load(std::memory_order_relaxed);
   }
   
   // Connection management
@@ -76,66 +160,128 @@ public:
     return last_check_time_;
   }
   double response_time_ms() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return avg_response_time_ms_;
+    return avg_response_time_ms_.load(std::memory_order_relaxed);
   }
   
-  void update_response_time(std::chrono::milliseconds response_time);
+  void update_response_time(std::chrono::nanoseconds response_time);
   
+  // Failed requests, decaying over time.
+  void record_error();
+  double error_penalty() const;
+  
+  // Expected cost of one more request, lower is better:
+  // (in flight + 1) * EWMA latency * (1 + error penalty).
+  double load_score() const;
+  
+  // Healthy enough, not ejected and, while circuit breakers are
+  // enabled, its breaker would admit a request.
   bool is_available() const;
+  // Breaker of address:port, shared with the routes proxying to it.
+  const std::shared_ptr<CircuitBreaker>& circuit_breaker() const {
+    return circuit_breaker_;
+  }
+  
+  // Outcome of a proxied request, a negative latency records none.
+  // Returns the number of errors in a row.
+  int record_outcome(bool success, std::chrono::nanoseconds latency);
+  SlidingWindow::Totals outcomes() const;
+  
+  // Outlier ejection, `until_ns` is on the steady clock.
+  void eject(int64_t until_ns);
+  bool ejected(int64_t now_ns) const {
+    int64_t until = ejected_until_ns_.load(std::memory_order_relaxed);
+    return until != 0 && now_ns < until;
+  }
+  // Clears an ejection that expired, true if there was one.
+  bool clear_expired_ejection(int64_t now_ns);
+  int ejection_count() const {
+    return ejection_count_.load(std::memory_order_relaxed);
+  }
+  void decay_ejection_count();
+  
+  // Slow start, only begins while the load balancer has it enabled.
+  // Disabling it ends a ramp in progress.
+  void set_slow_start(bool enabled);
+  void begin_slow_start();
+  // Share of the weight the server gets, 1 once the ramp is over.
+  double slow_start_factor(const SlowStartConfig& config);
   
 private:
-  std::string address_;
-  uint16_t port_;
+  // Ends the ramp that began at `begin_ns`, unless another one did.
+  void end_slow_start(int64_t begin_ns);
+  
+  ConnectionInfo target_;
   int weight_;
   
+  std::atomic<HealthStatus> health_status_;
+  std::atomic<int> active_connections_;
+  std::atomic<double> avg_response_time_ms_;  // Exponential moving average
+  // Penalty as of error_penalty_time_ns_ (steady clock).
+  std::atomic<double> error_penalty_;
+  std::atomic<int64_t> error_penalty_time_ns_;
+  
+  // Passive health.
+  SlidingWindow outcomes_;
+  std::atomic<int> consecutive_errors_;
+  std::atomic<int64_t> ejected_until_ns_;
+  // Ejections in a row, lengthens the next one.
+  std::atomic<int> ejection_count_;
+  
+  std::atomic<bool> slow_start_enabled_;
+  // Steady clock start of the ramp, 0 when not ramping.
+  std::atomic<int64_t> slow_start_begin_ns_;
+  
+  std::shared_ptr<CircuitBreaker> circuit_breaker_;
+  
   mutable std::mutex mutex_;
-  HealthStatus health_status_;
-  int active_connections_;
   int consecutive_successes_;
   int consecutive_failures_;
   std::chrono::steady_clock::time_point last_check_time_;
-  double avg_response_time_ms_;  // Exponential moving average
   int total_checks_;
   int total_successes_;
 };
 
-// Health checker for performing active health checks
-class HealthChecker {
-public:
-  HealthChecker(boost::asio::io_context& io_context, 
-                const HealthCheckConfig& config);
-  
-  void start_health_check(std::shared_ptr<UpstreamServer> server);
-  void stop_health_checks();
-  
-private:
-  void perform_health_check(std::shared_ptr<UpstreamServer> server);
-  void schedule_next_check(std::shared_ptr<UpstreamServer> server);
-  
-  boost::asio::io_context& io_context_;
-  HealthCheckConfig config_;
-  std::vector<std::shared_ptr<boost::asio::steady_timer>> timers_;
-  bool stopped_;
-};
-
 // Main load balancer class
+// Membership changes publish a new immutable snapshot of the servers, the
+// hot path only loads the current one: no lock and no per-request copy.
 class LoadBalancer {
 public:
+  // Active health checks run on the HealthCheckScheduler, the io_context
+  // is only kept for compatibility.
   LoadBalancer(boost::asio::io_context& io_context,
                LoadBalancingStrategy strategy = LoadBalancingStrategy::RoundRobin);
+  explicit LoadBalancer(LoadBalancingStrategy strategy = LoadBalancingStrategy::RoundRobin);
   
   ~LoadBalancer();
   
   // Server management
   void add_server(const std::string& address, uint16_t port, int weight = 1);
+  void add_server(const ConnectionInfo& target, int weight = 1);
   void remove_server(const std::string& address, uint16_t port);
   
-  // Get next server for load balancing
-  std::shared_ptr<UpstreamServer> get_server(const std::string& client_ip = "");
+  // Get next server for load balancing, `request` provides the header,
+  // cookie or path hash keys.
+  std::shared_ptr<UpstreamServer> get_server(const std::string& client_ip = "",
+                                             const RequestView* request = nullptr);
+  // Server for retrying a request that failed on `previous`: picked as
+  // usual but avoiding `previous`, which only comes back if no other
+  // server is available.
+  std::shared_ptr<UpstreamServer> get_retry_server(
+      const std::shared_ptr<UpstreamServer>& previous,
+      const std::string& client_ip = "", const RequestView* request = nullptr);
   
-  // Configuration
-  void set_strategy(LoadBalancingStrategy strategy) { strategy_ = strategy; }
+  // Configuration, both rebuild the lookup tables off the hot path.
+  void set_strategy(LoadBalancingStrategy strategy);
+  LoadBalancingStrategy strategy() const {
+    return snapshot_.load(std::memory_order_acquire)->strategy;
+  }
+  // `balance_factor` <= 0 disables the bounded load.
+  void set_hash_policy(const HashKey& key,
+                       double balance_factor = kDftHashBalanceFactor);
+  void set_outlier_detection(const OutlierDetectionConfig& config);
+  void set_slow_start(const SlowStartConfig& config);
+  // Registers the servers with the HealthCheckScheduler while enabled,
+  // the probes set their health status.
   void set_health_check_config(const HealthCheckConfig& config);
   void enable_health_checks(bool enable);
   
@@ -145,39 +291,102 @@ public:
   std::vector<std::shared_ptr<UpstreamServer>> get_all_servers() const;
   
   // Connection tracking
-  void on_request_start(std::shared_ptr<UpstreamServer> server);
-  void on_request_complete(std::shared_ptr<UpstreamServer> server,
-                          std::chrono::milliseconds response_time,
+  void on_request_start(const std::shared_ptr<UpstreamServer>& server);
+  void on_request_complete(const std::shared_ptr<UpstreamServer>& server,
+                          std::chrono::nanoseconds response_time,
+                          bool success);
+  // Long lived streams (websocket, tcp) only count as connections, their
+  // duration says nothing about the server latency.
+  void on_stream_complete(const std::shared_ptr<UpstreamServer>& server,
                           bool success);
+  // The losing copy of a hedged request was cut short, its outcome says
+  // nothing about the server.
+  void on_request_cancelled(const std::shared_ptr<UpstreamServer>& server);
 
 private:
-  std::shared_ptr<UpstreamServer> round_robin_select();
-  std::shared_ptr<UpstreamServer> least_connections_select();
-  std::shared_ptr<UpstreamServer> weighted_round_robin_select();
-  std::shared_ptr<UpstreamServer> random_select();
-  std::shared_ptr<UpstreamServer> ip_hash_select(const std::string& client_ip);
+  struct Snapshot {
+    LoadBalancingStrategy strategy = LoadBalancingStrategy::RoundRobin;
+    std::vector<std::shared_ptr<UpstreamServer>> servers;
+    // Smooth weighted round robin order, indexes into servers.
+    std::vector<uint32_t> weighted_schedule;
+    HashKey hash_key;
+    double hash_balance_factor = kDftHashBalanceFactor;
+    // Only built for the strategies using them, indexes into servers.
+    std::vector<uint32_t> maglev_table;
+    // Virtual nodes sorted by hash.
+    std::vector<std::pair<uint64_t, uint32_t>> ring;
+    // Null if the outlier detection is off.
+    std::shared_ptr<const OutlierDetectionConfig> outlier_detection;
+    // Null if slow start is off.
+    std::shared_ptr<const SlowStartConfig> slow_start;
+  };
   
-  std::vector<std::shared_ptr<UpstreamServer>> get_healthy_servers() const;
+  using SnapshotPtr = std::shared_ptr<const Snapshot>;
   
-  boost::asio::io_context& io_context_;
-  LoadBalancingStrategy strategy_;
+  // The caller must hold mutex_.
+  void publish();
+  
+  std::shared_ptr<UpstreamServer> round_robin_select(const Snapshot& snapshot);
+  std::shared_ptr<UpstreamServer> least_connections_select(const Snapshot& snapshot);
+  std::shared_ptr<UpstreamServer> weighted_round_robin_select(const Snapshot& snapshot);
+  std::shared_ptr<UpstreamServer> random_select(const Snapshot& snapshot);
+  std::shared_ptr<UpstreamServer> p2c_select(const Snapshot& snapshot);
+  std::shared_ptr<UpstreamServer> maglev_select(const Snapshot& snapshot,
+                                                uint64_t hash,
+                                                double balance_factor);
+  std::shared_ptr<UpstreamServer> ring_hash_select(const Snapshot& snapshot,
+                                                   uint64_t hash,
+                                                   double balance_factor);
+
+  
+  // Passive outlier detection.
+  void report_outcome(const std::shared_ptr<UpstreamServer>& server,
+                      bool success, std::chrono::nanoseconds latency);
+  void try_eject(const Snapshot& snapshot,
+                 const std::shared_ptr<UpstreamServer>& server,
+                 const char* reason, int64_t now_ns);
+  void maybe_evaluate_outliers(const Snapshot& snapshot, int64_t now_ns);
+  void evaluate_outliers(const Snapshot& snapshot, int64_t now_ns);
+  
+  // First available server at or after index `start`.
+  static std::shared_ptr<UpstreamServer> next_available(const Snapshot& snapshot,
+                                                        size_t start);
+  
+  // Active health checks, the caller must hold mutex_.
+  void start_health_check(const std::shared_ptr<UpstreamServer>& server);
+  void stop_health_check(const std::shared_ptr<UpstreamServer>& server);
   
+  // Serializes membership changes, never taken by get_server().
   mutable std::mutex mutex_;
+  LoadBalancingStrategy strategy_;
   std::vector<std::shared_ptr<UpstreamServer>> servers_;
+  HashKey hash_key_;
+  double hash_balance_factor_;
+  std::shared_ptr<const OutlierDetectionConfig> outlier_detection_;
+  std::shared_ptr<const SlowStartConfig> slow_start_;
+  std::atomic<SnapshotPtr> snapshot_;
+  
+  // Set by the first pick: servers added to a load balancer serving
+  // traffic slow start, the initial ones don't.
+  std::atomic<bool> serving_;
+  
+  // Steady clock time of the next outlier evaluation, claimed with CAS by
+  // the request completing first after it.
+  std::atomic<int64_t> next_outlier_evaluation_ns_;
+  
+  // Requests in flight over all the servers, for the bounded load.
+  std::atomic<int> total_connections_;
   
   // Round robin state
-  size_t round_robin_index_;
+  std::atomic<size_t> round_robin_index_;
   
   // Weighted round robin state
-  std::vector<int> weighted_current_weights_;
-  
-  // Random number generator
-  mutable std::random_device rd_;
-  mutable std::mt19937 gen_;
+  std::atomic<size_t> weighted_index_;
   
-  // Health checking
-  std::unique_ptr<HealthChecker> health_checker_;
+  // Health checking, scheduler ids by server.
+  HealthCheckConfig health_check_config_;
   bool health_checks_enabled_;
+  std::unordered_map<const UpstreamServer*, uint64_t> health_check_ids_;
 };
 
 // Utility functions for integration with routing
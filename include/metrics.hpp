@@ -180,11 +180,23 @@ public:
                                 std::chrono::milliseconds duration);
     
     void record_upstream_health_check(const std::string& upstream, bool healthy);
+    void record_outlier_ejection(const std::string& upstream, const std::string& reason);
     
     // Circuit breaker metrics
     void record_circuit_breaker_state(const std::string& name, int state);
     void record_circuit_breaker_request(const std::string& name, const std::string& result);
     
+    // Concurrency limiter metrics
+    void record_concurrency_limit(const std::string& name, size_t limit,
+                                  size_t in_flight, size_t queue_depth);
+    void record_concurrency_shed(const std::string& name, const std::string& reason);
+    
+    // Retry metrics
+    void record_upstream_retry(const std::string& upstream, const std::string& result);
+    
+    // Hedging metrics
+    void record_upstream_hedge(const std::string& upstream, const std::string& result);
+    
     // Connection metrics
     void record_active_connections(int count);
     void record_connection_duration(std::chrono::milliseconds duration);
@@ -230,11 +242,24 @@ private:
     std::unique_ptr<LabeledMetricFamily<Counter>> upstream_requests_total_;
     std::unique_ptr<LabeledMetricFamily<Histogram>> upstream_request_duration_;
     std::unique_ptr<LabeledMetricFamily<Gauge>> upstream_healthy_;
+    std::unique_ptr<LabeledMetricFamily<Counter>> outlier_ejections_total_;
     
     // Circuit breaker metrics
     std::unique_ptr<LabeledMetricFamily<Gauge>> circuit_breaker_state_;
     std::unique_ptr<LabeledMetricFamily<Counter>> circuit_breaker_requests_total_;
     
+    // Concurrency limiter metrics
+    std::unique_ptr<LabeledMetricFamily<Gauge>> concurrency_limit_;
+    std::unique_ptr<LabeledMetricFamily<Gauge>> concurrency_in_flight_;
+    std::unique_ptr<LabeledMetricFamily<Gauge>> concurrency_queue_depth_;
+    std::unique_ptr<LabeledMetricFamily<Counter>> concurrency_shed_total_;
+    
+    // Retry metrics
+    std::unique_ptr<LabeledMetricFamily<Counter>> upstream_retries_total_;
+    
+    // Hedging metrics
+    std::unique_ptr<LabeledMetricFamily<Counter>> upstream_hedges_total_;
+    
     // Connection metrics
     std::unique_ptr<Gauge> active_connections_;
     std::unique_ptr<Histogram> connection_duration_;
@@ -1,34 +1,106 @@
 #ifndef __RATE_LIMITER_H
 #define __RATE_LIMITER_H
 
-#include <atomic>
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/steady_timer.hpp>
-#include <boost/smart_ptr/shared_ptr.hpp>
+#include "shm_store.hpp"
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace azugate {
 
-constexpr size_t kDftTokenGenIntervalSec = 1;
+constexpr size_t kDftRateLimiterShards = 64;
+// idle keys are evicted in LRU order above this limit.
+constexpr size_t kDftRateLimiterMaxKeysPerShard = 16 * 1024;
 
+// what a request is limited by.
+struct RateLimitKey {
+  enum Type {
+    kClientIp,
+    // request path without the query string.
+    kPath,
+    // `sub` claim of a valid azugate access token.
+    kJwtSubject,
+    kHeader,
+  };
+  Type type = kClientIp;
+  // lower case, only used by kHeader.
+  std::string header_name = "";
+};
+
+// "client_ip", "path", "jwt_subject" or "header:<name>".
+// returns false and keeps `key` untouched for an unknown spec.
+bool ParseRateLimitKey(std::string_view spec, RateLimitKey &key);
+
+struct RateLimitDecision {
+  bool allowed;
+  // how long the client should wait before retrying, 0 if allowed.
+  std::chrono::nanoseconds retry_after;
+};
+
+// keyed rate limiter based on GCRA (generic cell rate algorithm):
+// every key only stores its theoretical arrival time (TAT), tokens are
+// "refilled" lazily from timestamps so there is no timer and no periodic
+// burst of refills. num_token_per_sec is the sustained rate and
+// num_token_max the burst size, the same as a token bucket.
+// keys are spread over mutex protected shards, each one bounded and
+// evicting the least recently used key first. an evicted key is simply
+// treated as a new one with a full bucket.
+// optionally the state lives in shared memory instead, see
+// SharedRateLimitTable.
 class TokenBucketRateLimiter {
 public:
-  explicit TokenBucketRateLimiter(
-      const boost::shared_ptr<boost::asio::io_context> io_context_ptr);
+  TokenBucketRateLimiter(size_t num_token_max, size_t num_token_per_sec,
+                         RateLimitKey key = {},
+                         size_t num_shards = kDftRateLimiterShards,
+                         size_t max_keys_per_shard =
+                             kDftRateLimiterMaxKeysPerShard);
 
-  void Start();
+  // enforce one combined limit with the other processes attached to the
+  // same file. must be called before the limiter is used.
+  bool AttachSharedMemory(const std::string &path,
+                          size_t num_slots = kDftSharedRateLimiterSlots);
 
-  bool GetToken();
+  RateLimitDecision Acquire(std::string_view key);
+
+  bool GetToken(std::string_view key) { return Acquire(key).allowed; }
+
+  const RateLimitKey &Key() const { return key_; }
+
+  // number of tracked keys.
+  size_t Size() const;
 
 private:
-  void performTask();
-  void tick(boost::asio::steady_timer &timer);
+  struct Entry {
+    std::string key;
+    // theoretical arrival time in steady clock nanoseconds.
+    int64_t tat;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // most recently used first.
+    std::list<Entry> lru;
+    // views point into the keys owned by `lru`.
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+  };
 
-  size_t token_gen_interval_sec_;
-  boost::shared_ptr<boost::asio::io_context> io_context_ptr_;
-  boost::asio::steady_timer timer_;
-  std::atomic<size_t> n_token_;
+  // nanoseconds between two tokens.
+  int64_t emission_interval_;
+  // how far the TAT may run ahead of now, i.e. the burst.
+  int64_t burst_tolerance_;
+  RateLimitKey key_;
+  size_t max_keys_per_shard_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // host wide state, keys that don't fit fall back to the shards.
+  std::unique_ptr<SharedRateLimitTable> shared_;
 };
 } // namespace azugate
 
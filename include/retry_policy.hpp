@@ -0,0 +1,105 @@
+#ifndef __RETRY_POLICY_H
+#define __RETRY_POLICY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace YAML {
+class Node;
+}
+
+namespace azugate {
+
+// share of the active requests that may be retries at the same time.
+constexpr double kDftRetryBudgetPercent = 20.0;
+// retries always allowed whatever the traffic, so a lightly loaded
+// gateway can still retry.
+constexpr size_t kDftMinRetryConcurrency = 3;
+
+// why an attempt to reach the upstream failed.
+enum class UpstreamFailure {
+  kNone,
+  // resolving or connecting failed, the upstream never saw the request.
+  kConnectFailure,
+  // the connection broke before a complete response was read.
+  kReset,
+};
+
+struct RetryPolicy {
+  // retries after the first attempt, 0 disables them.
+  int max_retries = 0;
+  bool retry_on_connect_failure = true;
+  bool retry_on_reset = true;
+  std::vector<int> retry_status_codes = {502, 503, 504};
+  // the backoff before the n-th retry is drawn uniformly from
+  // [0, min(max_backoff, base_backoff * 2^(n-1))].
+  std::chrono::milliseconds base_backoff{25};
+  std::chrono::milliseconds max_backoff{250};
+  bool operator==(const RetryPolicy &other) const = default;
+
+  // whether the outcome of an attempt calls for a retry, `status` is 0 if
+  // no response was received.
+  bool Retriable(UpstreamFailure failure, int status) const;
+};
+
+// parses the entries of `retry_on`: "connect_failure", "reset" or a status
+// code. the conditions left out are disabled.
+bool ParseRetryOn(const std::vector<std::string_view> &conditions,
+                  RetryPolicy &policy);
+
+// full jitter backoff before retry number `retry` (from 1).
+// ref: https://aws.amazon.com/blogs/architecture/exponential-backoff-and-jitter/
+std::chrono::nanoseconds RetryBackoff(const RetryPolicy &policy, int retry);
+
+// caps the retries in flight over all the routes to a share of the active
+// requests, so that retries can't multiply the load of an upstream that
+// is already failing because it's overloaded.
+// ref:
+// https://www.envoyproxy.io/docs/envoy/latest/api-v3/config/cluster/v3/circuit_breaker.proto
+class RetryBudget {
+public:
+  static RetryBudget &Instance();
+
+  // retry: {budget: {percent, min_concurrency}}.
+  bool LoadFromConfig(const YAML::Node &config);
+
+  void Configure(double budget_percent, size_t min_retry_concurrency);
+
+  // a client request starts or stops being proxied, however many
+  // attempts it takes.
+  void RequestStarted() {
+    active_requests_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void RequestFinished() {
+    active_requests_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // takes a retry slot if the budget allows, it must be given back with
+  // ReleaseRetry() once the retry completed.
+  bool TryAcquireRetry();
+  void ReleaseRetry() {
+    active_retries_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  size_t ActiveRequests() const {
+    return active_requests_.load(std::memory_order_relaxed);
+  }
+  size_t ActiveRetries() const {
+    return active_retries_.load(std::memory_order_relaxed);
+  }
+
+private:
+  RetryBudget() = default;
+
+  std::atomic<double> budget_percent_{kDftRetryBudgetPercent};
+  std::atomic<size_t> min_retry_concurrency_{kDftMinRetryConcurrency};
+  std::atomic<size_t> active_requests_{0};
+  std::atomic<size_t> active_retries_{0};
+};
+
+} // namespace azugate
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __ROUTE_MATCHER_H
+#define __ROUTE_MATCHER_H
+
+#include "picohttpparser.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace azugate {
+
+// the request as seen by the route matchers, every view points into the
+// parse buffer so that matching never copies.
+struct RequestView {
+  std::string_view method;
+  // includes the query string.
+  std::string_view path;
+  const phr_header *headers = nullptr;
+  size_t num_headers = 0;
+};
+
+enum class MatchSource : uint8_t {
+  kHeader,
+  kQuery,
+  kCookie,
+};
+
+enum class MatchOp : uint8_t {
+  // the attribute exists, whatever its value.
+  kPresent,
+  kExact,
+  kPrefix,
+  kSuffix,
+  kContains,
+};
+
+// match conditions of a route compiled into a flat program: a method
+// bitmask plus an array of predicates whose strings live in one pool.
+// all the conditions must hold, the evaluation stops at the first one
+// that fails and never allocates.
+class RequestMatcher {
+public:
+  // returns false for an unknown method.
+  bool AddMethod(std::string_view method);
+
+  // header names are case-insensitive, query and cookie names are not.
+  // values are always compared case-sensitively.
+  void AddCondition(MatchSource source, std::string_view name, MatchOp op,
+                    std::string_view value = {}, bool invert = false);
+
+  bool Matches(const RequestView &request) const;
+
+  // a matcher without conditions matches every request.
+  bool Empty() const { return methods_ == 0 && program_.empty(); }
+
+  bool operator==(const RequestMatcher &other) const = default;
+
+private:
+  struct Predicate {
+    MatchSource source;
+    MatchOp op;
+    bool invert;
+    uint32_t name_offset;
+    uint32_t name_len;
+    uint32_t value_offset;
+    uint32_t value_len;
+    bool operator==(const Predicate &other) const = default;
+  };
+
+  bool evalPredicate(const Predicate &predicate,
+                     const RequestView &request) const;
+
+  std::string_view poolView(uint32_t offset, uint32_t len) const {
+    return std::string_view(pool_).substr(offset, len);
+  }
+
+  // bit i is set if kKnownMethods[i] is accepted, 0 accepts any method.
+  uint32_t methods_ = 0;
+  std::vector<Predicate> program_;
+  std::string pool_;
+};
+
+} // namespace azugate
+
+#endif
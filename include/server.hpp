@@ -14,6 +14,11 @@
 #include <boost/system/error_code.hpp>
 #include <spdlog/spdlog.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include "rate_limiter.h"
 
 namespace azugate {
@@ -34,8 +39,25 @@ public:
       : io_context_ptr_(io_context_ptr),
         acceptor_(*io_context_ptr, boost::asio::ip::tcp::endpoint(
                                        boost::asio::ip::tcp::v4(), port)),
-        rate_limiter_(io_context_ptr) {
-    rate_limiter_.Start();
+        rate_limiter_settings_(currentRateLimiterSettings()),
+        rate_limiter_(makeRateLimiter(rate_limiter_settings_)) {}
+
+  // rebuilds the rate limiter after its settings were changed by a config
+  // reload, the connections already dispatched keep the old one. the
+  // tracked keys start over with a full bucket.
+  void ReloadRateLimiter() {
+    auto settings = currentRateLimiterSettings();
+    {
+      std::lock_guard<std::mutex> lock(rate_limiter_mutex_);
+      if (settings == rate_limiter_settings_) {
+        return;
+      }
+      rate_limiter_settings_ = settings;
+    }
+    rate_limiter_.store(makeRateLimiter(settings), std::memory_order_release);
+    SPDLOG_INFO("rate limiter reloaded: burst {}, {} request(s)/s, key {}",
+                settings.num_token_max, settings.num_token_per_sec,
+                settings.key);
   }
 
   void Run(boost::shared_ptr<boost::asio::io_context> io_context_ptr) {
@@ -68,16 +90,17 @@ public:
       accept();
       return;
     }
-    ConnectionInfo src_conn_info;
-    src_conn_info.address = source_endpoint.address().to_string();
-    // TODO: support async log, this is really slow...slow...slow...
-    SPDLOG_DEBUG("connection from {}", src_conn_info.address);
-    if (!azugate::Filter(sock_ptr, src_conn_info)) {
+    if (!azugate::Filter(sock_ptr, source_endpoint)) {
       safeCloseSocket(sock_ptr);
       accept();
       return;
     }
-    Dispatch(io_context_ptr_, sock_ptr, std::move(src_conn_info), rate_limiter_,
+    ConnectionInfo src_conn_info;
+    src_conn_info.address = source_endpoint.address().to_string();
+    // TODO: support async log, this is really slow...slow...slow...
+    SPDLOG_DEBUG("connection from {}", src_conn_info.address);
+    Dispatch(io_context_ptr_, sock_ptr, std::move(src_conn_info),
+             rate_limiter_.load(std::memory_order_acquire),
              std::bind(&Server::accept, this));
     accept();
     return;
@@ -93,8 +116,41 @@ public:
   }
 
 private:
+  struct RateLimiterSettings {
+    size_t num_token_max;
+    size_t num_token_per_sec;
+    std::string key;
+    std::string shm_path;
+    bool operator==(const RateLimiterSettings &other) const = default;
+  };
+
+  static RateLimiterSettings currentRateLimiterSettings() {
+    auto [num_token_max, num_token_per_sec] = GetRateLimitorConfig();
+    return RateLimiterSettings{
+        .num_token_max = num_token_max,
+        .num_token_per_sec = num_token_per_sec,
+        .key = GetRateLimitorKey(),
+        .shm_path = GetRateLimitorSharedMemory(),
+    };
+  }
+
+  static std::shared_ptr<TokenBucketRateLimiter>
+  makeRateLimiter(const RateLimiterSettings &settings) {
+    RateLimitKey key;
+    ParseRateLimitKey(settings.key, key);
+    auto rate_limiter = std::make_shared<TokenBucketRateLimiter>(
+        settings.num_token_max, settings.num_token_per_sec, std::move(key));
+    if (!settings.shm_path.empty() &&
+        !rate_limiter->AttachSharedMemory(settings.shm_path)) {
+      SPDLOG_WARN("fall back to a per-process rate limiter");
+    }
+    return rate_limiter;
+  }
+
   boost::shared_ptr<boost::asio::io_context> io_context_ptr_;
-  azugate::TokenBucketRateLimiter rate_limiter_;
+  std::mutex rate_limiter_mutex_;
+  RateLimiterSettings rate_limiter_settings_;
+  std::atomic<std::shared_ptr<azugate::TokenBucketRateLimiter>> rate_limiter_;
   boost::asio::ip::tcp::acceptor acceptor_;
 };
 
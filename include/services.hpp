@@ -7,11 +7,19 @@
 #include "crequest.h"
 #include "network_wrapper.hpp"
 #include "protocols.h"
+#include "rate_limiter.h"
 #include "string_op.h"
 #include "file_index.hpp"
+#include "hedging.hpp"
+#include "http_exchange.hpp"
 #include "load_balancer.hpp"
+#include "disk_cache.hpp"
 #include "http_cache.hpp"
 #include "circuit_breaker.hpp"
+#include "concurrency_limiter.hpp"
+#include "metrics.hpp"
+#include "retry_policy.hpp"
+#include "vhost.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/buffers_iterator.hpp>
 #include <boost/asio/error.hpp>
@@ -60,6 +68,7 @@
 #include <vector>
 #if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
 #include <sys/sendfile.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -119,6 +128,78 @@ inline bool handleGzipCompression(const boost::shared_ptr<T> sock_ptr,
   return true;
 }
 
+// writes a body of the cache's disk tier: sendfile() on plain sockets,
+// the mapped slabs otherwise.
+template <typename T>
+inline bool sendDiskBody(const boost::shared_ptr<T> &sock_ptr,
+                         const DiskBody &body) {
+  if (body.length == 0) {
+    return true;
+  }
+  constexpr bool is_ssl =
+      std::is_same_v<T, boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>;
+#if defined(__linux__)
+  if constexpr (!is_ssl) {
+    auto &sock = sock_ptr->lowest_layer();
+    off_t offset = static_cast<off_t>(body.offset);
+    size_t left = body.length;
+    while (left > 0) {
+      ssize_t sent =
+          sendfile(sock.native_handle(), body.segment->fd, &offset, left);
+      if (sent < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        // asio leaves the socket non-blocking once it was used asynchronously.
+        if (errno == EAGAIN) {
+          boost::system::error_code ec;
+          sock.wait(boost::asio::socket_base::wait_write, ec);
+          if (ec) {
+            SPDLOG_ERROR("failed to wait for socket: {}", ec.message());
+            return false;
+          }
+          continue;
+        }
+        SPDLOG_ERROR("sendfile failed: {}", strerror(errno));
+        return false;
+      }
+      // the segment file is shorter than the entry says, it would spin.
+      if (sent == 0) {
+        SPDLOG_ERROR("sendfile hit the end of segment {}",
+                     body.segment->id);
+        return false;
+      }
+      left -= static_cast<size_t>(sent);
+    }
+    return true;
+  }
+#endif
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+  auto page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  auto map_offset = body.offset / page_size * page_size;
+  auto skew = body.offset - map_offset;
+  void *mapped = mmap(nullptr, skew + body.length, PROT_READ, MAP_SHARED,
+                      body.segment->fd, static_cast<off_t>(map_offset));
+  if (mapped == MAP_FAILED) {
+    SPDLOG_ERROR("mmap failed: {}", strerror(errno));
+    return false;
+  }
+  boost::system::error_code ec;
+  boost::asio::write(
+      *sock_ptr,
+      boost::asio::buffer(static_cast<const char *>(mapped) + skew, body.length),
+      ec);
+  munmap(mapped, skew + body.length);
+  if (ec) {
+    SPDLOG_ERROR("failed to write data to socket: {}", ec.message());
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
 // TODO: async optimization.
 template <typename T>
 inline bool handleNoCompression(const boost::shared_ptr<T> sock_ptr,
@@ -208,17 +289,8 @@ inline bool compressAndWriteBody(const boost::shared_ptr<T> sock_ptr,
 // helper function to extract token from cookie.
 inline std::string
 extractAzugateAccessTokenFromCookie(const std::string_view &cookie_header) {
-  size_t token_pos = cookie_header.find("azugate_access_token=");
-  if (token_pos != std::string_view::npos) {
-    // move past 'azugate_access_token='
-    token_pos += 21;
-    size_t token_end = cookie_header.find(';', token_pos);
-    if (token_end == std::string_view::npos) {
-      token_end = cookie_header.length();
-    }
-    return std::string(cookie_header.substr(token_pos, token_end - token_pos));
-  }
-  return "";
+  auto token = network::FindCookie(cookie_header, "azugate_access_token");
+  return token ? std::string(*token) : "";
 }
 
 // helper function to extract token from Authorization header
@@ -351,7 +423,7 @@ inline bool extractMetaFromHeaders(utils::CompressionType &compression_type,
                                    network::PicoHttpRequest &request,
                                    std::string &token,
                                    size_t &request_content_length,
-                                   bool &isWebSocket) {
+                                   bool &isWebSocket, std::string &host) {
   if (request.num_headers <= 0 || request.num_headers > kMaxHeadersNum) {
     SPDLOG_WARN("No headers found in the request.");
     return false;
@@ -397,6 +469,11 @@ inline bool extractMetaFromHeaders(utils::CompressionType &compression_type,
                     utils::toLower(CRequest::kConnectionUpgrade);
       continue;
     }
+    if (header_name == CRequest::kHeaderFieldHost ||
+        header_name == CRequest::kHeaderFieldAuthority) {
+      host = NormalizeHost(header_value);
+      continue;
+    }
     // TODO: fix it when needed.
     // if (header_name == CRequest::kHeaderAuthorization) {
     //   std::string_view header_value(header.value, header.value_len);
@@ -420,14 +497,33 @@ public:
   HttpProxyHandler(boost::shared_ptr<boost::asio::io_context> io_context_ptr,
                    boost::shared_ptr<T> sock_ptr,
                    azugate::ConnectionInfo source_connection_info,
-                   std::function<void()> async_accpet_cb)
+                   std::function<void()> async_accpet_cb,
+                   std::shared_ptr<TokenBucketRateLimiter> rate_limiter_ptr =
+                       nullptr)
       : io_context_ptr_(io_context_ptr), sock_ptr_(sock_ptr),
         async_accpet_cb_(async_accpet_cb), total_parsed_(0),
+        request_content_length_(0),
         source_connection_info_(source_connection_info),
-        request_content_length_(0) {}
+        rate_limiter_ptr_(std::move(rate_limiter_ptr)) {}
 
   // TODO: release connections properly.
-  ~HttpProxyHandler() { Close(); }
+  ~HttpProxyHandler() {
+    if (upstream_stream_open_) {
+      load_balancer_->on_stream_complete(upstream_, upstream_status_ != 0);
+    }
+    if (circuit_breaker_) {
+      circuit_breaker_->record_cancelled();
+    }
+    releaseRetry();
+    if (cache_flight_) {
+      // the request failed before a response came.
+      finishCacheFlight(nullptr);
+    }
+    if (counted_by_retry_budget_) {
+      RetryBudget::Instance().RequestFinished();
+    }
+    Close();
+  }
 
   void Start() { parseRequest(); }
 
@@ -486,11 +582,16 @@ public:
 
   inline void extractMetadata() {
     if (!extractMetaFromHeaders(compression_type_, request_, token_,
-                                request_content_length_, isWebSocket_)) {
+                                request_content_length_, isWebSocket_,
+                                source_connection_info_.host)) {
       SPDLOG_WARN("failed to extract meta from headers");
       async_accpet_cb_();
       return;
     }
+    if (rate_limiter_ptr_ && !checkRateLimit()) {
+      async_accpet_cb_();
+      return;
+    }
     // TODO: external authoriation and router.
     if (g_http_external_authorization && !isWebSocket_ &&
         !externalAuthorization(request_, sock_ptr_, token_)) {
@@ -500,6 +601,66 @@ public:
     route();
   }
 
+  // the value the rate limiter keys on, falls back to the client ip.
+  inline std::string_view rateLimitKey() {
+    auto &key = rate_limiter_ptr_->Key();
+    switch (key.type) {
+    case RateLimitKey::kPath: {
+      std::string_view path(request_.path, request_.len_path);
+      return path.substr(0, path.find('?'));
+    }
+    case RateLimitKey::kJwtSubject:
+      if (!token_.empty() &&
+          utils::VerifyToken(token_, g_authorization_token_secret)) {
+        try {
+          rate_limit_key_ = jwt::decode(token_).get_subject();
+          return rate_limit_key_;
+        } catch (const std::exception &e) {
+          SPDLOG_DEBUG("no subject in token: {}", e.what());
+        }
+      }
+      break;
+    case RateLimitKey::kHeader:
+      for (size_t i = 0; i < request_.num_headers; ++i) {
+        auto &header = request_.headers[i];
+        if (boost::beast::iequals(
+                boost::beast::string_view(header.name, header.name_len),
+                boost::beast::string_view(key.header_name.data(),
+                                          key.header_name.size()))) {
+          return std::string_view(header.value, header.value_len);
+        }
+      }
+      break;
+    case RateLimitKey::kClientIp:
+      break;
+    }
+    return source_connection_info_.address;
+  }
+
+  // answers 429 and returns false if the request is over the limit.
+  inline bool checkRateLimit() {
+    using namespace boost::beast;
+    auto decision = rate_limiter_ptr_->Acquire(rateLimitKey());
+    if (decision.allowed) {
+      return true;
+    }
+    auto retry_after_sec =
+        std::chrono::ceil<std::chrono::seconds>(decision.retry_after).count();
+    SPDLOG_DEBUG("request from {} rejected by rate limiter, retry after {}s",
+                 source_connection_info_.address, retry_after_sec);
+    http::response<http::string_body> resp{http::status::too_many_requests,
+                                           11};
+    resp.set(http::field::retry_after,
+             std::to_string(std::max<int64_t>(retry_after_sec, 1)));
+    resp.prepare_payload();
+    boost::system::error_code ec;
+    http::write(*sock_ptr_, resp, ec);
+    if (ec) {
+      SPDLOG_WARN("failed to write http response");
+    }
+    return false;
+  }
+
   // convert string constants to boost::beast::http::verb.
   std::optional<boost::beast::http::verb>
   stringToVerb(const std::string &methodStr) {
@@ -525,7 +686,9 @@ public:
         std::string(request_.path, request_.len_path);
     source_connection_info_.type =
         isWebSocket_ ? ProtocolTypeWebSocket : ProtocolTypeHttp;
-    auto target_conn_info_opt = GetTargetRoute(source_connection_info_);
+    auto request_view = requestView();
+    auto target_conn_info_opt =
+        GetTargetRoute(source_connection_info_, &request_view);
     if (!target_conn_info_opt) {
       SPDLOG_WARN("no path found for {}", source_connection_info_.http_url);
       http::response<http::string_body> err_not_found_resp{
@@ -544,11 +707,37 @@ public:
       async_accpet_cb_();
       return;
     }
-    auto target_address = target_conn_info_opt->address;
-    auto target_port = target_conn_info_opt->port;
-    auto target_protocol = target_conn_info_opt->type;
+    if (target_conn_info_opt->type == ProtocolTypeHttp && !isWebSocket_ &&
+        serveFromCache(*target_conn_info_opt)) {
+      return;
+    }
+    forwardRequest(std::move(*target_conn_info_opt));
+  }
+
+  // sends the request to the remote target picked by route().
+  void forwardRequest(ConnectionInfo target) {
+    auto target_address = target.address;
+    auto target_port = target.port;
+    auto target_protocol = target.type;
+    load_balancer_ = std::move(target.load_balancer);
+    upstream_ = std::move(target.upstream);
     if (target_address == "") {
-      SPDLOG_ERROR("invalid target address");
+      if (load_balancer_) {
+        SPDLOG_WARN("no available upstream for {}",
+                    source_connection_info_.http_url);
+        if (!serveStaleOnError()) {
+          sendServiceUnavailableResponse();
+        }
+      } else {
+        SPDLOG_ERROR("invalid target address");
+      }
+      async_accpet_cb_();
+      return;
+    }
+    if (!admitByCircuitBreaker(target_address, target_port)) {
+      if (!serveStaleOnError()) {
+        sendServiceUnavailableResponse();
+      }
       async_accpet_cb_();
       return;
     }
@@ -556,16 +745,81 @@ public:
     SPDLOG_INFO("[{}] {}:{}{}", target_protocol, target_address, target_port,
                 target_url_);
     if (target_protocol == ProtocolTypeWebSocket) {
+      if (load_balancer_) {
+        load_balancer_->on_request_start(upstream_);
+        upstream_stream_open_ = true;
+      }
+      auto start = std::chrono::steady_clock::now();
       handleWebSocketRequest(std::move(target_address), std::move(target_port));
+      recordCircuitBreakerOutcome(std::chrono::steady_clock::now() - start);
       return;
     } else if (target_protocol == ProtocolTypeHttp) {
-      handleHttpRequest(std::move(target_address), std::move(target_port));
+      retry_policy_ = std::move(target.retry_policy);
+      hedging_ = std::move(target.hedging);
+      RetryBudget::Instance().RequestStarted();
+      counted_by_retry_budget_ = true;
+      if (hedgeableRequest()) {
+        hedgeHttpRequest();
+        return;
+      }
+      sendHttpRequest(std::move(target_address), target_port);
       return;
     }
     SPDLOG_WARN("unknown protocol: {}", target_protocol);
+    recordCircuitBreakerOutcome({});
     async_accpet_cb_();
   }
 
+  inline RequestView requestView() {
+    return RequestView{
+        .method = std::string_view(request_.method, request_.method_len),
+        .path = std::string_view(request_.path, request_.len_path),
+        .headers = request_.headers,
+        .num_headers = request_.num_headers,
+    };
+  }
+
+  // asks the breaker of the upstream whether the request may be sent,
+  // an open one fails it right away instead of waiting for a connect
+  // timeout. the admission must be followed by
+  // recordCircuitBreakerOutcome().
+  inline bool admitByCircuitBreaker(const std::string &target_address,
+                                    uint16_t target_port) {
+    auto &registry = CircuitBreakerRegistry::instance();
+    if (!registry.enabled()) {
+      return true;
+    }
+    circuit_breaker_ =
+        upstream_ ? upstream_->circuit_breaker()
+                  : registry.get_for_upstream(target_address, target_port);
+    if (circuit_breaker_->can_proceed()) {
+      return true;
+    }
+    SPDLOG_DEBUG("circuit breaker of {}:{} is open, request rejected",
+                 target_address, target_port);
+    circuit_breaker_.reset();
+    return false;
+  }
+
+  // a server error or no response at all counts against the upstream,
+  // a request that failed before reaching it doesn't count.
+  inline void
+  recordCircuitBreakerOutcome(std::chrono::steady_clock::duration elapsed) {
+    if (!circuit_breaker_) {
+      return;
+    }
+    auto breaker = std::move(circuit_breaker_);
+    if (!upstream_attempted_) {
+      breaker->record_cancelled();
+    } else if (upstream_status_ == 0) {
+      breaker->record_failure();
+    } else {
+      breaker->record_response(
+          upstream_status_,
+          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed));
+    }
+  }
+
   // grpc-web protocol data frame:
   // +---------------+----------------------------------+------+
   // | compressed(1) | data length (4 bytes big-endian) | data |
@@ -609,6 +863,748 @@ public:
     SPDLOG_INFO("received gRPC-Web message, length: {}", msg_len);
   }
 
+  // goes through the concurrency limiter of the upstream, if any.
+  void sendHttpRequest(std::string &&target_address, uint16_t target_port) {
+    auto limiter = ConcurrencyLimiterRegistry::Instance().Get(
+        fmt::format("{}:{}", target_address, target_port));
+    if (!limiter) {
+      proxyHttpRequest(std::move(target_address), target_port);
+      return;
+    }
+    limiter->Acquire(*io_context_ptr_,
+                     [self = this->shared_from_this(), limiter,
+                      target_address = std::move(target_address),
+                      target_port](bool admitted) mutable {
+                       self->handleLimitedHttpRequest(
+                           limiter, std::move(target_address), target_port,
+                           admitted);
+                     });
+  }
+
+  // proxies the request once the upstream's concurrency limiter admitted
+  // it, proxyHttpRequest() feeds the latency and outcome back to adapt the
+  // limit.
+  void
+  handleLimitedHttpRequest(const std::shared_ptr<ConcurrencyLimiter> &limiter,
+                           std::string &&target_host, uint16_t target_port,
+                           bool admitted) {
+    if (!admitted) {
+      recordCircuitBreakerOutcome({});
+      releaseRetry();
+      if (!serveStaleOnError()) {
+        sendServiceUnavailableResponse();
+      }
+      async_accpet_cb_();
+      return;
+    }
+    limiter_ = limiter;
+    proxyHttpRequest(std::move(target_host), target_port);
+  }
+
+  // no response at all or a server error means the upstream is in
+  // trouble, not that the request was bad.
+  inline bool upstreamSucceeded() const {
+    return upstream_status_ != 0 && upstream_status_ < 500;
+  }
+
+  // proxies one attempt of the request and reports its outcome to the
+  // load balancer and the circuit breaker, then retries or answers.
+  void proxyHttpRequest(std::string &&target_host, uint16_t target_port) {
+    auto start = std::chrono::steady_clock::now();
+    if (load_balancer_) {
+      load_balancer_->on_request_start(upstream_);
+    }
+    upstream_status_ = 0;
+    upstream_failure_ = UpstreamFailure::kNone;
+    response_str_.clear();
+    handleHttpRequest(std::move(target_host), std::move(target_port));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    // the slot is given back before any retry backoff or write to the
+    // client, the limit must only follow the upstream's latency.
+    if (limiter_) {
+      std::exchange(limiter_, nullptr)->Release(elapsed, !upstreamSucceeded());
+    }
+    if (load_balancer_) {
+      load_balancer_->on_request_complete(upstream_, elapsed,
+                                          upstreamSucceeded());
+    }
+    recordCircuitBreakerOutcome(elapsed);
+    releaseRetry();
+    if (!retryHttpRequest()) {
+      finishHttpRequest();
+    }
+  }
+
+  // methods a retry can't make worse, see RFC 9110 section 9.2.2.
+  inline bool idempotentRequest() const {
+    std::string_view method(request_.method, request_.method_len);
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+           method == "PUT" || method == "DELETE" || method == "TRACE";
+  }
+
+  // schedules another attempt on a different upstream if the route's
+  // policy covers the failure, the request can be sent again and the
+  // retry budget allows it. returns false if the request is done.
+  bool retryHttpRequest() {
+    if (!retry_policy_ || !load_balancer_ || !upstream_ ||
+        num_retries_ >= retry_policy_->max_retries ||
+        !retry_policy_->Retriable(upstream_failure_, upstream_status_)) {
+      return false;
+    }
+    // the upstream never saw a request it couldn't be connected to,
+    // otherwise only an idempotent request whose body hasn't been streamed
+    // from the client is sent again.
+    if (upstream_failure_ != UpstreamFailure::kConnectFailure &&
+        (!idempotentRequest() || request_content_length_ > extra_body_len_)) {
+      return false;
+    }
+    auto &metrics = GatewayMetrics::instance();
+    auto failed_upstream =
+        fmt::format("{}:{}", upstream_->address(), upstream_->port());
+    if (!RetryBudget::Instance().TryAcquireRetry()) {
+      SPDLOG_DEBUG("retry budget exhausted, not retrying {}",
+                   failed_upstream);
+      metrics.record_upstream_retry(failed_upstream, "budget_exhausted");
+      return false;
+    }
+    retry_in_flight_ = true;
+    auto request_view = requestView();
+    auto server = load_balancer_->get_retry_server(
+        upstream_, source_connection_info_.address, &request_view);
+    if (!server) {
+      releaseRetry();
+      return false;
+    }
+    upstream_ = std::move(server);
+    if (!admitByCircuitBreaker(upstream_->address(), upstream_->port())) {
+      metrics.record_upstream_retry(failed_upstream, "circuit_open");
+      releaseRetry();
+      return false;
+    }
+    ++num_retries_;
+    metrics.record_upstream_retry(failed_upstream, "retried");
+    SPDLOG_DEBUG("retry {} of {} on {}:{}", num_retries_, target_url_,
+                 upstream_->address(), upstream_->port());
+    retry_timer_ = std::make_unique<boost::asio::steady_timer>(
+        *io_context_ptr_, RetryBackoff(*retry_policy_, num_retries_));
+    retry_timer_->async_wait(
+        [self = this->shared_from_this(), address = upstream_->address(),
+         port = upstream_->port()](boost::system::error_code ec) mutable {
+          if (ec) {
+            self->recordCircuitBreakerOutcome({});
+            self->releaseRetry();
+            self->finishHttpRequest();
+            return;
+          }
+          self->sendHttpRequest(std::move(address), port);
+        });
+    return true;
+  }
+
+  inline void releaseRetry() {
+    if (retry_in_flight_) {
+      retry_in_flight_ = false;
+      RetryBudget::Instance().ReleaseRetry();
+    }
+  }
+
+  // answers the client with the response of the last attempt, if any,
+  // and keeps it in the cache if it's cacheable. a stale entry is served
+  // instead of a failure if its stale-if-error window allows it.
+  void finishHttpRequest() {
+    if (sliced_) {
+      onSliceFetched();
+      return;
+    }
+    if (refreshStaleEntry()) {
+      async_accpet_cb_();
+      return;
+    }
+    auto entry = cacheableResponse();
+    if (upstreamSucceeded() || !serveStaleOnError()) {
+      if (entry) {
+        // written as a hit would be, the range the client asked for was
+        // left to the cache.
+        writeCachedResponse(*entry);
+      } else if (!response_str_.empty()) {
+        boost::system::error_code ec;
+        boost::asio::write(*sock_ptr_, boost::asio::buffer(response_str_), ec);
+        if (ec) {
+          SPDLOG_ERROR("write back to client failed: {}", ec.message());
+        }
+      }
+    }
+    storeInCache(std::move(entry));
+    async_accpet_cb_();
+  }
+
+  // the upstream confirmed the stale entry with a 304, the refreshed
+  // entry answers the client. returns false for any other response.
+  bool refreshStaleEntry() {
+    if (upstream_status_ != 304 || !stale_entry_ ||
+        !stale_entry_->revalidatable) {
+      return false;
+    }
+    auto entry = cache_->refresh_entry(*stale_entry_, response_str_,
+                                       cache_policy_.get());
+    // still good for this client if it can't be stored anymore.
+    writeCachedResponse(entry ? *entry : *stale_entry_);
+    if (entry) {
+      cache_->put(*cache_key_, entry);
+    }
+    finishCacheFlight(std::move(entry));
+    stale_entry_.reset();
+    return true;
+  }
+
+  // request headers with lowercased names, as the cache expects them.
+  std::unordered_map<std::string, std::string> requestHeaders() const {
+    std::unordered_map<std::string, std::string> headers;
+    for (size_t i = 0; i < request_.num_headers; ++i) {
+      auto &header = request_.headers[i];
+      headers.emplace(
+          utils::toLower(std::string(header.name, header.name_len)),
+          std::string(header.value, header.value_len));
+    }
+    return headers;
+  }
+
+  // answers the request from the cache if it holds a fresh response, or
+  // once the fetch of the same response in progress completed. otherwise
+  // remembers the key to store the upstream's response under and returns
+  // false, the request is to be forwarded to `target`.
+  bool serveFromCache(ConnectionInfo &target) {
+    auto cache = HttpCacheManager::instance().get_cache();
+    if (!cache) {
+      return false;
+    }
+    std::string method(request_.method, request_.method_len);
+    std::string_view request_target(request_.path, request_.len_path);
+    auto query_pos = request_target.find('?');
+    std::string path(request_target.substr(0, query_pos));
+    auto headers = requestHeaders();
+    if (!cache->should_cache_request(method, path, headers)) {
+      return false;
+    }
+    std::string query;
+    if (query_pos != std::string_view::npos) {
+      query = request_target.substr(query_pos + 1);
+    }
+    // virtual hosts may share paths.
+    auto key = cache->create_cache_key(
+        method, source_connection_info_.host + path, query, headers);
+    cache_ = std::move(cache);
+    cache_request_headers_ = std::move(headers);
+    if (auto slice_size = cache_->slice_size(target.cache_policy.get());
+        slice_size > 0 && method == "GET") {
+      startSlices(target, std::move(key), slice_size);
+      return true;
+    }
+    auto &metrics = GatewayMetrics::instance();
+    std::shared_ptr<CacheEntry> stale;
+    if (auto entry = cache_->get(key, &stale)) {
+      metrics.record_cache_hit();
+      writeCachedResponse(**entry);
+      async_accpet_cb_();
+      return true;
+    }
+    cache_key_ = std::move(key);
+    cache_policy_ = target.cache_policy;
+    if (stale && (stale->revalidatable || stale->can_serve_if_error() ||
+                  stale->can_serve_while_revalidating())) {
+      stale_entry_ = std::move(stale);
+    }
+    // RFC 5861: the client doesn't wait for the refresh of a stale entry.
+    if (stale_entry_ && stale_entry_->can_serve_while_revalidating()) {
+      metrics.record_cache_hit();
+      cache_->record_stale_served();
+      writeCachedResponse(*stale_entry_);
+      revalidateInBackground(target);
+      async_accpet_cb_();
+      return true;
+    }
+    metrics.record_cache_miss();
+    auto config = cache_->get_config();
+    if (!config->coalesce_misses) {
+      return false;
+    }
+    bool leader = false;
+    auto flight = cache_->join_flight(*cache_key_, leader);
+    if (leader) {
+      cache_flight_ = std::move(flight);
+      return false;
+    }
+    awaitCacheFlight(flight, std::move(target), config->lock_timeout);
+    return true;
+  }
+
+  // answers the request a slice of the object at a time, starting with
+  // the one holding the first byte asked for. a suffix range starts with
+  // the first slice, the size of the object is only known then.
+  void startSlices(const ConnectionInfo &target, CacheKey key,
+                   size_t slice_size) {
+    sliced_ = std::make_unique<SlicedResponse>();
+    sliced_->target = target;
+    sliced_->key = std::move(key);
+    sliced_->slice_size = slice_size;
+    sliced_->next = cache_->requested_range_start(cache_request_headers_);
+    cache_policy_ = target.cache_policy;
+    nextSlice();
+  }
+
+  // writes the slice holding the next byte, from the cache or once it was
+  // fetched, until the response is complete.
+  void nextSlice() {
+    auto &sliced = *sliced_;
+    if (sliced.head_written && sliced.next >= sliced.end) {
+      finishSlices();
+      return;
+    }
+    auto key = sliced.key;
+    key.slice = sliced.next / sliced.slice_size;
+    key.finalize();
+    auto &metrics = GatewayMetrics::instance();
+    auto entry = cache_->get(key);
+    if (entry && sameSlicedObject(**entry)) {
+      metrics.record_cache_hit();
+      writeSlice(**entry);
+      return;
+    }
+    metrics.record_cache_miss();
+    cache_key_ = std::move(key);
+    // every slice is a request of its own to the upstream.
+    num_retries_ = 0;
+    if (counted_by_retry_budget_) {
+      RetryBudget::Instance().RequestFinished();
+      counted_by_retry_budget_ = false;
+    }
+    forwardRequest(sliced.target);
+  }
+
+  inline bool sameSlicedObject(const CacheEntry &slice) const {
+    return !sliced_->head_written ||
+           (slice.object_size == sliced_->object_size &&
+            slice.etag == sliced_->etag &&
+            slice.last_modified == sliced_->last_modified);
+  }
+
+  // the upstream's response to the Range of a slice. anything but the
+  // 206 of that slice goes to the client as is when nothing was written
+  // yet, the response is cut short otherwise.
+  void onSliceFetched() {
+    auto &sliced = *sliced_;
+    bool cacheable = false;
+    auto entry = cache_->create_slice_entry(
+        std::move(response_str_), *cache_key_->slice * sliced.slice_size,
+        cacheable, cache_policy_.get());
+    if (entry && cacheable) {
+      cache_->put(*cache_key_, entry);
+    }
+    if (entry && sameSlicedObject(*entry)) {
+      writeSlice(*entry);
+      return;
+    }
+    if (sliced.head_written) {
+      SPDLOG_ERROR("slice {} failed, the response is cut short",
+                   cache_key_->to_string());
+      finishSlices();
+      return;
+    }
+    // an empty object has no range to ask for, it's fetched whole.
+    if (upstream_status_ == 416 && !cache_request_headers_.contains("range")) {
+      auto target = std::move(sliced.target);
+      sliced_.reset();
+      cache_key_.reset();
+      forwardRequest(std::move(target));
+      return;
+    }
+    if (!response_str_.empty()) {
+      boost::system::error_code ec;
+      boost::asio::write(*sock_ptr_, boost::asio::buffer(response_str_), ec);
+      if (ec) {
+        SPDLOG_ERROR("write back to client failed: {}", ec.message());
+      }
+    }
+    finishSlices();
+  }
+
+  // writes the part of `slice` the client asked for, after the head if
+  // it's the first one. the next slice is written from a handler of its
+  // own, the stack doesn't grow with the object.
+  void writeSlice(const CacheEntry &slice) {
+    auto &sliced = *sliced_;
+    if (!sliced.head_written && !writeSlicedHead(slice)) {
+      finishSlices();
+      return;
+    }
+    auto slice_end = slice.slice_offset + slice.body_size();
+    if (sliced.next >= slice.slice_offset && sliced.next < slice_end) {
+      auto offset = sliced.next - slice.slice_offset;
+      auto length = std::min(slice_end, sliced.end) - sliced.next;
+      boost::system::error_code ec;
+      if (slice.disk_body) {
+        if (!sendDiskBody(sock_ptr_,
+                          DiskBody{.segment = slice.disk_body->segment,
+                                   .offset = slice.disk_body->offset + offset,
+                                   .length = length})) {
+          ec = boost::asio::error::broken_pipe;
+          Close();
+        }
+      } else {
+        std::vector<boost::asio::const_buffer> buffers;
+        for (auto part : slice.body_slices(offset, length)) {
+          buffers.push_back(boost::asio::buffer(part));
+        }
+        boost::asio::write(*sock_ptr_, buffers, ec);
+      }
+      if (ec) {
+        SPDLOG_ERROR("write slice failed: {}", ec.message());
+        finishSlices();
+        return;
+      }
+      sliced.next += length;
+    }
+    boost::asio::post(*io_context_ptr_,
+                      [self = this->shared_from_this()] { self->nextSlice(); });
+  }
+
+  // the head of the response, once the first slice told the size of the
+  // object. false if there's no body to write: a 304, a 416 or a failure.
+  bool writeSlicedHead(const CacheEntry &slice) {
+    auto &sliced = *sliced_;
+    sliced.head_written = true;
+    sliced.object_size = slice.object_size;
+    sliced.etag = slice.etag;
+    sliced.last_modified = slice.last_modified;
+    boost::system::error_code ec;
+    if (cache_->not_modified(slice, cache_request_headers_)) {
+      auto response = cache_->create_not_modified_response(slice);
+      boost::asio::write(*sock_ptr_, boost::asio::buffer(response), ec);
+      return false;
+    }
+    auto response = cache_->create_sliced_response(
+        slice, cache_->requested_range(slice, slice.object_size,
+                                       cache_request_headers_));
+    std::array<boost::asio::const_buffer, 3> buffers = {
+        boost::asio::buffer(response.status_line),
+        boost::asio::buffer(response.fields),
+        boost::asio::buffer(response.extra_fields)};
+    boost::asio::write(*sock_ptr_, buffers, ec);
+    if (ec) {
+      SPDLOG_ERROR("write sliced response failed: {}", ec.message());
+      return false;
+    }
+    sliced.next = response.body_offset;
+    sliced.end = response.body_offset + response.body_length;
+    return response.body_length > 0;
+  }
+
+  inline void finishSlices() {
+    sliced_.reset();
+    async_accpet_cb_();
+  }
+
+  // parks the request until the leader of `flight` stored its response,
+  // it's forwarded to `target` if the response can't be used or once
+  // `timeout` passed.
+  void awaitCacheFlight(const std::shared_ptr<CacheFlight> &flight,
+                        ConnectionInfo target,
+                        std::chrono::milliseconds timeout) {
+    // the timer and the leader race, the first one to set it resumes.
+    auto resumed = std::make_shared<std::atomic<bool>>(false);
+    auto pending = std::make_shared<ConnectionInfo>(std::move(target));
+    auto timer =
+        std::make_shared<boost::asio::steady_timer>(*io_context_ptr_, timeout);
+    auto self = this->shared_from_this();
+    timer->async_wait([self, resumed, pending](boost::system::error_code) {
+      if (resumed->exchange(true)) {
+        return;
+      }
+      SPDLOG_DEBUG("cache lock timed out for {}",
+                   self->source_connection_info_.http_url);
+      self->forwardRequest(std::move(*pending));
+    });
+    // the leader completes the flight from its own thread.
+    flight->wait([self, resumed, pending,
+                  timer](std::shared_ptr<CacheEntry> entry) {
+      boost::asio::post(*self->io_context_ptr_, [self, resumed, pending, timer,
+                                                 entry = std::move(entry)] {
+        if (resumed->exchange(true)) {
+          return;
+        }
+        timer->cancel();
+        if (!entry) {
+          self->forwardRequest(std::move(*pending));
+          return;
+        }
+        self->writeCachedResponse(*entry);
+        self->async_accpet_cb_();
+      });
+    });
+  }
+
+  // refreshes the entry of cache_key_ from `target` without holding the
+  // handler, unless another request is already fetching it. the misses
+  // of the key wait for the refresh like for any other fetch.
+  void revalidateInBackground(const ConnectionInfo &target) {
+    if (target.address.empty()) {
+      return;
+    }
+    auto flight = cache_->start_flight(*cache_key_);
+    if (!flight) {
+      return;
+    }
+    std::shared_ptr<CircuitBreaker> breaker;
+    auto &registry = CircuitBreakerRegistry::instance();
+    if (registry.enabled()) {
+      breaker = target.upstream
+                    ? target.upstream->circuit_breaker()
+                    : registry.get_for_upstream(target.address, target.port);
+      if (!breaker->can_proceed()) {
+        cache_->finish_flight(*cache_key_, flight, nullptr);
+        return;
+      }
+    }
+    if (target.load_balancer) {
+      target.load_balancer->on_request_start(target.upstream);
+    }
+    SPDLOG_DEBUG("revalidating {} in the background", cache_key_->to_string());
+    auto exchange = std::make_shared<HttpExchange<T>>(
+        boost::asio::make_strand(*io_context_ptr_), target.address,
+        target.port, serializeRequest(target.address));
+    exchange->Start(
+        nullptr, [cache = cache_, key = *cache_key_, flight,
+                  policy = cache_policy_, stale = stale_entry_,
+                  load_balancer = target.load_balancer,
+                  upstream = target.upstream, breaker = std::move(breaker),
+                  start = std::chrono::steady_clock::now()](
+                     typename HttpExchange<T>::Result result) {
+          auto elapsed = std::chrono::steady_clock::now() - start;
+          if (load_balancer) {
+            load_balancer->on_request_complete(
+                upstream, elapsed, result.status != 0 && result.status < 500);
+          }
+          if (breaker) {
+            if (result.status == 0) {
+              breaker->record_failure();
+            } else {
+              breaker->record_response(
+                  result.status,
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                      elapsed));
+            }
+          }
+          std::shared_ptr<CacheEntry> entry;
+          if (result.status == 304 && stale && stale->revalidatable) {
+            entry = cache->refresh_entry(*stale, result.response, policy.get());
+          } else if (result.status != 0) {
+            entry = cache->create_cache_entry(std::move(result.response),
+                                              policy.get());
+          }
+          if (entry) {
+            cache->put(key, entry);
+          }
+          cache->finish_flight(key, flight, std::move(entry));
+        });
+  }
+
+  // answers with the stale entry kept for its stale-if-error window,
+  // returns false if there's none.
+  bool serveStaleOnError() {
+    if (!stale_entry_ || !stale_entry_->can_serve_if_error()) {
+      return false;
+    }
+    SPDLOG_DEBUG("upstream failed, serving stale {}", cache_key_->to_string());
+    cache_->record_stale_served();
+    writeCachedResponse(*stale_entry_);
+    stale_entry_.reset();
+    return true;
+  }
+
+  // a conditional request the entry satisfies gets its headers only. the
+  // rest is gathered from the entry's buffers without a copy, sliced to
+  // the range the request asks for.
+  inline void writeCachedResponse(const CacheEntry &entry) {
+    boost::system::error_code ec;
+    if (cache_->not_modified(entry, cache_request_headers_)) {
+      auto response = cache_->create_not_modified_response(entry);
+      boost::asio::write(*sock_ptr_, boost::asio::buffer(response), ec);
+    } else {
+      auto response = cache_->create_cached_response(
+          entry, std::string_view(request_.method, request_.method_len),
+          cache_request_headers_);
+      std::vector<boost::asio::const_buffer> buffers{
+          boost::asio::buffer(response.status_line),
+          boost::asio::buffer(response.fields),
+          boost::asio::buffer(response.extra_fields)};
+      if (!entry.disk_body) {
+        for (auto slice :
+             entry.body_slices(response.body_offset, response.body_length)) {
+          buffers.push_back(boost::asio::buffer(slice));
+        }
+      }
+      boost::asio::write(*sock_ptr_, buffers, ec);
+      if (!ec && entry.disk_body &&
+          !sendDiskBody(sock_ptr_,
+                        DiskBody{.segment = entry.disk_body->segment,
+                                 .offset = entry.disk_body->offset +
+                                           response.body_offset,
+                                 .length = response.body_length})) {
+        // the head promised a body that won't come, the client can only
+        // tell from the connection being closed.
+        SPDLOG_ERROR("write cached body failed");
+        Close();
+      }
+    }
+    if (ec) {
+      SPDLOG_ERROR("write cached response failed: {}", ec.message());
+    }
+  }
+
+  // stores the entry of the response sent to the client. the requests
+  // waiting for it are released either way.
+  void storeInCache(std::shared_ptr<CacheEntry> entry) {
+    if (!cache_key_) {
+      return;
+    }
+    if (entry) {
+      cache_->put(*cache_key_, entry);
+    }
+    finishCacheFlight(std::move(entry));
+  }
+
+  inline void finishCacheFlight(std::shared_ptr<CacheEntry> entry) {
+    if (cache_flight_) {
+      cache_->finish_flight(*cache_key_, cache_flight_, std::move(entry));
+      cache_flight_.reset();
+    }
+  }
+
+  // the response of the upstream as a cache entry, which takes it over.
+  // null, leaving the response alone, if it must not be cached.
+  std::shared_ptr<CacheEntry> cacheableResponse() {
+    if (!cache_key_ || upstream_status_ == 0 || response_str_.empty()) {
+      return nullptr;
+    }
+    auto entry =
+        cache_->create_cache_entry(std::move(response_str_), cache_policy_.get());
+    if (entry) {
+      response_str_.clear();
+    }
+    return entry;
+  }
+
+  // hedging needs the whole request at hand to send it twice, and only
+  // a request that can't do harm when it's handled twice is hedged.
+  inline bool hedgeableRequest() const {
+    return hedging_ && load_balancer_ && upstream_ && idempotentRequest() &&
+           request_content_length_ <= extra_body_len_;
+  }
+
+  // proxies the request with a hedge instead of proxyHttpRequest(). the
+  // concurrency limiter is bypassed, the latency of the copies cancelled
+  // halfway would skew its samples.
+  void hedgeHttpRequest() {
+    upstream_attempted_ = true;
+    auto hedged = std::make_shared<HedgedHttpRequest<T>>(
+        *io_context_ptr_, hedging_, load_balancer_,
+        source_connection_info_.address, requestView(),
+        [self = this->shared_from_this()](const std::string &target_host) {
+          return self->serializeRequest(target_host);
+        });
+    hedged->Start(
+        upstream_, std::move(circuit_breaker_),
+        [self = this->shared_from_this()](
+            typename HedgedHttpRequest<T>::Outcome outcome) {
+          self->onHedgedResponse(std::move(outcome));
+        });
+  }
+
+  // the load balancer and the breakers already have the outcome of every
+  // copy, what's left is retrying or answering.
+  void onHedgedResponse(typename HedgedHttpRequest<T>::Outcome outcome) {
+    upstream_ = std::move(outcome.upstream);
+    upstream_failure_ = outcome.failure;
+    upstream_status_ = outcome.status;
+    response_str_ = std::move(outcome.response);
+    if (!retryHttpRequest()) {
+      finishHttpRequest();
+    }
+  }
+
+  // the request as sent to the upstream at `target_host`, header and
+  // body, the latter must have been read along with the header.
+  std::string serializeRequest(const std::string &target_host) {
+    auto http_verb =
+        stringToVerb(std::string(request_.method, request_.method_len));
+    std::ostringstream ss;
+    ss << upstreamRequest(*http_verb, target_host);
+    auto request = ss.str();
+    request.append(request_.header_buf + total_parsed_,
+                   request_content_length_);
+    return request;
+  }
+
+  // the request header as sent to the upstream at `target_host`.
+  boost::beast::http::request<boost::beast::http::empty_body>
+  upstreamRequest(boost::beast::http::verb http_verb,
+                  const std::string &target_host) {
+    namespace http = boost::beast::http;
+    http::request<http::empty_body> req{http_verb, target_url_, 11};
+    // rewirte headers field.
+    for (size_t i = 0; i < request_.num_headers; ++i) {
+      auto &header = request_.headers[i];
+      auto header_name = std::string(header.name, header.name_len);
+      auto lower_header_name = utils::toLower(header_name);
+      if (lower_header_name == CRequest::kHeaderFieldConnection) {
+        continue;
+      }
+      if (lower_header_name == CRequest::kHeaderFieldHost ||
+          lower_header_name == CRequest::kHeaderFieldReferer ||
+          lower_header_name == CRequest::kHeaderFieldAcceptEncoding ||
+          lower_header_name == CRequest::kHeaderFieldAccept ||
+          lower_header_name.find("sec-") != std::string::npos) {
+        continue;
+      }
+      req.set(header_name, std::string(header.value, header.value_len));
+    }
+    // the whole response is fetched for the cache, the range is cut from
+    // the entry.
+    if (cache_key_) {
+      req.erase(http::field::range);
+      req.erase(http::field::if_range);
+    }
+    // in slice mode only the slice is asked for, unconditionally.
+    if (sliced_ && cache_key_ && cache_key_->slice) {
+      auto first = *cache_key_->slice * sliced_->slice_size;
+      req.erase(http::field::if_none_match);
+      req.erase(http::field::if_modified_since);
+      req.set(http::field::range,
+              fmt::format("bytes={}-{}", first, first + sliced_->slice_size - 1));
+    }
+    // the cache's validators replace the client's, whose own are checked
+    // against the entry the upstream confirms.
+    if (stale_entry_ && stale_entry_->revalidatable) {
+      req.erase(http::field::if_none_match);
+      req.erase(http::field::if_modified_since);
+      if (!stale_entry_->etag.empty()) {
+        req.set(http::field::if_none_match, stale_entry_->etag);
+      }
+      if (!stale_entry_->last_modified.empty()) {
+        req.set(http::field::if_modified_since, stale_entry_->last_modified);
+      }
+    }
+    req.set(http::field::connection, CRequest::kConnectionClose);
+    req.set(http::field::host, target_host);
+    if (!source_connection_info_.host.empty()) {
+      req.set(std::string(CRequest::kHeaderFieldXForwardedHost),
+              source_connection_info_.host);
+    }
+    return req;
+  }
+
+  // one attempt: sends the request to the upstream and reads its response
+  // into response_str_. a failure is left in upstream_failure_.
   void handleHttpRequest(std::string &&target_host, uint16_t &&target_port) {
     namespace beast = boost::beast;
     namespace http = beast::http;
@@ -621,12 +1617,13 @@ public:
         std::is_same_v<T,
                        boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>;
     // proxy request to target.
+    upstream_attempted_ = true;
     tcp::resolver resolver(*io_context_ptr_);
     auto results =
         resolver.resolve(target_host, std::to_string(target_port), ec);
     if (ec) {
       SPDLOG_ERROR("resolver failed: {}", ec.message());
-      async_accpet_cb_();
+      upstream_failure_ = UpstreamFailure::kConnectFailure;
       return;
     }
     boost::shared_ptr<T> stream;
@@ -639,13 +1636,13 @@ public:
       net::connect(beast::get_lowest_layer(*stream), results, ec);
       if (ec) {
         SPDLOG_ERROR("SSL connect failed: {}", ec.message());
-        async_accpet_cb_();
+        upstream_failure_ = UpstreamFailure::kConnectFailure;
         return;
       }
       stream->handshake(ssl::stream_base::client, ec);
       if (ec) {
         SPDLOG_ERROR("SSL handshake failed: {}", ec.message());
-        async_accpet_cb_();
+        upstream_failure_ = UpstreamFailure::kConnectFailure;
         return;
       }
     } else {
@@ -653,7 +1650,7 @@ public:
       boost::asio::connect(*stream, results, ec);
       if (ec) {
         SPDLOG_ERROR("TCP connect failed: {}", ec.message());
-        async_accpet_cb_();
+        upstream_failure_ = UpstreamFailure::kConnectFailure;
         return;
       }
     }
@@ -662,34 +1659,15 @@ public:
     auto http_verb = stringToVerb(method_string);
     if (!http_verb) {
       SPDLOG_ERROR("unknown HTTP method: {}", method_string);
-      async_accpet_cb_();
+      upstream_attempted_ = false;
       return;
     }
-    http::request<http::empty_body> req{*http_verb, target_url_, 11};
-    // rewirte headers field.
-    for (size_t i = 0; i < request_.num_headers; ++i) {
-      auto &header = request_.headers[i];
-      auto header_name = std::string(header.name, header.name_len);
-      auto lower_header_name = utils::toLower(header_name);
-      if (lower_header_name == CRequest::kHeaderFieldConnection) {
-        continue;
-      }
-      if (lower_header_name == CRequest::kHeaderFieldHost ||
-          lower_header_name == CRequest::kHeaderFieldReferer ||
-          lower_header_name == CRequest::kHeaderFieldAcceptEncoding ||
-          lower_header_name == CRequest::kHeaderFieldAccept ||
-          lower_header_name.find("sec-") != std::string::npos) {
-        continue;
-      }
-      req.set(header_name, std::string(header.value, header.value_len));
-    }
-    req.set(http::field::connection, CRequest::kConnectionClose);
-    req.set(http::field::host, target_host);
+    auto req = upstreamRequest(*http_verb, target_host);
     http::serializer<true, http::empty_body> sr(req);
     http::write_header(*stream, sr, ec);
     if (ec) {
       SPDLOG_ERROR("write header failed: {}", ec.message());
-      async_accpet_cb_();
+      upstream_failure_ = UpstreamFailure::kReset;
       return;
     }
 
@@ -706,7 +1684,7 @@ public:
           *stream, boost::asio::buffer(*src_read_buffer, extra_body_len_), ec);
       if (ec) {
         SPDLOG_ERROR("error writing body to target: {}", ec.message());
-        async_accpet_cb_();
+        upstream_failure_ = UpstreamFailure::kReset;
         return;
       }
     }
@@ -720,39 +1698,33 @@ public:
         break;
       } else if (ec) {
         SPDLOG_ERROR("error reading body from client: {}", ec.message());
-        async_accpet_cb_();
+        // not the upstream's fault.
+        upstream_attempted_ = false;
         return;
       }
       boost::asio::write(*stream, boost::asio::buffer(*src_read_buffer, n), ec);
       if (ec) {
         SPDLOG_ERROR("error writing body to target: {}", ec.message());
-        async_accpet_cb_();
+        upstream_failure_ = UpstreamFailure::kReset;
         return;
       }
     }
 
-    std::string response_str;
     beast::flat_buffer response_buffer;
     http::response_parser<http::dynamic_body> parser;
     parser.body_limit(kMaxBodyBufferSize);
     http::read(*stream, response_buffer, parser, ec);
     if (ec && ec != boost::beast::http::error::end_of_stream) {
       SPDLOG_ERROR("http read failed: {}", ec.message());
-      async_accpet_cb_();
+      upstream_failure_ = UpstreamFailure::kReset;
       return;
     }
     auto res = parser.get();
+    upstream_status_ = res.result_int();
+    // kept until the attempt is known not to be retried.
     std::stringstream ss;
     ss << res;
-    response_str = ss.str();
-
-    // send back the reponse (header & body) from the target.
-    boost::asio::write(*sock_ptr_, boost::asio::buffer(response_str), ec);
-    if (ec) {
-      SPDLOG_ERROR("write back to client failed: {}", ec.message());
-      async_accpet_cb_();
-      return;
-    }
+    response_str_ = ss.str();
 
     // close connection.
     // TODO: gracefully shutdown.
@@ -761,7 +1733,6 @@ public:
     //     ec.message() != "Socket is not connected") {
     //   SPDLOG_WARN("shutdown failed: {}", ec.message());
     // }
-    async_accpet_cb_();
   }
 
   void handleWebSocketRequest(std::string &&target_host,
@@ -793,6 +1764,7 @@ public:
       }
 
       // connect to target.
+      upstream_attempted_ = true;
       tcp::resolver resolver(*io_context_ptr_);
       auto results =
           resolver.resolve(target_host, std::to_string(target_port), ec);
@@ -817,6 +1789,8 @@ public:
         async_accpet_cb_();
         return;
       }
+      upstream_status_ =
+          static_cast<int>(boost::beast::http::status::switching_protocols);
 
       // handle bi-direction connection.
       auto source_data_buffer = boost::make_shared<boost::beast::flat_buffer>();
@@ -993,6 +1967,28 @@ public:
     }
   }
 
+  void sendServiceUnavailableResponse() {
+    // a sliced response already under way can only be cut short.
+    if (sliced_ && sliced_->head_written) {
+      return;
+    }
+    using namespace boost::beast;
+    boost::system::error_code ec;
+    http::response<http::string_body> err_unavailable_resp{
+        http::status::service_unavailable, 11};
+    err_unavailable_resp.set(http::field::content_type, "text/html");
+    err_unavailable_resp.body() =
+        "<html><head><title>503 Service Unavailable</title></head><body><h1>"
+        "503 Service Unavailable</h1><p>The upstream server is overloaded, "
+        "please retry later.</p></body></html>";
+    err_unavailable_resp.prepare_payload();
+
+    http::write(*sock_ptr_, err_unavailable_resp, ec);
+    if (ec) {
+      SPDLOG_WARN("failed to write 503 response: {}", ec.message());
+    }
+  }
+
   void Close() {
     if (sock_ptr_ && sock_ptr_->lowest_layer().is_open()) {
       boost::system::error_code ec;
@@ -1029,6 +2025,67 @@ private:
   size_t request_content_length_;
   ConnectionInfo source_connection_info_;
   bool isWebSocket_;
+  std::shared_ptr<TokenBucketRateLimiter> rate_limiter_ptr_;
+  // owns the rate limiter key when it's not a view of the request.
+  std::string rate_limit_key_;
+  // status code of the upstream response, 0 if none was received.
+  int upstream_status_ = 0;
+  // picked by the route's load balancer, if any.
+  std::shared_ptr<LoadBalancer> load_balancer_;
+  std::shared_ptr<UpstreamServer> upstream_;
+  // a websocket session counts as a connection of upstream_ until the
+  // handler is gone.
+  bool upstream_stream_open_ = false;
+  // admitted the request, until its outcome is recorded.
+  std::shared_ptr<CircuitBreaker> circuit_breaker_;
+  // set once the upstream was contacted.
+  bool upstream_attempted_ = false;
+  // why the last attempt failed, if it did.
+  UpstreamFailure upstream_failure_ = UpstreamFailure::kNone;
+  // response of the last attempt, sent once the request is done.
+  std::string response_str_;
+  // retries of the route, null if it has none.
+  std::shared_ptr<const RetryPolicy> retry_policy_;
+  int num_retries_ = 0;
+  // holds a slot of the retry budget until the retry completed.
+  bool retry_in_flight_ = false;
+  bool counted_by_retry_budget_ = false;
+  std::unique_ptr<boost::asio::steady_timer> retry_timer_;
+  // concurrency limiter slot held by the current attempt, if any.
+  std::shared_ptr<ConcurrencyLimiter> limiter_;
+  // hedging of the route, null if its requests aren't hedged.
+  std::shared_ptr<RouteHedging> hedging_;
+  // set when the response of a cache miss is to be stored.
+  std::shared_ptr<HttpCache> cache_;
+  std::optional<CacheKey> cache_key_;
+  // set while the response of the miss is awaited by the other misses of
+  // the same key.
+  std::shared_ptr<CacheFlight> cache_flight_;
+  // cache settings of the route, null to use the cache's own.
+  std::shared_ptr<const RouteCachePolicy> cache_policy_;
+  // expired entry of the key, revalidated with the upstream and standing
+  // in for a failed response if its windows allow it.
+  std::shared_ptr<CacheEntry> stale_entry_;
+  // request headers as the cache sees them, for the client's validators.
+  std::unordered_map<std::string, std::string> cache_request_headers_;
+  // slice mode: the response is written a slice of the object at a time,
+  // each from the cache or fetched with a Range of its own.
+  struct SlicedResponse {
+    ConnectionInfo target;
+    // of the whole object, the slices have CacheKey::slice set.
+    CacheKey key;
+    uint64_t slice_size = 0;
+    // next byte of the object to write, and one past the last one once
+    // the head is written.
+    uint64_t next = 0;
+    uint64_t end = 0;
+    bool head_written = false;
+    // of the first slice, the others must be of the same object.
+    uint64_t object_size = 0;
+    std::string etag;
+    std::string last_modified;
+  };
+  std::unique_ptr<SlicedResponse> sliced_;
 };
 
 void TcpProxyHandler(
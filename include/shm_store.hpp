@@ -0,0 +1,83 @@
+#ifndef __SHM_STORE_H
+#define __SHM_STORE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace azugate {
+
+constexpr size_t kDftSharedRateLimiterSlots = 64 * 1024;
+// slots probed before an idle one is recycled.
+constexpr size_t kSharedRateLimiterMaxProbes = 16;
+
+// host wide counters kept next to the rate limiter state.
+enum SharedCounter : size_t {
+  kSharedCounterAllowed = 0,
+  kSharedCounterRejected,
+  kNumSharedCounters,
+};
+
+// GCRA state shared by all the gateway processes of a host through a
+// MAP_SHARED mapping of a file (put it on /dev/shm to keep it in memory).
+// the table is an open addressing hash of 64-bit key hashes, every slot is
+// claimed and updated with CAS only, so a process dying in the middle of
+// an update never leaves a lock behind. when all the probed slots are
+// taken, the one with the oldest TAT is recycled if it is idle (its
+// bucket is full again), otherwise the request is let through the local
+// limiter only.
+// steady_clock is CLOCK_MONOTONIC on Linux, which all the processes of a
+// host share, so TATs written by one process are valid for the others.
+class SharedRateLimitTable {
+public:
+  SharedRateLimitTable() = default;
+  ~SharedRateLimitTable();
+  SharedRateLimitTable(const SharedRateLimitTable &) = delete;
+  SharedRateLimitTable &operator=(const SharedRateLimitTable &) = delete;
+
+  // create or attach to `path`. the first process sizes and initializes
+  // the file under flock(), later ones reuse its geometry.
+  bool Open(const std::string &path, size_t num_slots,
+            int64_t emission_interval, int64_t burst_tolerance);
+
+  bool IsOpen() const { return header_ != nullptr; }
+
+  // returns false if the key has to wait, `retry_after` is then set.
+  // if no slot can be claimed the request is allowed and `tracked` false.
+  bool Acquire(uint64_t key_hash, int64_t now, int64_t emission_interval,
+               int64_t burst_tolerance, std::chrono::nanoseconds &retry_after,
+               bool &tracked);
+
+  void AddCounter(SharedCounter counter, uint64_t delta);
+  uint64_t LoadCounter(SharedCounter counter) const;
+
+private:
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    int64_t emission_interval;
+    int64_t burst_tolerance;
+    std::atomic<uint64_t> counters[kNumSharedCounters];
+  };
+
+  struct Slot {
+    // 0 means free.
+    std::atomic<uint64_t> key_hash;
+    std::atomic<int64_t> tat;
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                    std::atomic<int64_t>::is_always_lock_free,
+                "shared memory slots need lock-free 64-bit atomics");
+
+  Header *header_ = nullptr;
+  Slot *slots_ = nullptr;
+  size_t mapped_size_ = 0;
+};
+
+} // namespace azugate
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __SLIDING_WINDOW_H
+#define __SLIDING_WINDOW_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace azugate {
+
+constexpr size_t kDftSlidingWindowBuckets = 10;
+
+// request outcomes over the last `window`, split in buckets that are
+// recycled as time goes by. recording and summing never take a lock: the
+// first writer that finds a bucket of an older epoch claims it with CAS
+// and clears it. a record racing with the clear may get lost, which is
+// fine for statistics.
+class SlidingWindow {
+public:
+  struct Totals {
+    uint64_t successes = 0;
+    uint64_t failures = 0;
+    // sum and count of the recorded latencies.
+    uint64_t latency_ns = 0;
+    uint64_t num_latencies = 0;
+
+    uint64_t Requests() const { return successes + failures; }
+    double SuccessRate() const;
+    double FailureRate() const;
+    // 0 without samples.
+    double MeanLatencyNs() const;
+  };
+
+  explicit SlidingWindow(std::chrono::nanoseconds window,
+                         size_t num_buckets = kDftSlidingWindowBuckets);
+
+  // a negative `latency` records no latency sample, e.g. for failures or
+  // long lived streams.
+  void Record(bool success, std::chrono::nanoseconds latency, int64_t now_ns);
+
+  Totals Sum(int64_t now_ns) const;
+
+  void Reset();
+
+  std::chrono::nanoseconds Window() const {
+    return std::chrono::nanoseconds(bucket_width_ns_ * num_buckets_);
+  }
+
+private:
+  struct Bucket {
+    // index of the bucket width the counts belong to, -1 if unused.
+    std::atomic<int64_t> epoch{-1};
+    std::atomic<uint64_t> successes{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> latency_ns{0};
+    std::atomic<uint64_t> num_latencies{0};
+  };
+
+  Bucket &bucketFor(int64_t epoch);
+
+  int64_t bucket_width_ns_;
+  size_t num_buckets_;
+  std::unique_ptr<Bucket[]> buckets_;
+};
+
+} // namespace azugate
+
+#endif
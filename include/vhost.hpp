@@ -0,0 +1,65 @@
+#ifndef __VHOST_H
+#define __VHOST_H
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace azugate {
+
+// lower-case the Host/:authority value, strip the port (IPv6 literals keep
+// their brackets) and drop the trailing dot of fully-qualified names.
+// returns an empty string for malformed input.
+std::string NormalizeHost(std::string_view authority);
+
+// heterogeneous lookup so that string_view keys don't allocate.
+struct TransparentStringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view sv) const {
+    return std::hash<std::string_view>{}(sv);
+  }
+};
+
+// maps a normalized host name to a virtual host id.
+// - exact names ("api.example.com") live in a hash table.
+// - wildcard names ("*.example.com") live in a trie keyed by labels in
+//   reversed order (com -> example), the deepest wildcard wins.
+// exact matches always take precedence over wildcard ones, the same
+// order as Nginx's server_name.
+class VirtualHostIndex {
+public:
+  VirtualHostIndex();
+
+  // returns false if the pattern is malformed or already registered.
+  bool Insert(std::string_view pattern, size_t id);
+
+  // `host` must be normalized by NormalizeHost().
+  std::optional<size_t> Lookup(std::string_view host) const;
+
+  void Clear();
+
+  size_t Size() const { return num_entries_; }
+
+private:
+  struct TrieNode {
+    std::unordered_map<std::string, size_t, TransparentStringHash,
+                       std::equal_to<>>
+        children;
+    std::optional<size_t> wildcard_id;
+  };
+
+  std::unordered_map<std::string, size_t, TransparentStringHash,
+                     std::equal_to<>>
+      exact_;
+  // nodes_[0] is the root.
+  std::vector<TrieNode> nodes_;
+  size_t num_entries_;
+};
+
+} // namespace azugate
+
+#endif
@@ -4,6 +4,12 @@
 #include "worker.hpp"
 #include "http_cache.hpp"
 #include "config_manager.hpp"
+#include "hedging.hpp"
+#include "circuit_breaker.hpp"
+#include "concurrency_limiter.hpp"
+#include "ip_filter.hpp"
+#include "rate_limiter.h"
+#include "retry_policy.hpp"
 #include <cxxopts.hpp>
 #include <spdlog/spdlog.h>
 #include <string>
@@ -22,6 +28,31 @@ void signal_handler(int signum) {
   g_shutdown_requested.store(true);
 }
 
+// Applies the rate_limiter section to the globals the limiter is built from,
+// false if the key spec is invalid
+bool apply_rate_limiter_config(const YAML::Node &config) {
+  using namespace azugate;
+  const auto &rate_limiter = config["rate_limiter"];
+  if (!rate_limiter) {
+    return true;
+  }
+  RateLimitKey key;
+  auto key_spec = rate_limiter["key"].as<std::string>("client_ip");
+  if (!ParseRateLimitKey(key_spec, key)) {
+    SPDLOG_ERROR("Invalid rate_limiter.key: {}", key_spec);
+    return false;
+  }
+  SetEnableRateLimitor(rate_limiter["enabled"].as<bool>(false));
+  ConfigRateLimitor(rate_limiter["burst_size"].as<size_t>(0),
+                    rate_limiter["requests_per_second"].as<size_t>(0));
+  SetRateLimitorKey(key_spec);
+  if (rate_limiter["shared_memory"]) {
+    SetRateLimitorSharedMemory(
+        rate_limiter["shared_memory"]["path"].as<std::string>(""));
+  }
+  return true;
+}
+
 // TODO:
 // ref: https://www.envoyproxy.io/docs/envoy/latest/start/sandboxes.
 // memmory pool optimaization.
@@ -126,6 +157,81 @@ int main(int argc, char *argv[]) {
     return -1;
   }
   
+  // Upstream circuit breakers, loaded before the routes so the load
+  // balanced servers get their breakers with the configured defaults
+  if (!CircuitBreakerRegistry::instance().load_from_config(
+          config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load circuit breakers. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "circuit_breaker", [](const YAML::Node &new_config) {
+        CircuitBreakerRegistry::instance().load_from_config(new_config);
+      });
+
+  // HTTP response cache consulted by the proxy, off without a cache section
+  if (!HttpCacheManager::instance().load_from_config(
+          config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load HTTP cache. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "http_cache", [](const YAML::Node &new_config) {
+        HttpCacheManager::instance().load_from_config(new_config);
+      });
+
+  // IP allow/deny lists, rebuilt whenever the config file is reloaded
+  if (!IpFilter::Instance().LoadFromConfig(config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load IP filter. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "ip_filter", [](const YAML::Node &new_config) {
+        IpFilter::Instance().LoadFromConfig(new_config);
+      });
+
+  // Adaptive concurrency limits per upstream
+  if (!ConcurrencyLimiterRegistry::Instance().LoadFromConfig(
+          config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load concurrency limiter. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "concurrency_limiter", [](const YAML::Node &new_config) {
+        ConcurrencyLimiterRegistry::Instance().LoadFromConfig(new_config);
+      });
+
+  // Global retry budget, the retry policies themselves belong to the routes
+  if (!RetryBudget::Instance().LoadFromConfig(config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load retry budget. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "retry_budget", [](const YAML::Node &new_config) {
+        RetryBudget::Instance().LoadFromConfig(new_config);
+      });
+
+  // Global hedge budget, the hedge policies belong to the routes as well
+  if (!HedgeBudget::Instance().LoadFromConfig(config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load hedge budget. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "hedge_budget", [](const YAML::Node &new_config) {
+        HedgeBudget::Instance().LoadFromConfig(new_config);
+      });
+
+  // Active health checks: probe concurrency and jitter
+  if (!HealthCheckScheduler::Instance().LoadFromConfig(
+          config_manager.get_config())) {
+    SPDLOG_ERROR("Failed to load health checks. Exiting.");
+    return -1;
+  }
+  config_manager.register_change_callback(
+      "health_checks", [](const YAML::Node &new_config) {
+        HealthCheckScheduler::Instance().LoadFromConfig(new_config);
+      });
+
   // Enable hot-reload if specified
   if (parsed_opts.count("hot-reload") && parsed_opts["hot-reload"].as<bool>()) {
       config_manager.enable_hot_reload(true);
@@ -134,6 +240,9 @@ int main(int argc, char *argv[]) {
   // Apply initial configuration from manager
   const auto& initial_config = config_manager.get_config();
   g_azugate_port = initial_config["server"]["port"].as<uint16_t>(8080);
+  if (!apply_rate_limiter_config(initial_config)) {
+    return -1;
+  }
   
   // Apply command-line overrides
   if (parsed_opts.count("port")) {
@@ -156,6 +265,14 @@ int main(int argc, char *argv[]) {
                        parsed_opts["rate-limit-per-sec"].as<size_t>());
     }
   }
+
+  // Register routes (and their virtual hosts) declared in the config file,
+  // once the port the file servers are reached on is known
+  LoadRoutesFromConfig(initial_config);
+  config_manager.register_change_callback(
+      "routes", [](const YAML::Node &new_config) {
+        LoadRoutesFromConfig(new_config);
+      });
   
   // Handle file proxy mode
   bool enable_file_proxy = parsed_opts["enable-file-proxy"].as<bool>();
@@ -234,32 +351,36 @@ int main(int argc, char *argv[]) {
   
   auto io_context_ptr = boost::make_shared<boost::asio::io_context>();
   
-  // Initialize HTTP cache system
-  HttpCacheConfig cache_config;
-  cache_config.max_size_bytes = 100 * 1024 * 1024;  // 100MB cache
-  cache_config.max_entries = 10000;
-  cache_config.default_ttl = std::chrono::seconds(300);  // 5 minutes
-  cache_config.respect_cache_control = true;
-  cache_config.enable_conditional_requests = true;
-  
-  HttpCacheManager::instance().initialize(cache_config);
-  SPDLOG_INFO("HTTP cache initialized with {}MB capacity", cache_config.max_size_bytes / (1024 * 1024));
-
-  // Set up signal handlers for graceful shutdown
-  std::signal(SIGINT, signal_handler);
-  std::signal(SIGTERM, signal_handler);
+  // Set up signal handlers for graceful shutdown: the workers return from
+  // Run() and the HTTP cache writes its snapshot
+  boost::asio::signal_set signals(*io_context_ptr, SIGINT, SIGTERM);
 #ifdef _WIN32
-  std::signal(SIGBREAK, signal_handler);
+  signals.add(SIGBREAK);
 #else
-  std::signal(SIGQUIT, signal_handler);
-  std::signal(SIGHUP, signal_handler);
+  signals.add(SIGQUIT);
+  signals.add(SIGHUP);
 #endif
+  signals.async_wait(
+      [io_context_ptr](const boost::system::error_code &ec, int signum) {
+        if (ec) {
+          return;
+        }
+        signal_handler(signum);
+        io_context_ptr->stop();
+      });
 
   SPDLOG_INFO("Signal handlers installed for graceful shutdown");
 
   StartHealthCheckWorker(io_context_ptr);
 
   Server s(io_context_ptr, g_azugate_port);
+  // The limiter belongs to the server, its callback goes away with it
+  config_manager.register_change_callback(
+      "rate_limiter", [&s](const YAML::Node &new_config) {
+        if (apply_rate_limiter_config(new_config)) {
+          s.ReloadRateLimiter();
+        }
+      });
   SPDLOG_INFO("AzuGate v1.0.0 started successfully!");
   SPDLOG_INFO("Dashboard: http://localhost:{}/dashboard", g_azugate_port);
   SPDLOG_INFO("Health: http://localhost:{}/health", g_azugate_port);
@@ -268,8 +389,10 @@ int main(int argc, char *argv[]) {
   SPDLOG_INFO("Press Ctrl+C for graceful shutdown");
 
   s.Run(io_context_ptr);
+  config_manager.unregister_change_callback("rate_limiter");
 
   SPDLOG_WARN("server exits");
+  HttpCacheManager::instance().shutdown();
 
   return 0;
 }
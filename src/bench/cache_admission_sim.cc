@@ -0,0 +1,237 @@
+// trace-driven comparison of the admission policies of the HTTP cache.
+// replays a request log against a plain LRU, the real HttpCache with
+// admission off (SIEVE alone) and with W-TinyLFU, at several cache sizes,
+// and prints the hit ratio of each. the trace has one request per line,
+// either a bare key or a common log format line whose request path is
+// used, `#` starts a comment. without a trace, a zipf workload mixed with
+// scans of one-off keys is generated.
+#include "http_cache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cxxopts.hpp>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace azugate;
+
+namespace {
+
+struct Trace {
+  std::vector<std::string> keys;
+  // index into `keys` of every request.
+  std::vector<uint32_t> requests;
+};
+
+// the key of a log line, empty to skip it.
+std::string parse_line(const std::string &line) {
+  auto start = line.find_first_not_of(" \t");
+  if (start == std::string::npos || line[start] == '#') {
+    return {};
+  }
+  // common log format: ... "GET /path HTTP/1.1" ...
+  auto quote = line.find('"', start);
+  if (quote != std::string::npos) {
+    std::istringstream request(line.substr(quote + 1));
+    std::string method, path;
+    request >> method >> path;
+    return path.empty() ? std::string{} : method + " " + path;
+  }
+  auto end = line.find_first_of(" \t", start);
+  return line.substr(start, end == std::string::npos ? end : end - start);
+}
+
+bool load_trace(const std::string &path, size_t limit, Trace &trace) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::unordered_map<std::string, uint32_t> ids;
+  std::string line;
+  while ((limit == 0 || trace.requests.size() < limit) &&
+         std::getline(file, line)) {
+    auto key = parse_line(line);
+    if (key.empty()) {
+      continue;
+    }
+    auto [it, inserted] =
+        ids.emplace(key, static_cast<uint32_t>(trace.keys.size()));
+    if (inserted) {
+      trace.keys.push_back(std::move(key));
+    }
+    trace.requests.push_back(it->second);
+  }
+  return true;
+}
+
+// zipf(0.9) popularity over `num_keys` keys. every 20th block of 1000
+// requests is a scan of keys that are never requested again, like a
+// crawler walking the site.
+Trace generate_trace(size_t num_requests, size_t num_keys, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<double> cdf(num_keys);
+  double sum = 0;
+  for (size_t i = 0; i < num_keys; ++i) {
+    sum += 1.0 / std::pow(static_cast<double>(i + 1), 0.9);
+    cdf[i] = sum;
+  }
+  std::uniform_real_distribution<double> uniform(0, sum);
+  Trace trace;
+  for (size_t i = 0; i < num_keys; ++i) {
+    trace.keys.push_back("GET /objects/" + std::to_string(i));
+  }
+  trace.requests.reserve(num_requests);
+  size_t num_scans = 0;
+  while (trace.requests.size() < num_requests) {
+    bool scan = trace.requests.size() / 1000 % 20 == 19;
+    if (scan) {
+      trace.requests.push_back(static_cast<uint32_t>(trace.keys.size()));
+      trace.keys.push_back("GET /crawl/" + std::to_string(num_scans++));
+      continue;
+    }
+    auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+                cdf.begin();
+    trace.requests.push_back(
+        static_cast<uint32_t>(std::min<size_t>(rank, num_keys - 1)));
+  }
+  return trace;
+}
+
+double simulate_lru(const Trace &trace, size_t capacity) {
+  std::list<uint32_t> order;
+  std::unordered_map<uint32_t, std::list<uint32_t>::iterator> index;
+  size_t hits = 0;
+  for (auto id : trace.requests) {
+    auto it = index.find(id);
+    if (it != index.end()) {
+      order.splice(order.begin(), order, it->second);
+      ++hits;
+      continue;
+    }
+    if (index.size() >= capacity) {
+      index.erase(order.back());
+      order.pop_back();
+    }
+    order.push_front(id);
+    index.emplace(id, order.begin());
+  }
+  return static_cast<double>(hits) / trace.requests.size();
+}
+
+struct CacheResult {
+  double hit_ratio;
+  uint64_t rejections;
+};
+
+CacheResult simulate_cache(const Trace &trace,
+                           const std::vector<CacheKey> &keys,
+                           size_t capacity, size_t num_shards,
+                           CacheAdmission admission) {
+  HttpCacheConfig config;
+  config.max_entries = capacity;
+  config.max_size_bytes = SIZE_MAX / 2;
+  config.num_shards = num_shards;
+  config.admission = admission;
+  HttpCache cache(config);
+  auto expires_at = std::chrono::steady_clock::now() + std::chrono::hours(1);
+  size_t hits = 0;
+  for (auto id : trace.requests) {
+    if (cache.get(keys[id])) {
+      ++hits;
+      continue;
+    }
+    auto entry = std::make_shared<CacheEntry>();
+    entry->expires_at = expires_at;
+    entry->size_bytes = 1;
+    cache.put(keys[id], std::move(entry));
+  }
+  return CacheResult{
+      .hit_ratio = static_cast<double>(hits) / trace.requests.size(),
+      .rejections = cache.get_stats().admission_rejections.load(),
+  };
+}
+
+std::vector<size_t> parse_sizes(const std::string &spec) {
+  std::vector<size_t> sizes;
+  std::istringstream stream(spec);
+  std::string size;
+  while (std::getline(stream, size, ',')) {
+    if (!size.empty()) {
+      sizes.push_back(std::stoul(size));
+    }
+  }
+  return sizes;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options opts("cache_admission_sim",
+                        "Compare the hit ratio of LRU, SIEVE and W-TinyLFU "
+                        "on a request trace");
+  opts.add_options()
+      ("t,trace", "Request log to replay, generated when empty", cxxopts::value<std::string>()->default_value(""))
+      ("c,sizes", "Cache sizes in entries, comma separated", cxxopts::value<std::string>()->default_value("500,2000,8000,32000"))
+      ("n,requests", "Number of requests, 0 replays the whole trace", cxxopts::value<size_t>()->default_value("1000000"))
+      ("k,keys", "Distinct keys of the generated trace", cxxopts::value<size_t>()->default_value("100000"))
+      ("shards", "Shards of the HTTP cache", cxxopts::value<size_t>()->default_value("16"))
+      ("s,seed", "Random seed", cxxopts::value<uint64_t>()->default_value("42"))
+      ("h,help", "Print usage");
+  auto parsed_opts = opts.parse(argc, argv);
+  if (parsed_opts.count("help")) {
+    std::cout << opts.help() << std::endl;
+    return 0;
+  }
+  auto trace_path = parsed_opts["trace"].as<std::string>();
+  auto sizes = parse_sizes(parsed_opts["sizes"].as<std::string>());
+  auto num_requests = parsed_opts["requests"].as<size_t>();
+  auto num_shards = parsed_opts["shards"].as<size_t>();
+
+  Trace trace;
+  if (trace_path.empty()) {
+    trace = generate_trace(num_requests == 0 ? 1000000 : num_requests,
+                           std::max<size_t>(1, parsed_opts["keys"].as<size_t>()),
+                           parsed_opts["seed"].as<uint64_t>());
+  } else if (!load_trace(trace_path, num_requests, trace)) {
+    std::cerr << "failed to open " << trace_path << std::endl;
+    return 1;
+  }
+  if (trace.requests.empty() || sizes.empty()) {
+    std::cerr << "nothing to replay" << std::endl;
+    return 1;
+  }
+
+  spdlog::set_level(spdlog::level::warn);
+  std::vector<CacheKey> keys;
+  keys.reserve(trace.keys.size());
+  for (const auto &name : trace.keys) {
+    CacheKey key;
+    key.method = "GET";
+    key.url = name;
+    key.finalize();
+    keys.push_back(std::move(key));
+  }
+
+  std::printf("trace=%s requests=%zu keys=%zu shards=%zu\n",
+              trace_path.empty() ? "generated" : trace_path.c_str(),
+              trace.requests.size(), trace.keys.size(), num_shards);
+  std::printf("%10s %9s %9s %11s %12s\n", "entries", "lru", "sieve",
+              "w-tinylfu", "rejections");
+  for (auto size : sizes) {
+    auto lru = simulate_lru(trace, size);
+    auto sieve =
+        simulate_cache(trace, keys, size, num_shards, CacheAdmission::None);
+    auto tinylfu =
+        simulate_cache(trace, keys, size, num_shards, CacheAdmission::TinyLfu);
+    std::printf("%10zu %8.2f%% %8.2f%% %10.2f%% %12llu\n", size,
+                lru * 100, sieve.hit_ratio * 100, tinylfu.hit_ratio * 100,
+                static_cast<unsigned long long>(tinylfu.rejections));
+  }
+  return 0;
+}
@@ -0,0 +1,206 @@
+// discrete event simulation of the load balancing strategies against
+// stub backends of uneven speed. the real LoadBalancer picks the backend
+// of every request and is fed the simulated latencies, the backends are
+// multi-worker FIFO queues with exponential service times. prints the
+// latency distribution seen by the clients for each strategy.
+#include "load_balancer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cxxopts.hpp>
+#include <deque>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace azugate;
+
+namespace {
+
+struct BackendSpec {
+  // relative to the base service time, 1 is the fastest hardware.
+  double speed;
+  size_t workers;
+};
+
+struct Backend {
+  BackendSpec spec;
+  size_t busy = 0;
+  // arrival times of the waiting requests.
+  std::deque<double> queue;
+};
+
+struct Event {
+  double time;
+  // index of the backend for a completion, -1 for an arrival.
+  int backend;
+  double arrival;
+  bool failed;
+  bool operator>(const Event &other) const { return time > other.time; }
+};
+
+struct Result {
+  std::string strategy;
+  double mean, p50, p99, p999, max;
+  size_t num_errors;
+};
+
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t idx = std::min(sorted.size() - 1,
+                        static_cast<size_t>(p * (sorted.size() - 1)));
+  return sorted[idx];
+}
+
+Result simulate(const std::string &strategy_name,
+                LoadBalancingStrategy strategy,
+                const std::vector<BackendSpec> &specs, double base_ms,
+                double load, size_t num_requests, double error_rate,
+                uint64_t seed) {
+  spdlog::set_level(spdlog::level::warn);
+  std::mt19937_64 rng(seed);
+  LoadBalancer lb(strategy);
+  std::vector<Backend> backends;
+  std::unordered_map<const UpstreamServer *, int> index;
+  double capacity = 0;
+  for (size_t i = 0; i < specs.size(); ++i) {
+    // weights are what an operator would configure from the hardware.
+    lb.add_server("backend-" + std::to_string(i), 8000 + i,
+                  std::max(1, static_cast<int>(specs[i].speed * 10)));
+    backends.push_back(Backend{.spec = specs[i]});
+    capacity += specs[i].workers * specs[i].speed / base_ms;
+  }
+  for (auto &server : lb.get_all_servers()) {
+    index[server.get()] = static_cast<int>(server->port() - 8000);
+  }
+  auto servers = lb.get_all_servers();
+  double arrival_rate = load * capacity;
+
+  std::exponential_distribution<double> interarrival(arrival_rate);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<double> latencies;
+  latencies.reserve(num_requests);
+  size_t num_errors = 0;
+
+  auto start_service = [&](int b, double now, double arrival) {
+    auto &backend = backends[b];
+    ++backend.busy;
+    // backend 0 fails fast with `error_rate`, e.g. a broken dependency.
+    bool failed = b == 0 && uniform(rng) < error_rate;
+    double service =
+        failed ? 0.1 * base_ms
+               : std::exponential_distribution<double>(backend.spec.speed /
+                                                       base_ms)(rng);
+    events.push(Event{now + service, b, arrival, failed});
+  };
+
+  events.push(Event{interarrival(rng), -1, 0, false});
+  size_t num_arrivals = 0;
+  while (!events.empty()) {
+    auto event = events.top();
+    events.pop();
+    double now = event.time;
+    if (event.backend < 0) {
+      if (++num_arrivals < num_requests) {
+        events.push(Event{now + interarrival(rng), -1, 0, false});
+      }
+      auto client = "10.0.0." + std::to_string(uniform(rng) * 250);
+      auto server = lb.get_server(client);
+      int b = index[server.get()];
+      lb.on_request_start(server);
+      if (backends[b].busy < backends[b].spec.workers) {
+        start_service(b, now, now);
+      } else {
+        backends[b].queue.push_back(now);
+      }
+      continue;
+    }
+    int b = event.backend;
+    double latency_ms = now - event.arrival;
+    lb.on_request_complete(
+        servers[b],
+        std::chrono::nanoseconds(static_cast<int64_t>(latency_ms * 1e6)),
+        !event.failed);
+    if (event.failed) {
+      ++num_errors;
+    } else {
+      latencies.push_back(latency_ms);
+    }
+    --backends[b].busy;
+    if (!backends[b].queue.empty()) {
+      double arrival = backends[b].queue.front();
+      backends[b].queue.pop_front();
+      start_service(b, now, arrival);
+    }
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0;
+  for (double latency : latencies) {
+    sum += latency;
+  }
+  return Result{
+      .strategy = strategy_name,
+      .mean = sum / latencies.size(),
+      .p50 = percentile(latencies, 0.5),
+      .p99 = percentile(latencies, 0.99),
+      .p999 = percentile(latencies, 0.999),
+      .max = latencies.back(),
+      .num_errors = num_errors,
+  };
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options opts("lb_strategy_sim",
+                        "Compare the tail latency of the load balancing "
+                        "strategies on uneven backends");
+  opts.add_options()
+      ("n,requests", "Number of simulated requests", cxxopts::value<size_t>()->default_value("200000"))
+      ("l,load", "Offered load relative to the total capacity", cxxopts::value<double>()->default_value("0.4"))
+      ("b,base-ms", "Mean service time of the fastest backend", cxxopts::value<double>()->default_value("10"))
+      ("e,error-rate", "Fast failure rate of the first backend", cxxopts::value<double>()->default_value("0"))
+      ("s,seed", "Random seed", cxxopts::value<uint64_t>()->default_value("42"))
+      ("h,help", "Print usage");
+  auto parsed_opts = opts.parse(argc, argv);
+  if (parsed_opts.count("help")) {
+    std::cout << opts.help() << std::endl;
+    return 0;
+  }
+  auto num_requests = parsed_opts["requests"].as<size_t>();
+  auto load = parsed_opts["load"].as<double>();
+  auto base_ms = parsed_opts["base-ms"].as<double>();
+  auto error_rate = parsed_opts["error-rate"].as<double>();
+  auto seed = parsed_opts["seed"].as<uint64_t>();
+
+  // two current machines, four older ones at 60% and two at 25%.
+  const std::vector<BackendSpec> specs = {
+      {1.0, 8}, {1.0, 8}, {0.6, 8}, {0.6, 8},
+      {0.6, 8}, {0.6, 8}, {0.25, 8}, {0.25, 8},
+  };
+  const std::pair<const char *, LoadBalancingStrategy> strategies[] = {
+      {"round_robin", LoadBalancingStrategy::RoundRobin},
+      {"random", LoadBalancingStrategy::Random},
+      {"weighted", LoadBalancingStrategy::WeightedRoundRobin},
+      {"least_connections", LoadBalancingStrategy::LeastConnections},
+      {"p2c", LoadBalancingStrategy::PowerOfTwoChoices},
+  };
+
+  std::printf("backends=%zu requests=%zu load=%.2f base=%.1fms "
+              "error_rate=%.2f\n",
+              specs.size(), num_requests, load, base_ms, error_rate);
+  std::printf("%-18s %9s %9s %9s %9s %10s %8s\n", "strategy", "mean", "p50",
+              "p99", "p99.9", "max", "errors");
+  for (const auto &[name, strategy] : strategies) {
+    auto result = simulate(name, strategy, specs, base_ms, load,
+                           num_requests, error_rate, seed);
+    std::printf("%-18s %8.1fms %8.1fms %8.1fms %8.1fms %9.1fms %8zu\n",
+                result.strategy.c_str(), result.mean, result.p50, result.p99,
+                result.p999, result.max, result.num_errors);
+  }
+  return 0;
+}
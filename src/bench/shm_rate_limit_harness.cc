@@ -0,0 +1,146 @@
+// multi-process accuracy harness for the shared memory rate limiter.
+// N worker processes hammer the same keys through their own
+// TokenBucketRateLimiter attached to one file, the combined number of
+// admitted requests must match a single limiter's budget:
+//   keys * (burst + rate * duration).
+#include "rate_limiter.h"
+#include "shm_store.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cxxopts.hpp>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace azugate;
+
+namespace {
+
+int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// returns the number of admitted requests of this worker.
+uint64_t runWorker(const std::string &path, size_t burst, size_t rate,
+                   size_t num_keys, int64_t start_ns, int64_t stop_ns,
+                   bool shared) {
+  spdlog::set_level(spdlog::level::warn);
+  TokenBucketRateLimiter limiter(burst, rate);
+  if (shared && !limiter.AttachSharedMemory(path)) {
+    std::exit(2);
+  }
+  while (steadyNowNs() < start_ns) {
+    std::this_thread::yield();
+  }
+  uint64_t num_allowed = 0;
+  size_t i = 0;
+  while (steadyNowNs() < stop_ns) {
+    auto key = "tenant-" + std::to_string(i++ % num_keys);
+    num_allowed += limiter.GetToken(key);
+  }
+  return num_allowed;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options opts("shm_rate_limit_harness",
+                        "Check the accuracy of the shared rate limiter");
+  opts.add_options()
+      ("n,processes", "Number of worker processes", cxxopts::value<size_t>()->default_value("4"))
+      ("k,keys", "Number of distinct keys", cxxopts::value<size_t>()->default_value("16"))
+      ("b,burst", "Burst size per key", cxxopts::value<size_t>()->default_value("50"))
+      ("r,rate", "Requests per second per key", cxxopts::value<size_t>()->default_value("1000"))
+      ("d,duration-ms", "Duration of the run", cxxopts::value<size_t>()->default_value("2000"))
+      ("p,path", "Shared memory file", cxxopts::value<std::string>()->default_value("/dev/shm/azugate-harness"))
+      ("l,local", "Use per-process limiters, shows the N times overshoot", cxxopts::value<bool>()->default_value("false"))
+      ("t,tolerance", "Accepted relative error", cxxopts::value<double>()->default_value("0.02"))
+      ("h,help", "Print usage");
+  auto parsed_opts = opts.parse(argc, argv);
+  if (parsed_opts.count("help")) {
+    std::cout << opts.help() << std::endl;
+    return 0;
+  }
+  auto num_processes = parsed_opts["processes"].as<size_t>();
+  auto num_keys = parsed_opts["keys"].as<size_t>();
+  auto burst = parsed_opts["burst"].as<size_t>();
+  auto rate = parsed_opts["rate"].as<size_t>();
+  auto duration_ms = parsed_opts["duration-ms"].as<size_t>();
+  auto path = parsed_opts["path"].as<std::string>();
+  bool shared = !parsed_opts["local"].as<bool>();
+  auto tolerance = parsed_opts["tolerance"].as<double>();
+
+  // start from a fresh table.
+  unlink(path.c_str());
+  // leave the workers some time to start and attach.
+  int64_t start_ns = steadyNowNs() + 200 * 1000 * 1000;
+  int64_t stop_ns = start_ns + int64_t(duration_ms) * 1000 * 1000;
+
+  std::vector<std::pair<pid_t, int>> workers;
+  for (size_t i = 0; i < num_processes; ++i) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      std::perror("pipe");
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      uint64_t num_allowed = runWorker(path, burst, rate, num_keys, start_ns,
+                                       stop_ns, shared);
+      auto _ = write(fds[1], &num_allowed, sizeof(num_allowed));
+      close(fds[1]);
+      _exit(0);
+    }
+    close(fds[1]);
+    workers.emplace_back(pid, fds[0]);
+  }
+
+  uint64_t total_allowed = 0;
+  for (auto &[pid, fd] : workers) {
+    uint64_t num_allowed = 0;
+    if (read(fd, &num_allowed, sizeof(num_allowed)) !=
+        sizeof(num_allowed)) {
+      std::cerr << "worker " << pid << " failed" << std::endl;
+      return 1;
+    }
+    close(fd);
+    waitpid(pid, nullptr, 0);
+    total_allowed += num_allowed;
+  }
+
+  double expected = double(num_keys) *
+                    (double(burst) + double(rate) * duration_ms / 1000.0);
+  double error = (double(total_allowed) - expected) / expected;
+  std::printf("processes=%zu keys=%zu burst=%zu rate=%zu/s duration=%zums "
+              "mode=%s\n",
+              num_processes, num_keys, burst, rate, duration_ms,
+              shared ? "shared" : "local");
+  std::printf("admitted=%llu expected=%.0f error=%+.2f%%\n",
+              static_cast<unsigned long long>(total_allowed), expected,
+              error * 100);
+  if (shared) {
+    SharedRateLimitTable table;
+    int64_t emission_interval = 1000 * 1000 * 1000 / int64_t(rate);
+    if (table.Open(path, kDftSharedRateLimiterSlots, emission_interval,
+                   emission_interval * int64_t(burst))) {
+      std::printf("shared counters: allowed=%llu rejected=%llu\n",
+                  static_cast<unsigned long long>(
+                      table.LoadCounter(kSharedCounterAllowed)),
+                  static_cast<unsigned long long>(
+                      table.LoadCounter(kSharedCounterRejected)));
+    }
+    unlink(path.c_str());
+  }
+  return std::fabs(error) <= tolerance ? 0 : 1;
+}
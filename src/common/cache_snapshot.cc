@@ -0,0 +1,468 @@
+#include "../../include/cache_snapshot.hpp"
+#include "../../include/disk_cache.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+#include <spdlog/spdlog.h>
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace azugate {
+
+namespace {
+
+// Header: magic, byte order mark, version. Then the records, each a u64
+// length and its payload, and the footer: the number of records and the
+// end magic, missing if the writer didn't finish.
+constexpr char kMagic[8] = {'A', 'Z', 'C', 'S', 'N', 'A', 'P', '\0'};
+constexpr char kEndMagic[8] = {'A', 'Z', 'C', 'S', 'E', 'N', 'D', '\0'};
+constexpr uint32_t kByteOrder = 0x01020304;
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = sizeof(kMagic) + 2 * sizeof(uint32_t);
+constexpr size_t kFooterSize = sizeof(uint64_t) + sizeof(kEndMagic);
+
+enum : uint8_t { kMemoryRecord = 0, kDiskRecord = 1 };
+
+enum : uint8_t {
+    kAcceptRanges = 1 << 0,
+    kPrivate = 1 << 1,
+    kNoCache = 1 << 2,
+    kNoStore = 1 << 3,
+    kMustRevalidate = 1 << 4,
+    kRevalidatable = 1 << 5,
+};
+
+// The steady clock doesn't survive the process, times are written as
+// nanoseconds of the wall clock
+int64_t to_wall(std::chrono::steady_clock::time_point time) {
+    auto wall = std::chrono::system_clock::now() +
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    time - std::chrono::steady_clock::now());
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(wall.time_since_epoch()).count();
+}
+
+std::chrono::steady_clock::time_point from_wall(int64_t nanoseconds) {
+    auto wall = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(nanoseconds)));
+    return std::chrono::steady_clock::now() +
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               wall - std::chrono::system_clock::now());
+}
+
+class Writer {
+public:
+    template <typename T>
+    void put(T value) {
+        buffer_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void put_string(std::string_view value) {
+        put(static_cast<uint32_t>(value.size()));
+        buffer_.append(value);
+    }
+    std::string& buffer() { return buffer_; }
+
+private:
+    std::string buffer_;
+};
+
+// Bounds-checked reads from the mapping, a truncated or corrupted record
+// fails instead of reading past it
+class Reader {
+public:
+    Reader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (size_ - offset_ < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, data_ + offset_, sizeof(value));
+        offset_ += sizeof(value);
+        return true;
+    }
+    bool get_view(std::string_view& value, uint64_t length) {
+        if (size_ - offset_ < length) {
+            return false;
+        }
+        value = std::string_view(data_ + offset_, length);
+        offset_ += length;
+        return true;
+    }
+    bool get_string(std::string& value) {
+        uint32_t length = 0;
+        std::string_view view;
+        if (!get(length) || !get_view(view, length)) {
+            return false;
+        }
+        value.assign(view);
+        return true;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t offset_ = 0;
+};
+
+// Key and freshness, read for every record when the snapshot is opened
+struct RecordPrefix {
+    uint8_t kind = kMemoryRecord;
+    CacheKey key;
+    int64_t created_at = 0;
+    int64_t expires_at = 0;
+    int64_t stale_while_revalidate = 0;
+    int64_t stale_if_error = 0;
+    uint8_t flags = 0;
+};
+
+bool read_prefix(Reader& reader, RecordPrefix& prefix) {
+    uint8_t has_slice = 0;
+    uint64_t slice = 0;
+    if (!reader.get(prefix.kind) || !reader.get_string(prefix.key.method) ||
+        !reader.get_string(prefix.key.url) || !reader.get_string(prefix.key.query_params) ||
+        !reader.get_string(prefix.key.vary_headers) || !reader.get(has_slice) ||
+        !reader.get(slice) || !reader.get(prefix.created_at) || !reader.get(prefix.expires_at) ||
+        !reader.get(prefix.stale_while_revalidate) || !reader.get(prefix.stale_if_error) ||
+        !reader.get(prefix.flags)) {
+        return false;
+    }
+    if (has_slice) {
+        prefix.key.slice = slice;
+    }
+    prefix.key.finalize();
+    return prefix.kind == kMemoryRecord || prefix.kind == kDiskRecord;
+}
+
+void encode(Writer& writer, const CacheKey& key, const CacheEntry& entry) {
+    writer.put<uint8_t>(entry.disk_body ? kDiskRecord : kMemoryRecord);
+    writer.put_string(key.method);
+    writer.put_string(key.url);
+    writer.put_string(key.query_params);
+    writer.put_string(key.vary_headers);
+    writer.put<uint8_t>(key.slice ? 1 : 0);
+    writer.put<uint64_t>(key.slice.value_or(0));
+    writer.put<int64_t>(to_wall(entry.created_at));
+    writer.put<int64_t>(to_wall(entry.expires_at));
+    writer.put<int64_t>(entry.stale_while_revalidate.count());
+    writer.put<int64_t>(entry.stale_if_error.count());
+    writer.put<uint8_t>((entry.accept_ranges ? kAcceptRanges : 0) |
+                        (entry.is_private ? kPrivate : 0) | (entry.no_cache ? kNoCache : 0) |
+                        (entry.no_store ? kNoStore : 0) |
+                        (entry.must_revalidate ? kMustRevalidate : 0) |
+                        (entry.revalidatable ? kRevalidatable : 0));
+    writer.put<uint64_t>(entry.fields_at);
+    writer.put<uint64_t>(entry.range_fields_at);
+    writer.put<uint64_t>(entry.content_length);
+    writer.put<uint64_t>(entry.size_bytes);
+    writer.put<uint64_t>(entry.slice_offset);
+    writer.put<uint64_t>(entry.object_size);
+    writer.put<int32_t>(entry.status_code);
+    writer.put_string(entry.head);
+    writer.put_string(entry.etag);
+    writer.put_string(entry.last_modified);
+    writer.put_string(entry.content_type);
+    if (entry.disk_body) {
+        writer.put<uint64_t>(entry.disk_body->segment->id);
+        writer.put<uint64_t>(entry.disk_body->offset);
+        writer.put<uint64_t>(entry.disk_body->length);
+        return;
+    }
+    writer.put<uint64_t>(entry.body_size());
+    for (const auto& segment : entry.body) {
+        writer.buffer().append(segment.view());
+    }
+}
+
+bool write_record(std::FILE* file, std::string_view payload) {
+    uint64_t length = payload.size();
+    return std::fwrite(&length, sizeof(length), 1, file) == 1 &&
+           std::fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+}
+
+} // namespace
+
+CacheSnapshot::CacheSnapshot(void* mapping, size_t size)
+    : mapping_(mapping), data_(static_cast<const char*>(mapping)), size_(size) {}
+
+CacheSnapshot::~CacheSnapshot() {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    ::munmap(mapping_, size_);
+#endif
+}
+
+bool CacheSnapshot::write(const std::string& path,
+                          const std::vector<std::pair<CacheKey, std::shared_ptr<CacheEntry>>>& entries,
+                          CacheSnapshot* pending) {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    std::error_code ec;
+    auto directory = std::filesystem::path(path).parent_path();
+    if (!directory.empty()) {
+        std::filesystem::create_directories(directory, ec);
+    }
+    auto temporary = path + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file) {
+        SPDLOG_ERROR("failed to open cache snapshot {}: {}", temporary, std::strerror(errno));
+        return false;
+    }
+
+    bool ok = std::fwrite(kMagic, sizeof(kMagic), 1, file) == 1 &&
+              std::fwrite(&kByteOrder, sizeof(kByteOrder), 1, file) == 1 &&
+              std::fwrite(&kVersion, sizeof(kVersion), 1, file) == 1;
+    uint64_t count = 0;
+    Writer writer;
+    for (const auto& [key, entry] : entries) {
+        if (!ok) {
+            break;
+        }
+        writer.buffer().clear();
+        encode(writer, key, *entry);
+        ok = write_record(file, writer.buffer());
+        count++;
+    }
+    if (pending && ok) {
+        std::unordered_set<CacheKey, CacheKeyHash> written;
+        for (const auto& [key, entry] : entries) {
+            written.insert(key);
+        }
+        // The records are copied as they are, they were encoded the same way
+        std::lock_guard<std::mutex> lock(pending->mutex_);
+        for (const auto& [key, record] : pending->index_) {
+            if (!ok) {
+                break;
+            }
+            if (written.contains(key) || record.usable_until <= std::chrono::steady_clock::now()) {
+                continue;
+            }
+            ok = write_record(file, std::string_view(pending->data_ + record.offset, record.length));
+            count++;
+        }
+    }
+    ok = ok && std::fwrite(&count, sizeof(count), 1, file) == 1 &&
+         std::fwrite(kEndMagic, sizeof(kEndMagic), 1, file) == 1 && std::fflush(file) == 0 &&
+         ::fsync(::fileno(file)) == 0;
+    if (std::fclose(file) != 0) {
+        ok = false;
+    }
+    if (ok) {
+        std::filesystem::rename(temporary, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        SPDLOG_ERROR("failed to write cache snapshot {}: {}", path,
+                     ec ? ec.message() : std::string(std::strerror(errno)));
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    SPDLOG_INFO("HTTP cache snapshot written to {} - Entries: {}", path, count);
+    return true;
+#else
+    SPDLOG_ERROR("HTTP cache snapshots aren't supported on this platform");
+    return false;
+#endif
+}
+
+std::unique_ptr<CacheSnapshot> CacheSnapshot::open(const std::string& path) {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            SPDLOG_WARN("failed to open cache snapshot {}: {}", path, std::strerror(errno));
+        }
+        return nullptr;
+    }
+    struct stat info {};
+    if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < kHeaderSize + kFooterSize) {
+        SPDLOG_WARN("cache snapshot {} is truncated, ignored", path);
+        ::close(fd);
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        SPDLOG_WARN("failed to map cache snapshot {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    std::unique_ptr<CacheSnapshot> snapshot(new CacheSnapshot(mapping, size));
+
+    const char* data = snapshot->data_;
+    uint32_t byte_order = 0;
+    uint32_t version = 0;
+    uint64_t count = 0;
+    std::memcpy(&byte_order, data + sizeof(kMagic), sizeof(byte_order));
+    std::memcpy(&version, data + sizeof(kMagic) + sizeof(byte_order), sizeof(version));
+    std::memcpy(&count, data + size - kFooterSize, sizeof(count));
+    if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0 || byte_order != kByteOrder ||
+        version != kVersion ||
+        std::memcmp(data + size - sizeof(kEndMagic), kEndMagic, sizeof(kEndMagic)) != 0) {
+        SPDLOG_WARN("cache snapshot {} is incomplete or from another version, ignored", path);
+        return nullptr;
+    }
+
+    // Only the keys are read now, the entries when they're looked up
+    auto now = std::chrono::steady_clock::now();
+    size_t offset = kHeaderSize;
+    size_t end = size - kFooterSize;
+    uint64_t records = 0;
+    size_t dropped = 0;
+    while (offset < end) {
+        uint64_t length = 0;
+        if (end - offset < sizeof(length)) {
+            break;
+        }
+        std::memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (end - offset < length) {
+            break;
+        }
+        Record record{.offset = offset, .length = length};
+        offset += length;
+        records++;
+
+        Reader reader(data + record.offset, record.length);
+        RecordPrefix prefix;
+        if (!read_prefix(reader, prefix)) {
+            break;
+        }
+        record.on_disk = prefix.kind == kDiskRecord;
+        record.usable_until =
+            prefix.flags & kRevalidatable
+                ? std::chrono::steady_clock::time_point::max()
+                : from_wall(prefix.expires_at) +
+                      std::chrono::seconds(std::max(prefix.stale_while_revalidate,
+                                                    prefix.stale_if_error));
+        // Expired while the gateway was down
+        if (record.usable_until <= now) {
+            dropped++;
+            continue;
+        }
+        snapshot->index_.insert_or_assign(std::move(prefix.key), record);
+    }
+    if (offset != end || records != count) {
+        SPDLOG_WARN("cache snapshot {} is corrupted, ignored", path);
+        return nullptr;
+    }
+    SPDLOG_INFO("HTTP cache snapshot {} opened - Entries: {}, Expired: {}", path,
+                snapshot->index_.size(), dropped);
+    return snapshot;
+#else
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<CacheEntry> CacheSnapshot::take(const CacheKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end() || it->second.on_disk) {
+        return nullptr;
+    }
+    auto record = it->second;
+    index_.erase(it);
+    if (record.usable_until <= std::chrono::steady_clock::now()) {
+        return nullptr;
+    }
+    CacheKey decoded_key;
+    std::shared_ptr<CacheEntry> entry;
+    if (!decode(record, decoded_key, entry, nullptr)) {
+        return nullptr;
+    }
+    return entry;
+}
+
+std::vector<CacheSnapshot::DiskRecord> CacheSnapshot::take_disk_records() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<DiskRecord> records;
+    for (auto it = index_.begin(); it != index_.end();) {
+        if (!it->second.on_disk) {
+            ++it;
+            continue;
+        }
+        DiskRecord disk;
+        if (decode(it->second, disk.key, disk.entry, &disk)) {
+            records.push_back(std::move(disk));
+        }
+        it = index_.erase(it);
+    }
+    return records;
+}
+
+size_t CacheSnapshot::drop_unusable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    return std::erase_if(index_, [now](const auto& item) { return item.second.usable_until <= now; });
+}
+
+size_t CacheSnapshot::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+bool CacheSnapshot::decode(const Record& record, CacheKey& key, std::shared_ptr<CacheEntry>& entry,
+                           DiskRecord* disk) const {
+    Reader reader(data_ + record.offset, record.length);
+    RecordPrefix prefix;
+    if (!read_prefix(reader, prefix)) {
+        return false;
+    }
+    key = std::move(prefix.key);
+    entry = std::make_shared<CacheEntry>();
+    entry->created_at = from_wall(prefix.created_at);
+    entry->expires_at = from_wall(prefix.expires_at);
+    entry->stale_while_revalidate = std::chrono::seconds(prefix.stale_while_revalidate);
+    entry->stale_if_error = std::chrono::seconds(prefix.stale_if_error);
+    entry->accept_ranges = prefix.flags & kAcceptRanges;
+    entry->is_private = prefix.flags & kPrivate;
+    entry->no_cache = prefix.flags & kNoCache;
+    entry->no_store = prefix.flags & kNoStore;
+    entry->must_revalidate = prefix.flags & kMustRevalidate;
+    entry->revalidatable = prefix.flags & kRevalidatable;
+
+    uint64_t fields_at = 0;
+    uint64_t range_fields_at = 0;
+    uint64_t content_length = 0;
+    uint64_t size_bytes = 0;
+    int32_t status_code = 0;
+    if (!reader.get(fields_at) || !reader.get(range_fields_at) || !reader.get(content_length) ||
+        !reader.get(size_bytes) || !reader.get(entry->slice_offset) ||
+        !reader.get(entry->object_size) || !reader.get(status_code) ||
+        !reader.get_string(entry->head) || !reader.get_string(entry->etag) ||
+        !reader.get_string(entry->last_modified) || !reader.get_string(entry->content_type) ||
+        fields_at > range_fields_at || range_fields_at > entry->head.size()) {
+        return false;
+    }
+    entry->fields_at = fields_at;
+    entry->range_fields_at = range_fields_at;
+    entry->content_length = content_length;
+    entry->size_bytes = size_bytes;
+    entry->status_code = status_code;
+
+    if (disk) {
+        return reader.get(disk->segment_id) && reader.get(disk->offset) && reader.get(disk->length);
+    }
+    uint64_t body_length = 0;
+    std::string_view body;
+    if (!reader.get(body_length) || !reader.get_view(body, body_length)) {
+        return false;
+    }
+    // The body leaves the mapping now, the snapshot can be unmapped while
+    // the entry is served
+    if (!body.empty()) {
+        entry->body.push_back(BodySegment{
+            .buffer = std::make_shared<const std::string>(body),
+            .offset = 0,
+            .length = body.size(),
+        });
+    }
+    return true;
+}
+
+} // namespace azugate
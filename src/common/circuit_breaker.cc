@@ -1,9 +1,12 @@
 #include "../../include/circuit_breaker.hpp"
+#include "../../include/config.h"
+#include "../../include/metrics.hpp"
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
-#include <shared_mutex>
 #include <sstream>
 #include <fmt/format.h>
+#include <yaml-cpp/yaml.h>
 
 namespace azugate {
 
@@ -24,19 +27,27 @@ std::string CircuitBreakerStats::to_json() const {
 }
 
 // CircuitBreaker implementation
+static int64_t steady_now_ns(std::chrono::steady_clock::time_point now) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+}
+
 CircuitBreaker::CircuitBreaker(const std::string& name, const CircuitBreakerConfig& config)
-    : name_(name), config_(config), last_attempt_time_(std::chrono::steady_clock::now()) {
+    : name_(name), config_(std::make_shared<const CircuitBreakerConfig>(config)),
+      window_(config.metrics_window, std::max<uint32_t>(config.metrics_window_buckets, 1)) {
     
     stats_.last_state_change = std::chrono::steady_clock::now();
-    request_history_.reserve(config_.minimum_requests * 2);
     
     SPDLOG_INFO("Circuit breaker '{}' created with failure_threshold={}, recovery_timeout={}ms", 
-                name_, config_.failure_threshold, config_.recovery_timeout.count());
+                name_, config.failure_threshold, config.recovery_timeout.count());
 }
 
 bool CircuitBreaker::can_proceed() {
     auto current_state = state_.load();
-    auto now = std::chrono::steady_clock::now();
+    // Closed admits without looking at the config
+    if (current_state == CircuitBreakerState::CLOSED) {
+        return true;
+    }
+    auto config = get_config();
     
     switch (current_state) {
         case CircuitBreakerState::CLOSED:
@@ -44,21 +55,25 @@ bool CircuitBreaker::can_proceed() {
             
         case CircuitBreakerState::OPEN: {
             // Check if recovery timeout has elapsed
-            auto recovery_timeout = calculate_recovery_timeout();
-            if (now - stats_.last_state_change >= recovery_timeout) {
-                transition_to_half_open();
-                return true;
+            auto now = std::chrono::steady_clock::now();
+            auto recovery_timeout = calculate_recovery_timeout(*config);
+            if (now - stats_.last_state_change.load(std::memory_order_relaxed) < recovery_timeout) {
+                stats_.rejected_requests.fetch_add(1, std::memory_order_relaxed);
+                GatewayMetrics::instance().record_circuit_breaker_request(name_, "rejected");
+                return false;
             }
-            return false;
+            transition_to_half_open(*config);
+            [[fallthrough]];
         }
         
         case CircuitBreakerState::HALF_OPEN: {
             // Allow limited requests in half-open state
-            uint32_t current_half_open = half_open_requests_.load();
-            if (current_half_open < config_.half_open_max_requests) {
-                half_open_requests_++;
+            if (half_open_requests_.fetch_add(1) < config->half_open_max_requests) {
                 return true;
             }
+            half_open_requests_.fetch_sub(1);
+            stats_.rejected_requests.fetch_add(1, std::memory_order_relaxed);
+            GatewayMetrics::instance().record_circuit_breaker_request(name_, "rejected");
             return false;
         }
     }
@@ -66,87 +81,136 @@ bool CircuitBreaker::can_proceed() {
     return false;
 }
 
-void CircuitBreaker::record_success(std::chrono::milliseconds response_time) {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    
-    stats_.total_requests++;
-    stats_.successful_requests++;
-    stats_.consecutive_successes++;
-    stats_.consecutive_failures = 0;
-    stats_.last_success_time = std::chrono::steady_clock::now();
-    
-    // Add to rolling window
-    {
-        std::lock_guard<std::mutex> history_lock(history_mutex_);
-        request_history_.push_back({stats_.last_success_time, true});
+bool CircuitBreaker::allows_requests() const {
+    switch (state_.load()) {
+        case CircuitBreakerState::CLOSED:
+            return true;
+        case CircuitBreakerState::OPEN:
+            return std::chrono::steady_clock::now() -
+                       stats_.last_state_change.load(std::memory_order_relaxed) >=
+                   calculate_recovery_timeout(*get_config());
+        case CircuitBreakerState::HALF_OPEN:
+            return half_open_requests_.load(std::memory_order_relaxed) <
+                   get_config()->half_open_max_requests;
     }
+    return false;
+}
+
+void CircuitBreaker::record_success(std::chrono::milliseconds response_time) {
+    record_success(*get_config(), response_time);
+}
+
+void CircuitBreaker::record_success(const CircuitBreakerConfig& config,
+                                    std::chrono::milliseconds response_time) {
+    auto now = std::chrono::steady_clock::now();
     
-    auto current_state = state_.load();
-    
-    if (current_state == CircuitBreakerState::HALF_OPEN) {
-        // Check if we should close the circuit
-        if (should_close_circuit()) {
-            transition_to_closed();
-        }
+    stats_.total_requests.fetch_add(1, std::memory_order_relaxed);
+    stats_.successful_requests.fetch_add(1, std::memory_order_relaxed);
+    auto consecutive_successes =
+        stats_.consecutive_successes.fetch_add(1, std::memory_order_relaxed) + 1;
+    stats_.consecutive_failures.store(0, std::memory_order_relaxed);
+    stats_.last_success_time.store(now, std::memory_order_relaxed);
+    
+    // A zero response time means none was measured
+    window_.Record(true,
+                   response_time.count() > 0 ? std::chrono::nanoseconds(response_time)
+                                             : std::chrono::nanoseconds(-1),
+                   steady_now_ns(now));
+    
+    if (state_.load() == CircuitBreakerState::HALF_OPEN &&
+        should_close_circuit(config, consecutive_successes)) {
+        transition_to_closed(config);
     }
     
-    // Clean old records periodically
-    update_failure_rate();
-    
     SPDLOG_DEBUG("Circuit breaker '{}': SUCCESS recorded (response_time={}ms, consecutive_successes={})", 
-                name_, response_time.count(), stats_.consecutive_successes.load());
+                name_, response_time.count(), consecutive_successes);
 }
 
 void CircuitBreaker::record_failure() {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
+    record_failure(*get_config());
+}
+
+void CircuitBreaker::record_failure(const CircuitBreakerConfig& config) {
+    auto now = std::chrono::steady_clock::now();
     
-    stats_.total_requests++;
-    stats_.failed_requests++;
-    stats_.consecutive_failures++;
-    stats_.consecutive_successes = 0;
-    stats_.last_failure_time = std::chrono::steady_clock::now();
+    stats_.total_requests.fetch_add(1, std::memory_order_relaxed);
+    stats_.failed_requests.fetch_add(1, std::memory_order_relaxed);
+    auto consecutive_failures =
+        stats_.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    stats_.consecutive_successes.store(0, std::memory_order_relaxed);
+    stats_.last_failure_time.store(now, std::memory_order_relaxed);
     
-    // Add to rolling window
-    {
-        std::lock_guard<std::mutex> history_lock(history_mutex_);
-        request_history_.push_back({stats_.last_failure_time, false});
-    }
+    int64_t now_ns = steady_now_ns(now);
+    window_.Record(false, std::chrono::nanoseconds(-1), now_ns);
     
     auto current_state = state_.load();
     
     if (current_state == CircuitBreakerState::CLOSED) {
         // Check if we should open the circuit
-        if (should_open_circuit()) {
-            transition_to_open();
+        if (should_open_circuit(config, consecutive_failures, now_ns)) {
+            transition_to_open(config);
         }
     } else if (current_state == CircuitBreakerState::HALF_OPEN) {
         // Any failure in half-open state reopens the circuit
-        transition_to_open();
+        transition_to_open(config);
     }
     
-    update_failure_rate();
-    
     SPDLOG_DEBUG("Circuit breaker '{}': FAILURE recorded (consecutive_failures={})", 
-                name_, stats_.consecutive_failures.load());
+                name_, consecutive_failures);
 }
 
 void CircuitBreaker::record_timeout() {
-    stats_.timeout_requests++;
+    stats_.timeout_requests.fetch_add(1, std::memory_order_relaxed);
     record_failure();  // Treat timeouts as failures
     
     SPDLOG_WARN("Circuit breaker '{}': TIMEOUT recorded", name_);
 }
 
+CircuitBreakerResult CircuitBreaker::record_response(int status_code,
+                                                     std::chrono::milliseconds response_time) {
+    auto config = get_config();
+    
+    // Check if response time exceeded timeout
+    if (response_time > config->timeout) {
+        stats_.timeout_requests.fetch_add(1, std::memory_order_relaxed);
+        record_failure(*config);
+        SPDLOG_WARN("Circuit breaker '{}': TIMEOUT recorded", name_);
+        return CircuitBreakerResult::TIMEOUT;
+    }
+    
+    // Check if status code indicates failure
+    const auto& failure_codes = config->failure_status_codes;
+    if (std::find(failure_codes.begin(), failure_codes.end(), status_code) != failure_codes.end()) {
+        record_failure(*config);
+        return CircuitBreakerResult::FAILURE;
+    }
+    record_success(*config, response_time);
+    return CircuitBreakerResult::SUCCESS;
+}
+
+void CircuitBreaker::record_cancelled() {
+    // Only half-open admissions are limited
+    if (state_.load() != CircuitBreakerState::HALF_OPEN) {
+        return;
+    }
+    auto requests = half_open_requests_.load();
+    while (requests > 0 && !half_open_requests_.compare_exchange_weak(requests, requests - 1)) {
+    }
+}
+
+SlidingWindow::Totals CircuitBreaker::get_window_totals() const {
+    return window_.Sum(steady_now_ns(std::chrono::steady_clock::now()));
+}
+
 void CircuitBreaker::update_config(const CircuitBreakerConfig& new_config) {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    config_ = new_config;
+    config_.store(std::make_shared<const CircuitBreakerConfig>(new_config),
+                  std::memory_order_release);
     
     SPDLOG_INFO("Circuit breaker '{}' configuration updated", name_);
 }
 
 void CircuitBreaker::reset() {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    std::lock_guard<std::mutex> history_lock(history_mutex_);
+    std::lock_guard<std::mutex> lock(config_mutex_);
     
     // Reset all atomic counters individually since assignment operator is deleted
     stats_.total_requests.store(0);
@@ -163,7 +227,7 @@ void CircuitBreaker::reset() {
     stats_.last_success_time = now;
     stats_.last_state_change = now;
     
-    request_history_.clear();
+    window_.Reset();
     half_open_requests_ = 0;
     current_backoff_count_ = 0;
     
@@ -173,64 +237,68 @@ void CircuitBreaker::reset() {
 }
 
 void CircuitBreaker::force_open() {
-    transition_to_open();
+    transition_to_open(*get_config());
     SPDLOG_WARN("Circuit breaker '{}' forced to OPEN state", name_);
 }
 
 void CircuitBreaker::force_close() {
-    transition_to_closed();
+    transition_to_closed(*get_config());
     SPDLOG_INFO("Circuit breaker '{}' forced to CLOSED state", name_);
 }
 
 void CircuitBreaker::force_half_open() {
-    transition_to_half_open();
+    transition_to_half_open(*get_config());
     SPDLOG_INFO("Circuit breaker '{}' forced to HALF_OPEN state", name_);
 }
 
 // Private methods
-void CircuitBreaker::transition_to_open() {
+// The thread whose exchange changes the state does the bookkeeping.
+void CircuitBreaker::transition_to_open(const CircuitBreakerConfig& config) {
     auto old_state = state_.exchange(CircuitBreakerState::OPEN);
     
     if (old_state != CircuitBreakerState::OPEN) {
         stats_.last_state_change = std::chrono::steady_clock::now();
+        GatewayMetrics::instance().record_circuit_breaker_state(name_, 1);
         half_open_requests_ = 0;
         
-        if (config_.enable_exponential_backoff) {
+        if (config.enable_exponential_backoff) {
             current_backoff_count_++;
         }
         
-        if (config_.log_state_changes) {
+        if (config.log_state_changes) {
             SPDLOG_WARN("Circuit breaker '{}' transitioned from {} to OPEN (failures: {}, failure_rate: {:.1f}%)", 
                        name_, static_cast<int>(old_state), 
                        stats_.consecutive_failures.load(), 
-                       stats_.current_failure_rate() * 100);
+                       get_window_totals().FailureRate() * 100);
         }
     }
 }
 
-void CircuitBreaker::transition_to_half_open() {
+void CircuitBreaker::transition_to_half_open(const CircuitBreakerConfig& config) {
     auto old_state = state_.exchange(CircuitBreakerState::HALF_OPEN);
     
     if (old_state != CircuitBreakerState::HALF_OPEN) {
         stats_.last_state_change = std::chrono::steady_clock::now();
+        GatewayMetrics::instance().record_circuit_breaker_state(name_, 2);
         half_open_requests_ = 0;
         
-        if (config_.log_state_changes) {
+        if (config.log_state_changes) {
             SPDLOG_INFO("Circuit breaker '{}' transitioned from {} to HALF_OPEN", 
                        name_, static_cast<int>(old_state));
         }
     }
 }
 
-void CircuitBreaker::transition_to_closed() {
+void CircuitBreaker::transition_to_closed(const CircuitBreakerConfig& config) {
     auto old_state = state_.exchange(CircuitBreakerState::CLOSED);
     
     if (old_state != CircuitBreakerState::CLOSED) {
         stats_.last_state_change = std::chrono::steady_clock::now();
+        GatewayMetrics::instance().record_circuit_breaker_state(name_, 0);
         half_open_requests_ = 0;
         current_backoff_count_ = 0;  // Reset backoff on successful recovery
         
-        if (config_.log_state_changes) {
+        if (config.log_state_changes) {
             SPDLOG_INFO("Circuit breaker '{}' transitioned from {} to CLOSED (consecutive_successes: {})", 
                        name_, static_cast<int>(old_state), 
                        stats_.consecutive_successes.load());
@@ -238,58 +306,36 @@ void CircuitBreaker::transition_to_closed() {
     }
 }
 
-void CircuitBreaker::update_failure_rate() {
-    std::lock_guard<std::mutex> lock(history_mutex_);
-    
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff_time = now - config_.metrics_window;
-    
-    // Remove old records
-    request_history_.erase(
-        std::remove_if(request_history_.begin(), request_history_.end(),
-                      [cutoff_time](const RequestRecord& record) {
-                          return record.timestamp < cutoff_time;
-                      }),
-        request_history_.end());
-}
-
-bool CircuitBreaker::should_open_circuit() {
+bool CircuitBreaker::should_open_circuit(const CircuitBreakerConfig& config,
+                                         uint32_t consecutive_failures, int64_t now_ns) {
     // Check consecutive failures threshold
-    if (stats_.consecutive_failures >= config_.failure_threshold) {
+    if (consecutive_failures >= config.failure_threshold) {
         return true;
     }
     
-    // Check failure rate threshold (only if we have minimum requests)
-    if (stats_.total_requests >= config_.minimum_requests) {
-        std::lock_guard<std::mutex> lock(history_mutex_);
-        
-        if (request_history_.size() >= config_.minimum_requests) {
-            size_t failures = std::count_if(request_history_.begin(), request_history_.end(),
-                                          [](const RequestRecord& record) { return !record.success; });
-            
-            double failure_rate = static_cast<double>(failures) / request_history_.size();
-            return failure_rate >= config_.failure_rate_threshold;
-        }
-    }
-    
-    return false;
+    // Check failure rate threshold over the window (only if we have minimum requests)
+    auto totals = window_.Sum(now_ns);
+    return totals.Requests() >= config.minimum_requests &&
+           totals.FailureRate() >= config.failure_rate_threshold;
 }
 
-bool CircuitBreaker::should_close_circuit() {
-    return stats_.consecutive_successes >= config_.success_threshold;
+bool CircuitBreaker::should_close_circuit(const CircuitBreakerConfig& config,
+                                          uint32_t consecutive_successes) {
+    return consecutive_successes >= config.success_threshold;
 }
 
-std::chrono::milliseconds CircuitBreaker::calculate_recovery_timeout() {
-    if (!config_.enable_exponential_backoff) {
-        return config_.recovery_timeout;
+std::chrono::milliseconds CircuitBreaker::calculate_recovery_timeout(
+    const CircuitBreakerConfig& config) const {
+    if (!config.enable_exponential_backoff) {
+        return config.recovery_timeout;
     }
     
     // Calculate exponential backoff
-    double multiplier = std::pow(config_.backoff_multiplier, current_backoff_count_);
+    double multiplier = std::pow(config.backoff_multiplier, current_backoff_count_.load());
     auto backoff_timeout = std::chrono::milliseconds(
-        static_cast<long long>(config_.recovery_timeout.count() * multiplier));
+        static_cast<long long>(config.recovery_timeout.count() * multiplier));
     
-    return std::min(backoff_timeout, config_.max_recovery_timeout);
+    return std::min(backoff_timeout, config.max_recovery_timeout);
 }
 
 // CircuitBreakerRegistry implementation
@@ -301,63 +347,65 @@ CircuitBreakerRegistry& CircuitBreakerRegistry::instance() {
 std::shared_ptr<CircuitBreaker> CircuitBreakerRegistry::get_or_create(
     const std::string& name, const CircuitBreakerConfig& config) {
     
-    std::shared_lock<std::shared_mutex> read_lock(registry_mutex_);
-    
-    auto it = breakers_.find(name);
-    if (it != breakers_.end()) {
-        return it->second;
+    // Lock-free lookup of an existing breaker
+    if (auto breaker = get(name)) {
+        return breaker;
     }
     
-    read_lock.unlock();
-    std::unique_lock<std::shared_mutex> write_lock(registry_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
     
     // Double-check pattern
-    it = breakers_.find(name);
-    if (it != breakers_.end()) {
+    auto current = breakers_.load(std::memory_order_acquire);
+    auto it = current->find(name);
+    if (it != current->end()) {
         return it->second;
     }
     
     auto breaker = std::make_shared<CircuitBreaker>(name, config);
-    breakers_[name] = breaker;
+    auto updated = std::make_shared<BreakerMap>(*current);
+    updated->emplace(name, breaker);
+    breakers_.store(std::move(updated), std::memory_order_release);
     
     SPDLOG_DEBUG("Created new circuit breaker: {}", name);
     return breaker;
 }
 
 std::shared_ptr<CircuitBreaker> CircuitBreakerRegistry::get(const std::string& name) {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
-    
-    auto it = breakers_.find(name);
-    return (it != breakers_.end()) ? it->second : nullptr;
+    auto breakers = breakers_.load(std::memory_order_acquire);
+    auto it = breakers->find(name);
+    return (it != breakers->end()) ? it->second : nullptr;
 }
 
 bool CircuitBreakerRegistry::remove(const std::string& name) {
-    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
     
-    auto removed_count = breakers_.erase(name);
-    if (removed_count > 0) {
-        SPDLOG_INFO("Removed circuit breaker: {}", name);
-        return true;
+    auto current = breakers_.load(std::memory_order_acquire);
+    if (current->find(name) == current->end()) {
+        return false;
     }
-    return false;
+    auto updated = std::make_shared<BreakerMap>(*current);
+    updated->erase(name);
+    breakers_.store(std::move(updated), std::memory_order_release);
+    SPDLOG_INFO("Removed circuit breaker: {}", name);
+    return true;
 }
 
 void CircuitBreakerRegistry::clear() {
-    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
     
-    size_t count = breakers_.size();
-    breakers_.clear();
+    size_t count = breakers_.load(std::memory_order_acquire)->size();
+    breakers_.store(std::make_shared<const BreakerMap>(), std::memory_order_release);
     
     SPDLOG_INFO("Cleared all {} circuit breakers", count);
 }
 
 std::vector<std::string> CircuitBreakerRegistry::get_all_names() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto breakers = breakers_.load(std::memory_order_acquire);
     
     std::vector<std::string> names;
-    names.reserve(breakers_.size());
+    names.reserve(breakers->size());
     
-    for (const auto& pair : breakers_) {
+    for (const auto& pair : *breakers) {
         names.push_back(pair.first);
     }
     
@@ -365,11 +413,11 @@ std::vector<std::string> CircuitBreakerRegistry::get_all_names() const {
 }
 
 std::unordered_map<std::string, CircuitBreakerStats> CircuitBreakerRegistry::get_all_stats() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto breakers = breakers_.load(std::memory_order_acquire);
     
     std::unordered_map<std::string, CircuitBreakerStats> stats;
     
-    for (const auto& pair : breakers_) {
+    for (const auto& pair : *breakers) {
         // Create a copy by manually copying each atomic field
         const auto& src_stats = pair.second->get_stats();
         CircuitBreakerStats dest_stats;
@@ -382,9 +430,9 @@ std::unordered_map<std::string, CircuitBreakerStats> CircuitBreakerRegistry::get
         dest_stats.consecutive_failures.store(src_stats.consecutive_failures.load());
         dest_stats.consecutive_successes.store(src_stats.consecutive_successes.load());
         
-        dest_stats.last_failure_time = src_stats.last_failure_time;
-        dest_stats.last_success_time = src_stats.last_success_time;
-        dest_stats.last_state_change = src_stats.last_state_change;
+        dest_stats.last_failure_time.store(src_stats.last_failure_time.load());
+        dest_stats.last_success_time.store(src_stats.last_success_time.load());
+        dest_stats.last_state_change.store(src_stats.last_state_change.load());
         
         stats.emplace(pair.first, std::move(dest_stats));
     }
@@ -393,30 +441,107 @@ std::unordered_map<std::string, CircuitBreakerStats> CircuitBreakerRegistry::get
 }
 
 void CircuitBreakerRegistry::set_default_config(const CircuitBreakerConfig& config) {
-    std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
     default_config_ = config;
 }
 
 const CircuitBreakerConfig& CircuitBreakerRegistry::get_default_config() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    std::lock_guard<std::mutex> lock(write_mutex_);
     return default_config_;
 }
 
+bool CircuitBreakerRegistry::load_from_config(const YAML::Node& config) {
+    auto node = config["circuit_breaker"];
+    if (!node) {
+        configure(false, CircuitBreakerConfig{});
+        return true;
+    }
+    CircuitBreakerConfig breaker_config;
+    try {
+        auto duration = [&](const char* field, std::chrono::milliseconds& value) {
+            if (!node[field]) {
+                return true;
+            }
+            auto spec = node[field].as<std::string>();
+            auto parsed = ParseDuration(spec);
+            if (!parsed) {
+                SPDLOG_ERROR("invalid circuit_breaker.{}: {}", field, spec);
+                return false;
+            }
+            value = *parsed;
+            return true;
+        };
+        breaker_config.failure_threshold =
+            node["failure_threshold"].as<uint32_t>(breaker_config.failure_threshold);
+        breaker_config.success_threshold =
+            node["success_threshold"].as<uint32_t>(breaker_config.success_threshold);
+        breaker_config.failure_rate_threshold =
+            node["failure_rate_threshold"].as<double>(breaker_config.failure_rate_threshold);
+        breaker_config.minimum_requests =
+            node["minimum_requests"].as<uint32_t>(breaker_config.minimum_requests);
+        breaker_config.half_open_max_requests =
+            node["half_open_max_requests"].as<uint32_t>(breaker_config.half_open_max_requests);
+        breaker_config.metrics_window_buckets =
+            node["metrics_window_buckets"].as<uint32_t>(breaker_config.metrics_window_buckets);
+        breaker_config.enable_exponential_backoff =
+            node["exponential_backoff"].as<bool>(breaker_config.enable_exponential_backoff);
+        breaker_config.backoff_multiplier =
+            node["backoff_multiplier"].as<double>(breaker_config.backoff_multiplier);
+        if (!duration("timeout", breaker_config.timeout) ||
+            !duration("recovery_timeout", breaker_config.recovery_timeout) ||
+            !duration("max_recovery_timeout", breaker_config.max_recovery_timeout) ||
+            !duration("metrics_window", breaker_config.metrics_window)) {
+            return false;
+        }
+        if (node["failure_status_codes"]) {
+            breaker_config.failure_status_codes =
+                node["failure_status_codes"].as<std::vector<int>>();
+        }
+        configure(node["enabled"].as<bool>(true), breaker_config);
+    } catch (const YAML::Exception& e) {
+        SPDLOG_ERROR("failed to load circuit breaker: {}", e.what());
+        return false;
+    }
+    return true;
+}
+
+void CircuitBreakerRegistry::configure(bool enabled, const CircuitBreakerConfig& config) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    default_config_ = config;
+    for (const auto& pair : *breakers_.load(std::memory_order_acquire)) {
+        pair.second->update_config(config);
+    }
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+std::shared_ptr<CircuitBreaker> CircuitBreakerRegistry::get_for_upstream(const std::string& host,
+                                                                         uint16_t port) {
+    auto name = HttpCircuitBreaker::create_breaker_name(host, port);
+    if (auto breaker = get(name)) {
+        return breaker;
+    }
+    CircuitBreakerConfig config;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        config = default_config_;
+    }
+    return get_or_create(name, config);
+}
+
 size_t CircuitBreakerRegistry::count() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
-    return breakers_.size();
+    return breakers_.load(std::memory_order_acquire)->size();
 }
 
 std::string CircuitBreakerRegistry::get_health_report() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto breakers = breakers_.load(std::memory_order_acquire);
     
     std::ostringstream oss;
     oss << "Circuit Breaker Health Report:\n";
-    oss << "Total breakers: " << breakers_.size() << "\n";
+    oss << "Total breakers: " << breakers->size() << "\n";
     
     size_t open_count = 0, half_open_count = 0, closed_count = 0;
     
-    for (const auto& pair : breakers_) {
+    for (const auto& pair : *breakers) {
         auto state = pair.second->get_state();
         switch (state) {
             case CircuitBreakerState::OPEN: open_count++; break;
@@ -441,13 +566,13 @@ std::string CircuitBreakerRegistry::get_health_report() const {
 }
 
 std::string CircuitBreakerRegistry::export_metrics_json() const {
-    std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+    auto breakers = breakers_.load(std::memory_order_acquire);
     
     std::ostringstream oss;
     oss << "{\"circuit_breakers\":{";
     
     bool first = true;
-    for (const auto& pair : breakers_) {
+    for (const auto& pair : *breakers) {
         if (!first) oss << ",";
         first = false;
         
@@ -469,27 +594,9 @@ HttpCircuitBreaker::HttpCircuitBreaker(const std::string& name, const CircuitBre
 
 CircuitBreakerResult HttpCircuitBreaker::handle_http_response(int status_code, 
                                                              std::chrono::milliseconds response_time) {
-    if (!breaker_->can_proceed()) {
-        return CircuitBreakerResult::CIRCUIT_OPEN;
-    }
-    
-    // Check if response time exceeded timeout
-    if (response_time > breaker_->get_config().timeout) {
-        breaker_->record_timeout();
-        return CircuitBreakerResult::TIMEOUT;
-    }
-    
-    // Check if status code indicates failure
-    const auto& failure_codes = breaker_->get_config().failure_status_codes;
-    bool is_failure = std::find(failure_codes.begin(), failure_codes.end(), status_code) != failure_codes.end();
-    
-    if (is_failure) {
-        breaker_->record_failure();
-        return CircuitBreakerResult::FAILURE;
-    } else {
-        breaker_->record_success(response_time);
-        return CircuitBreakerResult::SUCCESS;
-    }
+    // Admission was checked before the request was sent, checking it again
+    // here would take a half-open slot for a request already done
+    return breaker_->record_response(status_code, response_time);
 }
 
 bool HttpCircuitBreaker::should_retry(CircuitBreakerResult result, int attempt_count) {
@@ -0,0 +1,290 @@
+// adaptive concurrency limits, the limit is discovered from the latency
+// instead of being configured.
+// ref:
+// https://github.com/Netflix/concurrency-limits
+// https://en.wikipedia.org/wiki/Additive_increase/multiplicative_decrease
+#include "../../include/concurrency_limiter.hpp"
+#include "../../include/metrics.hpp"
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <cmath>
+#include <spdlog/spdlog.h>
+#include <yaml-cpp/yaml.h>
+
+namespace azugate {
+
+bool ParseConcurrencyLimitAlgorithm(std::string_view spec,
+                                    ConcurrencyLimitAlgorithm &algorithm) {
+  if (spec == "gradient") {
+    algorithm = ConcurrencyLimitAlgorithm::kGradient;
+  } else if (spec == "aimd") {
+    algorithm = ConcurrencyLimitAlgorithm::kAimd;
+  } else {
+    SPDLOG_WARN("unknown concurrency limit algorithm: {}", spec);
+    return false;
+  }
+  return true;
+}
+
+bool ParseConcurrencyQueueOrder(std::string_view spec,
+                                ConcurrencyQueueOrder &order) {
+  if (spec == "fifo") {
+    order = ConcurrencyQueueOrder::kFifo;
+  } else if (spec == "lifo") {
+    order = ConcurrencyQueueOrder::kLifo;
+  } else {
+    SPDLOG_WARN("unknown concurrency queue order: {}", spec);
+    return false;
+  }
+  return true;
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(std::string name,
+                                       const ConcurrencyLimiterConfig &config)
+    : name_(std::move(name)), config_(config) {
+  config_.min_limit = std::max<size_t>(config_.min_limit, 1);
+  config_.max_limit = std::max(config_.max_limit, config_.min_limit);
+  config_.long_window = std::max<size_t>(config_.long_window, 1);
+  limit_ = static_cast<double>(std::clamp(
+      config_.initial_limit, config_.min_limit, config_.max_limit));
+}
+
+size_t ConcurrencyLimiter::effectiveLimit() const {
+  return std::max(static_cast<size_t>(limit_), config_.min_limit);
+}
+
+void ConcurrencyLimiter::Acquire(boost::asio::io_context &io_context,
+                                 Callback callback) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (in_flight_ < effectiveLimit()) {
+    ++in_flight_;
+    lock.unlock();
+    callback(true);
+    return;
+  }
+  if (queue_.size() >= config_.queue_size) {
+    lock.unlock();
+    SPDLOG_DEBUG("concurrency limiter {}: queue full, request shed", name_);
+    GatewayMetrics::instance().record_concurrency_shed(name_, "queue_full");
+    callback(false);
+    return;
+  }
+  auto waiter = std::make_shared<Waiter>();
+  waiter->io_context = &io_context;
+  waiter->callback = std::move(callback);
+  waiter->timer = std::make_unique<boost::asio::steady_timer>(
+      io_context, config_.queue_timeout);
+  waiter->timer->async_wait(
+      [self = shared_from_this(), waiter](boost::system::error_code ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+          self->onQueueTimeout(waiter);
+        }
+      });
+  queue_.push_back(std::move(waiter));
+}
+
+void ConcurrencyLimiter::onQueueTimeout(const std::shared_ptr<Waiter> &waiter) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiter->done) {
+      return;
+    }
+    waiter->done = true;
+    queue_.erase(std::find(queue_.begin(), queue_.end(), waiter));
+  }
+  SPDLOG_DEBUG("concurrency limiter {}: queue timeout, request shed", name_);
+  GatewayMetrics::instance().record_concurrency_shed(name_, "queue_timeout");
+  waiter->callback(false);
+}
+
+void ConcurrencyLimiter::Release(std::chrono::nanoseconds latency,
+                                 bool dropped) {
+  std::vector<std::shared_ptr<Waiter>> admitted;
+  size_t limit, in_flight, queue_depth;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    updateLimit(static_cast<double>(latency.count()), dropped, in_flight_);
+    --in_flight_;
+    limit = effectiveLimit();
+    while (in_flight_ < limit && !queue_.empty()) {
+      std::shared_ptr<Waiter> waiter;
+      if (config_.queue_order == ConcurrencyQueueOrder::kFifo) {
+        waiter = std::move(queue_.front());
+        queue_.pop_front();
+      } else {
+        waiter = std::move(queue_.back());
+        queue_.pop_back();
+      }
+      waiter->done = true;
+      ++in_flight_;
+      admitted.emplace_back(std::move(waiter));
+    }
+    in_flight = in_flight_;
+    queue_depth = queue_.size();
+  }
+  // the releasing thread may run another io_context, the timer is only
+  // touched from the one it was created on.
+  for (auto &waiter : admitted) {
+    boost::asio::post(*waiter->io_context, [waiter]() {
+      waiter->timer->cancel();
+      waiter->callback(true);
+    });
+  }
+  publishMetrics(limit, in_flight, queue_depth);
+}
+
+void ConcurrencyLimiter::updateLimit(double latency_ns, bool dropped,
+                                     size_t in_flight) {
+  const double min_limit = static_cast<double>(config_.min_limit);
+  const double max_limit = static_cast<double>(config_.max_limit);
+  // a limit that isn't used can't be validated, don't let it drift up.
+  const bool app_limited = static_cast<double>(in_flight) * 2 < limit_;
+
+  if (config_.algorithm == ConcurrencyLimitAlgorithm::kAimd) {
+    if (dropped || latency_ns > std::chrono::duration<double, std::nano>(
+                                    config_.latency_threshold)
+                                    .count()) {
+      limit_ = std::max(limit_ * config_.backoff_ratio, min_limit);
+    } else if (!app_limited) {
+      limit_ = std::min(limit_ + 1, max_limit);
+    }
+    return;
+  }
+
+  latency_ns = std::max(latency_ns, 1.0);
+  if (long_rtt_ == 0) {
+    long_rtt_ = latency_ns;
+  } else {
+    long_rtt_ += (latency_ns - long_rtt_) / config_.long_window;
+  }
+  // after a long slowdown the average lags far behind, let it catch up.
+  if (long_rtt_ / latency_ns > 2) {
+    long_rtt_ *= 0.95;
+  }
+  if (app_limited && !dropped) {
+    return;
+  }
+  double gradient =
+      dropped ? 0.5
+              : std::clamp(config_.rtt_tolerance * long_rtt_ / latency_ns, 0.5,
+                           1.0);
+  // sqrt(limit) leaves room for a small queue at the upstream, which is
+  // what lets the limit probe upwards while the latency is stable.
+  double new_limit = limit_ * gradient + std::sqrt(limit_);
+  limit_ = limit_ * (1 - config_.smoothing) + new_limit * config_.smoothing;
+  limit_ = std::clamp(limit_, min_limit, max_limit);
+}
+
+void ConcurrencyLimiter::publishMetrics(size_t limit, size_t in_flight,
+                                        size_t queue_depth) {
+  GatewayMetrics::instance().record_concurrency_limit(name_, limit, in_flight,
+                                                      queue_depth);
+}
+
+size_t ConcurrencyLimiter::Limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return effectiveLimit();
+}
+
+size_t ConcurrencyLimiter::InFlight() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_flight_;
+}
+
+size_t ConcurrencyLimiter::QueueDepth() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+ConcurrencyLimiterRegistry &ConcurrencyLimiterRegistry::Instance() {
+  static ConcurrencyLimiterRegistry registry;
+  return registry;
+}
+
+bool ConcurrencyLimiterRegistry::LoadFromConfig(const YAML::Node &config) {
+  auto node = config["concurrency_limiter"];
+  if (!node) {
+    Configure(false, ConcurrencyLimiterConfig{});
+    return true;
+  }
+  ConcurrencyLimiterConfig limiter_config;
+  try {
+    if (node["algorithm"] &&
+        !ParseConcurrencyLimitAlgorithm(node["algorithm"].as<std::string>(),
+                                        limiter_config.algorithm)) {
+      return false;
+    }
+    limiter_config.initial_limit =
+        node["initial_limit"].as<size_t>(limiter_config.initial_limit);
+    limiter_config.min_limit =
+        node["min_limit"].as<size_t>(limiter_config.min_limit);
+    limiter_config.max_limit =
+        node["max_limit"].as<size_t>(limiter_config.max_limit);
+    limiter_config.rtt_tolerance =
+        node["rtt_tolerance"].as<double>(limiter_config.rtt_tolerance);
+    limiter_config.backoff_ratio =
+        node["backoff_ratio"].as<double>(limiter_config.backoff_ratio);
+    limiter_config.latency_threshold = std::chrono::milliseconds(
+        node["latency_threshold_ms"].as<int64_t>(
+            limiter_config.latency_threshold.count()));
+    if (auto queue = node["queue"]) {
+      limiter_config.queue_size =
+          queue["size"].as<size_t>(limiter_config.queue_size);
+      if (queue["order"] &&
+          !ParseConcurrencyQueueOrder(queue["order"].as<std::string>(),
+                                      limiter_config.queue_order)) {
+        return false;
+      }
+      limiter_config.queue_timeout = std::chrono::milliseconds(
+          queue["timeout_ms"].as<int64_t>(
+              limiter_config.queue_timeout.count()));
+    }
+    Configure(node["enabled"].as<bool>(false), limiter_config);
+  } catch (const YAML::Exception &e) {
+    SPDLOG_ERROR("failed to load concurrency limiter: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+void ConcurrencyLimiterRegistry::Configure(
+    bool enabled, const ConcurrencyLimiterConfig &config) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  enabled_ = enabled;
+  if (config_ == config) {
+    return;
+  }
+  config_ = config;
+  limiters_.clear();
+}
+
+std::shared_ptr<ConcurrencyLimiter>
+ConcurrencyLimiterRegistry::Get(const std::string &name) {
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (!enabled_) {
+      return nullptr;
+    }
+    auto it = limiters_.find(name);
+    if (it != limiters_.end()) {
+      return it->second;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (!enabled_) {
+    return nullptr;
+  }
+  auto &limiter = limiters_[name];
+  if (!limiter) {
+    limiter = std::make_shared<ConcurrencyLimiter>(name, config_);
+    SPDLOG_DEBUG("created concurrency limiter for {}", name);
+  }
+  return limiter;
+}
+
+bool ConcurrencyLimiterRegistry::Enabled() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return enabled_;
+}
+
+} // namespace azugate
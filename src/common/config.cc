@@ -1,7 +1,16 @@
 #include "../../include/config.h"
 #include "auth.h"
+#include "ip_filter.hpp"
+#include "load_balancer.hpp"
 #include "protocols.h"
+#include "retry_policy.hpp"
+#include "hedging.hpp"
+#include "http_cache.hpp"
+#include "string_op.h"
+#include "vhost.hpp"
 #include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -71,12 +80,34 @@ void IgnoreSignalPipe() {
 }
 
 // router.
+// round robin position, advanced by the lookups of a published router.
+struct RoundRobinIndex {
+  std::atomic<size_t> value{0};
+
+  RoundRobinIndex() = default;
+  RoundRobinIndex(const RoundRobinIndex &other)
+      : value(other.value.load(std::memory_order_relaxed)) {}
+  RoundRobinIndex &operator=(const RoundRobinIndex &other) {
+    value.store(other.value.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    return *this;
+  }
+};
+
 struct RouterEntry {
   // used for round robin.
-  size_t next_index;
+  mutable RoundRobinIndex next_index;
   std::vector<ConnectionInfo> targets;
+  // picks among the targets when they are all remote.
+  std::shared_ptr<LoadBalancer> balancer;
+  // null or disabled if failed requests aren't retried.
+  std::shared_ptr<const RetryPolicy> retry_policy;
+  // null if the requests aren't hedged, kept while the policy is the same
+  // so the latency observed so far isn't lost.
+  std::shared_ptr<RouteHedging> hedging;
+  std::shared_ptr<const RouteCachePolicy> cache_policy;
 
-  void AddTarget(ConnectionInfo &&conn) {
+  void AddTarget(ConnectionInfo &&conn, const BalancingPolicy &policy = {}) {
     auto pred = [&](const ConnectionInfo &c) {
       return conn.address == c.address && conn.http_url == c.http_url &&
              conn.port == c.port && conn.type == c.type &&
@@ -84,45 +115,193 @@ struct RouterEntry {
     };
     auto it = std::find_if(targets.begin(), targets.end(), pred);
     if (it == targets.end()) {
+      if (conn.remote) {
+        if (!balancer) {
+          balancer = std::make_shared<LoadBalancer>(
+              policy.strategy.value_or(LoadBalancingStrategy::RoundRobin));
+        }
+        addServer(conn);
+      }
       targets.emplace_back(conn);
     }
+    if (balancer) {
+      ApplyPolicy(policy);
+    }
     return;
   }
 
+  void ApplyPolicy(const BalancingPolicy &policy) {
+    if (policy.strategy) {
+      balancer->set_strategy(*policy.strategy);
+    }
+    if (policy.outlier_detection) {
+      balancer->set_outlier_detection(*policy.outlier_detection);
+    }
+    if (policy.slow_start) {
+      balancer->set_slow_start(*policy.slow_start);
+    }
+    if (policy.retry) {
+      retry_policy = policy.retry->max_retries > 0 ? policy.retry : nullptr;
+    }
+    if (policy.hedge) {
+      if (!policy.hedge->enabled) {
+        hedging = nullptr;
+      } else if (!hedging || hedging->Policy() != *policy.hedge) {
+        hedging = std::make_shared<RouteHedging>(*policy.hedge);
+      }
+    }
+    if (policy.cache) {
+      cache_policy = policy.cache;
+    }
+    if (policy.health_check) {
+      if (policy.health_check->enabled) {
+        balancer->set_health_check_config(*policy.health_check);
+      }
+      balancer->enable_health_checks(policy.health_check->enabled);
+    }
+    if (policy.hash_key.empty() && !policy.hash_balance_factor) {
+      return;
+    }
+    auto hash_key = policy.hash_key.empty()
+                        ? std::optional<HashKey>(HashKey{})
+                        : parse_hash_key(policy.hash_key);
+    if (!hash_key) {
+      SPDLOG_WARN("unknown hash key: {}", policy.hash_key);
+      return;
+    }
+    balancer->set_hash_policy(
+        *hash_key, policy.hash_balance_factor.value_or(kDftHashBalanceFactor));
+  }
+
   // TODO: exact match & prefix match.
   void RemoveTarget(const ConnectionInfo &conn) {
     auto it = std::remove(targets.begin(), targets.end(), conn);
     if (it != targets.end()) {
-      targets.erase(it, targets.end());
-      if (next_index >= targets.size() && !targets.empty()) {
-        next_index %= targets.size();
+      for (auto removed = it; removed != targets.end(); ++removed) {
+        if (balancer && removed->remote) {
+          balancer->remove_server(removed->address, removed->port);
+        }
       }
+      targets.erase(it, targets.end());
     }
   }
 
-  std::optional<ConnectionInfo> GetNextTarget() {
+  // local targets are mixed in with plain round robin. the balancer may
+  // be shared with the next router, only the targets tell.
+  bool Balanced() const {
+    return balancer &&
+           std::all_of(targets.begin(), targets.end(),
+                       [](const ConnectionInfo &c) { return c.remote; });
+  }
+
+  std::optional<ConnectionInfo> GetNextTarget() const {
     if (targets.empty()) {
       return std::nullopt;
     }
-    ConnectionInfo &result = targets[next_index];
-    next_index = (next_index + 1) % targets.size();
-    return result;
+    auto index =
+        next_index.value.fetch_add(1, std::memory_order_relaxed) %
+        targets.size();
+    return targets[index];
   }
 
   bool Contains(const ConnectionInfo &conn) const {
     return std::find(targets.begin(), targets.end(), conn) != targets.end();
   }
+
+  // the entry replacing `previous` on a reload takes over its balancer and
+  // hedging, the upstreams keep their health and latency history.
+  static RouterEntry Inherit(const RouterEntry &previous) {
+    RouterEntry entry{};
+    entry.balancer = previous.balancer;
+    entry.retry_policy = previous.retry_policy;
+    entry.hedging = previous.hedging;
+    entry.cache_policy = previous.cache_policy;
+    return entry;
+  }
+
+  // drops the inherited servers that are no longer targets.
+  void PruneServers() {
+    if (!balancer) {
+      return;
+    }
+    for (const auto &server : balancer->get_all_servers()) {
+      auto it = std::find_if(
+          targets.begin(), targets.end(), [&](const ConnectionInfo &c) {
+            return c.remote && c.address == server->address() &&
+                   c.port == server->port();
+          });
+      if (it == targets.end()) {
+        balancer->remove_server(server->address(), server->port());
+      }
+    }
+    if (balancer->total_servers() == 0) {
+      balancer = nullptr;
+    }
+  }
+
+private:
+  // an inherited server is kept unless its weight changed.
+  void addServer(const ConnectionInfo &conn) {
+    for (const auto &server : balancer->get_all_servers()) {
+      if (server->address() == conn.address && server->port() == conn.port) {
+        if (server->weight() == conn.weight) {
+          return;
+        }
+        balancer->remove_server(conn.address, conn.port);
+        break;
+      }
+    }
+    balancer->add_server(conn, conn.weight);
+  }
+};
+
+struct ConditionalRoute {
+  ConnectionInfo source;
+  RequestMatcher matcher;
+  RouterEntry entry;
+};
+
+// every virtual host owns one route table.
+struct RouteTable {
+  std::unordered_map<ConnectionInfo, RouterEntry> exact_routes;
+  std::vector<std::pair<ConnectionInfo, RouterEntry>> prefix_routes;
+  // routes with match conditions, first match wins.
+  std::vector<ConditionalRoute> conditional_routes;
 };
 
-std::unordered_map<ConnectionInfo, RouterEntry> g_exact_routes;
-std::vector<std::pair<ConnectionInfo, RouterEntry>> g_prefix_routes;
+struct Router {
+  // routes without a host, also used when no virtual host matches.
+  RouteTable default_table;
+  std::vector<RouteTable> vhost_tables;
+  VirtualHostIndex vhost_index;
+  // host pattern -> index of vhost_tables.
+  std::unordered_map<std::string, size_t> vhost_ids;
+};
+
+// a route as passed to AddRoute().
+struct RouteSpec {
+  ConnectionInfo source;
+  ConnectionInfo target;
+  RequestMatcher matcher;
+  BalancingPolicy policy;
+};
+
+// lookups only load the current router, changes publish a new one under
+// g_config_mutex.
+std::atomic<std::shared_ptr<const Router>> g_router{
+    std::make_shared<const Router>()};
+// routes added outside of the config file, e.g. by the file proxy mode,
+// replayed when the routes are reloaded.
+std::vector<RouteSpec> g_added_routes;
 // token.
 std::string g_authorization_token_secret;
 
 // rate limitor
-bool g_enable_rate_limiter = false;
+std::atomic<bool> g_enable_rate_limiter{false};
 size_t g_num_token_per_sec = 100;
 size_t g_num_token_max = 1000;
+std::string g_rate_limiter_key = "client_ip";
+std::string g_rate_limiter_shm_path;
 // io
 size_t g_num_threads = 4;
 // healthz.
@@ -150,14 +329,19 @@ std::unordered_set<std::string> GetIpBlackList() {
   return g_ip_blacklist;
 };
 
+// the set is kept for listing, the filtering itself is done by IpFilter.
 void AddBlacklistIp(const std::string &&ip) {
   std::lock_guard<std::mutex> lock(g_config_mutex);
   // TODO: return more details.
-  g_ip_blacklist.insert(ip);
+  if (IpFilter::Instance().AddRule(ip, IpAction::kDeny)) {
+    g_ip_blacklist.insert(ip);
+  }
 }
 
 void RemoveBlacklistIp(const std::string &&ip) {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
   // TODO: return more details.
+  IpFilter::Instance().RemoveRule(ip, IpAction::kDeny);
   g_ip_blacklist.erase(ip);
 }
 
@@ -192,6 +376,26 @@ std::pair<size_t, size_t> GetRateLimitorConfig() {
   return std::pair<size_t, size_t>(g_num_token_max, g_num_token_per_sec);
 }
 
+void SetRateLimitorKey(const std::string &key) {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  g_rate_limiter_key = key;
+}
+
+std::string GetRateLimitorKey() {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  return g_rate_limiter_key;
+}
+
+void SetRateLimitorSharedMemory(const std::string &path) {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  g_rate_limiter_shm_path = path;
+}
+
+std::string GetRateLimitorSharedMemory() {
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  return g_rate_limiter_shm_path;
+}
+
 void AddHealthzList(std::string &&addr) {
   std::lock_guard<std::mutex> lock(g_config_mutex);
   g_healthz_list.emplace_back(addr);
@@ -217,79 +421,709 @@ inline bool prefixMatchEqual(const ConnectionInfo &source_conn_info,
   return prefix_match && type_match;
 }
 
-void AddRoute(ConnectionInfo &&source, ConnectionInfo &&target) {
-  std::lock_guard<std::mutex> lock(g_config_mutex);
-  
+static RouteTable &routeTableForPattern(Router &router,
+                                        const std::string &host_pattern) {
+  if (host_pattern.empty()) {
+    return router.default_table;
+  }
+  auto it = router.vhost_ids.find(host_pattern);
+  if (it != router.vhost_ids.end()) {
+    return router.vhost_tables[it->second];
+  }
+  size_t id = router.vhost_tables.size();
+  if (!router.vhost_index.Insert(host_pattern, id)) {
+    SPDLOG_WARN("fall back to the default virtual host for {}", host_pattern);
+    return router.default_table;
+  }
+  router.vhost_ids.emplace(host_pattern, id);
+  router.vhost_tables.emplace_back();
+  SPDLOG_DEBUG("add virtual host: {}", host_pattern);
+  return router.vhost_tables.back();
+}
+
+// null if `router` has no table for `host_pattern`.
+static const RouteTable *findRouteTable(const Router &router,
+                                        const std::string &host_pattern) {
+  if (host_pattern.empty()) {
+    return &router.default_table;
+  }
+  auto it = router.vhost_ids.find(host_pattern);
+  return it != router.vhost_ids.end() ? &router.vhost_tables[it->second]
+                                      : nullptr;
+}
+
+static const RouteTable &routeTableForHost(const Router &router,
+                                           const std::string &host) {
+  if (host.empty() || router.vhost_tables.empty()) {
+    return router.default_table;
+  }
+  auto id = router.vhost_index.Lookup(host);
+  if (!id) {
+    return router.default_table;
+  }
+  return router.vhost_tables[*id];
+}
+
+static std::string normalizeHostPattern(const std::string &host_pattern) {
+  if (!host_pattern.empty() && !host_pattern.starts_with("*.")) {
+    return NormalizeHost(host_pattern);
+  }
+  return utils::toLower(host_pattern);
+}
+
+// a new route of `router` inherits from the same route of `previous`, if
+// there is one.
+static void addRoute(Router &router, const Router *previous,
+                     ConnectionInfo &&source, ConnectionInfo &&target,
+                     RequestMatcher &&matcher, const BalancingPolicy &policy) {
+  auto host_pattern = normalizeHostPattern(source.host);
+  auto &table = routeTableForPattern(router, host_pattern);
+  const RouteTable *previous_table =
+      previous ? findRouteTable(*previous, host_pattern) : nullptr;
+
+  if (!matcher.Empty()) {
+    SPDLOG_DEBUG("add conditional rule: {}{} -> {}", host_pattern,
+                 source.http_url, target.http_url);
+    for (auto &route : table.conditional_routes) {
+      if (route.source.type == source.type &&
+          route.source.http_url == source.http_url &&
+          route.matcher == matcher) {
+        route.entry.AddTarget(std::move(target), policy);
+        return;
+      }
+    }
+    RouterEntry router_entry{};
+    if (previous_table) {
+      for (const auto &route : previous_table->conditional_routes) {
+        if (route.source.type == source.type &&
+            route.source.http_url == source.http_url &&
+            route.matcher == matcher) {
+          router_entry = RouterEntry::Inherit(route.entry);
+          break;
+        }
+      }
+    }
+    router_entry.AddTarget(std::move(target), policy);
+    table.conditional_routes.emplace_back(ConditionalRoute{
+        .source = std::move(source),
+        .matcher = std::move(matcher),
+        .entry = std::move(router_entry),
+    });
+    return;
+  }
+
   if (source.http_url.find("*") != std::string::npos) {
-    SPDLOG_DEBUG("add prefix match rule: {} -> {}", source.http_url,
-                 target.http_url);
-    for (auto &route : g_prefix_routes) {
-      auto http_url = route.first.http_url;
+    SPDLOG_DEBUG("add prefix match rule: {}{} -> {}", host_pattern,
+                 source.http_url, target.http_url);
+    for (auto &route : table.prefix_routes) {
       if (prefixMatchEqual(source, route.first)) {
-        route.second.AddTarget(std::move(target));
+        route.second.AddTarget(std::move(target), policy);
         return;
       }
     }
     RouterEntry router_entry{};
-    router_entry.AddTarget(std::move(target));
-    g_prefix_routes.emplace_back(std::move(source), std::move(router_entry));
+    if (previous_table) {
+      for (const auto &route : previous_table->prefix_routes) {
+        if (prefixMatchEqual(source, route.first)) {
+          router_entry = RouterEntry::Inherit(route.second);
+          break;
+        }
+      }
+    }
+    router_entry.AddTarget(std::move(target), policy);
+    table.prefix_routes.emplace_back(std::move(source),
+                                     std::move(router_entry));
     return;
   }
   // exact match.
-  auto er_it = g_exact_routes.find(source);
-  if (er_it != g_exact_routes.end()) {
-    er_it->second.AddTarget(std::move(target));
+  auto er_it = table.exact_routes.find(source);
+  if (er_it != table.exact_routes.end()) {
+    er_it->second.AddTarget(std::move(target), policy);
     return;
   }
   RouterEntry router_entry{};
-  router_entry.AddTarget(std::move(target));
-  g_exact_routes.emplace(std::move(source), std::move(router_entry));
+  if (previous_table) {
+    auto previous_it = previous_table->exact_routes.find(source);
+    if (previous_it != previous_table->exact_routes.end()) {
+      router_entry = RouterEntry::Inherit(previous_it->second);
+    }
+  }
+  router_entry.AddTarget(std::move(target), policy);
+  table.exact_routes.emplace(std::move(source), std::move(router_entry));
   return;
 }
 
-std::optional<ConnectionInfo> GetTargetRoute(const ConnectionInfo &source) {
+static void pruneServers(RouteTable &table) {
+  for (auto &route : table.exact_routes) {
+    route.second.PruneServers();
+  }
+  for (auto &route : table.prefix_routes) {
+    route.second.PruneServers();
+  }
+  for (auto &route : table.conditional_routes) {
+    route.entry.PruneServers();
+  }
+}
+
+void AddRoute(ConnectionInfo &&source, ConnectionInfo &&target) {
+  AddRoute(std::move(source), std::move(target), RequestMatcher{});
+}
+
+void AddRoute(ConnectionInfo &&source, ConnectionInfo &&target,
+              RequestMatcher &&matcher,
+              const BalancingPolicy &policy) {
   std::lock_guard<std::mutex> lock(g_config_mutex);
-  SPDLOG_DEBUG("Looking for route for: {} (type: {})", source.http_url, source.type);
-  
+  g_added_routes.emplace_back(RouteSpec{
+      .source = source, .target = target, .matcher = matcher, .policy = policy});
+  auto router = std::make_shared<Router>(*g_router.load(std::memory_order_acquire));
+  addRoute(*router, nullptr, std::move(source), std::move(target),
+           std::move(matcher), policy);
+  g_router.store(std::move(router), std::memory_order_release);
+}
+
+// rewrite "/target/*" with the part of the source url after the prefix.
+static void rewritePrefixTarget(const ConnectionInfo &source,
+                                ConnectionInfo &target) {
+  auto &target_url = target.http_url;
+  if (target_url.size() >= 2 &&
+      target_url.compare(target_url.size() - 2, 2, "/*") == 0) {
+    std::string target_prefix = target_url.substr(0, target_url.size() - 2);
+    std::string suffix = source.http_url;
+    if (suffix.find(target_prefix) == 0) {
+      suffix = suffix.substr(target_prefix.size());
+    }
+    if (!target_prefix.empty() && target_prefix.back() != '/' &&
+        (suffix.empty() || suffix.front() != '/')) {
+      target_prefix += '/';
+    }
+    target_url = target_prefix + suffix;
+  }
+}
+
+static const RouterEntry *findRouterEntry(const Router &router,
+                                          const ConnectionInfo &source,
+                                          const RequestView *request,
+                                          bool &is_prefix) {
+  auto &table = routeTableForHost(router, source.host);
+
+  // conditional routes first, their exact paths ignore the query string.
+  if (request != nullptr) {
+    std::string_view source_path(source.http_url);
+    source_path = source_path.substr(0, source_path.find('?'));
+    for (auto &route : table.conditional_routes) {
+      is_prefix = route.source.http_url.find('*') != std::string::npos;
+      bool path_match = is_prefix ? prefixMatchEqual(source, route.source)
+                                  : route.source.type == source.type &&
+                                        route.source.http_url == source_path;
+      if (!path_match || route.entry.targets.empty() ||
+          !route.matcher.Matches(*request)) {
+        continue;
+      }
+      return &route.entry;
+    }
+  }
+
   // exact match first.
-  auto it = g_exact_routes.find(source);
-  if (it != g_exact_routes.end() && !it->second.targets.empty()) {
+  is_prefix = false;
+  auto it = table.exact_routes.find(source);
+  if (it != table.exact_routes.end() && !it->second.targets.empty()) {
     SPDLOG_DEBUG("Found exact route match");
-    auto next_target = it->second.GetNextTarget();
-    return next_target;
+    return &it->second;
   }
-  
+
   // prefix match.
-  SPDLOG_DEBUG("Checking {} prefix routes", g_prefix_routes.size());
-  for (auto &route : g_prefix_routes) {
+  is_prefix = true;
+  SPDLOG_DEBUG("Checking {} prefix routes", table.prefix_routes.size());
+  for (auto &route : table.prefix_routes) {
     SPDLOG_DEBUG("Checking prefix route: {} vs {}", source.http_url, route.first.http_url);
-    if (!prefixMatchEqual(source, route.first)) {
+    if (!prefixMatchEqual(source, route.first) ||
+        route.second.targets.empty()) {
       SPDLOG_DEBUG("Prefix match failed");
       continue;
     }
     SPDLOG_DEBUG("Prefix match succeeded!");
-    auto target = route.second.GetNextTarget();
-    auto &target_url = target->http_url;
-    if (target_url.size() >= 2 &&
-        target_url.compare(target_url.size() - 2, 2, "/*") == 0) {
-      std::string target_prefix = target_url.substr(0, target_url.size() - 2);
-      std::string suffix = source.http_url;
-      if (suffix.find(target_prefix) == 0) {
-        suffix = suffix.substr(target_prefix.size());
+    return &route.second;
+  }
+  return nullptr;
+}
+
+std::optional<ConnectionInfo> GetTargetRoute(const ConnectionInfo &source,
+                                             const RequestView *request) {
+  std::optional<ConnectionInfo> target;
+  bool is_prefix = false;
+  // the router is immutable once published, no lock is needed.
+  auto router = g_router.load(std::memory_order_acquire);
+  SPDLOG_DEBUG("Looking for route for: {}{} (type: {})", source.host,
+               source.http_url, source.type);
+  auto *entry = findRouterEntry(*router, source, request, is_prefix);
+  if (entry == nullptr) {
+    SPDLOG_WARN("no path found for: {}{}", source.host, source.http_url);
+    return std::nullopt;
+  }
+  if (!entry->Balanced()) {
+    target = entry->GetNextTarget();
+  } else {
+    // the load balancer works on its own snapshot.
+    auto server = entry->balancer->get_server(source.address, request);
+    if (server) {
+      target = server->target();
+      target->upstream = std::move(server);
+    } else {
+      SPDLOG_WARN("no available upstream for: {}{}", source.host,
+                  source.http_url);
+      target = ConnectionInfo{.type = source.type, .remote = true};
+    }
+    target->load_balancer = entry->balancer;
+    target->retry_policy = entry->retry_policy;
+    target->hedging = entry->hedging;
+    target->cache_policy = entry->cache_policy;
+  }
+  if (is_prefix && target) {
+    rewritePrefixTarget(source, *target);
+  }
+  return target;
+}
+
+size_t GetRouterTableSize() {
+  auto router = g_router.load(std::memory_order_acquire);
+  size_t size = router->default_table.exact_routes.size();
+  for (auto &table : router->vhost_tables) {
+    size += table.exact_routes.size();
+  }
+  return size;
+}
+
+size_t GetVirtualHostCount() {
+  return g_router.load(std::memory_order_acquire)->vhost_tables.size();
+}
+
+// compile the `match` section of a route, e.g.
+//   match:
+//     methods: ["GET"]
+//     headers: [{name: "x-canary", exact: "1"}]
+//     query: [{name: "version", prefix: "v2"}]
+//     cookies: [{name: "beta", present: true, invert: true}]
+static bool compileRequestMatcher(const YAML::Node &match,
+                                  RequestMatcher &matcher) {
+  if (match["methods"]) {
+    for (const auto &method : match["methods"]) {
+      if (!matcher.AddMethod(method.as<std::string>())) {
+        return false;
       }
-      if (!target_prefix.empty() && target_prefix.back() != '/' &&
-          (suffix.empty() || suffix.front() != '/')) {
-        target_prefix += '/';
+    }
+  }
+  const std::pair<const char *, MatchSource> sources[] = {
+      {"headers", MatchSource::kHeader},
+      {"query", MatchSource::kQuery},
+      {"cookies", MatchSource::kCookie},
+  };
+  const std::pair<const char *, MatchOp> ops[] = {
+      {"exact", MatchOp::kExact},
+      {"prefix", MatchOp::kPrefix},
+      {"suffix", MatchOp::kSuffix},
+      {"contains", MatchOp::kContains},
+  };
+  for (const auto &[field, source] : sources) {
+    if (!match[field]) {
+      continue;
+    }
+    for (const auto &condition : match[field]) {
+      if (!condition["name"]) {
+        SPDLOG_WARN("match condition in {} without a name", field);
+        return false;
       }
-      target->http_url = target_prefix + suffix;
+      auto name = condition["name"].as<std::string>();
+      auto op = MatchOp::kPresent;
+      std::string value;
+      for (const auto &[op_field, op_value] : ops) {
+        if (condition[op_field]) {
+          op = op_value;
+          value = condition[op_field].as<std::string>();
+          break;
+        }
+      }
+      bool invert = condition["invert"] && condition["invert"].as<bool>();
+      matcher.AddCondition(source, name, op, value, invert);
     }
-    return target;
   }
-  SPDLOG_WARN("no path found for: {}", source.http_url);
+  return true;
+}
+
+// `outlier_detection: {enabled, consecutive_errors, interval_ms, ...}`,
+// the fields left out keep their value in `config`.
+static void parseOutlierDetection(const YAML::Node &node,
+                                  OutlierDetectionConfig &config) {
+  auto millis = [&](const char *field, std::chrono::milliseconds &value) {
+    value = std::chrono::milliseconds(node[field].as<int64_t>(value.count()));
+  };
+  config.enabled = node["enabled"].as<bool>(true);
+  config.consecutive_errors =
+      node["consecutive_errors"].as<int>(config.consecutive_errors);
+  millis("interval_ms", config.interval);
+  millis("base_ejection_time_ms", config.base_ejection_time);
+  millis("max_ejection_time_ms", config.max_ejection_time);
+  config.max_ejection_percent =
+      node["max_ejection_percent"].as<int>(config.max_ejection_percent);
+  config.success_rate_minimum_hosts = node["success_rate_minimum_hosts"].as<int>(
+      config.success_rate_minimum_hosts);
+  config.success_rate_request_volume =
+      node["success_rate_request_volume"].as<int>(
+          config.success_rate_request_volume);
+  config.success_rate_stdev_factor = node["success_rate_stdev_factor"].as<double>(
+      config.success_rate_stdev_factor);
+  config.failure_percentage_threshold =
+      node["failure_percentage_threshold"].as<int>(
+          config.failure_percentage_threshold);
+  config.latency_factor =
+      node["latency_factor"].as<double>(config.latency_factor);
+}
+
+// `slow_start: {enabled, window_ms, aggression, min_weight_percent}`, the
+// fields left out keep their value in `config`.
+static void parseSlowStart(const YAML::Node &node, SlowStartConfig &config) {
+  config.enabled = node["enabled"].as<bool>(true);
+  config.window = std::chrono::milliseconds(
+      node["window_ms"].as<int64_t>(config.window.count()));
+  config.aggression = node["aggression"].as<double>(config.aggression);
+  config.min_weight_percent =
+      node["min_weight_percent"].as<int>(config.min_weight_percent);
+}
+
+std::optional<std::chrono::milliseconds> ParseDuration(std::string_view spec) {
+  size_t digits = 0;
+  while (digits < spec.size() &&
+         std::isdigit(static_cast<unsigned char>(spec[digits]))) {
+    ++digits;
+  }
+  if (digits == 0 || digits > 12) {
+    return std::nullopt;
+  }
+  auto value = std::stoll(std::string(spec.substr(0, digits)));
+  auto unit = spec.substr(digits);
+  if (unit == "ms") {
+    return std::chrono::milliseconds(value);
+  }
+  if (unit.empty() || unit == "s") {
+    return std::chrono::seconds(value);
+  }
+  if (unit == "m") {
+    return std::chrono::minutes(value);
+  }
+  if (unit == "h") {
+    return std::chrono::hours(value);
+  }
+  if (unit == "d") {
+    return std::chrono::hours(24 * value);
+  }
   return std::nullopt;
 }
 
-size_t GetRouterTableSize() { return g_exact_routes.size(); }
+// `retry: {max_retries, retry_on, base_backoff, max_backoff}`, the fields
+// left out keep their value in `policy`.
+static void parseRetryPolicy(const YAML::Node &node, RetryPolicy &policy) {
+  policy.max_retries = node["max_retries"].as<int>(policy.max_retries);
+  if (node["retry_on"]) {
+    auto conditions = node["retry_on"].as<std::vector<std::string>>();
+    std::vector<std::string_view> views(conditions.begin(), conditions.end());
+    auto parsed = policy;
+    if (ParseRetryOn(views, parsed)) {
+      policy = std::move(parsed);
+    }
+  }
+  auto duration = [&](const char *field, std::chrono::milliseconds &value) {
+    if (!node[field]) {
+      return;
+    }
+    auto spec = node[field].as<std::string>();
+    if (auto parsed = ParseDuration(spec)) {
+      value = *parsed;
+    } else {
+      SPDLOG_WARN("invalid retry {}: {}", field, spec);
+    }
+  };
+  duration("base_backoff", policy.base_backoff);
+  duration("max_backoff", policy.max_backoff);
+}
+
+// `hedge: {enabled, delay, min_delay}`, the fields left out keep their
+// value in `policy`. `delay` is a duration or a percentile like "p95".
+static void parseHedgePolicy(const YAML::Node &node, HedgePolicy &policy) {
+  policy.enabled = node["enabled"].as<bool>(policy.enabled);
+  if (node["delay"]) {
+    auto parsed = policy;
+    if (ParseHedgeDelay(node["delay"].as<std::string>(), parsed)) {
+      policy = std::move(parsed);
+    }
+  }
+  if (node["min_delay"]) {
+    auto spec = node["min_delay"].as<std::string>();
+    if (auto parsed = ParseDuration(spec)) {
+      policy.min_delay = *parsed;
+    } else {
+      SPDLOG_WARN("invalid hedge min_delay: {}", spec);
+    }
+  }
+}
+
+// `cache: {stale_while_revalidate, stale_if_error}` of a route, the
+// fields left out fall back to the global `cache` section.
+static void parseRouteCachePolicy(const YAML::Node &node,
+                                  RouteCachePolicy &policy) {
+  auto duration = [&](const char *field,
+                      std::optional<std::chrono::seconds> &value) {
+    if (!node[field]) {
+      return;
+    }
+    auto spec = node[field].as<std::string>();
+    if (auto parsed = ParseDuration(spec)) {
+      value = std::chrono::duration_cast<std::chrono::seconds>(*parsed);
+    } else {
+      SPDLOG_WARN("invalid route cache {}: {}", field, spec);
+    }
+  };
+  duration("stale_while_revalidate", policy.stale_while_revalidate);
+  duration("stale_if_error", policy.stale_if_error);
+  if (node["slice_size"]) {
+    auto spec = node["slice_size"].as<std::string>();
+    if (auto size = HttpCacheManager::parse_size(spec)) {
+      policy.slice_size = *size;
+    } else {
+      SPDLOG_WARN("invalid route cache slice_size: {}", spec);
+    }
+  }
+}
+
+// `health_check: {enabled, type, path, interval, timeout, ...}`, the
+// fields left out keep their value in `config`.
+static void parseHealthCheck(const YAML::Node &node, HealthCheckConfig &config) {
+  auto duration = [&](const char *field, std::chrono::milliseconds &value) {
+    if (!node[field]) {
+      return;
+    }
+    auto spec = node[field].as<std::string>();
+    if (auto parsed = ParseDuration(spec)) {
+      value = *parsed;
+    } else {
+      SPDLOG_WARN("invalid health check {}: {}", field, spec);
+    }
+  };
+  config.enabled = node["enabled"].as<bool>(true);
+  if (node["type"]) {
+    ParseHealthCheckType(node["type"].as<std::string>(), config.type);
+  }
+  config.path = node["path"].as<std::string>(config.path);
+  duration("interval", config.interval);
+  duration("timeout", config.timeout);
+  config.healthy_threshold =
+      node["healthy_threshold"].as<int>(config.healthy_threshold);
+  config.unhealthy_threshold =
+      node["unhealthy_threshold"].as<int>(config.unhealthy_threshold);
+  config.expected_status =
+      node["expected_status"].as<unsigned>(config.expected_status);
+  config.expected_body =
+      node["expected_body"].as<std::string>(config.expected_body);
+  config.grpc_service =
+      node["grpc_service"].as<std::string>(config.grpc_service);
+}
+
+// the routes of the config come first, then the ones added by AddRoute().
+// the new router is only published once the whole config is read.
+static void publishRoutes(std::vector<RouteSpec> &&routes) {
+  auto router = std::make_shared<Router>();
+  std::lock_guard<std::mutex> lock(g_config_mutex);
+  auto previous = g_router.load(std::memory_order_acquire);
+  for (auto &route : routes) {
+    addRoute(*router, previous.get(), std::move(route.source),
+             std::move(route.target), std::move(route.matcher), route.policy);
+  }
+  for (const auto &route : g_added_routes) {
+    addRoute(*router, previous.get(), ConnectionInfo(route.source),
+             ConnectionInfo(route.target), RequestMatcher(route.matcher),
+             route.policy);
+  }
+  pruneServers(router->default_table);
+  for (auto &table : router->vhost_tables) {
+    pruneServers(table);
+  }
+  g_router.store(std::move(router), std::memory_order_release);
+}
+
+bool LoadRoutesFromConfig(const YAML::Node &config) {
+  auto routes = config["routes"];
+  if (!routes || !routes.IsSequence()) {
+    SPDLOG_WARN("no routes found in the configuration");
+    publishRoutes({});
+    return false;
+  }
+  std::vector<RouteSpec> route_specs;
+  size_t num_loaded = 0;
+  try {
+    // `load_balancer.strategy` is the default of `upstream.strategy`.
+    auto default_strategy = LoadBalancingStrategy::RoundRobin;
+    if (config["load_balancer"] && config["load_balancer"]["strategy"]) {
+      auto name = config["load_balancer"]["strategy"].as<std::string>();
+      auto strategy = parse_load_balancing_strategy(name);
+      if (!strategy) {
+        SPDLOG_WARN("unknown load balancing strategy: {}", name);
+      }
+      default_strategy = strategy.value_or(default_strategy);
+    }
+    std::string default_hash_key;
+    std::optional<double> default_hash_balance_factor;
+    // routes override the global outlier detection field by field.
+    OutlierDetectionConfig default_outlier_detection{.enabled = false};
+    HealthCheckConfig default_health_check{.enabled = false};
+    SlowStartConfig default_slow_start{.enabled = false};
+    // `retry` holds the default policy along with the global budget.
+    RetryPolicy default_retry;
+    if (config["retry"]) {
+      parseRetryPolicy(config["retry"], default_retry);
+    }
+    // likewise `hedge`, whose policy is off unless enabled explicitly.
+    HedgePolicy default_hedge;
+    if (config["hedge"]) {
+      parseHedgePolicy(config["hedge"], default_hedge);
+    }
+    if (auto load_balancer = config["load_balancer"]) {
+      default_hash_key = load_balancer["hash_key"].as<std::string>("");
+      if (load_balancer["hash_balance_factor"]) {
+        default_hash_balance_factor =
+            load_balancer["hash_balance_factor"].as<double>();
+      }
+      if (load_balancer["outlier_detection"]) {
+        parseOutlierDetection(load_balancer["outlier_detection"],
+                              default_outlier_detection);
+      }
+      if (load_balancer["health_checks"]) {
+        parseHealthCheck(load_balancer["health_checks"], default_health_check);
+      }
+      if (load_balancer["slow_start"]) {
+        parseSlowStart(load_balancer["slow_start"], default_slow_start);
+      }
+    }
+    for (const auto &route : routes) {
+      if (!route["path"]) {
+        continue;
+      }
+      auto path = route["path"].as<std::string>();
+      // `host` or `hosts` select the virtual host(s) of this route.
+      std::vector<std::string> hosts;
+      if (route["host"]) {
+        hosts.emplace_back(route["host"].as<std::string>());
+      }
+      if (route["hosts"] && route["hosts"].IsSequence()) {
+        for (const auto &host : route["hosts"]) {
+          hosts.emplace_back(host.as<std::string>());
+        }
+      }
+      if (hosts.empty()) {
+        hosts.emplace_back("");
+      }
+
+      std::vector<ConnectionInfo> targets;
+      BalancingPolicy policy{.strategy = default_strategy};
+      if (route["upstream"] && route["upstream"]["servers"]) {
+        for (const auto &server : route["upstream"]["servers"]) {
+          targets.emplace_back(ConnectionInfo{
+              .type = ProtocolTypeHttp,
+              .address = server["host"].as<std::string>(),
+              .port = server["port"].as<uint16_t>(),
+              .http_url = path,
+              .remote = true,
+              .weight = server["weight"].as<int>(1),
+          });
+        }
+        if (route["upstream"]["strategy"]) {
+          auto name = route["upstream"]["strategy"].as<std::string>();
+          auto route_strategy = parse_load_balancing_strategy(name);
+          if (!route_strategy) {
+            SPDLOG_WARN("unknown load balancing strategy {} for route {}",
+                        name, path);
+          }
+          policy.strategy = route_strategy.value_or(*policy.strategy);
+        }
+        policy.hash_key =
+            route["upstream"]["hash_key"].as<std::string>(default_hash_key);
+        policy.hash_balance_factor = default_hash_balance_factor;
+        if (auto factor = route["upstream"]["hash_balance_factor"]) {
+          policy.hash_balance_factor = factor.as<double>();
+        }
+        auto outlier_detection = default_outlier_detection;
+        if (auto node = route["upstream"]["outlier_detection"]) {
+          parseOutlierDetection(node, outlier_detection);
+        }
+        policy.outlier_detection =
+            std::make_shared<const OutlierDetectionConfig>(outlier_detection);
+        auto health_check = default_health_check;
+        if (auto node = route["upstream"]["health_check"]) {
+          parseHealthCheck(node, health_check);
+        }
+        policy.health_check =
+            std::make_shared<const HealthCheckConfig>(health_check);
+        auto slow_start = default_slow_start;
+        if (auto node = route["upstream"]["slow_start"]) {
+          parseSlowStart(node, slow_start);
+        }
+        policy.slow_start = std::make_shared<const SlowStartConfig>(slow_start);
+        auto retry = default_retry;
+        if (auto node = route["upstream"]["retry"]) {
+          parseRetryPolicy(node, retry);
+        }
+        policy.retry = std::make_shared<const RetryPolicy>(retry);
+        // a route asking for hedging has it, unless disabled there.
+        auto hedge = default_hedge;
+        if (auto node = route["upstream"]["hedge"]) {
+          hedge.enabled = true;
+          parseHedgePolicy(node, hedge);
+        }
+        policy.hedge = std::make_shared<const HedgePolicy>(hedge);
+        RouteCachePolicy cache;
+        if (auto node = route["upstream"]["cache"]) {
+          parseRouteCachePolicy(node, cache);
+        }
+        policy.cache = std::make_shared<const RouteCachePolicy>(cache);
+      }
+      if (route["file_server"] && route["file_server"]["root"]) {
+        targets.emplace_back(ConnectionInfo{
+            .type = ProtocolTypeHttp,
+            .address = "localhost",
+            .port = g_azugate_port,
+            .http_url = route["file_server"]["root"].as<std::string>(),
+            .remote = false,
+        });
+      }
+      if (targets.empty()) {
+        SPDLOG_WARN("route {} has no target", path);
+        continue;
+      }
+      RequestMatcher matcher;
+      if (route["match"] && !compileRequestMatcher(route["match"], matcher)) {
+        SPDLOG_WARN("skip route {} with invalid match conditions", path);
+        continue;
+      }
+      for (const auto &host : hosts) {
+        for (const auto &target : targets) {
+          route_specs.emplace_back(RouteSpec{
+              .source = ConnectionInfo{.type = ProtocolTypeHttp,
+                                       .http_url = path,
+                                       .host = host},
+              .target = target,
+              .matcher = matcher,
+              .policy = policy,
+          });
+        }
+      }
+      ++num_loaded;
+    }
+  } catch (const YAML::Exception &e) {
+    SPDLOG_ERROR("failed to load routes: {}", e.what());
+    return false;
+  }
+  publishRoutes(std::move(route_specs));
+  SPDLOG_INFO("loaded {} route(s) across {} virtual host(s)", num_loaded,
+              GetVirtualHostCount());
+  return true;
+}
 
 // perfect match and prefix match.
 bool azugate::ConnectionInfo::operator==(const ConnectionInfo &other) const {
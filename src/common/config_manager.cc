@@ -1,4 +1,8 @@
 #include "../../include/config_manager.hpp"
+#include "../../include/load_balancer.hpp"
+#include "../../include/hedging.hpp"
+#include "../../include/http_cache.hpp"
+#include "../../include/retry_policy.hpp"
 #include <fstream>
 #include <regex>
 #include <sstream>
@@ -107,6 +111,9 @@ ValidationResult ConfigManager::validate_config(const YAML::Node& config) {
     auto metrics_result = validate_metrics_config(config);
     auto cb_result = validate_circuit_breaker_config(config);
     auto lb_result = validate_load_balancer_config(config);
+    auto cl_result = validate_concurrency_limiter_config(config);
+    auto retry_result = validate_retry_config(config);
+    auto hedge_result = validate_hedge_config(config);
     
     // Merge results
     result.errors.insert(result.errors.end(), server_result.errors.begin(), server_result.errors.end());
@@ -116,6 +123,9 @@ ValidationResult ConfigManager::validate_config(const YAML::Node& config) {
     result.errors.insert(result.errors.end(), metrics_result.errors.begin(), metrics_result.errors.end());
     result.errors.insert(result.errors.end(), cb_result.errors.begin(), cb_result.errors.end());
     result.errors.insert(result.errors.end(), lb_result.errors.begin(), lb_result.errors.end());
+    result.errors.insert(result.errors.end(), cl_result.errors.begin(), cl_result.errors.end());
+    result.errors.insert(result.errors.end(), retry_result.errors.begin(), retry_result.errors.end());
+    result.errors.insert(result.errors.end(), hedge_result.errors.begin(), hedge_result.errors.end());
     
     result.warnings.insert(result.warnings.end(), server_result.warnings.begin(), server_result.warnings.end());
     result.warnings.insert(result.warnings.end(), routes_result.warnings.begin(), routes_result.warnings.end());
@@ -124,6 +134,9 @@ ValidationResult ConfigManager::validate_config(const YAML::Node& config) {
     result.warnings.insert(result.warnings.end(), metrics_result.warnings.begin(), metrics_result.warnings.end());
     result.warnings.insert(result.warnings.end(), cb_result.warnings.begin(), cb_result.warnings.end());
     result.warnings.insert(result.warnings.end(), lb_result.warnings.begin(), lb_result.warnings.end());
+    result.warnings.insert(result.warnings.end(), cl_result.warnings.begin(), cl_result.warnings.end());
+    result.warnings.insert(result.warnings.end(), retry_result.warnings.begin(), retry_result.warnings.end());
+    result.warnings.insert(result.warnings.end(), hedge_result.warnings.begin(), hedge_result.warnings.end());
     
     result.valid = result.errors.empty();
     return result;
@@ -178,6 +191,135 @@ ValidationResult ConfigManager::validate_server_config(const YAML::Node& config)
     return result;
 }
 
+// Shared by load_balancer.outlier_detection and the per route override.
+static void validate_outlier_detection(const YAML::Node& od, const std::string& prefix,
+                                       ValidationResult& result) {
+    int max_ejection_percent = od["max_ejection_percent"].as<int>(10);
+    if (max_ejection_percent < 0 || max_ejection_percent > 100) {
+        result.add_error(prefix + ".max_ejection_percent must be between 0 and 100");
+    }
+    int failure_percentage = od["failure_percentage_threshold"].as<int>(0);
+    if (failure_percentage < 0 || failure_percentage > 100) {
+        result.add_error(prefix + ".failure_percentage_threshold must be between 0 and 100");
+    }
+    for (const char* field : {"interval_ms", "base_ejection_time_ms"}) {
+        if (od[field] && od[field].as<int64_t>() <= 0) {
+            result.add_error(prefix + "." + field + " must be positive");
+        }
+    }
+    if (od["max_ejection_time_ms"] && od["base_ejection_time_ms"] &&
+        od["max_ejection_time_ms"].as<int64_t>() < od["base_ejection_time_ms"].as<int64_t>()) {
+        result.add_error(prefix + ".max_ejection_time_ms must not be less than base_ejection_time_ms");
+    }
+    for (const char* field : {"consecutive_errors", "success_rate_minimum_hosts",
+                              "success_rate_request_volume"}) {
+        if (od[field] && od[field].as<int>() < 0) {
+            result.add_error(prefix + "." + field + " must not be negative");
+        }
+    }
+    if (od["latency_factor"] && od["latency_factor"].as<double>() != 0 &&
+        od["latency_factor"].as<double>() <= 1) {
+        result.add_error(prefix + ".latency_factor must be 0 (disabled) or greater than 1");
+    }
+}
+
+// Shared by load_balancer.slow_start and the per route override.
+static void validate_slow_start(const YAML::Node& ss, const std::string& prefix,
+                                ValidationResult& result) {
+    if (ss["window_ms"] && ss["window_ms"].as<int64_t>() < 0) {
+        result.add_error(prefix + ".window_ms must not be negative");
+    }
+    if (ss["aggression"] && ss["aggression"].as<double>() <= 0) {
+        result.add_error(prefix + ".aggression must be positive");
+    }
+    int min_weight_percent = ss["min_weight_percent"].as<int>(10);
+    if (min_weight_percent < 0 || min_weight_percent > 100) {
+        result.add_error(prefix + ".min_weight_percent must be between 0 and 100");
+    }
+}
+
+// Shared by the retry defaults and the per route override.
+static void validate_retry(const YAML::Node& retry, const std::string& prefix,
+                           ValidationResult& result) {
+    if (retry["max_retries"] && retry["max_retries"].as<int>() < 0) {
+        result.add_error(prefix + ".max_retries must not be negative");
+    }
+    if (const auto& retry_on = retry["retry_on"]) {
+        if (!retry_on.IsSequence()) {
+            result.add_error(prefix + ".retry_on must be a list");
+        } else {
+            auto conditions = retry_on.as<std::vector<std::string>>();
+            std::vector<std::string_view> views(conditions.begin(), conditions.end());
+            RetryPolicy policy;
+            if (!ParseRetryOn(views, policy)) {
+                result.add_error(prefix + ".retry_on takes connect_failure, reset and status codes");
+            }
+        }
+    }
+    for (const char* field : {"base_backoff", "max_backoff"}) {
+        if (retry[field]) {
+            ConfigValidator::validate_duration(retry[field].as<std::string>(),
+                                               prefix + "." + field, result);
+        }
+    }
+}
+
+// Shared by the hedge defaults and the per route override.
+static void validate_hedge(const YAML::Node& hedge, const std::string& prefix,
+                           ValidationResult& result) {
+    if (hedge["delay"]) {
+        HedgePolicy policy;
+        if (!ParseHedgeDelay(hedge["delay"].as<std::string>(), policy)) {
+            result.add_error(prefix + ".delay must be a duration or a percentile like p95");
+        }
+    }
+    if (hedge["min_delay"]) {
+        ConfigValidator::validate_duration(hedge["min_delay"].as<std::string>(),
+                                           prefix + ".min_delay", result);
+    }
+}
+
+// Shared by the cache section and the per route override.
+static void validate_cache_policy(const YAML::Node& cache, const std::string& prefix,
+                                  ValidationResult& result) {
+    for (const char* field : {"stale_while_revalidate", "stale_if_error"}) {
+        if (cache[field]) {
+            ConfigValidator::validate_duration(cache[field].as<std::string>(),
+                                               prefix + "." + field, result);
+        }
+    }
+    // "0" turns slice mode off
+    if (cache["slice_size"] &&
+        !HttpCacheManager::parse_size(cache["slice_size"].as<std::string>())) {
+        result.add_error(prefix + ".slice_size must be in format like '1MB', '512KB', etc.");
+    }
+}
+
+// Shared by load_balancer.health_checks and the per route override.
+static void validate_health_check(const YAML::Node& hc, const std::string& prefix,
+                                  ValidationResult& result) {
+    if (hc["type"]) {
+        ConfigValidator::validate_enum(hc["type"].as<std::string>(), {"http", "tcp", "grpc"},
+                                       prefix + ".type", result);
+    }
+    for (const char* field : {"interval", "timeout"}) {
+        if (!hc[field]) {
+            continue;
+        }
+        // Durations also take milliseconds, e.g. "500ms".
+        auto duration = hc[field].as<std::string>();
+        if (duration.size() > 2 && duration.ends_with("ms")) {
+            duration.resize(duration.size() - 2);
+        }
+        ConfigValidator::validate_duration(duration, prefix + "." + field, result);
+    }
+    for (const char* field : {"healthy_threshold", "unhealthy_threshold"}) {
+        if (hc[field] && hc[field].as<int>() < 1) {
+            result.add_error(prefix + "." + field + " must be at least 1");
+        }
+    }
+}
+
 ValidationResult ConfigManager::validate_routes_config(const YAML::Node& config) {
     ValidationResult result;
     result.valid = true;
@@ -207,9 +349,95 @@ ValidationResult ConfigManager::validate_routes_config(const YAML::Node& config)
             continue;
         }
         
+        // Validate virtual hosts
+        if (route["host"] && !route["host"].IsScalar()) {
+            result.add_error(route_prefix + ".host must be a string");
+        }
+        if (route["hosts"]) {
+            if (!route["hosts"].IsSequence()) {
+                result.add_error(route_prefix + ".hosts must be an array");
+            } else {
+                for (size_t j = 0; j < route["hosts"].size(); ++j) {
+                    if (!route["hosts"][j].IsScalar() || route["hosts"][j].as<std::string>().empty()) {
+                        result.add_error(route_prefix + ".hosts[" + std::to_string(j) + "] must be a non-empty string");
+                    }
+                }
+            }
+        }
+        
+        // Validate match conditions
+        if (route["match"]) {
+            const auto& match = route["match"];
+            if (match["methods"]) {
+                if (!match["methods"].IsSequence()) {
+                    result.add_error(route_prefix + ".match.methods must be an array");
+                } else {
+                    for (size_t j = 0; j < match["methods"].size(); ++j) {
+                        ConfigValidator::validate_enum(match["methods"][j].as<std::string>(),
+                            {"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"},
+                            route_prefix + ".match.methods[" + std::to_string(j) + "]", result);
+                    }
+                }
+            }
+            for (const char* field : {"headers", "query", "cookies"}) {
+                if (!match[field]) {
+                    continue;
+                }
+                std::string field_prefix = route_prefix + ".match." + field;
+                if (!match[field].IsSequence()) {
+                    result.add_error(field_prefix + " must be an array");
+                    continue;
+                }
+                for (size_t j = 0; j < match[field].size(); ++j) {
+                    if (!match[field][j]["name"]) {
+                        result.add_error(field_prefix + "[" + std::to_string(j) + "].name is required");
+                    }
+                }
+            }
+        }
+        
         // Validate upstream configuration
         if (route["upstream"]) {
             const auto& upstream = route["upstream"];
+            if (upstream["strategy"]) {
+                std::string strategy = upstream["strategy"].as<std::string>();
+                if (!parse_load_balancing_strategy(strategy)) {
+                    result.add_error(route_prefix + ".upstream.strategy: unknown strategy '" + strategy + "'");
+                }
+            }
+            if (upstream["hash_key"]) {
+                std::string hash_key = upstream["hash_key"].as<std::string>();
+                if (!parse_hash_key(hash_key)) {
+                    result.add_error(route_prefix + ".upstream.hash_key: unknown hash key '" + hash_key + "'");
+                }
+            }
+            if (upstream["outlier_detection"]) {
+                validate_outlier_detection(upstream["outlier_detection"],
+                                           route_prefix + ".upstream.outlier_detection", result);
+            }
+            if (upstream["slow_start"]) {
+                validate_slow_start(upstream["slow_start"],
+                                    route_prefix + ".upstream.slow_start", result);
+            }
+            if (upstream["health_check"]) {
+                validate_health_check(upstream["health_check"],
+                                      route_prefix + ".upstream.health_check", result);
+            }
+            if (upstream["retry"]) {
+                validate_retry(upstream["retry"], route_prefix + ".upstream.retry", result);
+            }
+            if (upstream["hedge"]) {
+                validate_hedge(upstream["hedge"], route_prefix + ".upstream.hedge", result);
+            }
+            if (upstream["cache"]) {
+                validate_cache_policy(upstream["cache"], route_prefix + ".upstream.cache", result);
+            }
+            if (upstream["hash_balance_factor"]) {
+                double factor = upstream["hash_balance_factor"].as<double>();
+                if (factor > 0 && factor < 1) {
+                    result.add_error(route_prefix + ".upstream.hash_balance_factor must be 0 (unbounded) or at least 1");
+                }
+            }
             if (upstream["servers"] && upstream["servers"].IsSequence()) {
                 for (size_t j = 0; j < upstream["servers"].size(); ++j) {
                     const auto& server = upstream["servers"][j];
@@ -278,6 +506,60 @@ ValidationResult ConfigManager::validate_cache_config(const YAML::Node& config)
             std::string ttl = cache["ttl"].as<std::string>();
             ConfigValidator::validate_duration(ttl, "cache.ttl", result);
         }
+        
+        if (cache["max_response_size"] &&
+            !HttpCacheManager::parse_size(cache["max_response_size"].as<std::string>())) {
+            result.add_error("cache.max_response_size must be in format like '1MB', '512KB', etc.");
+        }
+        
+        if (cache["shards"] && cache["shards"].as<int>() <= 0) {
+            result.add_error("cache.shards must be positive");
+        }
+        
+        if (cache["lock_timeout"]) {
+            ConfigValidator::validate_duration(cache["lock_timeout"].as<std::string>(),
+                                               "cache.lock_timeout", result);
+        }
+        validate_cache_policy(cache, "cache", result);
+        
+        if (cache["admission"]) {
+            auto admission = cache["admission"].as<std::string>();
+            if (admission != "tinylfu" && admission != "none") {
+                result.add_error("cache.admission must be 'tinylfu' or 'none'");
+            }
+        }
+        if (cache["admission_window"]) {
+            auto window = cache["admission_window"].as<double>();
+            if (window < 0.0 || window > 1.0) {
+                result.add_error("cache.admission_window must be between 0 and 1");
+            }
+        }
+        
+        if (const auto& disk = cache["disk"]) {
+            for (const char* field : {"max_size", "segment_size", "max_object_size"}) {
+                if (!disk[field]) {
+                    continue;
+                }
+                auto size = HttpCacheManager::parse_size(disk[field].as<std::string>());
+                if (!size || *size == 0) {
+                    result.add_error(std::string("cache.disk.") + field +
+                                     " must be in format like '256MB', '10GB', etc.");
+                }
+            }
+            if (disk["path"] && disk["path"].as<std::string>().empty()) {
+                result.add_error("cache.disk.path must not be empty");
+            }
+        }
+        
+        if (const auto& snapshot = cache["snapshot"]) {
+            if (snapshot["path"] && snapshot["path"].as<std::string>().empty()) {
+                result.add_error("cache.snapshot.path must not be empty");
+            }
+            if (snapshot["interval"]) {
+                ConfigValidator::validate_duration(snapshot["interval"].as<std::string>(),
+                                                   "cache.snapshot.interval", result);
+            }
+        }
     }
     
     return result;
@@ -311,9 +593,35 @@ ValidationResult ConfigManager::validate_circuit_breaker_config(const YAML::Node
             }
         }
         
-        if (cb["timeout"]) {
-            std::string timeout = cb["timeout"].as<std::string>();
-            ConfigValidator::validate_duration(timeout, "circuit_breaker.timeout", result);
+        for (const char* field : {"timeout", "recovery_timeout", "max_recovery_timeout", "metrics_window"}) {
+            if (cb[field]) {
+                ConfigValidator::validate_duration(cb[field].as<std::string>(),
+                                                   std::string("circuit_breaker.") + field, result);
+            }
+        }
+        if (cb["failure_rate_threshold"]) {
+            double rate = cb["failure_rate_threshold"].as<double>();
+            if (rate <= 0 || rate > 1) {
+                result.add_error("circuit_breaker.failure_rate_threshold must be in (0, 1]");
+            }
+        }
+        for (const char* field : {"success_threshold", "half_open_max_requests", "metrics_window_buckets"}) {
+            if (cb[field] && cb[field].as<int>() < 1) {
+                result.add_error(std::string("circuit_breaker.") + field + " must be at least 1");
+            }
+        }
+        if (const auto& codes = cb["failure_status_codes"]) {
+            if (!codes.IsSequence()) {
+                result.add_error("circuit_breaker.failure_status_codes must be a list of status codes");
+            } else {
+                for (const auto& code : codes) {
+                    int status = code.as<int>();
+                    if (status < 100 || status > 599) {
+                        result.add_error("circuit_breaker.failure_status_codes has an invalid status code: " +
+                                         std::to_string(status));
+                    }
+                }
+            }
         }
     }
     
@@ -328,9 +636,100 @@ ValidationResult ConfigManager::validate_load_balancer_config(const YAML::Node&
         const auto& lb = config["load_balancer"];
         if (lb["strategy"]) {
             std::string strategy = lb["strategy"].as<std::string>();
-            std::vector<std::string> valid_strategies = {"round_robin", "least_connections", "weighted", "ip_hash"};
+            std::vector<std::string> valid_strategies = {"round_robin", "least_connections", "weighted", "weighted_round_robin", "random", "ip_hash", "p2c", "power_of_two_choices", "maglev", "ring_hash"};
             ConfigValidator::validate_enum(strategy, valid_strategies, "load_balancer.strategy", result);
         }
+        if (lb["hash_key"] && !parse_hash_key(lb["hash_key"].as<std::string>())) {
+            result.add_error("load_balancer.hash_key must be client_ip, path, header:<name> or cookie:<name>");
+        }
+        if (lb["hash_balance_factor"] && lb["hash_balance_factor"].as<double>() > 0 &&
+            lb["hash_balance_factor"].as<double>() < 1) {
+            result.add_error("load_balancer.hash_balance_factor must be 0 (unbounded) or at least 1");
+        }
+        if (lb["outlier_detection"]) {
+            validate_outlier_detection(lb["outlier_detection"], "load_balancer.outlier_detection", result);
+        }
+        if (lb["slow_start"]) {
+            validate_slow_start(lb["slow_start"], "load_balancer.slow_start", result);
+        }
+        if (const auto& hc = lb["health_checks"]) {
+            validate_health_check(hc, "load_balancer.health_checks", result);
+            if (hc["max_concurrent"] && hc["max_concurrent"].as<int64_t>() < 1) {
+                result.add_error("load_balancer.health_checks.max_concurrent must be at least 1");
+            }
+            if (hc["jitter"] && (hc["jitter"].as<double>() < 0 || hc["jitter"].as<double>() > 1)) {
+                result.add_error("load_balancer.health_checks.jitter must be between 0 and 1");
+            }
+        }
+    }
+    
+    return result;
+}
+
+ValidationResult ConfigManager::validate_retry_config(const YAML::Node& config) {
+    ValidationResult result;
+    result.valid = true;
+    
+    if (const auto& retry = config["retry"]) {
+        validate_retry(retry, "retry", result);
+        if (const auto& budget = retry["budget"]) {
+            double percent = budget["percent"].as<double>(kDftRetryBudgetPercent);
+            if (percent < 0 || percent > 100) {
+                result.add_error("retry.budget.percent must be between 0 and 100");
+            }
+            if (budget["min_concurrency"] && budget["min_concurrency"].as<int>() < 0) {
+                result.add_error("retry.budget.min_concurrency must not be negative");
+            }
+        }
+    }
+    
+    return result;
+}
+
+ValidationResult ConfigManager::validate_hedge_config(const YAML::Node& config) {
+    ValidationResult result;
+    result.valid = true;
+    
+    if (const auto& hedge = config["hedge"]) {
+        validate_hedge(hedge, "hedge", result);
+        if (const auto& budget = hedge["budget"]) {
+            double percent = budget["percent"].as<double>(kDftHedgeBudgetPercent);
+            if (percent < 0 || percent > 100) {
+                result.add_error("hedge.budget.percent must be between 0 and 100");
+            }
+            if (budget["min_concurrency"] && budget["min_concurrency"].as<int>() < 0) {
+                result.add_error("hedge.budget.min_concurrency must not be negative");
+            }
+        }
+    }
+    
+    return result;
+}
+
+ValidationResult ConfigManager::validate_concurrency_limiter_config(const YAML::Node& config) {
+    ValidationResult result;
+    result.valid = true;
+    
+    if (config["concurrency_limiter"]) {
+        const auto& cl = config["concurrency_limiter"];
+        if (cl["algorithm"]) {
+            std::string algorithm = cl["algorithm"].as<std::string>();
+            ConfigValidator::validate_enum(algorithm, {"gradient", "aimd"}, "concurrency_limiter.algorithm", result);
+        }
+        
+        size_t min_limit = cl["min_limit"].as<size_t>(1);
+        size_t max_limit = cl["max_limit"].as<size_t>(1000);
+        if (min_limit < 1) {
+            result.add_error("concurrency_limiter.min_limit must be at least 1");
+        }
+        if (max_limit < min_limit) {
+            result.add_error("concurrency_limiter.max_limit must not be less than min_limit");
+        }
+        
+        if (cl["queue"] && cl["queue"]["order"]) {
+            std::string order = cl["queue"]["order"].as<std::string>();
+            ConfigValidator::validate_enum(order, {"fifo", "lifo"}, "concurrency_limiter.queue.order", result);
+        }
     }
     
     return result;
@@ -543,10 +942,10 @@ bool ConfigValidator::validate_positive_number(double value, const std::string&
 }
 
 bool ConfigValidator::validate_duration(const std::string& duration_str, const std::string& field_name, ValidationResult& result) {
-    // Basic duration validation for formats like "5s", "10m", "1h"
-    std::regex duration_regex(R"(\d+[smhd]?)", std::regex_constants::icase);
+    // Basic duration validation for formats like "500ms", "5s", "10m", "1h"
+    std::regex duration_regex(R"(\d+(ms|[smhd])?)");
     if (!std::regex_match(duration_str, duration_regex)) {
-        result.add_error(field_name + " must be in format like '30s', '5m', '1h', '2d'");
+        result.add_error(field_name + " must be in format like '500ms', '30s', '5m', '1h', '2d'");
         return false;
     }
     return true;
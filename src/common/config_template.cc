@@ -73,12 +73,71 @@ std::string ConfigTemplateGenerator::generate_full_template() {
         - host: "localhost"
           port: 3001
           weight: 1
-      strategy: "round_robin"  # round_robin, least_connections, weighted, ip_hash
+      strategy: "round_robin"  # round_robin, least_connections, weighted, random, ip_hash, p2c, maglev, ring_hash
+      # maglev and ring_hash: client_ip, path, header:<name> or cookie:<name>
+      # hash_key: "cookie:session"
+      # hash_balance_factor: 1.25  # a server takes at most 1.25x the average load, 0 for unbounded
+      # Passive health checking from the proxied requests, overrides load_balancer.outlier_detection
+      outlier_detection:
+        consecutive_errors: 5          # 5xx or connection failures in a row, 0 disables
+        interval_ms: 10000             # how often success rates are compared
+        base_ejection_time_ms: 30000   # n-th ejection in a row lasts n times this
+        max_ejection_time_ms: 300000
+        max_ejection_percent: 10
+        success_rate_minimum_hosts: 5
+        success_rate_request_volume: 100
+        success_rate_stdev_factor: 1.9
+        failure_percentage_threshold: 0  # eject above this error percentage, 0 disables
+        latency_factor: 0              # eject above this factor of the median latency, 0 disables
+      # Traffic ramp of servers added or back to healthy, overrides load_balancer.slow_start
+      # slow_start:
+      #   window_ms: 30000
+      #   aggression: 1.0           # 1 is linear, higher gives more traffic early on
+      #   min_weight_percent: 10
+      # Active health checks, overrides load_balancer.health_checks
       health_check:
         enabled: true
+        type: "http"          # http, tcp (connect only) or grpc (grpc.health.v1)
         path: "/health"
         interval: "30s"
         timeout: "5s"
+        # grpc_service: "my.Service"  # grpc: empty checks the whole server
+      # Retries on another server, overrides the retry defaults
+      # retry:
+      #   max_retries: 2
+      #   retry_on: ["connect_failure", "reset", 502, 503, 504]
+      # Second copy to another server when the first is slow to answer
+      # hedge:
+      #   delay: "p95"              # or a duration such as "50ms"
+      # Stale responses and slice mode, overrides the cache defaults
+      # cache:
+      #   stale_while_revalidate: "30s"
+      #   stale_if_error: "1h"
+      #   slice_size: "512KB"       # videos, downloads: fetched in ranges
+  
+  # Canary: requests carrying "x-canary: 1" go to the canary upstream,
+  # conditional routes are tried before the plain ones.
+  - path: "/api/*"
+    match:
+      methods: ["GET", "POST"]
+      headers:
+        - name: "x-canary"
+          exact: "1"          # exact, prefix, suffix, contains or none for presence
+      # query: [{name: "version", prefix: "v2"}]
+      # cookies: [{name: "beta", present: true, invert: true}]
+    upstream:
+      servers:
+        - host: "localhost"
+          port: 3100
+  
+  # Virtual hosts: only requests whose Host header matches are routed here.
+  # Exact names win over wildcards, routes without hosts are the default.
+  - path: "/"
+    hosts: ["api.example.com", "*.api.example.com"]
+    upstream:
+      servers:
+        - host: "localhost"
+          port: 4000
   
   # TCP proxy (for non-HTTP protocols)
   - path: "/tcp/*"
@@ -107,12 +166,38 @@ std::string ConfigTemplateGenerator::generate_full_template() {
 
 )" + add_section_header("Caching Configuration", "HTTP response caching");
 
-    config += R"(cache:
+    config += R"(# Responses to GET and HEAD requests proxied to upstreams, no section
+# disables the cache
+cache:
   enabled: true
-  type: "lru"  # lru, redis
   max_size: "100MB"
   max_entries: 10000
-  ttl: "1h"
+  ttl: "1h"                   # when the response doesn't say
+  max_response_size: "1MB"    # larger responses aren't cached
+  shards: 16                  # each with its own lock and SIEVE eviction
+  admission: "tinylfu"        # or "none": new entries only replace less popular ones
+  admission_window: 0.01      # share of the entries new ones start in
+  coalesce_misses: true       # concurrent misses of a URL wait for one fetch
+  lock_timeout: "5s"          # then the waiting requests fetch themselves
+  # RFC 5861 windows when the response doesn't set them
+  stale_while_revalidate: "0s"  # served while refreshed in the background
+  stale_if_error: "0s"          # served when the upstream fails
+  slice_size: "0"               # large objects fetched and cached in ranges, 0 is off
+  # Responses larger than max_response_size, bodies in segment files on
+  # local disk, served with sendfile()
+  disk:
+    enabled: false
+    path: "/var/cache/azugate"
+    max_size: "10GB"
+    segment_size: "256MB"     # space is reclaimed a segment at a time
+    max_object_size: "100MB"
+    admit_after: 2            # fetches of a URL before it's written to disk
+  # Written on shutdown and read back on startup, so a restart doesn't
+  # start cold. Entries that expired in between are dropped.
+  snapshot:
+    enabled: false
+    path: "/var/cache/azugate/snapshot.bin"
+    interval: "0s"            # also written periodically, 0 is on shutdown only
   
   # Cache rules
   rules:
@@ -127,12 +212,26 @@ std::string ConfigTemplateGenerator::generate_full_template() {
 
     config += R"(load_balancer:
   strategy: "round_robin"
+  # Servers added or back to healthy get a share of their weight growing
+  # over the window, every strategy honors it
+  slow_start:
+    enabled: false
+    window_ms: 30000
+    aggression: 1.0
+    min_weight_percent: 10
+
+  # Defaults of upstream.health_check, probes of every route share one scheduler
   health_checks:
     enabled: true
+    type: "http"              # http, tcp or grpc
+    path: "/health"
     interval: "30s"
     timeout: "5s"
     unhealthy_threshold: 3
     healthy_threshold: 2
+    expected_status: 200
+    max_concurrent: 64        # probes in flight over all upstreams
+    jitter: 0.1               # intervals vary by up to 10% to spread the probes
   
   # Session affinity
   session_affinity:
@@ -140,19 +239,54 @@ std::string ConfigTemplateGenerator::generate_full_template() {
     type: "cookie"  # cookie, ip_hash
     cookie_name: "azugate_session"
 
+)" + add_section_header("Retry Configuration", "Retrying failed upstream requests");
+
+    config += R"(# Defaults of upstream.retry. Connect failures are retried for any
+# request, resets and status codes only for idempotent requests whose body
+# was buffered. The retry goes to another server of the route.
+retry:
+  max_retries: 0              # 0 disables retries
+  retry_on: ["connect_failure", "reset", 502, 503, 504]
+  base_backoff: "25ms"        # full jitter, doubling up to max_backoff
+  max_backoff: "250ms"
+  # Retries in flight are capped at this share of the active requests,
+  # so that retries can't pile up on an overloaded upstream
+  budget:
+    percent: 20
+    min_concurrency: 3        # always allowed
+
+)" + add_section_header("Hedging Configuration", "Cutting the latency tail of slow upstreams");
+
+    config += R"(# Defaults of upstream.hedge. An idempotent request whose body was
+# buffered is sent to another server of the route if the first one hasn't
+# sent its response headers after `delay`. The first response wins, the
+# other copy is cancelled.
+hedge:
+  enabled: false              # routes with an upstream.hedge section hedge
+  delay: "50ms"               # or a percentile of the route's latency: "p95"
+  min_delay: "5ms"            # floor of a percentile delay
+  # Hedges in flight are capped at this share of the active requests
+  budget:
+    percent: 10
+    min_concurrency: 1        # always allowed
+
 )" + add_section_header("Circuit Breaker Configuration", "Fault tolerance and resilience");
 
-    config += R"(circuit_breaker:
+    config += R"(# One breaker per upstream host:port. An open breaker answers 503 right
+# away and the load balancers skip its server until it goes half-open.
+circuit_breaker:
   enabled: true
-  failure_threshold: 5
-  success_threshold: 3
-  timeout: "60s"
-  
-  # Per-route circuit breakers
-  routes:
-    - path: "/api/critical/*"
-      failure_threshold: 2
-      timeout: "30s"
+  failure_threshold: 5          # consecutive failures that open it
+  failure_rate_threshold: 0.5   # or this share of failures over metrics_window
+  minimum_requests: 10          # before the failure rate counts
+  metrics_window: "60s"
+  success_threshold: 3          # half-open successes that close it
+  half_open_max_requests: 5     # probe requests let through while half-open
+  timeout: "60s"                # slower responses count as failures
+  recovery_timeout: "30s"       # open time before the first probe
+  exponential_backoff: true     # doubles it each time it reopens
+  max_recovery_timeout: "5m"
+  failure_status_codes: [500, 502, 503, 504]
 
 )" + add_section_header("Rate Limiting Configuration", "Request rate limiting");
 
@@ -161,6 +295,12 @@ std::string ConfigTemplateGenerator::generate_full_template() {
   type: "token_bucket"
   requests_per_second: 100
   burst_size: 200
+  # What requests are limited by: client_ip, path, jwt_subject or
+  # header:<name>. Over the limit requests get 429 with Retry-After.
+  key: "client_ip"
+  # Share the limit among the gateway processes of a host (Linux/Unix).
+  # shared_memory:
+  #   path: "/dev/shm/azugate-ratelimit"
   
   # Per-IP rate limiting
   per_ip:
@@ -174,6 +314,22 @@ std::string ConfigTemplateGenerator::generate_full_template() {
       requests_per_second: 5
       burst_size: 10
 
+)" + add_section_header("Concurrency Limiter", "Adaptive per-upstream concurrency limits");
+
+    config += R"(concurrency_limiter:
+  enabled: false
+  # gradient follows the latency trend, aimd backs off on errors and
+  # responses slower than latency_threshold_ms.
+  algorithm: "gradient"
+  initial_limit: 20
+  min_limit: 1
+  max_limit: 1000
+  # Requests over the limit wait here, then get 503.
+  queue:
+    size: 100
+    order: "fifo"  # fifo or lifo
+    timeout_ms: 1000
+
 )" + add_section_header("Compression Configuration", "Response compression");
 
     config += R"(compression:
@@ -237,6 +393,14 @@ std::string ConfigTemplateGenerator::generate_full_template() {
     strict_transport_security: "max-age=31536000; includeSubDomains"
     content_security_policy: "default-src 'self'"
   
+  # Connection level IP filtering (CIDR, IPv4 and IPv6).
+  # Without allow rules everything not denied is accepted, otherwise only
+  # allowed addresses are. The most specific rule wins.
+  ip_filter:
+    allow: []
+    deny: ["192.0.2.0/24", "2001:db8::/32"]
+    # deny_file: "/etc/azugate/blocklist.txt"  # one CIDR per line
+  
   # CORS settings
   cors:
     enabled: false
@@ -415,7 +579,6 @@ auth:
 # Production caching
 cache:
   enabled: true
-  type: "lru"
   max_size: "1GB"
   max_entries: 100000
   ttl: "1h"
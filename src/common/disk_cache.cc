@@ -0,0 +1,388 @@
+#include "../../include/disk_cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace azugate {
+
+namespace {
+
+constexpr std::string_view kSegmentPrefix = "segment-";
+constexpr std::string_view kSegmentSuffix = ".dat";
+
+size_t align_up(size_t n, size_t alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// CacheEntry holds an atomic, its metadata is copied field by field
+std::shared_ptr<CacheEntry> copy_metadata(const CacheEntry& entry) {
+    auto copy = std::make_shared<CacheEntry>();
+    copy->head = entry.head;
+    copy->fields_at = entry.fields_at;
+    copy->range_fields_at = entry.range_fields_at;
+    copy->accept_ranges = entry.accept_ranges;
+    copy->created_at = entry.created_at;
+    copy->expires_at = entry.expires_at;
+    copy->etag = entry.etag;
+    copy->last_modified = entry.last_modified;
+    copy->content_length = entry.content_length;
+    copy->content_type = entry.content_type;
+    copy->is_private = entry.is_private;
+    copy->no_cache = entry.no_cache;
+    copy->no_store = entry.no_store;
+    copy->must_revalidate = entry.must_revalidate;
+    copy->status_code = entry.status_code;
+    copy->size_bytes = entry.size_bytes;
+    copy->stale_while_revalidate = entry.stale_while_revalidate;
+    copy->stale_if_error = entry.stale_if_error;
+    copy->revalidatable = entry.revalidatable;
+    copy->slice_offset = entry.slice_offset;
+    copy->object_size = entry.object_size;
+    return copy;
+}
+
+bool write_all(int fd, const char* data, size_t length, uint64_t offset) {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    while (length > 0) {
+        auto written = ::pwrite(fd, data, length, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+DiskSegment::~DiskSegment() {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    ::close(fd);
+#endif
+}
+
+DiskCache::DiskCache(const DiskCacheConfig& config)
+    : config_(config), admission_counters_(kAdmissionCounters, 0) {
+    config_.slab_size = std::max<size_t>(config_.slab_size, 1);
+    config_.max_object_size = std::min(config_.max_object_size, config_.segment_size);
+}
+
+bool DiskCache::open(bool keep_segments) {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    std::error_code ec;
+    std::filesystem::create_directories(config_.path, ec);
+    if (ec) {
+        SPDLOG_ERROR("failed to create cache directory {}: {}", config_.path, ec.message());
+        return false;
+    }
+    // Without a snapshot the index of a previous run is lost, its segments
+    // can't be used. Kept ones are only read, new bodies go to new segments.
+    std::vector<std::shared_ptr<DiskSegment>> kept;
+    for (const auto& file : std::filesystem::directory_iterator(config_.path, ec)) {
+        auto name = file.path().filename().string();
+        if (!name.starts_with(kSegmentPrefix) || !name.ends_with(kSegmentSuffix)) {
+            continue;
+        }
+        auto digits = std::string_view(name).substr(
+            kSegmentPrefix.size(), name.size() - kSegmentPrefix.size() - kSegmentSuffix.size());
+        uint64_t id = 0;
+        auto [end, parse_ec] = std::from_chars(digits.data(), digits.data() + digits.size(), id);
+        int fd = -1;
+        if (keep_segments && parse_ec == std::errc() && end == digits.data() + digits.size()) {
+            fd = ::open(file.path().c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        auto size = std::filesystem::file_size(file.path(), ec);
+        if (fd < 0 || ec) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            std::filesystem::remove(file.path(), ec);
+            continue;
+        }
+        auto segment = std::make_shared<DiskSegment>(id, file.path().string(), fd);
+        segment->used_bytes = size;
+        kept.push_back(std::move(segment));
+    }
+    std::sort(kept.begin(), kept.end(), [](const auto& a, const auto& b) { return a->id < b->id; });
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& segment : kept) {
+        next_segment_id_ = std::max(next_segment_id_, segment->id + 1);
+        stats_.current_size_bytes += segment->used_bytes;
+        segments_.push_back(std::move(segment));
+    }
+    first_segment_id_ = next_segment_id_;
+    if (!open_segment()) {
+        return false;
+    }
+    SPDLOG_INFO("HTTP cache disk tier in {} - Max size: {}MB, Segments: {}MB",
+                config_.path, config_.max_size_bytes / (1024 * 1024),
+                config_.segment_size / (1024 * 1024));
+    return true;
+#else
+    SPDLOG_ERROR("the HTTP cache disk tier isn't supported on this platform");
+    return false;
+#endif
+}
+
+std::shared_ptr<CacheEntry> DiskCache::get(const CacheKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    if (!it->second->is_expired()) {
+        stats_.hits++;
+    }
+    return it->second;
+}
+
+bool DiskCache::put(const CacheKey& key, const CacheEntry& entry) {
+    if (entry.disk_body) {
+        return false;
+    }
+    size_t body_length = entry.body_size();
+
+    std::shared_ptr<DiskSegment> segment;
+    uint64_t offset = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (entry.head.size() + body_length > config_.max_object_size) {
+            return false;
+        }
+        if (!admit(key)) {
+            stats_.rejected++;
+            return false;
+        }
+        if (!reserve(body_length, segment, offset)) {
+            stats_.write_errors++;
+            return false;
+        }
+    }
+
+    // The slabs are reserved, the write doesn't hold the lock
+    for (const auto& body_segment : entry.body) {
+        if (!write_all(segment->fd, body_segment.buffer->data() + body_segment.offset,
+                       body_segment.length, offset)) {
+            SPDLOG_WARN("failed to write {} to {}: {}", key.to_string(), segment->path,
+                        std::strerror(errno));
+            stats_.write_errors++;
+            return false;
+        }
+        offset += body_segment.length;
+    }
+    offset -= body_length;
+    auto disk_entry = copy_metadata(entry);
+    disk_entry->disk_body = std::make_shared<const DiskBody>(
+        DiskBody{.segment = segment, .offset = offset, .length = body_length});
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segment->dropped) {
+        return false;
+    }
+    segment->keys.push_back(key);
+    if (index_.insert_or_assign(key, std::move(disk_entry)).second) {
+        stats_.current_entries++;
+    }
+    stats_.writes++;
+    return true;
+}
+
+bool DiskCache::update(const CacheKey& key, std::shared_ptr<CacheEntry> entry) {
+    if (!entry || !entry->disk_body) {
+        return false;
+    }
+    auto& segment = entry->disk_body->segment;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segment->dropped) {
+        return false;
+    }
+    auto [it, inserted] = index_.insert_or_assign(key, std::move(entry));
+    if (inserted) {
+        segment->keys.push_back(key);
+        stats_.current_entries++;
+    }
+    return true;
+}
+
+bool DiskCache::remove(const CacheKey& key, const CacheEntry* expected) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end() || (expected && it->second.get() != expected)) {
+        return false;
+    }
+    erase(it);
+    return true;
+}
+
+bool DiskCache::restore(const CacheKey& key, std::shared_ptr<CacheEntry> entry, uint64_t segment_id,
+                        uint64_t offset, uint64_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segment_id >= first_segment_id_) {
+        return false;
+    }
+    auto it = std::find_if(segments_.begin(), segments_.end(),
+                           [segment_id](const auto& segment) { return segment->id == segment_id; });
+    if (it == segments_.end() || length > (*it)->used_bytes || offset > (*it)->used_bytes - length) {
+        return false;
+    }
+    entry->disk_body = std::make_shared<const DiskBody>(
+        DiskBody{.segment = *it, .offset = offset, .length = length});
+    (*it)->keys.push_back(key);
+    if (index_.insert_or_assign(key, std::move(entry)).second) {
+        stats_.current_entries++;
+    }
+    return true;
+}
+
+void DiskCache::drop_unreferenced_segments() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = segments_.begin(); it != segments_.end();) {
+        it = (*it)->id < first_segment_id_ && (*it)->keys.empty() ? drop_segment(it) : std::next(it);
+    }
+    size_t max_segments = std::max<size_t>(1, config_.max_size_bytes / config_.segment_size);
+    while (segments_.size() > max_segments) {
+        drop_oldest_segment();
+    }
+}
+
+std::vector<std::pair<CacheKey, std::shared_ptr<CacheEntry>>> DiskCache::entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {index_.begin(), index_.end()};
+}
+
+void DiskCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    stats_.current_entries = 0;
+    while (!segments_.empty()) {
+        drop_oldest_segment();
+    }
+    open_segment();
+}
+
+size_t DiskCache::cleanup_unusable_entries() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t removed = 0;
+    for (auto it = index_.begin(); it != index_.end();) {
+        auto next = std::next(it);
+        if (it->second->is_unusable()) {
+            erase(it);
+            removed++;
+        }
+        it = next;
+    }
+    return removed;
+}
+
+void DiskCache::update_config(const DiskCacheConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.max_size_bytes = config.max_size_bytes;
+    config_.max_object_size = std::min(config.max_object_size, config_.segment_size);
+    config_.admit_after = config.admit_after;
+    size_t max_segments = std::max<size_t>(1, config_.max_size_bytes / config_.segment_size);
+    while (segments_.size() > max_segments) {
+        drop_oldest_segment();
+    }
+}
+
+bool DiskCache::admit(const CacheKey& key) {
+    if (config_.admit_after <= 1) {
+        return true;
+    }
+    // The high bits of the hash pick the memory shard, the low ones the counter
+    auto& counter = admission_counters_[key.hash & (kAdmissionCounters - 1)];
+    if (counter < UINT8_MAX) {
+        counter++;
+    }
+    bool admitted = counter >= config_.admit_after;
+    if (++admission_offers_ >= kAdmissionWindow) {
+        for (auto& count : admission_counters_) {
+            count /= 2;
+        }
+        admission_offers_ = 0;
+    }
+    return admitted;
+}
+
+std::shared_ptr<DiskSegment> DiskCache::open_segment() {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    auto id = next_segment_id_++;
+    auto path = fmt::format("{}/{}{:08}{}", config_.path, kSegmentPrefix, id, kSegmentSuffix);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        SPDLOG_ERROR("failed to open cache segment {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    auto segment = std::make_shared<DiskSegment>(id, std::move(path), fd);
+    segments_.push_back(segment);
+    return segment;
+#else
+    return nullptr;
+#endif
+}
+
+bool DiskCache::reserve(size_t bytes, std::shared_ptr<DiskSegment>& segment, uint64_t& offset) {
+    auto slabs = align_up(bytes, config_.slab_size);
+    if (segments_.empty() || segments_.back()->used_bytes + slabs > config_.segment_size) {
+        if (!open_segment()) {
+            return false;
+        }
+    }
+    // The tier is accounted a whole segment at a time
+    size_t max_segments = std::max<size_t>(1, config_.max_size_bytes / config_.segment_size);
+    while (segments_.size() > max_segments) {
+        drop_oldest_segment();
+    }
+    segment = segments_.back();
+    offset = segment->used_bytes;
+    segment->used_bytes += slabs;
+    stats_.current_size_bytes += slabs;
+    return true;
+}
+
+void DiskCache::drop_oldest_segment() {
+    drop_segment(segments_.begin());
+}
+
+std::deque<std::shared_ptr<DiskSegment>>::iterator DiskCache::drop_segment(
+    std::deque<std::shared_ptr<DiskSegment>>::iterator it) {
+    auto segment = std::move(*it);
+    it = segments_.erase(it);
+    segment->dropped = true;
+    for (const auto& key : segment->keys) {
+        auto it = index_.find(key);
+        if (it != index_.end() && it->second->disk_body->segment == segment) {
+            erase(it);
+        }
+    }
+    stats_.current_size_bytes -= segment->used_bytes;
+    stats_.dropped_segments++;
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+    // The responses being served keep the descriptor, and the data, open
+    ::unlink(segment->path.c_str());
+#endif
+    return it;
+}
+
+void DiskCache::erase(std::unordered_map<CacheKey, std::shared_ptr<CacheEntry>, CacheKeyHash>::iterator it) {
+    stats_.current_entries--;
+    index_.erase(it);
+}
+
+} // namespace azugate
@@ -49,19 +49,23 @@ SslHandshake(boost::shared_ptr<boost::asio::ip::tcp::socket> sock_ptr) {
 void Dispatch(boost::shared_ptr<boost::asio::io_context> io_context_ptr,
               boost::shared_ptr<boost::asio::ip::tcp::socket> sock_ptr,
               ConnectionInfo &&source_connection_info,
-              TokenBucketRateLimiter &rate_limiter,
+              std::shared_ptr<TokenBucketRateLimiter> rate_limiter,
               std::function<void()> callback) {
-
-  // rate limiting.
-  if (g_enable_rate_limiter && !rate_limiter.GetToken()) {
-    SPDLOG_WARN("request rejected by rate limiter");
-    callback();
-    return;
+  // http requests are limited by HttpProxyHandler once the headers are
+  // parsed, so that it can answer 429.
+  if (!g_enable_rate_limiter) {
+    rate_limiter.reset();
   }
   // Check if this should be handled as TCP proxy
   source_connection_info.type = ProtocolTypeTcp;
   auto tcp_target = GetTargetRoute(source_connection_info);
   if (tcp_target && tcp_target->type == ProtocolTypeTcp) {
+    // nothing but the peer address is known for raw tcp.
+    if (rate_limiter && !rate_limiter->GetToken(source_connection_info.address)) {
+      SPDLOG_WARN("tcp connection rejected by rate limiter");
+      callback();
+      return;
+    }
     SPDLOG_INFO("Handling TCP proxy to {}:{}", tcp_target->address, tcp_target->port);
     TcpProxyHandler(io_context_ptr, sock_ptr, tcp_target);
     callback();
@@ -78,13 +82,15 @@ void Dispatch(boost::shared_ptr<boost::asio::io_context> io_context_ptr,
     }
     auto https_handler =
         std::make_shared<HttpProxyHandler<ssl::stream<ip::tcp::socket>>>(
-            io_context_ptr, ssl_sock_ptr, source_connection_info, callback);
+            io_context_ptr, ssl_sock_ptr, source_connection_info, callback,
+            rate_limiter);
     https_handler->Start();
     callback();
     return;
   }
   auto http_handler = std::make_shared<HttpProxyHandler<ip::tcp::socket>>(
-      io_context_ptr, sock_ptr, source_connection_info, callback);
+      io_context_ptr, sock_ptr, source_connection_info, callback,
+      rate_limiter);
   http_handler->Start();
   callback();
   return;
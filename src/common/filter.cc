@@ -1,4 +1,5 @@
 #include "config.h"
+#include "ip_filter.hpp"
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <spdlog/spdlog.h>
@@ -7,11 +8,11 @@
 namespace azugate {
 bool Filter(
     const boost::shared_ptr<boost::asio::ip::tcp::socket> &accepted_sock_ptr,
-    ConnectionInfo &connection_info) {
-  auto ip_blacklist = azugate::GetIpBlackList();
-  if (ip_blacklist.contains(std::string(connection_info.address))) {
+    const boost::asio::ip::tcp::endpoint &source_endpoint) {
+  if (!IpFilter::Instance().IsAllowed(source_endpoint.data())) {
     accepted_sock_ptr->close();
-    SPDLOG_WARN("reject connection from {}", connection_info.address);
+    SPDLOG_DEBUG("reject connection from {}",
+                 source_endpoint.address().to_string());
     return false;
   }
   return true;
@@ -0,0 +1,147 @@
+#include "../../include/frequency_sketch.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace azugate {
+
+namespace {
+
+constexpr uint64_t kRowSeeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                  0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+constexpr uint64_t kDoorkeeperSeeds[] = {0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL};
+constexpr uint64_t kCounterMax = 15;
+// Every counter of a word halved at once
+constexpr uint64_t kHalfMask = 0x7777777777777777ULL;
+
+uint64_t mix(uint64_t hash, uint64_t seed) {
+    // splitmix64 finalizer, the rows must not share the bits the shard was picked with
+    uint64_t x = hash ^ seed;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+FrequencySketch::FrequencySketch(size_t capacity) {
+    capacity = std::max<size_t>(capacity, 16);
+    // 16 counters per tracked key over the 4 rows, and 8 doorkeeper bits
+    size_t table_words = std::bit_ceil(capacity);
+    size_t doorkeeper_words = std::bit_ceil(std::max<size_t>(capacity / 8, 1));
+    table_mask_ = table_words * 16 - 1;
+    doorkeeper_mask_ = doorkeeper_words * 64 - 1;
+    sample_size_ = 10 * capacity;
+    table_ = std::make_unique<std::atomic<uint64_t>[]>(table_words);
+    doorkeeper_ = std::make_unique<std::atomic<uint64_t>[]>(doorkeeper_words);
+    clear();
+}
+
+void FrequencySketch::record(uint64_t hash) {
+    // A first sighting only sets the doorkeeper bits, it still counts
+    // towards the sample so one hit wonders age the sketch too
+    if (!doorkeeper_test_and_set(hash)) {
+        count_sample();
+        return;
+    }
+    // Conservative update: only the smallest counters grow, the estimate of
+    // the keys sharing the others stays closer to their real count
+    size_t indexes[kDepth];
+    uint64_t minimum = kCounterMax;
+    for (int row = 0; row < kDepth; row++) {
+        indexes[row] = counter_index(hash, row);
+        auto word = table_[indexes[row] / 16].load(std::memory_order_relaxed);
+        minimum = std::min(minimum, (word >> (indexes[row] % 16 * 4)) & 0xf);
+    }
+    // Popular keys saturate, their lookups stop writing to the shared words
+    if (minimum == kCounterMax) {
+        return;
+    }
+    bool incremented = false;
+    for (auto index : indexes) {
+        auto& slot = table_[index / 16];
+        auto shift = index % 16 * 4;
+        auto word = slot.load(std::memory_order_relaxed);
+        while (((word >> shift) & 0xf) == minimum) {
+            if (slot.compare_exchange_weak(word, word + (uint64_t{1} << shift),
+                                           std::memory_order_relaxed)) {
+                incremented = true;
+                break;
+            }
+        }
+    }
+    if (incremented) {
+        count_sample();
+    }
+}
+
+void FrequencySketch::count_sample() {
+    auto samples = samples_.fetch_add(1, std::memory_order_relaxed) + 1;
+    // A single thread ages the sketch, the one resetting the sample count
+    if (samples >= sample_size_ &&
+        samples_.compare_exchange_strong(samples, 0, std::memory_order_relaxed)) {
+        age();
+    }
+}
+
+unsigned FrequencySketch::estimate(uint64_t hash) const {
+    uint64_t minimum = kCounterMax;
+    for (int row = 0; row < kDepth; row++) {
+        auto index = counter_index(hash, row);
+        auto word = table_[index / 16].load(std::memory_order_relaxed);
+        minimum = std::min(minimum, (word >> (index % 16 * 4)) & 0xf);
+    }
+    return static_cast<unsigned>(minimum) + (doorkeeper_contains(hash) ? 1 : 0);
+}
+
+void FrequencySketch::clear() {
+    for (size_t i = 0; i <= table_mask_ / 16; i++) {
+        table_[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i <= doorkeeper_mask_ / 64; i++) {
+        doorkeeper_[i].store(0, std::memory_order_relaxed);
+    }
+    samples_.store(0, std::memory_order_relaxed);
+}
+
+size_t FrequencySketch::counter_index(uint64_t hash, int row) const {
+    return mix(hash, kRowSeeds[row]) & table_mask_;
+}
+
+bool FrequencySketch::doorkeeper_test_and_set(uint64_t hash) {
+    bool present = true;
+    for (auto seed : kDoorkeeperSeeds) {
+        auto bit = mix(hash, seed) & doorkeeper_mask_;
+        uint64_t mask = uint64_t{1} << (bit % 64);
+        auto& slot = doorkeeper_[bit / 64];
+        // Read first, the bits of a popular key are already set
+        if (!(slot.load(std::memory_order_relaxed) & mask)) {
+            present = (slot.fetch_or(mask, std::memory_order_relaxed) & mask) && present;
+        }
+    }
+    return present;
+}
+
+bool FrequencySketch::doorkeeper_contains(uint64_t hash) const {
+    for (auto seed : kDoorkeeperSeeds) {
+        auto bit = mix(hash, seed) & doorkeeper_mask_;
+        if (!(doorkeeper_[bit / 64].load(std::memory_order_relaxed) & (uint64_t{1} << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrequencySketch::age() {
+    for (size_t i = 0; i <= table_mask_ / 16; i++) {
+        auto& slot = table_[i];
+        auto word = slot.load(std::memory_order_relaxed);
+        while (!slot.compare_exchange_weak(word, (word >> 1) & kHalfMask,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+    for (size_t i = 0; i <= doorkeeper_mask_ / 64; i++) {
+        doorkeeper_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace azugate
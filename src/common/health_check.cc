@@ -0,0 +1,744 @@
+#include "../../include/health_check.hpp"
+#include "config.h"
+#include <algorithm>
+#include <array>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <yaml-cpp/yaml.h>
+
+namespace azugate {
+
+namespace {
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// the subset of HTTP/2 the grpc probe speaks, ref: RFC 9113.
+constexpr std::string_view kH2Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t kH2FrameHeaderSize = 9;
+constexpr uint8_t kH2Data = 0x0;
+constexpr uint8_t kH2Headers = 0x1;
+constexpr uint8_t kH2RstStream = 0x3;
+constexpr uint8_t kH2Settings = 0x4;
+constexpr uint8_t kH2Ping = 0x6;
+constexpr uint8_t kH2Goaway = 0x7;
+constexpr uint8_t kH2WindowUpdate = 0x8;
+constexpr uint8_t kH2FlagEndStream = 0x1;
+constexpr uint8_t kH2FlagAck = 0x1;
+constexpr uint8_t kH2FlagEndHeaders = 0x4;
+constexpr uint8_t kH2FlagPadded = 0x8;
+// HPACK static table, ref: RFC 7541 appendix A.
+constexpr uint8_t kHpackMethodPost = 0x83;
+constexpr uint8_t kHpackSchemeHttp = 0x86;
+constexpr size_t kHpackAuthority = 1;
+constexpr size_t kHpackPath = 4;
+constexpr size_t kHpackContentType = 31;
+constexpr std::string_view kGrpcHealthCheckPath =
+    "/grpc.health.v1.Health/Check";
+// grpc.health.v1.HealthCheckResponse.ServingStatus.SERVING.
+constexpr uint64_t kGrpcServing = 1;
+
+void appendUint32(std::string &out, uint32_t value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+uint32_t readUint32(const uint8_t *in) {
+  return (static_cast<uint32_t>(in[0]) << 24) |
+         (static_cast<uint32_t>(in[1]) << 16) |
+         (static_cast<uint32_t>(in[2]) << 8) | in[3];
+}
+
+void appendFrameHeader(std::string &out, size_t length, uint8_t type,
+                       uint8_t flags, uint32_t stream_id) {
+  out.push_back(static_cast<char>(length >> 16));
+  out.push_back(static_cast<char>(length >> 8));
+  out.push_back(static_cast<char>(length));
+  out.push_back(static_cast<char>(type));
+  out.push_back(static_cast<char>(flags));
+  appendUint32(out, stream_id);
+}
+
+// integer with a `prefix_bits` prefix, ref: RFC 7541 5.1.
+void appendHpackInteger(std::string &out, uint8_t first, int prefix_bits,
+                        size_t value) {
+  size_t max = (size_t{1} << prefix_bits) - 1;
+  if (value < max) {
+    out.push_back(static_cast<char>(first | value));
+    return;
+  }
+  out.push_back(static_cast<char>(first | max));
+  for (value -= max; value >= 0x80; value >>= 7) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void appendHpackString(std::string &out, std::string_view value) {
+  appendHpackInteger(out, 0x00, 7, value.size());
+  out.append(value);
+}
+
+// literal fields without indexing, so the probe never keeps a dynamic
+// table in sync with the server. ref: RFC 7541 6.2.2.
+void appendHpackField(std::string &out, size_t name_index,
+                      std::string_view value) {
+  appendHpackInteger(out, 0x00, 4, name_index);
+  appendHpackString(out, value);
+}
+
+void appendHpackField(std::string &out, std::string_view name,
+                      std::string_view value) {
+  out.push_back(0x00);
+  appendHpackString(out, name);
+  appendHpackString(out, value);
+}
+
+void appendVarint(std::string &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+bool readVarint(std::string_view in, size_t &pos, uint64_t &value) {
+  value = 0;
+  for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<uint8_t>(in[pos++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// status of a length prefixed grpc.health.v1.HealthCheckResponse, 0
+// (UNKNOWN) if it can't be decoded.
+uint64_t grpcServingStatus(std::string_view message) {
+  if (message.size() < 5 || message[0] != 0) {
+    return 0;
+  }
+  auto length = readUint32(reinterpret_cast<const uint8_t *>(&message[1]));
+  auto body = message.substr(5, length);
+  uint64_t status = 0;
+  for (size_t pos = 0; pos < body.size();) {
+    uint64_t tag, value;
+    if (!readVarint(body, pos, tag)) {
+      return 0;
+    }
+    if ((tag & 0x7) == 0) {
+      if (!readVarint(body, pos, value)) {
+        return 0;
+      }
+      if (tag >> 3 == 1) {
+        status = value;
+      }
+    } else if ((tag & 0x7) == 2) {
+      if (!readVarint(body, pos, value)) {
+        return 0;
+      }
+      pos += value;
+    } else {
+      return 0;
+    }
+  }
+  return status;
+}
+
+} // namespace
+
+bool ParseHealthCheckType(std::string_view spec, HealthCheckType &type) {
+  if (spec == "http") {
+    type = HealthCheckType::kHttp;
+  } else if (spec == "tcp") {
+    type = HealthCheckType::kTcp;
+  } else if (spec == "grpc") {
+    type = HealthCheckType::kGrpc;
+  } else {
+    SPDLOG_WARN("unknown health check type: {}", spec);
+    return false;
+  }
+  return true;
+}
+
+// probe connection kept alive between the checks of a target.
+struct HealthCheckScheduler::Connection {
+  explicit Connection(net::io_context &io_context) : stream(io_context) {}
+
+  beast::tcp_stream stream;
+  beast::flat_buffer buffer;
+  // grpc: the preface went out, id of the next stream and DATA received
+  // since the last connection WINDOW_UPDATE.
+  bool h2_started = false;
+  uint32_t next_stream_id = 1;
+  uint32_t window_debt = 0;
+};
+
+struct HealthCheckScheduler::Target {
+  uint64_t id;
+  // immutable once registered, probes read them without a lock.
+  std::string address;
+  uint16_t port;
+  HealthCheckConfig config;
+  Callback callback;
+
+  // the rest is protected by the scheduler's mutex.
+  bool removed = false;
+  // full turns of the wheel left before the probe is due.
+  size_t rounds = 0;
+  HealthStatus status = HealthStatus::Unknown;
+  int consecutive_successes = 0;
+  int consecutive_failures = 0;
+  // idle between probes, null while a probe owns it.
+  std::shared_ptr<Connection> connection;
+};
+
+// one check of a target. a failure on a reused connection is retried
+// once on a fresh one, the server may have closed it while idle.
+class HealthCheckScheduler::Probe
+    : public std::enable_shared_from_this<Probe> {
+public:
+  Probe(HealthCheckScheduler &scheduler, net::io_context &io_context,
+        std::shared_ptr<Target> target,
+        std::shared_ptr<Connection> connection)
+      : scheduler_(scheduler), io_context_(io_context),
+        target_(std::move(target)), connection_(std::move(connection)),
+        resolver_(io_context) {}
+
+  void Start() {
+    start_ = std::chrono::steady_clock::now();
+    deadline_ = start_ + target_->config.timeout;
+    if (connection_) {
+      reused_ = true;
+      send();
+      return;
+    }
+    connect();
+  }
+
+private:
+  void connect() {
+    reused_ = false;
+    connection_ = std::make_shared<Connection>(io_context_);
+    resolver_.async_resolve(
+        target_->address, std::to_string(target_->port),
+        [self = shared_from_this()](const boost::system::error_code &ec,
+                                    tcp::resolver::results_type results) {
+          if (ec) {
+            return self->fail("resolve", ec);
+          }
+          auto &stream = self->connection_->stream;
+          stream.expires_at(self->deadline_);
+          stream.async_connect(
+              results, [self](const boost::system::error_code &ec,
+                              const tcp::endpoint &) {
+                if (ec) {
+                  return self->fail("connect", ec);
+                }
+                if (self->target_->config.type == HealthCheckType::kTcp) {
+                  return self->finish(true, false);
+                }
+                self->send();
+              });
+        });
+  }
+
+  void send() {
+    connection_->stream.expires_at(deadline_);
+    if (target_->config.type == HealthCheckType::kGrpc) {
+      sendGrpc();
+    } else {
+      sendHttp();
+    }
+  }
+
+  void sendHttp() {
+    request_ = http::request<http::empty_body>{http::verb::get,
+                                              target_->config.path, 11};
+    request_.set(http::field::host, target_->address);
+    request_.set(http::field::user_agent, AZUGATE_VERSION_STRING);
+    request_.keep_alive(true);
+    http::async_write(
+        connection_->stream, request_,
+        [self = shared_from_this()](const boost::system::error_code &ec,
+                                    size_t) {
+          if (ec) {
+            return self->fail("write", ec);
+          }
+          self->parser_.emplace();
+          self->parser_->body_limit(kMaxHealthCheckBodySize);
+          http::async_read(self->connection_->stream,
+                           self->connection_->buffer, *self->parser_,
+                           [self](const boost::system::error_code &ec,
+                                  size_t) {
+                             if (ec) {
+                               return self->fail("read", ec);
+                             }
+                             self->onHttpResponse();
+                           });
+        });
+  }
+
+  void onHttpResponse() {
+    auto &response = parser_->get();
+    const auto &config = target_->config;
+    bool success = response.result_int() == config.expected_status &&
+                   (config.expected_body.empty() ||
+                    response.body() == config.expected_body);
+    if (!success) {
+      SPDLOG_DEBUG("health check of {}:{} got status {}", target_->address,
+                   target_->port, response.result_int());
+    }
+    finish(success, response.keep_alive());
+  }
+
+  // HEADERS and DATA of a unary grpc.health.v1.Health/Check call, the
+  // response is judged on its message, trailers are not decoded.
+  void sendGrpc() {
+    auto &connection = *connection_;
+    out_.clear();
+    if (!connection.h2_started) {
+      out_.append(kH2Preface);
+      appendFrameHeader(out_, 0, kH2Settings, 0, 0);
+      connection.h2_started = true;
+    }
+    if (connection.window_debt > 0) {
+      appendFrameHeader(out_, 4, kH2WindowUpdate, 0, 0);
+      appendUint32(out_, connection.window_debt);
+      connection.window_debt = 0;
+    }
+    stream_id_ = connection.next_stream_id;
+    connection.next_stream_id += 2;
+
+    std::string headers;
+    headers.push_back(static_cast<char>(kHpackMethodPost));
+    headers.push_back(static_cast<char>(kHpackSchemeHttp));
+    appendHpackField(headers, kHpackPath, kGrpcHealthCheckPath);
+    appendHpackField(headers, kHpackAuthority,
+                     target_->address + ":" + std::to_string(target_->port));
+    appendHpackField(headers, kHpackContentType, "application/grpc");
+    appendHpackField(headers, "te", "trailers");
+    appendFrameHeader(out_, headers.size(), kH2Headers, kH2FlagEndHeaders,
+                      stream_id_);
+    out_ += headers;
+
+    // HealthCheckRequest{service = 1}.
+    std::string message;
+    if (!target_->config.grpc_service.empty()) {
+      message.push_back(0x0a);
+      appendVarint(message, target_->config.grpc_service.size());
+      message += target_->config.grpc_service;
+    }
+    appendFrameHeader(out_, 5 + message.size(), kH2Data, kH2FlagEndStream,
+                      stream_id_);
+    out_.push_back(0);
+    appendUint32(out_, static_cast<uint32_t>(message.size()));
+    out_ += message;
+
+    grpc_message_.clear();
+    net::async_write(connection_->stream, net::buffer(out_),
+                     [self = shared_from_this()](
+                         const boost::system::error_code &ec, size_t) {
+                       if (ec) {
+                         return self->fail("write", ec);
+                       }
+                       self->readFrame();
+                     });
+  }
+
+  void readFrame() {
+    net::async_read(
+        connection_->stream, net::buffer(frame_header_),
+        [self = shared_from_this()](const boost::system::error_code &ec,
+                                    size_t) {
+          if (ec) {
+            return self->fail("read", ec);
+          }
+          auto &header = self->frame_header_;
+          size_t length = (static_cast<size_t>(header[0]) << 16) |
+                          (static_cast<size_t>(header[1]) << 8) | header[2];
+          if (length > kMaxHealthCheckBodySize) {
+            return self->finish(false, false);
+          }
+          self->frame_payload_.resize(length);
+          if (length == 0) {
+            return self->onFrame();
+          }
+          net::async_read(self->connection_->stream,
+                          net::buffer(self->frame_payload_),
+                          [self](const boost::system::error_code &ec,
+                                 size_t) {
+                            if (ec) {
+                              return self->fail("read", ec);
+                            }
+                            self->onFrame();
+                          });
+        });
+  }
+
+  void onFrame() {
+    uint8_t type = frame_header_[3];
+    uint8_t flags = frame_header_[4];
+    uint32_t stream_id = readUint32(&frame_header_[5]) & 0x7fffffff;
+    std::string_view payload(frame_payload_.data(), frame_payload_.size());
+    switch (type) {
+    case kH2Settings:
+      if ((flags & kH2FlagAck) == 0) {
+        std::string ack;
+        appendFrameHeader(ack, 0, kH2Settings, kH2FlagAck, 0);
+        return writeControl(std::move(ack));
+      }
+      break;
+    case kH2Ping:
+      if ((flags & kH2FlagAck) == 0) {
+        std::string pong;
+        appendFrameHeader(pong, payload.size(), kH2Ping, kH2FlagAck, 0);
+        pong += payload;
+        return writeControl(std::move(pong));
+      }
+      break;
+    case kH2Goaway:
+      return fail("read", net::error::connection_aborted);
+    case kH2RstStream:
+      if (stream_id == stream_id_) {
+        return finish(false, true);
+      }
+      break;
+    case kH2Data:
+      connection_->window_debt += static_cast<uint32_t>(payload.size());
+      if (stream_id != stream_id_) {
+        break;
+      }
+      if ((flags & kH2FlagPadded) != 0 && !payload.empty()) {
+        size_t padding = static_cast<uint8_t>(payload[0]);
+        payload = payload.substr(1, payload.size() - 1 -
+                                        std::min(padding, payload.size() - 1));
+      }
+      grpc_message_ += payload;
+      if (grpc_message_.size() > kMaxHealthCheckBodySize) {
+        return finish(false, false);
+      }
+      if ((flags & kH2FlagEndStream) != 0) {
+        return onGrpcResponse();
+      }
+      break;
+    case kH2Headers:
+      // trailers, or a trailers only error response.
+      if (stream_id == stream_id_ && (flags & kH2FlagEndStream) != 0) {
+        return onGrpcResponse();
+      }
+      break;
+    default:
+      break;
+    }
+    readFrame();
+  }
+
+  void writeControl(std::string frame) {
+    control_ = std::move(frame);
+    net::async_write(connection_->stream, net::buffer(control_),
+                     [self = shared_from_this()](
+                         const boost::system::error_code &ec, size_t) {
+                       if (ec) {
+                         return self->fail("write", ec);
+                       }
+                       self->readFrame();
+                     });
+  }
+
+  void onGrpcResponse() {
+    auto status = grpcServingStatus(grpc_message_);
+    if (status != kGrpcServing) {
+      SPDLOG_DEBUG("grpc health check of {}:{} got serving status {}",
+                   target_->address, target_->port, status);
+    }
+    finish(status == kGrpcServing, true);
+  }
+
+  void fail([[maybe_unused]] const char *step,
+            [[maybe_unused]] const boost::system::error_code &ec) {
+    if (reused_ && std::chrono::steady_clock::now() < deadline_) {
+      SPDLOG_DEBUG("kept alive probe connection to {}:{} failed to {}: {}",
+                   target_->address, target_->port, step, ec.message());
+      connection_.reset();
+      return connect();
+    }
+    SPDLOG_DEBUG("health check of {}:{} failed to {}: {}", target_->address,
+                 target_->port, step, ec.message());
+    finish(false, false);
+  }
+
+  void finish(bool success, bool keep_alive) {
+    auto latency = std::chrono::steady_clock::now() - start_;
+    if (connection_ && keep_alive) {
+      connection_->stream.expires_never();
+    } else if (connection_) {
+      boost::system::error_code ec;
+      connection_->stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+      connection_->stream.close();
+      connection_.reset();
+    }
+    scheduler_.onProbeDone(target_, std::move(connection_), success,
+                           latency);
+  }
+
+  HealthCheckScheduler &scheduler_;
+  net::io_context &io_context_;
+  std::shared_ptr<Target> target_;
+  std::shared_ptr<Connection> connection_;
+  tcp::resolver resolver_;
+  bool reused_ = false;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point deadline_;
+  // http.
+  http::request<http::empty_body> request_;
+  std::optional<http::response_parser<http::string_body>> parser_;
+  // grpc.
+  std::string out_;
+  std::string control_;
+  uint32_t stream_id_ = 0;
+  std::array<uint8_t, kH2FrameHeaderSize> frame_header_;
+  std::string frame_payload_;
+  std::string grpc_message_;
+};
+
+HealthCheckScheduler &HealthCheckScheduler::Instance() {
+  static HealthCheckScheduler scheduler;
+  return scheduler;
+}
+
+bool HealthCheckScheduler::LoadFromConfig(const YAML::Node &config) {
+  auto node = config["load_balancer"] ? config["load_balancer"]["health_checks"]
+                                      : YAML::Node();
+  if (!node) {
+    Configure(kDftMaxConcurrentProbes, kDftHealthCheckJitter);
+    return true;
+  }
+  try {
+    Configure(node["max_concurrent"].as<size_t>(kDftMaxConcurrentProbes),
+              node["jitter"].as<double>(kDftHealthCheckJitter));
+  } catch (const YAML::Exception &e) {
+    SPDLOG_ERROR("failed to load health checks: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+void HealthCheckScheduler::Configure(size_t max_concurrent, double jitter) {
+  std::vector<std::shared_ptr<Probe>> probes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_concurrent_ = std::max<size_t>(max_concurrent, 1);
+    jitter_ = std::clamp(jitter, 0.0, 1.0);
+    takeReady(probes);
+  }
+  for (auto &probe : probes) {
+    probe->Start();
+  }
+}
+
+void HealthCheckScheduler::Start(net::io_context &io_context) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return;
+  }
+  if (!timer_ || io_context_ != &io_context) {
+    io_context_ = &io_context;
+    timer_ = std::make_unique<net::steady_timer>(io_context);
+  }
+  running_ = true;
+  last_tick_ = std::chrono::steady_clock::now();
+  armTimer();
+  SPDLOG_INFO("health check scheduler started with {} target(s)",
+              targets_.size());
+}
+
+void HealthCheckScheduler::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = false;
+  if (timer_) {
+    timer_->cancel();
+  }
+  for (auto &[_, target] : targets_) {
+    target->connection.reset();
+  }
+}
+
+uint64_t HealthCheckScheduler::Register(const std::string &address,
+                                        uint16_t port,
+                                        const HealthCheckConfig &config,
+                                        Callback callback) {
+  auto target = std::make_shared<Target>();
+  target->address = address;
+  target->port = port;
+  target->config = config;
+  target->callback = std::move(callback);
+  std::lock_guard<std::mutex> lock(mutex_);
+  target->id = next_id_++;
+  targets_.emplace(target->id, target);
+  // spread the targets registered together over their first interval.
+  std::uniform_int_distribution<int64_t> first_delay(
+      0, std::chrono::nanoseconds(config.interval).count());
+  schedule(target, std::chrono::nanoseconds(first_delay(rng_)));
+  return target->id;
+}
+
+void HealthCheckScheduler::Unregister(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = targets_.find(id);
+  if (it == targets_.end()) {
+    return;
+  }
+  it->second->removed = true;
+  it->second->connection.reset();
+  targets_.erase(it);
+}
+
+size_t HealthCheckScheduler::NumTargets() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return targets_.size();
+}
+
+size_t HealthCheckScheduler::NumInFlight() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_flight_;
+}
+
+void HealthCheckScheduler::schedule(const std::shared_ptr<Target> &target,
+                                    std::chrono::nanoseconds delay) {
+  int64_t tick = std::chrono::nanoseconds(kHealthCheckTick).count();
+  int64_t ticks = std::max<int64_t>((delay.count() + tick - 1) / tick, 1);
+  target->rounds = static_cast<size_t>(ticks - 1) / kHealthCheckWheelSlots;
+  auto slot = (current_slot_ + static_cast<size_t>(ticks - 1) %
+                                   kHealthCheckWheelSlots +
+               1) %
+              kHealthCheckWheelSlots;
+  wheel_[slot].push_back(target);
+}
+
+std::chrono::nanoseconds
+HealthCheckScheduler::jittered(std::chrono::milliseconds interval) {
+  std::uniform_real_distribution<double> spread(-jitter_, jitter_);
+  return std::chrono::nanoseconds(static_cast<int64_t>(
+      std::chrono::nanoseconds(interval).count() * (1.0 + spread(rng_))));
+}
+
+void HealthCheckScheduler::armTimer() {
+  timer_->expires_at(last_tick_ + kHealthCheckTick);
+  timer_->async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      onTick();
+    }
+  });
+}
+
+void HealthCheckScheduler::onTick() {
+  std::vector<std::shared_ptr<Probe>> probes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    // catch up with the ticks missed by a busy io_context, at most one
+    // turn of the wheel: every slot is visited once then.
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0;
+         last_tick_ + kHealthCheckTick <= now && i < kHealthCheckWheelSlots;
+         ++i) {
+      last_tick_ += kHealthCheckTick;
+      current_slot_ = (current_slot_ + 1) % kHealthCheckWheelSlots;
+      std::vector<std::shared_ptr<Target>> waiting;
+      for (auto &target : wheel_[current_slot_]) {
+        if (target->removed) {
+          continue;
+        }
+        if (target->rounds > 0) {
+          --target->rounds;
+          waiting.push_back(std::move(target));
+        } else {
+          ready_.push_back(std::move(target));
+        }
+      }
+      wheel_[current_slot_].swap(waiting);
+    }
+    if (last_tick_ + kHealthCheckTick <= now) {
+      last_tick_ = now;
+    }
+    takeReady(probes);
+    armTimer();
+  }
+  for (auto &probe : probes) {
+    probe->Start();
+  }
+}
+
+void HealthCheckScheduler::takeReady(
+    std::vector<std::shared_ptr<Probe>> &probes) {
+  while (running_ && in_flight_ < max_concurrent_ && !ready_.empty()) {
+    auto target = std::move(ready_.front());
+    ready_.pop_front();
+    if (target->removed) {
+      continue;
+    }
+    ++in_flight_;
+    probes.push_back(std::make_shared<Probe>(*this, *io_context_, target,
+                                             std::move(target->connection)));
+  }
+}
+
+void HealthCheckScheduler::onProbeDone(const std::shared_ptr<Target> &target,
+                                       std::shared_ptr<Connection> connection,
+                                       bool success,
+                                       std::chrono::nanoseconds latency) {
+  HealthCheckResult result{.success = success, .latency = latency};
+  Callback callback;
+  std::vector<std::shared_ptr<Probe>> probes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_flight_;
+    if (!target->removed) {
+      auto previous = target->status;
+      const auto &config = target->config;
+      if (success) {
+        ++target->consecutive_successes;
+        target->consecutive_failures = 0;
+        if (target->status == HealthStatus::Unknown ||
+            (target->status != HealthStatus::Healthy &&
+             target->consecutive_successes >= config.healthy_threshold)) {
+          target->status = HealthStatus::Healthy;
+        }
+      } else {
+        ++target->consecutive_failures;
+        target->consecutive_successes = 0;
+        if (target->status != HealthStatus::Unhealthy &&
+            target->consecutive_failures >= config.unhealthy_threshold) {
+          target->status = HealthStatus::Unhealthy;
+        }
+      }
+      result.status = target->status;
+      result.status_changed = target->status != previous;
+      target->connection = running_ ? std::move(connection) : nullptr;
+      schedule(target, jittered(config.interval));
+      callback = target->callback;
+    }
+    takeReady(probes);
+  }
+  if (callback) {
+    callback(result);
+  }
+  for (auto &probe : probes) {
+    probe->Start();
+  }
+}
+
+} // namespace azugate
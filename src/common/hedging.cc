@@ -0,0 +1,142 @@
+#include "../../include/hedging.hpp"
+#include "../../include/config.h"
+#include "../../include/retry_policy.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <spdlog/spdlog.h>
+#include <yaml-cpp/yaml.h>
+
+namespace azugate {
+
+bool ParseHedgeDelay(std::string_view spec, HedgePolicy &policy) {
+  if (!spec.empty() && spec.front() == 'p') {
+    double percentile = 0;
+    auto [end, ec] =
+        std::from_chars(spec.data() + 1, spec.data() + spec.size(), percentile);
+    if (ec != std::errc() || end != spec.data() + spec.size() ||
+        percentile <= 0 || percentile >= 100) {
+      SPDLOG_WARN("invalid hedge percentile: {}", spec);
+      return false;
+    }
+    policy.percentile = percentile;
+    return true;
+  }
+  auto delay = ParseDuration(spec);
+  if (!delay) {
+    SPDLOG_WARN("invalid hedge delay: {}", spec);
+    return false;
+  }
+  policy.percentile = 0;
+  policy.delay = *delay;
+  return true;
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency) {
+  // bucket 0 holds [0, 1us), bucket i [2^((i-1)/4), 2^(i/4)) us.
+  auto us = std::chrono::duration<double, std::micro>(latency).count();
+  size_t index = 0;
+  if (us >= 1) {
+    auto bucket = 1 + static_cast<size_t>(std::floor(4 * std::log2(us)));
+    index = std::min(kNumBuckets - 1, bucket);
+  }
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  if (since_decay_.fetch_add(1, std::memory_order_relaxed) + 1 ==
+      kHedgeLatencyDecaySamples) {
+    decay();
+  }
+}
+
+// only the thread that reached the threshold gets here.
+void LatencyHistogram::decay() {
+  uint64_t remaining = 0;
+  for (auto &bucket : buckets_) {
+    auto halved = bucket.load(std::memory_order_relaxed) / 2;
+    bucket.store(halved, std::memory_order_relaxed);
+    remaining += halved;
+  }
+  count_.store(remaining, std::memory_order_relaxed);
+  since_decay_.store(0, std::memory_order_relaxed);
+}
+
+std::optional<std::chrono::nanoseconds>
+LatencyHistogram::Percentile(double percentile, uint64_t min_samples) const {
+  auto count = Count();
+  if (count == 0 || count < min_samples) {
+    return std::nullopt;
+  }
+  auto rank = static_cast<uint64_t>(std::ceil(count * percentile / 100.0));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return std::chrono::nanoseconds(
+          static_cast<int64_t>(std::exp2(i / 4.0) * 1000));
+    }
+  }
+  return std::chrono::nanoseconds(
+      static_cast<int64_t>(std::exp2(kNumBuckets / 4.0) * 1000));
+}
+
+std::chrono::nanoseconds RouteHedging::Delay() const {
+  if (policy_.percentile > 0) {
+    if (auto observed = histogram_.Percentile(policy_.percentile,
+                                              kMinHedgeLatencySamples)) {
+      return std::max<std::chrono::nanoseconds>(*observed, policy_.min_delay);
+    }
+  }
+  return policy_.delay;
+}
+
+HedgeBudget &HedgeBudget::Instance() {
+  static HedgeBudget instance;
+  return instance;
+}
+
+bool HedgeBudget::LoadFromConfig(const YAML::Node &config) {
+  auto budget = config["hedge"] ? config["hedge"]["budget"] : YAML::Node();
+  if (!budget) {
+    Configure(kDftHedgeBudgetPercent, kDftMinHedgeConcurrency);
+    return true;
+  }
+  try {
+    auto percent = budget["percent"].as<double>(kDftHedgeBudgetPercent);
+    if (percent < 0 || percent > 100) {
+      SPDLOG_ERROR("hedge.budget.percent must be between 0 and 100");
+      return false;
+    }
+    Configure(percent,
+              budget["min_concurrency"].as<size_t>(kDftMinHedgeConcurrency));
+  } catch (const YAML::Exception &e) {
+    SPDLOG_ERROR("failed to load hedge budget: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+void HedgeBudget::Configure(double budget_percent,
+                            size_t min_hedge_concurrency) {
+  budget_percent_.store(budget_percent, std::memory_order_relaxed);
+  min_hedge_concurrency_.store(min_hedge_concurrency,
+                               std::memory_order_relaxed);
+}
+
+bool HedgeBudget::TryAcquireHedge() {
+  // hedged requests are counted by the retry budget like all the others.
+  auto allowed = std::max(
+      static_cast<size_t>(RetryBudget::Instance().ActiveRequests() *
+                          budget_percent_.load(std::memory_order_relaxed) /
+                          100.0),
+      min_hedge_concurrency_.load(std::memory_order_relaxed));
+  auto hedges = active_hedges_.load(std::memory_order_relaxed);
+  do {
+    if (hedges >= allowed) {
+      return false;
+    }
+  } while (!active_hedges_.compare_exchange_weak(hedges, hedges + 1,
+                                                 std::memory_order_relaxed));
+  return true;
+}
+
+} // namespace azugate
@@ -1,97 +1,609 @@
 #include "../../include/http_cache.hpp"
+#include "../../include/cache_snapshot.hpp"
+#include "../../include/config.h"
+#include "../../include/disk_cache.hpp"
+#include "../../include/frequency_sketch.hpp"
+#include "picohttpparser.h"
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <ctime>
 #include <iomanip>
+#include <locale>
 #include <shared_mutex>
 #include <sstream>
+#include <yaml-cpp/yaml.h>
 
 namespace azugate {
 
-// HttpCache Implementation
-HttpCache::HttpCache(const HttpCacheConfig& config) 
-    : config_(config), last_cleanup_(std::chrono::steady_clock::now()) {
-    SPDLOG_INFO("HTTP cache initialized - Max size: {}MB, Max entries: {}", 
-                config_.max_size_bytes / (1024 * 1024), config_.max_entries);
+namespace {
+
+uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
 }
 
-std::optional<std::shared_ptr<CacheEntry>> HttpCache::get(const CacheKey& key) {
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    
-    auto it = cache_map_.find(key);
-    if (it == cache_map_.end()) {
-        stats_.misses++;
+size_t round_up_to_power_of_two(size_t n) {
+    size_t power = 1;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+struct ResponseHead {
+    int status = 0;
+    // Length of the status line and the headers, up to the body
+    size_t length = 0;
+    phr_header headers[kMaxHeadersNum];
+    size_t num_headers = kMaxHeadersNum;
+};
+
+bool parse_response_head(std::string_view response, ResponseHead& head) {
+    int minor_version = 0;
+    const char* msg = nullptr;
+    size_t msg_len = 0;
+    int length = phr_parse_response(response.data(), response.size(), &minor_version,
+                                    &head.status, &msg, &msg_len, head.headers,
+                                    &head.num_headers, 0);
+    if (length <= 0) {
+        return false;
+    }
+    head.length = static_cast<size_t>(length);
+    return true;
+}
+
+std::string header_name(const phr_header& header) {
+    std::string name(header.name, header.name_len);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name;
+}
+
+std::optional<std::time_t> parse_http_date(const std::string& date) {
+    // IMF-fixdate, the only format senders may generate (RFC 9110 section 5.6.7)
+    std::tm tm{};
+    std::istringstream iss(date);
+    iss.imbue(std::locale::classic());
+    iss >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+    if (iss.fail()) {
         return std::nullopt;
     }
-    
-    auto& entry = it->second->second;
-    
-    // Check if entry is expired
-    if (entry->is_expired()) {
-        stats_.expired_entries++;
-        stats_.misses++;
+#ifdef _WIN32
+    return _mkgmtime(&tm);
+#else
+    return timegm(&tm);
+#endif
+}
+
+// Weak comparison of an If-None-Match list with an entity tag
+bool etag_matches(const std::string& if_none_match, const std::string& etag) {
+    auto opaque = [](std::string_view tag) {
+        return tag.starts_with("W/") ? tag.substr(2) : tag;
+    };
+    std::istringstream iss(if_none_match);
+    std::string candidate;
+    while (std::getline(iss, candidate, ',')) {
+        candidate.erase(0, candidate.find_first_not_of(" \t"));
+        candidate.erase(candidate.find_last_not_of(" \t") + 1);
+        if (candidate == "*" || opaque(candidate) == opaque(etag)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Null unless the value is a decimal number, or a list of the same one
+// repeated, RFC 9110 section 8.6
+std::optional<uint64_t> parse_content_length(std::string_view value) {
+    std::optional<uint64_t> length;
+    while (true) {
+        auto comma = value.find(',');
+        auto item = value.substr(0, comma);
+        auto begin = item.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) {
+            return std::nullopt;
+        }
+        item = item.substr(begin, item.find_last_not_of(" \t") - begin + 1);
+        uint64_t item_length = 0;
+        auto [end, ec] = std::from_chars(item.data(), item.data() + item.size(), item_length);
+        if (ec != std::errc() || end != item.data() + item.size() ||
+            (length && *length != item_length)) {
+            return std::nullopt;
+        }
+        length = item_length;
+        if (comma == std::string_view::npos) {
+            return length;
+        }
+        value.remove_prefix(comma + 1);
+    }
+}
+
+// Header names of a Vary value, lowercased, sorted and comma separated,
+// "*" if it has one
+std::string normalize_vary(std::string_view vary) {
+    std::vector<std::string> names;
+    std::istringstream iss{std::string(vary)};
+    std::string name;
+    while (std::getline(iss, name, ',')) {
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (name == "*") {
+            return name;
+        }
+        if (!name.empty()) {
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            names.push_back(std::move(name));
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    std::string normalized;
+    for (const auto& header : names) {
+        if (!normalized.empty()) {
+            normalized += ',';
+        }
+        normalized += header;
+    }
+    return normalized;
+}
+
+// Normalized Vary of a stored response, from the headers of its head
+std::string response_vary(const CacheEntry& entry) {
+    std::string_view fields = std::string_view(entry.head).substr(entry.fields_at);
+    std::string vary;
+    while (!fields.empty()) {
+        auto end = fields.find("\r\n");
+        auto line = fields.substr(0, end);
+        fields = end == std::string_view::npos ? std::string_view{} : fields.substr(end + 2);
+        auto colon = line.find(':');
+        if (colon != 4 || !std::equal(line.begin(), line.begin() + 4, "vary",
+                                      [](char a, char b) { return std::tolower(a) == b; })) {
+            continue;
+        }
+        if (!vary.empty()) {
+            vary += ',';
+        }
+        vary.append(line.substr(colon + 1));
+    }
+    return normalize_vary(vary);
+}
+
+// Header names the secondary key was built from, see extract_vary_headers()
+std::string_view vary_of(const CacheKey& key) {
+    return std::string_view(key.vary_headers).substr(0, key.vary_headers.find('\n'));
+}
+
+// Identifies the variants of a URL
+std::string primary_key(const CacheKey& key) {
+    return key.method + ":" + key.url + "?" + key.query_params;
+}
+
+// Current time as an IMF-fixdate, formatted once a second per thread
+std::string_view http_date_now() {
+    thread_local std::time_t formatted_at = 0;
+    thread_local char date[32] = {};
+    auto now = std::time(nullptr);
+    if (now != formatted_at) {
+        std::tm tm{};
+#ifdef _WIN32
+        gmtime_s(&tm, &now);
+#else
+        gmtime_r(&now, &tm);
+#endif
+        std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        formatted_at = now;
+    }
+    return date;
+}
+
+// Status line, then the Content-Length and Content-Range lines and the
+// other headers but Date and Age, for CacheEntry::head
+void serialize_head(CacheEntry& entry, std::string_view response, const ResponseHead& parsed) {
+    auto& head = entry.head;
+    head.clear();
+    head.reserve(parsed.length);
+    head.append(response.substr(0, response.find("\r\n") + 2));
+    entry.fields_at = head.size();
+    bool chunked = false;
+    bool content_length = false;
+    for (size_t i = 0; i < parsed.num_headers; ++i) {
+        auto name = header_name(parsed.headers[i]);
+        content_length = content_length || name == "content-length";
+        if (name == "content-length" || name == "content-range") {
+            head.append(parsed.headers[i].name, parsed.headers[i].name_len);
+            head += ": ";
+            head.append(parsed.headers[i].value, parsed.headers[i].value_len);
+            head += "\r\n";
+        }
+        chunked = chunked || name == "transfer-encoding";
+    }
+    entry.range_fields_at = head.size();
+    entry.accept_ranges = parsed.status == 200 && content_length && !chunked;
+    bool accept_ranges_sent = false;
+    for (size_t i = 0; i < parsed.num_headers; ++i) {
+        auto name = header_name(parsed.headers[i]);
+        if (name == "content-length" || name == "content-range" || name == "date" ||
+            name == "age") {
+            continue;
+        }
+        accept_ranges_sent = accept_ranges_sent || name == "accept-ranges";
+        head.append(parsed.headers[i].name, parsed.headers[i].name_len);
+        head += ": ";
+        head.append(parsed.headers[i].value, parsed.headers[i].value_len);
+        head += "\r\n";
+    }
+    if ((entry.accept_ranges || parsed.status == 206) && !accept_ranges_sent) {
+        head += "Accept-Ranges: bytes\r\n";
+    }
+}
+
+// Single byte range of a Range header, RFC 9110 section 14.1.2. `first`
+// is unset for a suffix range of the last `last` bytes, `last` for an
+// open-ended one. A header with several ranges, or one that can't be
+// parsed, has none: the whole body is then sent.
+struct RangeSpec {
+    std::optional<uint64_t> first;
+    std::optional<uint64_t> last;
+};
+
+std::optional<RangeSpec> parse_range(std::string_view value) {
+    auto trim = [](std::string_view s) {
+        auto begin = s.find_first_not_of(" \t");
+        return begin == std::string_view::npos
+                   ? std::string_view()
+                   : s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+    };
+    auto number = [](std::string_view s) -> std::optional<uint64_t> {
+        uint64_t n = 0;
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+        if (s.empty() || ec != std::errc() || end != s.data() + s.size()) {
+            return std::nullopt;
+        }
+        return n;
+    };
+    value = trim(value);
+    constexpr std::string_view kUnit = "bytes=";
+    if (value.size() < kUnit.size() ||
+        !std::equal(kUnit.begin(), kUnit.end(), value.begin(),
+                    [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); })) {
+        return std::nullopt;
+    }
+    auto spec = trim(value.substr(kUnit.size()));
+    auto dash = spec.find('-');
+    if (spec.find(',') != std::string_view::npos || dash == std::string_view::npos) {
+        return std::nullopt;
+    }
+    auto first_pos = trim(spec.substr(0, dash));
+    auto last_pos = trim(spec.substr(dash + 1));
+    RangeSpec range;
+    if (!first_pos.empty() && !(range.first = number(first_pos))) {
+        return std::nullopt;
+    }
+    if (!last_pos.empty() && !(range.last = number(last_pos))) {
+        return std::nullopt;
+    }
+    if (!range.first && !range.last) {
+        return std::nullopt;
+    }
+    if (range.first && range.last && *range.last < *range.first) {
+        return std::nullopt;
+    }
+    return range;
+}
+
+// The range over a body of `size` bytes
+ByteRange resolve_range(const RangeSpec& spec, uint64_t size) {
+    ByteRange range;
+    if (!spec.first) {
+        // Suffix range, the last bytes
+        range.satisfiable = *spec.last > 0 && size > 0;
+        range.length = std::min(*spec.last, size);
+        range.first = size - range.length;
+        return range;
+    }
+    range.satisfiable = *spec.first < size;
+    if (range.satisfiable) {
+        range.first = *spec.first;
+        auto last = spec.last ? std::min(*spec.last, size - 1) : size - 1;
+        range.length = last - range.first + 1;
+    }
+    return range;
+}
+
+// Complete length of a 206's "Content-Range: bytes first-last/length", the
+// range has to start at `offset` and have `size` bytes
+std::optional<uint64_t> parse_content_range(std::string_view value, uint64_t offset, uint64_t size) {
+    uint64_t first = 0;
+    uint64_t last = 0;
+    uint64_t length = 0;
+    constexpr std::string_view kUnit = "bytes ";
+    if (!value.starts_with(kUnit)) {
+        return std::nullopt;
+    }
+    const char* p = value.data() + kUnit.size();
+    const char* end = value.data() + value.size();
+    auto next = [&](uint64_t& n, char separator) {
+        auto [ptr, ec] = std::from_chars(p, end, n);
+        if (ec != std::errc() || (separator && (ptr == end || *ptr != separator))) {
+            return false;
+        }
+        p = separator ? ptr + 1 : ptr;
+        return true;
+    };
+    if (!next(first, '-') || !next(last, '/') || !next(length, 0) || p != end) {
+        return std::nullopt;
+    }
+    if (first != offset || last < first || last - first + 1 != size || last >= length) {
+        return std::nullopt;
+    }
+    return length;
+}
+
+// If-Range, RFC 9110 section 13.1.5: a strong entity tag or the exact
+// Last-Modified date of the entry
+bool if_range_matches(const CacheEntry& entry, const std::string& if_range) {
+    if (if_range.starts_with("\"") || if_range.starts_with("W/")) {
+        return !entry.etag.starts_with("W/") && if_range == entry.etag;
+    }
+    if (entry.last_modified.empty()) {
+        return false;
+    }
+    auto date = parse_http_date(if_range);
+    auto modified = parse_http_date(entry.last_modified);
+    return date && modified && *date == *modified;
+}
+
+// Content-Range and Content-Length of a 206, or of a 416 if unsatisfiable
+void append_content_range(std::string& fields, const ByteRange& range, uint64_t size) {
+    if (!range.satisfiable) {
+        fields += "Content-Range: bytes */" + std::to_string(size) + "\r\nContent-Length: 0\r\n";
+        return;
+    }
+    fields += "Content-Range: bytes " + std::to_string(range.first) + "-" +
+              std::to_string(range.first + range.length - 1) + "/" + std::to_string(size) + "\r\n";
+    fields += "Content-Length: " + std::to_string(range.length) + "\r\n";
+}
+
+// The headers set for each response, and the blank line
+void append_date_and_age(std::string& fields, const CacheEntry& entry) {
+    fields += "Date: ";
+    fields.append(http_date_now());
+    fields += "\r\nAge: " + std::to_string(entry.age().count()) + "\r\n\r\n";
+}
+
+} // namespace
+
+uint64_t CacheEntry::body_size() const {
+    if (disk_body) {
+        return disk_body->length;
+    }
+    uint64_t size = 0;
+    for (const auto& segment : body) {
+        size += segment.length;
+    }
+    return size;
+}
+
+std::vector<std::string_view> CacheEntry::body_slices(uint64_t offset, uint64_t length) const {
+    std::vector<std::string_view> slices;
+    for (const auto& segment : body) {
+        if (length == 0) {
+            break;
+        }
+        if (offset >= segment.length) {
+            offset -= segment.length;
+            continue;
+        }
+        auto slice = segment.view().substr(offset, length);
+        slices.push_back(slice);
+        length -= slice.size();
+        offset = 0;
+    }
+    return slices;
+}
+
+void CacheKey::finalize() {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (const std::string* part : {&method, &url, &query_params, &vary_headers}) {
+        h = mix64(h ^ std::hash<std::string_view>{}(*part));
+    }
+    if (slice) {
+        h = mix64(h ^ (*slice + 1));
+    }
+    hash = h;
+}
+
+// HttpCache Implementation
+HttpCache::HttpCache(const HttpCacheConfig& config) 
+    : config_(std::make_shared<const HttpCacheConfig>(config)),
+      last_cleanup_(std::chrono::steady_clock::now().time_since_epoch().count()) {
+    size_t num_shards = round_up_to_power_of_two(std::clamp<size_t>(config.num_shards, 1, 1024));
+    shard_shift_ = 64;
+    for (size_t n = num_shards; n > 1; n >>= 1) {
+        --shard_shift_;
+    }
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>(std::max<size_t>(1, config.max_entries / num_shards)));
+    }
+    SPDLOG_INFO("HTTP cache initialized - Max size: {}MB, Max entries: {}, Shards: {}", 
+                config.max_size_bytes / (1024 * 1024), config.max_entries, num_shards);
+    if (config.disk.enabled) {
+        auto disk = std::make_unique<DiskCache>(config.disk);
+        if (disk->open(config.snapshot.enabled)) {
+            disk_ = std::move(disk);
+        } else {
+            SPDLOG_WARN("HTTP cache disk tier disabled, large responses won't be cached");
+        }
+    }
+    if (config.snapshot.enabled) {
+        snapshot_path_ = config.snapshot.path;
+        restore_snapshot();
+    }
+    if (disk_) {
+        disk_->drop_unreferenced_segments();
+    }
+}
+
+HttpCache::~HttpCache() = default;
+
+HttpCache::Shard::Shard(size_t capacity)
+    : hand(queue.end()), sketch(std::make_unique<FrequencySketch>(capacity)) {}
+
+HttpCache::Shard::~Shard() = default;
+
+std::optional<std::shared_ptr<CacheEntry>> HttpCache::get(const CacheKey& key,
+                                                      std::shared_ptr<CacheEntry>* stale) {
+    auto& shard = shard_for(key);
+    shard.sketch->record(key.hash);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
         
-        // Remove expired entry (need to upgrade to exclusive lock)
-        lock.unlock();
-        std::unique_lock<std::shared_mutex> write_lock(mutex_);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            lock.unlock();
+            if (auto restored = take_from_snapshot(key)) {
+                if (!restored->is_expired()) {
+                    restored->hit_count.fetch_add(1, std::memory_order_relaxed);
+                    stats_.hits++;
+                    return restored;
+                }
+                // The snapshot only holds usable entries
+                stats_.misses++;
+                if (stale) {
+                    *stale = std::move(restored);
+                }
+                return std::nullopt;
+            }
+            return get_from_disk(key, stale);
+        }
         
-        // Double-check the entry is still there and still expired
-        auto check_it = cache_map_.find(key);
-        if (check_it != cache_map_.end() && check_it->second->second->is_expired()) {
-            stats_.current_size_bytes -= check_it->second->second->size_bytes;
-            stats_.current_entries--;
-            lru_list_.erase(check_it->second);
-            cache_map_.erase(check_it);
+        auto& node = *it->second;
+        if (!node.entry->is_expired()) {
+            // Skip the store when it's already set, hot entries stay read-only
+            if (!node.visited.load(std::memory_order_relaxed)) {
+                node.visited.store(true, std::memory_order_relaxed);
+            }
+            node.entry->hit_count.fetch_add(1, std::memory_order_relaxed);
+            stats_.hits++;
+            return node.entry;
         }
         
-        return std::nullopt;
+        stats_.misses++;
+        if (!node.entry->is_unusable()) {
+            // Kept for the stale windows, the caller decides whether it can use it
+            if (stale) {
+                *stale = node.entry;
+            }
+            return std::nullopt;
+        }
     }
     
-    // Move to front of LRU list (need to upgrade to exclusive lock)
-    lock.unlock();
-    std::unique_lock<std::shared_mutex> write_lock(mutex_);
+    stats_.expired_entries++;
     
-    // Double-check the entry is still there
-    auto check_it = cache_map_.find(key);
-    if (check_it != cache_map_.end()) {
-        move_to_front(check_it->second);
-        check_it->second->second->hit_count++;
+    // Remove the expired entry, if nobody replaced it in the meantime
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end() && it->second->entry->is_unusable()) {
+        erase(shard, it->second);
+    }
+    return std::nullopt;
+}
+
+std::optional<std::shared_ptr<CacheEntry>> HttpCache::get_from_disk(const CacheKey& key,
+                                                                    std::shared_ptr<CacheEntry>* stale) {
+    auto entry = disk_ ? disk_->get(key) : nullptr;
+    if (entry && !entry->is_expired()) {
+        entry->hit_count.fetch_add(1, std::memory_order_relaxed);
         stats_.hits++;
-        return check_it->second->second;
+        return entry;
     }
-    
     stats_.misses++;
+    if (!entry) {
+        return std::nullopt;
+    }
+    if (!entry->is_unusable()) {
+        if (stale) {
+            *stale = std::move(entry);
+        }
+        return std::nullopt;
+    }
+    stats_.expired_entries++;
+    disk_->remove(key, entry.get());
     return std::nullopt;
 }
 
 bool HttpCache::put(const CacheKey& key, std::shared_ptr<CacheEntry> entry) {
-    if (!entry || !entry->is_cacheable() || entry->size_bytes > config_.max_response_size) {
+    auto config = get_config();
+    if (!entry || !entry->is_cacheable()) {
+        return false;
+    }
+    // A response is stored under the request's values of the headers it
+    // varies on. The key of the first one of a URL wasn't built from them,
+    // it only teaches the keys of the next requests.
+    if (auto vary = response_vary(*entry); vary != vary_of(key)) {
+        if (vary != "*") {
+            remember_vary(key, vary);
+        }
         return false;
     }
     
-    std::unique_lock<std::shared_mutex> lock(mutex_);
+    // Responses too large for memory go to the disk tier
+    if (entry->disk_body || entry->size_bytes > config->max_response_size) {
+        if (!disk_ || entry->size_bytes > max_object_size(*config)) {
+            return false;
+        }
+        bool stored = entry->disk_body ? disk_->update(key, std::move(entry))
+                                       : disk_->put(key, *entry);
+        if (stored) {
+            remove_from_memory(key);
+            stats_.stores++;
+        }
+        return stored;
+    }
+    if (disk_) {
+        disk_->remove(key);
+    }
+    
+    auto& shard = shard_for(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
     
     // Check if key already exists
-    auto existing_it = cache_map_.find(key);
-    if (existing_it != cache_map_.end()) {
-        // Update existing entry
-        stats_.current_size_bytes -= existing_it->second->second->size_bytes;
-        existing_it->second->second = entry;
-        stats_.current_size_bytes += entry->size_bytes;
-        move_to_front(existing_it->second);
+    auto existing_it = shard.index.find(key);
+    if (existing_it != shard.index.end()) {
+        // Update existing entry, it counts as an access
+        auto& node = *existing_it->second;
+        shard.size_bytes -= node.entry->size_bytes;
+        stats_.current_size_bytes -= node.entry->size_bytes;
+        if (node.in_window) {
+            shard.window_bytes += entry->size_bytes - node.entry->size_bytes;
+        }
+        node.entry = std::move(entry);
+        shard.size_bytes += node.entry->size_bytes;
+        stats_.current_size_bytes += node.entry->size_bytes;
+        node.visited.store(true, std::memory_order_relaxed);
         return true;
     }
     
-    // Ensure we have space
-    evict_if_needed();
-    
-    // Add new entry
-    lru_list_.push_front({key, entry});
-    cache_map_[key] = lru_list_.begin();
+    // New entries start in the window, the ones pushed out of it have to be
+    // admitted into the main queue
+    shard.window.emplace_front(key, entry);
+    shard.window.front().in_window = true;
+    shard.index.emplace(key, shard.window.begin());
+    shard.size_bytes += entry->size_bytes;
+    shard.window_bytes += entry->size_bytes;
     
     stats_.stores++;
     stats_.current_entries++;
     stats_.current_size_bytes += entry->size_bytes;
     
+    drain_window(shard, *config, shard_limits(*config));
+    
     SPDLOG_DEBUG("Cached response: {} (size: {} bytes, TTL: {}s)", 
                 key.to_string(), entry->size_bytes, 
                 std::chrono::duration_cast<std::chrono::seconds>(
@@ -101,28 +613,45 @@ bool HttpCache::put(const CacheKey& key, std::shared_ptr<CacheEntry> entry) {
 }
 
 bool HttpCache::remove(const CacheKey& key) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
+    bool removed = disk_ && disk_->remove(key);
+    removed = remove_from_memory(key) || removed;
+    return removed;
+}
+
+bool HttpCache::remove_from_memory(const CacheKey& key) {
+    auto& shard = shard_for(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
     
-    auto it = cache_map_.find(key);
-    if (it == cache_map_.end()) {
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
         return false;
     }
     
-    stats_.current_size_bytes -= it->second->second->size_bytes;
-    stats_.current_entries--;
-    lru_list_.erase(it->second);
-    cache_map_.erase(it);
-    
+    erase(shard, it->second);
     return true;
 }
 
 void HttpCache::clear() {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
-    lru_list_.clear();
-    cache_map_.clear();
-    stats_.current_entries = 0;
-    stats_.current_size_bytes = 0;
+    for (auto& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        stats_.current_entries -= shard->index.size();
+        stats_.current_size_bytes -= shard->size_bytes;
+        shard->index.clear();
+        shard->queue.clear();
+        shard->window.clear();
+        shard->hand = shard->queue.end();
+        shard->size_bytes = 0;
+        shard->window_bytes = 0;
+        shard->sketch->clear();
+    }
+    if (disk_) {
+        disk_->clear();
+    }
+    snapshot_.store(nullptr);
+    {
+        std::unique_lock<std::shared_mutex> lock(vary_mutex_);
+        vary_.clear();
+    }
     
     SPDLOG_INFO("HTTP cache cleared");
 }
@@ -130,9 +659,10 @@ void HttpCache::clear() {
 bool HttpCache::should_cache_request(const std::string& method, 
                                    const std::string& path,
                                    const std::unordered_map<std::string, std::string>& headers) const {
+    auto config = get_config();
     // Check method
-    if (std::find(config_.cacheable_methods.begin(), config_.cacheable_methods.end(), method) 
-        == config_.cacheable_methods.end()) {
+    if (std::find(config->cacheable_methods.begin(), config->cacheable_methods.end(), method) 
+        == config->cacheable_methods.end()) {
         return false;
     }
     
@@ -141,8 +671,9 @@ bool HttpCache::should_cache_request(const std::string& method,
         return false;
     }
     
-    // Check for cache bypass headers
-    for (const auto& bypass_header : config_.cache_bypass_headers) {
+    // Check for cache bypass headers, the request headers are lowercased
+    for (auto bypass_header : config->cache_bypass_headers) {
+        std::transform(bypass_header.begin(), bypass_header.end(), bypass_header.begin(), ::tolower);
         if (headers.find(bypass_header) != headers.end()) {
             return false;
         }
@@ -154,15 +685,32 @@ bool HttpCache::should_cache_request(const std::string& method,
 bool HttpCache::should_cache_response(int status_code,
                                     const std::unordered_map<std::string, std::string>& headers,
                                     size_t content_length) const {
+    auto config = get_config();
     // Check status code
-    if (std::find(config_.cacheable_status_codes.begin(), 
-                  config_.cacheable_status_codes.end(), status_code) 
-        == config_.cacheable_status_codes.end()) {
+    if (std::find(config->cacheable_status_codes.begin(), 
+                  config->cacheable_status_codes.end(), status_code) 
+        == config->cacheable_status_codes.end()) {
         return false;
     }
     
     // Check content length
-    if (content_length > config_.max_response_size) {
+    if (content_length > max_object_size(*config)) {
+        return false;
+    }
+    
+    // The body of a response whose length can't be read can't be trusted
+    auto content_length_it = headers.find("content-length");
+    if (content_length_it != headers.end() && !parse_content_length(content_length_it->second)) {
+        return false;
+    }
+    
+    // A cookie set for one client must not reach the others, and a
+    // response varying on anything can't be matched to a request
+    if (headers.contains("set-cookie")) {
+        return false;
+    }
+    auto vary_it = headers.find("vary");
+    if (vary_it != headers.end() && normalize_vary(vary_it->second) == "*") {
         return false;
     }
     
@@ -175,11 +723,11 @@ bool HttpCache::should_cache_response(int status_code,
             return false;
         }
         
-        if (directives.is_private && !config_.cache_private_responses) {
+        if (directives.is_private && !config->cache_private_responses) {
             return false;
         }
         
-        if (directives.no_cache && config_.respect_cache_control) {
+        if (directives.no_cache && config->respect_cache_control) {
             return false;
         }
     }
@@ -188,26 +736,24 @@ bool HttpCache::should_cache_response(int status_code,
 }
 
 std::chrono::seconds HttpCache::calculate_ttl(const std::unordered_map<std::string, std::string>& headers) const {
-    std::chrono::seconds ttl = config_.default_ttl;
+    auto config = get_config();
+    // The heuristic TTL of a response without an explicit lifetime
+    auto heuristic_ttl = std::clamp(config->default_ttl, config->min_ttl, config->max_ttl);
     
-    if (!config_.respect_cache_control) {
-        return std::clamp(ttl, config_.min_ttl, config_.max_ttl);
+    if (!config->respect_cache_control) {
+        return heuristic_ttl;
     }
     
-    // Check Cache-Control max-age
+    // s-maxage takes precedence over max-age for a shared cache
+    std::optional<std::chrono::seconds> ttl;
     auto cache_control_it = headers.find("cache-control");
     if (cache_control_it != headers.end()) {
         auto directives = HttpCacheManager::parse_cache_control(cache_control_it->second);
-        
-        if (directives.max_age.has_value()) {
-            ttl = directives.max_age.value();
-        } else if (directives.s_maxage.has_value()) {
-            ttl = directives.s_maxage.value(); // s-maxage takes precedence for proxies
-        }
+        ttl = directives.s_maxage ? directives.s_maxage : directives.max_age;
     }
     
     // Check Expires header if no Cache-Control max-age
-    if (ttl == config_.default_ttl) {
+    if (!ttl) {
         auto expires_it = headers.find("expires");
         if (expires_it != headers.end()) {
             auto expires_ttl = HttpCacheManager::parse_expires_header(expires_it->second);
@@ -217,22 +763,33 @@ std::chrono::seconds HttpCache::calculate_ttl(const std::unordered_map<std::stri
         }
     }
     
-    // Clamp to configured limits
-    return std::clamp(ttl, config_.min_ttl, config_.max_ttl);
+    // An explicit lifetime is only capped, max-age=0 stays 0
+    return ttl ? std::clamp(*ttl, std::chrono::seconds(0), config->max_ttl) : heuristic_ttl;
 }
 
 std::shared_ptr<CacheEntry> HttpCache::create_cache_entry(
-    const std::string& response_data,
+    std::string response_data,
     int status_code,
-    const std::unordered_map<std::string, std::string>& headers) const {
+    const std::unordered_map<std::string, std::string>& headers,
+    const RouteCachePolicy* route) const {
     
+    auto buffer = std::make_shared<const std::string>(std::move(response_data));
+    ResponseHead parsed;
+    if (!parse_response_head(*buffer, parsed)) {
+        return nullptr;
+    }
+    auto config = get_config();
     auto entry = std::make_shared<CacheEntry>();
     auto now = std::chrono::steady_clock::now();
     
-    entry->response_data = response_data;
+    serialize_head(*entry, *buffer, parsed);
+    if (buffer->size() > parsed.length) {
+        entry->body.push_back(BodySegment{
+            .buffer = buffer, .offset = parsed.length, .length = buffer->size() - parsed.length});
+    }
     entry->status_code = status_code;
     entry->created_at = now;
-    entry->size_bytes = response_data.size();
+    entry->size_bytes = entry->head.size() + entry->body_size();
     
     // Calculate TTL and expiration
     auto ttl = calculate_ttl(headers);
@@ -254,10 +811,27 @@ std::shared_ptr<CacheEntry> HttpCache::create_cache_entry(
         entry->last_modified = last_modified_it->second;
     }
     
+    entry->revalidatable = config->enable_conditional_requests &&
+                           (!entry->etag.empty() || !entry->last_modified.empty());
+    
     auto content_length_it = headers.find("content-length");
     if (content_length_it != headers.end()) {
-        entry->content_length = std::stoull(content_length_it->second);
+        auto content_length = parse_content_length(content_length_it->second);
+        if (!content_length) {
+            return nullptr;
+        }
+        entry->content_length = *content_length;
     }
+    // A 304 refreshing the entry brings its body afterwards
+    entry->accept_ranges = entry->accept_ranges &&
+                           (entry->body.empty() || entry->content_length == entry->body_size());
+    
+    // Stale windows of the route or the config, unless the response says otherwise
+    entry->stale_while_revalidate = route && route->stale_while_revalidate
+                                        ? *route->stale_while_revalidate
+                                        : config->stale_while_revalidate;
+    entry->stale_if_error = route && route->stale_if_error ? *route->stale_if_error
+                                                           : config->stale_if_error;
     
     // Parse Cache-Control directives
     auto cache_control_it = headers.find("cache-control");
@@ -267,11 +841,269 @@ std::shared_ptr<CacheEntry> HttpCache::create_cache_entry(
         entry->no_store = directives.no_store;
         entry->must_revalidate = directives.must_revalidate;
         entry->is_private = directives.is_private;
+        if (config->respect_cache_control) {
+            entry->stale_while_revalidate =
+                directives.stale_while_revalidate.value_or(entry->stale_while_revalidate);
+            entry->stale_if_error = directives.stale_if_error.value_or(entry->stale_if_error);
+        }
+    }
+    // The origin wants every use of an expired response checked
+    if (config->respect_cache_control && (entry->must_revalidate || entry->no_cache)) {
+        entry->stale_while_revalidate = std::chrono::seconds(0);
+        entry->stale_if_error = std::chrono::seconds(0);
+    }
+    
+    return entry;
+}
+
+std::shared_ptr<CacheEntry> HttpCache::create_cache_entry(std::string&& response,
+                                                          const RouteCachePolicy* route) const {
+    ResponseHead head;
+    if (!parse_response_head(response, head)) {
+        return nullptr;
+    }
+    std::unordered_map<std::string, std::string> headers;
+    for (size_t i = 0; i < head.num_headers; ++i) {
+        headers.emplace(header_name(head.headers[i]),
+                        std::string(head.headers[i].value, head.headers[i].value_len));
+    }
+    if (!should_cache_response(head.status, headers, response.size() - head.length)) {
+        return nullptr;
+    }
+    return create_cache_entry(std::move(response), head.status, headers, route);
+}
+
+std::shared_ptr<CacheEntry> HttpCache::refresh_entry(const CacheEntry& stale,
+                                                     std::string_view not_modified_response,
+                                                     const RouteCachePolicy* route) const {
+    auto stored_head = stale.head + "\r\n";
+    ResponseHead stored;
+    ResponseHead update;
+    if (!parse_response_head(stored_head, stored) ||
+        !parse_response_head(not_modified_response, update)) {
+        return nullptr;
+    }
+    // The 304 describes the stored body, it can't change its framing
+    auto updatable = [](const std::string& name) {
+        return name != "content-length" && name != "transfer-encoding" &&
+               name != "content-range" && name != "connection" && name != "keep-alive";
+    };
+    // Lowercased name to the header as sent
+    std::unordered_map<std::string, const phr_header*> updated;
+    for (size_t i = 0; i < update.num_headers; ++i) {
+        auto name = header_name(update.headers[i]);
+        if (updatable(name)) {
+            updated.emplace(std::move(name), &update.headers[i]);
+        }
+    }
+    
+    std::string response(stale.head, 0, stale.fields_at);
+    response.reserve(stored_head.size() + not_modified_response.size());
+    std::unordered_map<std::string, std::string> headers;
+    for (size_t i = 0; i < stored.num_headers; ++i) {
+        auto name = header_name(stored.headers[i]);
+        auto it = updated.find(name);
+        auto& source = it != updated.end() ? *it->second : stored.headers[i];
+        std::string value(source.value, source.value_len);
+        response.append(stored.headers[i].name, stored.headers[i].name_len);
+        response += ": " + value + "\r\n";
+        headers.emplace(std::move(name), std::move(value));
+    }
+    for (auto& [name, header] : updated) {
+        std::string value(header->value, header->value_len);
+        if (headers.emplace(name, value).second) {
+            response.append(header->name, header->name_len);
+            response += ": " + value + "\r\n";
+        }
+    }
+    response += "\r\n";
+    
+    size_t body_size = stale.body_size();
+    if (!should_cache_response(stale.status_code, headers, body_size)) {
+        return nullptr;
+    }
+    auto entry = create_cache_entry(std::move(response), stale.status_code, headers, route);
+    if (!entry) {
+        return nullptr;
+    }
+    stats_.revalidated++;
+    // Same body, shared with the stale entry or on disk where it was
+    entry->body = stale.body;
+    entry->disk_body = stale.disk_body;
+    entry->size_bytes += body_size;
+    entry->accept_ranges = entry->accept_ranges && entry->content_length == body_size;
+    return entry;
+}
+
+bool HttpCache::not_modified(const CacheEntry& entry,
+                             const std::unordered_map<std::string, std::string>& request_headers) const {
+    if ((entry.status_code != 200 && !entry.is_slice()) ||
+        !get_config()->enable_conditional_requests) {
+        return false;
+    }
+    // If-Modified-Since is ignored along with If-None-Match, RFC 9110 section 13.1.3
+    auto if_none_match_it = request_headers.find("if-none-match");
+    if (if_none_match_it != request_headers.end()) {
+        return !entry.etag.empty() && etag_matches(if_none_match_it->second, entry.etag);
+    }
+    auto if_modified_since_it = request_headers.find("if-modified-since");
+    if (if_modified_since_it == request_headers.end() || entry.last_modified.empty()) {
+        return false;
+    }
+    auto since = parse_http_date(if_modified_since_it->second);
+    auto modified = parse_http_date(entry.last_modified);
+    return since && modified && *modified <= *since;
+}
+
+std::string HttpCache::create_not_modified_response(const CacheEntry& entry) const {
+    std::string response = "HTTP/1.1 304 Not Modified\r\nDate: ";
+    response.append(http_date_now());
+    response += "\r\n";
+    auto stored_head = entry.head + "\r\n";
+    ResponseHead stored;
+    if (!parse_response_head(stored_head, stored)) {
+        return response + "\r\n";
+    }
+    // The headers a 200 would have had, RFC 9110 section 15.4.5
+    static const std::vector<std::string> kept = {
+        "cache-control", "content-location", "etag", "expires", "last-modified", "vary"};
+    for (size_t i = 0; i < stored.num_headers; ++i) {
+        if (std::find(kept.begin(), kept.end(), header_name(stored.headers[i])) != kept.end()) {
+            response.append(stored.headers[i].name, stored.headers[i].name_len);
+            response += ": ";
+            response.append(stored.headers[i].value, stored.headers[i].value_len);
+            response += "\r\n";
+        }
+    }
+    return response + "\r\n";
+}
+
+CachedResponse HttpCache::create_cached_response(
+    const CacheEntry& entry, std::string_view method,
+    const std::unordered_map<std::string, std::string>& request_headers) const {
+    CachedResponse response;
+    std::string_view head(entry.head);
+    response.status_line = head.substr(0, entry.fields_at);
+    response.fields = head.substr(entry.fields_at);
+    response.body_length = entry.body_size();
+    
+    std::optional<ByteRange> range;
+    if (entry.accept_ranges && method == "GET") {
+        range = requested_range(entry, response.body_length, request_headers);
     }
     
+    auto& fields = response.extra_fields;
+    fields.reserve(128);
+    if (range && range->satisfiable) {
+        response.status_line = "HTTP/1.1 206 Partial Content\r\n";
+        response.fields = head.substr(entry.range_fields_at);
+        append_content_range(fields, *range, response.body_length);
+        response.body_offset = range->first;
+        response.body_length = range->length;
+        stats_.partial_hits++;
+    } else if (range) {
+        response.status_line = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        response.fields = {};
+        append_content_range(fields, *range, response.body_length);
+        response.body_length = 0;
+    }
+    append_date_and_age(fields, entry);
+    return response;
+}
+
+std::optional<ByteRange> HttpCache::requested_range(
+    const CacheEntry& entry, uint64_t size,
+    const std::unordered_map<std::string, std::string>& request_headers) const {
+    auto range_it = request_headers.find("range");
+    if (range_it == request_headers.end()) {
+        return std::nullopt;
+    }
+    auto if_range_it = request_headers.find("if-range");
+    if (if_range_it != request_headers.end() && !if_range_matches(entry, if_range_it->second)) {
+        return std::nullopt;
+    }
+    auto spec = parse_range(range_it->second);
+    if (!spec) {
+        return std::nullopt;
+    }
+    return resolve_range(*spec, size);
+}
+
+size_t HttpCache::slice_size(const RouteCachePolicy* route) const {
+    return route && route->slice_size ? *route->slice_size : get_config()->slice_size;
+}
+
+uint64_t HttpCache::requested_range_start(
+    const std::unordered_map<std::string, std::string>& request_headers) const {
+    auto range_it = request_headers.find("range");
+    if (range_it == request_headers.end()) {
+        return 0;
+    }
+    auto spec = parse_range(range_it->second);
+    return spec ? spec->first.value_or(0) : 0;
+}
+
+std::shared_ptr<CacheEntry> HttpCache::create_slice_entry(std::string&& response, uint64_t offset,
+                                                          bool& cacheable,
+                                                          const RouteCachePolicy* route) const {
+    cacheable = false;
+    ResponseHead head;
+    if (!parse_response_head(response, head) || head.status != 206) {
+        return nullptr;
+    }
+    std::unordered_map<std::string, std::string> headers;
+    for (size_t i = 0; i < head.num_headers; ++i) {
+        headers.emplace(header_name(head.headers[i]),
+                        std::string(head.headers[i].value, head.headers[i].value_len));
+    }
+    auto content_range_it = headers.find("content-range");
+    auto body_size = response.size() - head.length;
+    if (content_range_it == headers.end() || headers.contains("transfer-encoding")) {
+        return nullptr;
+    }
+    auto object_size = parse_content_range(content_range_it->second, offset, body_size);
+    if (!object_size) {
+        return nullptr;
+    }
+    // Stored on the same terms as the 200 it's part of
+    cacheable = should_cache_response(200, headers, body_size);
+    stats_.slice_fetches++;
+    auto entry = create_cache_entry(std::move(response), head.status, headers, route);
+    if (!entry) {
+        cacheable = false;
+        return nullptr;
+    }
+    entry->slice_offset = offset;
+    entry->object_size = *object_size;
     return entry;
 }
 
+CachedResponse HttpCache::create_sliced_response(const CacheEntry& slice,
+                                                 const std::optional<ByteRange>& range) const {
+    CachedResponse response;
+    response.fields = std::string_view(slice.head).substr(slice.range_fields_at);
+    auto& fields = response.extra_fields;
+    fields.reserve(128);
+    if (!range) {
+        response.status_line = "HTTP/1.1 200 OK\r\n";
+        response.body_length = slice.object_size;
+        fields += "Content-Length: " + std::to_string(slice.object_size) + "\r\n";
+    } else if (range->satisfiable) {
+        response.status_line = "HTTP/1.1 206 Partial Content\r\n";
+        response.body_offset = range->first;
+        response.body_length = range->length;
+        stats_.partial_hits++;
+    } else {
+        response.status_line = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        response.fields = {};
+    }
+    if (range) {
+        append_content_range(fields, *range, slice.object_size);
+    }
+    append_date_and_age(fields, slice);
+    return response;
+}
+
 CacheKey HttpCache::create_cache_key(const std::string& method,
                                    const std::string& url,
                                    const std::string& query_params,
@@ -281,18 +1113,43 @@ CacheKey HttpCache::create_cache_key(const std::string& method,
     key.url = url;
     key.query_params = query_params;
     
-    // Handle Vary header for response variation
-    auto vary_it = headers.find("vary");
-    if (vary_it != headers.end()) {
-        key.vary_headers = extract_vary_headers(headers, vary_it->second);
+    // Secondary key: the request's values of the headers the stored
+    // response of the URL varies on
+    std::string vary;
+    {
+        std::shared_lock<std::shared_mutex> lock(vary_mutex_);
+        if (!vary_.empty()) {
+            if (auto it = vary_.find(primary_key(key)); it != vary_.end()) {
+                vary = it->second;
+            }
+        }
+    }
+    if (!vary.empty()) {
+        key.vary_headers = extract_vary_headers(headers, vary);
     }
     
+    key.finalize();
     return key;
 }
 
+void HttpCache::remember_vary(const CacheKey& key, const std::string& vary) {
+    auto primary = primary_key(key);
+    std::unique_lock<std::shared_mutex> lock(vary_mutex_);
+    if (vary.empty()) {
+        vary_.erase(primary);
+        return;
+    }
+    // A forgotten URL only costs a miss, its next response teaches it again
+    if (vary_.size() >= get_config()->max_entries) {
+        vary_.clear();
+    }
+    vary_[primary] = vary;
+}
+
 bool HttpCache::needs_revalidation(const std::shared_ptr<CacheEntry>& entry,
                                  const std::unordered_map<std::string, std::string>& request_headers) const {
-    if (!config_.enable_conditional_requests) {
+    auto config = get_config();
+    if (!config->enable_conditional_requests) {
         return false;
     }
     
@@ -317,6 +1174,47 @@ bool HttpCache::needs_revalidation(const std::shared_ptr<CacheEntry>& entry,
     return false;
 }
 
+std::shared_ptr<CacheFlight> HttpCache::join_flight(const CacheKey& key, bool& leader) {
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.flights_mutex);
+    auto [it, inserted] = shard.flights.try_emplace(key);
+    leader = inserted;
+    if (inserted) {
+        it->second = std::make_shared<CacheFlight>();
+    } else {
+        stats_.coalesced++;
+    }
+    return it->second;
+}
+
+std::shared_ptr<CacheFlight> HttpCache::start_flight(const CacheKey& key) {
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.flights_mutex);
+    auto [it, inserted] = shard.flights.try_emplace(key);
+    if (!inserted) {
+        return nullptr;
+    }
+    it->second = std::make_shared<CacheFlight>();
+    return it->second;
+}
+
+void HttpCache::finish_flight(const CacheKey& key, const std::shared_ptr<CacheFlight>& flight,
+                              std::shared_ptr<CacheEntry> entry) {
+    auto& shard = shard_for(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.flights_mutex);
+        auto it = shard.flights.find(key);
+        if (it != shard.flights.end() && it->second == flight) {
+            shard.flights.erase(it);
+        }
+    }
+    // The waiters only share the key's variant, another one is fetched again
+    if (entry && response_vary(*entry) != vary_of(key)) {
+        entry = nullptr;
+    }
+    flight->complete(std::move(entry));
+}
+
 std::string HttpCache::create_conditional_request_headers(const std::shared_ptr<CacheEntry>& entry) const {
     std::string headers;
     
@@ -337,112 +1235,296 @@ void HttpCache::reset_stats() {
     stats_.stores = 0;
     stats_.evictions = 0;
     stats_.expired_entries = 0;
+    stats_.coalesced = 0;
+    stats_.stale_served = 0;
+    stats_.revalidated = 0;
+    stats_.partial_hits = 0;
+    stats_.slice_fetches = 0;
+    stats_.admission_rejections = 0;
+    stats_.restored = 0;
 }
 
 void HttpCache::update_config(const HttpCacheConfig& config) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    config_ = config;
+    auto snapshot = std::make_shared<const HttpCacheConfig>(config);
+    config_.store(snapshot, std::memory_order_release);
     
     // Evict if new limits are exceeded
-    evict_if_needed();
+    for (auto& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        evict_if_needed(*shard, *snapshot);
+    }
+    if (disk_) {
+        disk_->update_config(config.disk);
+    }
     
     SPDLOG_INFO("HTTP cache configuration updated");
 }
 
 void HttpCache::cleanup_expired_entries() {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
     auto now = std::chrono::steady_clock::now();
     
     // Only run cleanup periodically
-    if (now - last_cleanup_ < std::chrono::minutes(1)) {
+    auto last = last_cleanup_.load(std::memory_order_relaxed);
+    if (now.time_since_epoch().count() - last <
+            std::chrono::steady_clock::duration(std::chrono::minutes(1)).count() ||
+        !last_cleanup_.compare_exchange_strong(last, now.time_since_epoch().count())) {
         return;
     }
     
-    auto it = lru_list_.rbegin(); // Start from least recently used
     size_t removed = 0;
-    
-    while (it != lru_list_.rend()) {
-        if (it->second->is_expired()) {
-            auto to_remove = std::next(it).base();
-            --it; // Move iterator before removal
-            
-            stats_.current_size_bytes -= to_remove->second->size_bytes;
-            stats_.current_entries--;
-            stats_.expired_entries++;
-            cache_map_.erase(to_remove->first);
-            lru_list_.erase(to_remove);
-            removed++;
-        } else {
-            ++it;
+    for (auto& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        for (auto* queue : {&shard->window, &shard->queue}) {
+            for (auto it = queue->begin(); it != queue->end();) {
+                auto next = std::next(it);
+                if (it->entry->is_unusable()) {
+                    stats_.expired_entries++;
+                    erase(*shard, it);
+                    removed++;
+                }
+                it = next;
+            }
         }
     }
     
-    last_cleanup_ = now;
+    if (disk_) {
+        auto disk_removed = disk_->cleanup_unusable_entries();
+        stats_.expired_entries += disk_removed;
+        removed += disk_removed;
+    }
+    
+    if (auto snapshot = snapshot_.load()) {
+        auto snapshot_removed = snapshot->drop_unusable();
+        stats_.expired_entries += snapshot_removed;
+        removed += snapshot_removed;
+        // The mapping is released once nothing is left to take from it
+        if (snapshot->empty()) {
+            snapshot_.compare_exchange_strong(snapshot, nullptr);
+        }
+    }
     
     if (removed > 0) {
         SPDLOG_DEBUG("Cleaned up {} expired cache entries", removed);
     }
 }
 
-void HttpCache::force_evict_lru(size_t count) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
-    for (size_t i = 0; i < count && !lru_list_.empty(); ++i) {
-        evict_lru();
+bool HttpCache::save_snapshot() {
+    if (snapshot_path_.empty()) {
+        return false;
+    }
+    std::vector<std::pair<CacheKey, std::shared_ptr<CacheEntry>>> entries;
+    entries.reserve(stats_.current_entries.load());
+    for (auto& shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard->mutex);
+        for (const auto* queue : {&shard->window, &shard->queue}) {
+            for (const auto& node : *queue) {
+                if (!node.entry->is_unusable()) {
+                    entries.emplace_back(node.key, node.entry);
+                }
+            }
+        }
+    }
+    if (disk_) {
+        for (auto& [key, entry] : disk_->entries()) {
+            if (!entry->is_unusable()) {
+                entries.emplace_back(std::move(key), std::move(entry));
+            }
+        }
+    }
+    auto pending = snapshot_.load();
+    return CacheSnapshot::write(snapshot_path_, entries, pending.get());
+}
+
+void HttpCache::restore_snapshot() {
+    std::shared_ptr<CacheSnapshot> snapshot = CacheSnapshot::open(snapshot_path_);
+    if (!snapshot) {
+        return;
+    }
+    size_t restored = 0;
+    for (auto& record : snapshot->take_disk_records()) {
+        if (disk_ && disk_->restore(record.key, std::move(record.entry), record.segment_id,
+                                    record.offset, record.length)) {
+            restored++;
+        }
+    }
+    stats_.restored += restored;
+    SPDLOG_INFO("HTTP cache restored {} disk tier entries, {} more on their first lookup",
+                restored, snapshot->size());
+    if (!snapshot->empty()) {
+        snapshot_.store(std::move(snapshot));
+    }
+}
+
+std::shared_ptr<CacheEntry> HttpCache::take_from_snapshot(const CacheKey& key) {
+    auto snapshot = snapshot_.load(std::memory_order_acquire);
+    if (!snapshot) {
+        return nullptr;
+    }
+    auto entry = snapshot->take(key);
+    if (snapshot->empty()) {
+        snapshot_.compare_exchange_strong(snapshot, nullptr);
+    }
+    if (!entry) {
+        return nullptr;
+    }
+    stats_.restored++;
+    // Shared with the memory tier, which may not admit it
+    put(key, entry);
+    return entry;
+}
+
+void HttpCache::force_evict(size_t count) {
+    size_t evicted = 0;
+    bool progress = true;
+    while (evicted < count && progress) {
+        progress = false;
+        for (auto& shard : shards_) {
+            if (evicted == count) {
+                break;
+            }
+            std::unique_lock<std::shared_mutex> lock(shard->mutex);
+            if (evict_one(*shard)) {
+                evicted++;
+                progress = true;
+            }
+        }
     }
 }
 
 size_t HttpCache::size() const {
-    std::shared_lock<std::shared_mutex> lock(mutex_);
     return stats_.current_entries.load();
 }
 
 size_t HttpCache::memory_usage() const {
-    std::shared_lock<std::shared_mutex> lock(mutex_);
     return stats_.current_size_bytes.load();
 }
 
 bool HttpCache::is_full() const {
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    return stats_.current_entries >= config_.max_entries || 
-           stats_.current_size_bytes >= config_.max_size_bytes;
+    auto config = get_config();
+    return stats_.current_entries >= config->max_entries || 
+           stats_.current_size_bytes >= config->max_size_bytes;
 }
 
 // Private methods
-void HttpCache::move_to_front(LRUIterator it) {
-    lru_list_.splice(lru_list_.begin(), lru_list_, it);
+size_t HttpCache::max_object_size(const HttpCacheConfig& config) const {
+    return disk_ ? std::max(config.max_response_size, config.disk.max_object_size)
+                 : config.max_response_size;
 }
 
-void HttpCache::evict_lru() {
-    if (lru_list_.empty()) {
-        return;
+HttpCache::ShardLimits HttpCache::shard_limits(const HttpCacheConfig& config) const {
+    ShardLimits limits;
+    size_t max_entries = std::max<size_t>(1, config.max_entries / shards_.size());
+    size_t max_bytes = std::max<size_t>(1, config.max_size_bytes / shards_.size());
+    if (config.admission == CacheAdmission::TinyLfu) {
+        double share = std::clamp(config.admission_window, 0.0, 1.0);
+        limits.window_entries = std::max<size_t>(1, max_entries * share);
+        limits.window_bytes = static_cast<size_t>(max_bytes * share);
     }
-    
-    auto& back = lru_list_.back();
-    stats_.current_size_bytes -= back.second->size_bytes;
+    limits.main_entries = std::max<size_t>(1, max_entries - std::min(max_entries, limits.window_entries));
+    limits.main_bytes = std::max<size_t>(1, max_bytes - limits.window_bytes);
+    return limits;
+}
+
+void HttpCache::erase(Shard& shard, Queue::iterator it) {
+    shard.size_bytes -= it->entry->size_bytes;
+    stats_.current_size_bytes -= it->entry->size_bytes;
     stats_.current_entries--;
+    shard.index.erase(it->key);
+    if (it->in_window) {
+        shard.window_bytes -= it->entry->size_bytes;
+        shard.window.erase(it);
+        return;
+    }
+    if (shard.hand == it) {
+        shard.hand = it == shard.queue.begin() ? shard.queue.end() : std::prev(it);
+    }
+    shard.queue.erase(it);
+}
+
+// SIEVE: the hand keeps its position between evictions, visited nodes
+// stay where they are with their bit cleared, the first unvisited (or
+// expired) one is the victim.
+HttpCache::Queue::iterator HttpCache::sieve_victim(Shard& shard) {
+    auto it = shard.hand == shard.queue.end() ? std::prev(shard.queue.end()) : shard.hand;
+    while (it->visited.exchange(false, std::memory_order_relaxed) &&
+           !it->entry->is_expired()) {
+        it = it == shard.queue.begin() ? std::prev(shard.queue.end()) : std::prev(it);
+    }
+    // erase() moves the hand on to the next node
+    shard.hand = it;
+    return it;
+}
+
+bool HttpCache::evict_one(Shard& shard) {
+    Queue::iterator it;
+    if (!shard.queue.empty()) {
+        it = sieve_victim(shard);
+    } else if (!shard.window.empty()) {
+        it = std::prev(shard.window.end());
+    } else {
+        return false;
+    }
     stats_.evictions++;
-    
-    cache_map_.erase(back.first);
-    lru_list_.pop_back();
+    erase(shard, it);
+    return true;
 }
 
-void HttpCache::evict_if_needed() {
-    // Evict expired entries first
-    cleanup_expired_entries();
-    
-    // Evict LRU entries if still over limits
-    while ((stats_.current_entries >= config_.max_entries || 
-            stats_.current_size_bytes >= config_.max_size_bytes) &&
-           !lru_list_.empty()) {
-        evict_lru();
+void HttpCache::drain_window(Shard& shard, const HttpCacheConfig& config, const ShardLimits& limits) {
+    while (!shard.window.empty() &&
+           (shard.window.size() > limits.window_entries || shard.window_bytes > limits.window_bytes)) {
+        auto candidate = std::prev(shard.window.end());
+        if (!make_room(shard, config, limits, *candidate)) {
+            stats_.admission_rejections++;
+            erase(shard, candidate);
+            continue;
+        }
+        candidate->in_window = false;
+        shard.window_bytes -= candidate->entry->size_bytes;
+        shard.queue.splice(shard.queue.begin(), shard.window, candidate);
+    }
+}
+
+bool HttpCache::make_room(Shard& shard, const HttpCacheConfig& config, const ShardLimits& limits,
+                          const Node& candidate) {
+    if (candidate.entry->size_bytes > limits.main_bytes) {
+        return false;
+    }
+    size_t incoming_bytes = candidate.entry->size_bytes;
+    auto main_entries = [&] { return shard.index.size() - shard.window.size(); };
+    auto main_bytes = [&] { return shard.size_bytes - shard.window_bytes; };
+    // Decided once, against the first live victim: a candidate rejected
+    // after some evictions would only have cost the entries. The expired
+    // victims before it go either way.
+    bool admitted = config.admission != CacheAdmission::TinyLfu;
+    while (main_entries() + 1 > limits.main_entries || main_bytes() + incoming_bytes > limits.main_bytes) {
+        auto victim = sieve_victim(shard);
+        if (!admitted && !victim->entry->is_expired()) {
+            // A tie keeps the victim: a scan of one-off keys can't flush
+            // the entries it runs into
+            if (shard.sketch->estimate(candidate.key.hash) <= shard.sketch->estimate(victim->key.hash)) {
+                return false;
+            }
+            admitted = true;
+        }
+        stats_.evictions++;
+        erase(shard, victim);
+    }
+    return true;
+}
+
+void HttpCache::evict_if_needed(Shard& shard, const HttpCacheConfig& config) {
+    auto limits = shard_limits(config);
+    drain_window(shard, config, limits);
+    while ((shard.index.size() - shard.window.size() > limits.main_entries ||
+            shard.size_bytes - shard.window_bytes > limits.main_bytes) &&
+           evict_one(shard)) {
     }
 }
 
 bool HttpCache::is_path_cacheable(const std::string& path) const {
+    auto config = get_config();
     // Check if path should never be cached
-    for (const auto& no_cache_path : config_.no_cache_paths) {
+    for (const auto& no_cache_path : config->no_cache_paths) {
         if (path.find(no_cache_path) == 0) {
             return false;
         }
@@ -452,8 +1534,9 @@ bool HttpCache::is_path_cacheable(const std::string& path) const {
 }
 
 bool HttpCache::is_path_force_cached(const std::string& path) const {
+    auto config = get_config();
     // Check if path should always be cached
-    for (const auto& force_cache_path : config_.force_cache_paths) {
+    for (const auto& force_cache_path : config->force_cache_paths) {
         if (path.find(force_cache_path) == 0) {
             return true;
         }
@@ -464,30 +1547,49 @@ bool HttpCache::is_path_force_cached(const std::string& path) const {
 
 std::string HttpCache::extract_vary_headers(const std::unordered_map<std::string, std::string>& request_headers,
                                           const std::string& vary_header) const {
+    // The names, then a line per value, an absent header is an empty one.
+    // Header values can't hold line breaks.
+    std::string result = vary_header;
     std::istringstream iss(vary_header);
     std::string header_name;
-    std::string result;
-    
     while (std::getline(iss, header_name, ',')) {
-        // Trim whitespace
-        header_name.erase(0, header_name.find_first_not_of(" \t"));
-        header_name.erase(header_name.find_last_not_of(" \t") + 1);
-        
-        // Convert to lowercase for case-insensitive lookup
-        std::transform(header_name.begin(), header_name.end(), header_name.begin(), ::tolower);
-        
+        result += '\n';
         auto it = request_headers.find(header_name);
         if (it != request_headers.end()) {
-            if (!result.empty()) {
-                result += ";";
-            }
-            result += header_name + "=" + it->second;
+            result += it->second;
         }
     }
-    
     return result;
 }
 
+// CacheFlight Implementation
+void CacheFlight::wait(Waiter waiter) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!done_) {
+        waiters_.push_back(std::move(waiter));
+        return;
+    }
+    auto entry = entry_;
+    lock.unlock();
+    waiter(std::move(entry));
+}
+
+void CacheFlight::complete(std::shared_ptr<CacheEntry> entry) {
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done_) {
+            return;
+        }
+        done_ = true;
+        entry_ = entry;
+        waiters.swap(waiters_);
+    }
+    for (auto& waiter : waiters) {
+        waiter(entry);
+    }
+}
+
 // HttpCacheManager Implementation
 HttpCacheManager& HttpCacheManager::instance() {
     static HttpCacheManager instance;
@@ -497,24 +1599,195 @@ HttpCacheManager& HttpCacheManager::instance() {
 void HttpCacheManager::initialize(const HttpCacheConfig& config) {
     std::lock_guard<std::mutex> lock(init_mutex_);
     
-    if (!initialized_) {
-        cache_ = std::make_shared<HttpCache>(config);
-        initialized_ = true;
+    if (!get_cache()) {
+        cache_.store(std::make_shared<HttpCache>(config), std::memory_order_release);
+        start_maintenance_thread();
         SPDLOG_INFO("HTTP cache manager initialized");
     }
 }
 
+HttpCacheManager::~HttpCacheManager() {
+    stop_maintenance_thread();
+}
+
 void HttpCacheManager::shutdown() {
     std::lock_guard<std::mutex> lock(init_mutex_);
+    stop_maintenance_thread();
     
-    if (initialized_) {
-        cache_->clear();
-        cache_.reset();
-        initialized_ = false;
+    // Requests holding the cache keep it alive until they're done
+    if (auto cache = cache_.exchange(nullptr, std::memory_order_acq_rel)) {
+        // The snapshot points into the disk tier's segments, they're kept
+        if (cache->snapshots_enabled()) {
+            cache->save_snapshot();
+        } else {
+            cache->clear();
+        }
         SPDLOG_INFO("HTTP cache manager shutdown");
     }
 }
 
+void HttpCacheManager::start_maintenance_thread() {
+    stop_maintenance_thread();
+    maintenance_stop_ = false;
+    maintenance_thread_ = std::thread([this]() {
+        // The interval is read again every second, reloads may change it
+        constexpr auto kCheckInterval = std::chrono::seconds(1);
+        auto last = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(maintenance_mutex_);
+        while (!maintenance_cv_.wait_for(lock, kCheckInterval, [this] { return maintenance_stop_; })) {
+            auto cache = get_cache();
+            if (!cache) {
+                continue;
+            }
+            lock.unlock();
+            // Runs once a minute at most, the rest of the ticks return at once
+            cache->cleanup_expired_entries();
+            auto now = std::chrono::steady_clock::now();
+            auto interval = cache->get_config()->snapshot.interval;
+            if (cache->snapshots_enabled() && interval > std::chrono::seconds(0) &&
+                now - last >= interval) {
+                last = now;
+                cache->save_snapshot();
+            }
+            lock.lock();
+        }
+    });
+}
+
+void HttpCacheManager::stop_maintenance_thread() {
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex_);
+        maintenance_stop_ = true;
+    }
+    maintenance_cv_.notify_all();
+    if (maintenance_thread_.joinable()) {
+        maintenance_thread_.join();
+    }
+}
+
+bool HttpCacheManager::load_from_config(const YAML::Node& config) {
+    const auto& section = config["cache"];
+    if (!section || !section["enabled"].as<bool>(true)) {
+        shutdown();
+        return true;
+    }
+    
+    HttpCacheConfig cache_config;
+    try {
+        if (section["max_size"]) {
+            auto size = parse_size(section["max_size"].as<std::string>());
+            if (!size) {
+                SPDLOG_ERROR("invalid cache.max_size: {}", section["max_size"].as<std::string>());
+                return false;
+            }
+            cache_config.max_size_bytes = *size;
+        }
+        if (section["max_response_size"]) {
+            auto size = parse_size(section["max_response_size"].as<std::string>());
+            if (!size) {
+                SPDLOG_ERROR("invalid cache.max_response_size: {}",
+                             section["max_response_size"].as<std::string>());
+                return false;
+            }
+            cache_config.max_response_size = *size;
+        }
+        cache_config.max_entries = section["max_entries"].as<size_t>(cache_config.max_entries);
+        cache_config.num_shards = section["shards"].as<size_t>(cache_config.num_shards);
+        cache_config.coalesce_misses = section["coalesce_misses"].as<bool>(cache_config.coalesce_misses);
+        if (section["slice_size"]) {
+            auto size = parse_size(section["slice_size"].as<std::string>());
+            if (!size) {
+                SPDLOG_ERROR("invalid cache.slice_size: {}", section["slice_size"].as<std::string>());
+                return false;
+            }
+            cache_config.slice_size = *size;
+        }
+        if (section["admission"]) {
+            auto admission = section["admission"].as<std::string>();
+            if (admission == "tinylfu") {
+                cache_config.admission = CacheAdmission::TinyLfu;
+            } else if (admission == "none") {
+                cache_config.admission = CacheAdmission::None;
+            } else {
+                SPDLOG_ERROR("invalid cache.admission: {}", admission);
+                return false;
+            }
+        }
+        cache_config.admission_window = section["admission_window"].as<double>(cache_config.admission_window);
+        auto duration = [&](const char* field, auto& value) {
+            if (!section[field]) {
+                return true;
+            }
+            auto parsed = ParseDuration(section[field].as<std::string>());
+            if (!parsed) {
+                SPDLOG_ERROR("invalid cache.{}: {}", field, section[field].as<std::string>());
+                return false;
+            }
+            value = std::chrono::duration_cast<std::remove_reference_t<decltype(value)>>(*parsed);
+            return true;
+        };
+        if (!duration("lock_timeout", cache_config.lock_timeout) ||
+            !duration("stale_while_revalidate", cache_config.stale_while_revalidate) ||
+            !duration("stale_if_error", cache_config.stale_if_error)) {
+            return false;
+        }
+        if (const auto& disk = section["disk"]) {
+            auto& disk_config = cache_config.disk;
+            disk_config.enabled = disk["enabled"].as<bool>(true);
+            disk_config.path = disk["path"].as<std::string>(disk_config.path);
+            for (auto [field, value] : {std::pair{"max_size", &disk_config.max_size_bytes},
+                                        std::pair{"segment_size", &disk_config.segment_size},
+                                        std::pair{"max_object_size", &disk_config.max_object_size}}) {
+                if (!disk[field]) {
+                    continue;
+                }
+                auto size = parse_size(disk[field].as<std::string>());
+                if (!size || *size == 0) {
+                    SPDLOG_ERROR("invalid cache.disk.{}: {}", field, disk[field].as<std::string>());
+                    return false;
+                }
+                *value = *size;
+            }
+            disk_config.admit_after = disk["admit_after"].as<unsigned>(disk_config.admit_after);
+        }
+        if (const auto& snapshot = section["snapshot"]) {
+            auto& snapshot_config = cache_config.snapshot;
+            snapshot_config.enabled = snapshot["enabled"].as<bool>(true);
+            snapshot_config.path = snapshot["path"].as<std::string>(snapshot_config.path);
+            if (snapshot["interval"]) {
+                auto interval = ParseDuration(snapshot["interval"].as<std::string>());
+                if (!interval) {
+                    SPDLOG_ERROR("invalid cache.snapshot.interval: {}",
+                                 snapshot["interval"].as<std::string>());
+                    return false;
+                }
+                snapshot_config.interval = std::chrono::duration_cast<std::chrono::seconds>(*interval);
+            }
+        }
+        if (section["ttl"]) {
+            auto ttl = ParseDuration(section["ttl"].as<std::string>());
+            if (!ttl) {
+                SPDLOG_ERROR("invalid cache.ttl: {}", section["ttl"].as<std::string>());
+                return false;
+            }
+            cache_config.default_ttl = std::chrono::duration_cast<std::chrono::seconds>(*ttl);
+            cache_config.max_ttl = std::max(cache_config.max_ttl, cache_config.default_ttl);
+        }
+    } catch (const YAML::Exception& e) {
+        SPDLOG_ERROR("failed to load cache config: {}", e.what());
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(init_mutex_);
+    if (auto cache = get_cache()) {
+        cache->update_config(cache_config);
+    } else {
+        cache_.store(std::make_shared<HttpCache>(cache_config), std::memory_order_release);
+        start_maintenance_thread();
+    }
+    return true;
+}
+
 bool HttpCacheManager::is_cacheable_method(const std::string& method) {
     static const std::vector<std::string> cacheable = {"GET", "HEAD"};
     return std::find(cacheable.begin(), cacheable.end(), method) != cacheable.end();
@@ -580,12 +1853,51 @@ HttpCacheManager::CacheControlDirectives HttpCacheManager::parse_cache_control(c
             } catch (...) {
                 SPDLOG_WARN("Invalid s-maxage value in Cache-Control: {}", token);
             }
+        } else if (token.starts_with("stale-while-revalidate=")) {
+            try {
+                int seconds = std::stoi(token.substr(23));
+                directives.stale_while_revalidate = std::chrono::seconds(seconds);
+            } catch (...) {
+                SPDLOG_WARN("Invalid stale-while-revalidate value in Cache-Control: {}", token);
+            }
+        } else if (token.starts_with("stale-if-error=")) {
+            try {
+                int seconds = std::stoi(token.substr(15));
+                directives.stale_if_error = std::chrono::seconds(seconds);
+            } catch (...) {
+                SPDLOG_WARN("Invalid stale-if-error value in Cache-Control: {}", token);
+            }
         }
     }
     
     return directives;
 }
 
+std::optional<size_t> HttpCacheManager::parse_size(const std::string& spec) {
+    size_t value = 0;
+    auto [end, ec] = std::from_chars(spec.data(), spec.data() + spec.size(), value);
+    if (ec != std::errc() || end == spec.data()) {
+        return std::nullopt;
+    }
+    std::string unit(end, spec.data() + spec.size());
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+    if (!unit.empty() && unit.back() == 'B') {
+        unit.pop_back();
+    }
+    if (unit.empty()) {
+        return value;
+    }
+    if (unit.size() != 1) {
+        return std::nullopt;
+    }
+    static const std::string units = "KMGT";
+    auto power = units.find(unit[0]);
+    if (power == std::string::npos) {
+        return std::nullopt;
+    }
+    return value << (10 * (power + 1));
+}
+
 std::chrono::seconds HttpCacheManager::parse_expires_header(const std::string& expires_header) {
     // Simplified Expires header parsing - in production, use proper HTTP date parsing
     auto now = std::chrono::system_clock::now();
@@ -0,0 +1,449 @@
+#include "../../include/ip_filter.hpp"
+#include <algorithm>
+#include <boost/asio/detail/socket_types.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <yaml-cpp/yaml.h>
+
+namespace azugate {
+
+namespace {
+
+inline std::string_view trim(std::string_view sv) {
+  while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.front()))) {
+    sv.remove_prefix(1);
+  }
+  while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.back()))) {
+    sv.remove_suffix(1);
+  }
+  return sv;
+}
+
+// deny wins over allow.
+inline IpAction mergeAction(IpAction lhs, IpAction rhs) {
+  return static_cast<uint8_t>(lhs) > static_cast<uint8_t>(rhs) ? lhs : rhs;
+}
+
+inline bool ruleLess(const IpRule &lhs, const IpRule &rhs) {
+  if (lhs.v6 != rhs.v6) {
+    return lhs.v6 < rhs.v6;
+  }
+  if (lhs.addr != rhs.addr) {
+    return lhs.addr < rhs.addr;
+  }
+  if (lhs.prefix_len != rhs.prefix_len) {
+    return lhs.prefix_len < rhs.prefix_len;
+  }
+  return lhs.action < rhs.action;
+}
+
+// invalid entries are skipped, returns the number of rules parsed.
+size_t parseRules(const std::vector<std::string> &cidrs, IpAction action,
+                  std::vector<IpRule> &rules) {
+  size_t num_parsed = 0;
+  for (auto &cidr : cidrs) {
+    IpRule rule;
+    if (ParseCidr(cidr, action, rule)) {
+      rules.emplace_back(rule);
+      ++num_parsed;
+    }
+  }
+  return num_parsed;
+}
+
+bool readRuleFile(const std::string &path, IpAction action,
+                  std::vector<IpRule> &rules) {
+  std::ifstream file(path);
+  if (!file) {
+    SPDLOG_ERROR("failed to open ip list: {}", path);
+    return false;
+  }
+  std::vector<std::string> cidrs;
+  std::string line;
+  while (std::getline(file, line)) {
+    auto entry = trim(std::string_view(line).substr(0, line.find('#')));
+    if (!entry.empty()) {
+      cidrs.emplace_back(entry);
+    }
+  }
+  if (file.bad()) {
+    SPDLOG_ERROR("failed to read ip list: {}", path);
+    return false;
+  }
+  auto num_loaded = parseRules(cidrs, action, rules);
+  SPDLOG_INFO("loaded {}/{} {} rule(s) from {}", num_loaded, cidrs.size(),
+              action == IpAction::kAllow ? "allow" : "deny", path);
+  return true;
+}
+
+void sortRules(std::vector<IpRule> &rules) {
+  std::sort(rules.begin(), rules.end(), ruleLess);
+  rules.erase(std::unique(rules.begin(), rules.end()), rules.end());
+}
+
+inline bool isV4Mapped(const uint8_t *addr) {
+  static constexpr uint8_t kPrefix[12] = {0, 0, 0, 0, 0,    0,
+                                          0, 0, 0, 0, 0xff, 0xff};
+  return std::memcmp(addr, kPrefix, sizeof(kPrefix)) == 0;
+}
+
+} // namespace
+
+bool ParseCidr(std::string_view cidr, IpAction action, IpRule &rule) {
+  cidr = trim(cidr);
+  auto slash = cidr.find('/');
+  auto addr_str = trim(cidr.substr(0, slash));
+  boost::system::error_code ec;
+  auto addr = boost::asio::ip::make_address(std::string(addr_str), ec);
+  if (ec) {
+    SPDLOG_WARN("invalid ip address: {}", cidr);
+    return false;
+  }
+  rule = IpRule{};
+  rule.action = action;
+  rule.v6 = addr.is_v6();
+  unsigned max_len = rule.v6 ? 128 : 32;
+  unsigned prefix_len = max_len;
+  if (slash != std::string_view::npos) {
+    auto len_str = trim(cidr.substr(slash + 1));
+    auto [ptr, err] = std::from_chars(len_str.data(),
+                                      len_str.data() + len_str.size(),
+                                      prefix_len);
+    if (err != std::errc() || ptr != len_str.data() + len_str.size() ||
+        prefix_len > max_len) {
+      SPDLOG_WARN("invalid prefix length: {}", cidr);
+      return false;
+    }
+  }
+  if (rule.v6) {
+    auto bytes = addr.to_v6().to_bytes();
+    if (isV4Mapped(bytes.data()) && prefix_len >= 96) {
+      rule.v6 = false;
+      prefix_len -= 96;
+      std::copy(bytes.begin() + 12, bytes.end(), rule.addr.begin());
+    } else {
+      std::copy(bytes.begin(), bytes.end(), rule.addr.begin());
+    }
+  } else {
+    auto bytes = addr.to_v4().to_bytes();
+    std::copy(bytes.begin(), bytes.end(), rule.addr.begin());
+  }
+  rule.prefix_len = static_cast<uint8_t>(prefix_len);
+  // clear the host bits.
+  for (size_t i = 0; i < rule.addr.size(); ++i) {
+    if (prefix_len >= 8) {
+      prefix_len -= 8;
+      continue;
+    }
+    rule.addr[i] &= static_cast<uint8_t>(0xff00 >> prefix_len);
+    prefix_len = 0;
+  }
+  return true;
+}
+
+bool IpFilterTable::Trie::Insert(const IpRule &rule) {
+  if (rule.prefix_len == 0) {
+    default_action = mergeAction(default_action, rule.action);
+    return true;
+  }
+  size_t depth = (rule.prefix_len - 1) / 8;
+  uint32_t node = 0;
+  for (size_t i = 0; i < depth; ++i) {
+    uint32_t child = nodes[node].children[rule.addr[i]];
+    if (child == 0) {
+      if (nodes.size() >= max_nodes) {
+        return false;
+      }
+      child = static_cast<uint32_t>(nodes.size());
+      // nodes[node] may be invalidated by emplace_back.
+      nodes.emplace_back();
+      nodes[node].children[rule.addr[i]] = child;
+    }
+    node = child;
+  }
+  // expand the prefix to all the slots it covers in this node.
+  size_t bits = rule.prefix_len - depth * 8;
+  size_t first = rule.addr[depth];
+  size_t count = size_t(1) << (8 - bits);
+  auto &n = nodes[node];
+  for (size_t slot = first; slot < first + count; ++slot) {
+    if (n.prefix_lens[slot] < rule.prefix_len ||
+        (n.prefix_lens[slot] == rule.prefix_len &&
+         rule.action == IpAction::kDeny)) {
+      n.prefix_lens[slot] = rule.prefix_len;
+      n.actions[slot] = rule.action;
+    }
+  }
+  return true;
+}
+
+IpAction IpFilterTable::Trie::Lookup(const uint8_t *addr, size_t len) const {
+  IpAction best = default_action;
+  uint32_t node = 0;
+  for (size_t i = 0; i < len; ++i) {
+    auto &n = nodes[node];
+    if (n.actions[addr[i]] != IpAction::kNone) {
+      best = n.actions[addr[i]];
+    }
+    node = n.children[addr[i]];
+    if (node == 0) {
+      break;
+    }
+  }
+  return best;
+}
+
+IpFilterTable::IpFilterTable(const std::vector<IpRule> &rules)
+    // 1 + 256 + 65536 nodes at most for IPv4.
+    : v4_(std::numeric_limits<size_t>::max()), v6_(kMaxV6TrieNodes) {
+  std::vector<std::pair<uint32_t, IpAction>> hosts_v4;
+  for (auto &rule : rules) {
+    if (rule.action == IpAction::kAllow) {
+      has_allow_rules_ = true;
+    }
+    if (!rule.v6 && rule.prefix_len == 32) {
+      uint32_t addr = (uint32_t(rule.addr[0]) << 24) |
+                      (uint32_t(rule.addr[1]) << 16) |
+                      (uint32_t(rule.addr[2]) << 8) | uint32_t(rule.addr[3]);
+      hosts_v4.emplace_back(addr, rule.action);
+    } else if (rule.v6 && rule.prefix_len == 128) {
+      hosts_v6_.emplace_back(HostV6{rule.addr, rule.action});
+    } else if (!(rule.v6 ? v6_ : v4_).Insert(rule)) {
+      complete_ = false;
+      return;
+    }
+  }
+
+  std::sort(hosts_v4.begin(), hosts_v4.end());
+  hosts_v4_.reserve(hosts_v4.size());
+  hosts_v4_actions_.reserve(hosts_v4.size());
+  for (auto &[addr, action] : hosts_v4) {
+    if (!hosts_v4_.empty() && hosts_v4_.back() == addr) {
+      hosts_v4_actions_.back() = mergeAction(hosts_v4_actions_.back(), action);
+      continue;
+    }
+    hosts_v4_.emplace_back(addr);
+    hosts_v4_actions_.emplace_back(action);
+  }
+
+  std::sort(hosts_v6_.begin(), hosts_v6_.end(),
+            [](const HostV6 &lhs, const HostV6 &rhs) {
+              return lhs.addr < rhs.addr;
+            });
+  // merge duplicated addresses.
+  size_t n = 0;
+  for (size_t i = 0; i < hosts_v6_.size(); ++i) {
+    if (n > 0 && hosts_v6_[n - 1].addr == hosts_v6_[i].addr) {
+      hosts_v6_[n - 1].action =
+          mergeAction(hosts_v6_[n - 1].action, hosts_v6_[i].action);
+      continue;
+    }
+    hosts_v6_[n++] = hosts_v6_[i];
+  }
+  hosts_v6_.resize(n);
+}
+
+IpAction IpFilterTable::Lookup(const uint8_t *addr, bool v6) const {
+  if (!v6) {
+    uint32_t key = (uint32_t(addr[0]) << 24) | (uint32_t(addr[1]) << 16) |
+                   (uint32_t(addr[2]) << 8) | uint32_t(addr[3]);
+    auto it = std::lower_bound(hosts_v4_.begin(), hosts_v4_.end(), key);
+    if (it != hosts_v4_.end() && *it == key) {
+      return hosts_v4_actions_[it - hosts_v4_.begin()];
+    }
+    return v4_.Lookup(addr, 4);
+  }
+  auto it = std::lower_bound(
+      hosts_v6_.begin(), hosts_v6_.end(), addr,
+      [](const HostV6 &host, const uint8_t *key) {
+        return std::memcmp(host.addr.data(), key, 16) < 0;
+      });
+  if (it != hosts_v6_.end() && std::memcmp(it->addr.data(), addr, 16) == 0) {
+    return it->action;
+  }
+  return v6_.Lookup(addr, 16);
+}
+
+IpFilter::IpFilter() : table_(nullptr) {}
+
+IpFilter &IpFilter::Instance() {
+  static IpFilter instance;
+  return instance;
+}
+
+bool IpFilter::publish() {
+  if (config_rules_.empty() && rules_.empty()) {
+    table_.store(nullptr, std::memory_order_release);
+    return true;
+  }
+  std::vector<IpRule> rules;
+  rules.reserve(config_rules_.size() + rules_.size());
+  rules.insert(rules.end(), config_rules_.begin(), config_rules_.end());
+  rules.insert(rules.end(), rules_.begin(), rules_.end());
+  auto table = std::make_shared<const IpFilterTable>(rules);
+  if (!table->Complete()) {
+    SPDLOG_ERROR("too many ip filter rules, the IPv6 prefixes need more than "
+                 "{} trie nodes",
+                 IpFilterTable::kMaxV6TrieNodes);
+    return false;
+  }
+  table_.store(std::move(table), std::memory_order_release);
+  return true;
+}
+
+bool IpFilter::AddRule(std::string_view cidr, IpAction action) {
+  IpRule rule;
+  if (!ParseCidr(cidr, action, rule)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (std::find(rules_.begin(), rules_.end(), rule) != rules_.end()) {
+    return true;
+  }
+  rules_.emplace_back(rule);
+  if (!publish()) {
+    rules_.pop_back();
+    return false;
+  }
+  return true;
+}
+
+bool IpFilter::RemoveRule(std::string_view cidr, IpAction action) {
+  IpRule rule;
+  if (!ParseCidr(cidr, action, rule)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool removed = false;
+  for (auto *rules : {&rules_, &config_rules_}) {
+    auto it = std::remove(rules->begin(), rules->end(), rule);
+    removed = removed || it != rules->end();
+    rules->erase(it, rules->end());
+  }
+  if (!removed) {
+    return false;
+  }
+  // fewer rules always fit.
+  publish();
+  return true;
+}
+
+size_t IpFilter::AddRules(const std::vector<std::string> &cidrs,
+                          IpAction action) {
+  std::vector<IpRule> parsed;
+  parsed.reserve(cidrs.size());
+  auto num_parsed = parseRules(cidrs, action, parsed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto rules = rules_;
+  rules_.insert(rules_.end(), parsed.begin(), parsed.end());
+  sortRules(rules_);
+  if (!publish()) {
+    rules_ = std::move(rules);
+    return 0;
+  }
+  return num_parsed;
+}
+
+bool IpFilter::LoadFromFile(const std::string &path, IpAction action) {
+  std::vector<IpRule> parsed;
+  if (!readRuleFile(path, action, parsed)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto rules = rules_;
+  rules_.insert(rules_.end(), parsed.begin(), parsed.end());
+  sortRules(rules_);
+  if (!publish()) {
+    rules_ = std::move(rules);
+    return false;
+  }
+  return true;
+}
+
+bool IpFilter::LoadFromConfig(const YAML::Node &config) {
+  // build the whole rule set first, the current one stays on any failure.
+  std::vector<IpRule> rules;
+  if (config["security"] && config["security"]["ip_filter"]) {
+    auto ip_filter = config["security"]["ip_filter"];
+    try {
+      const std::pair<const char *, IpAction> lists[] = {
+          {"allow", IpAction::kAllow},
+          {"deny", IpAction::kDeny},
+      };
+      for (const auto &[field, action] : lists) {
+        if (ip_filter[field]) {
+          parseRules(ip_filter[field].as<std::vector<std::string>>(), action,
+                     rules);
+        }
+        auto file_field = std::string(field) + "_file";
+        if (ip_filter[file_field] &&
+            !readRuleFile(ip_filter[file_field].as<std::string>(), action,
+                          rules)) {
+          return false;
+        }
+      }
+    } catch (const YAML::Exception &e) {
+      SPDLOG_ERROR("failed to load ip filter: {}", e.what());
+      return false;
+    }
+  }
+  sortRules(rules);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::swap(config_rules_, rules);
+  if (!publish()) {
+    std::swap(config_rules_, rules);
+    return false;
+  }
+  return true;
+}
+
+void IpFilter::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_rules_.clear();
+  rules_.clear();
+  publish();
+}
+
+size_t IpFilter::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_rules_.size() + rules_.size();
+}
+
+bool IpFilter::IsAllowed(const sockaddr *addr) const {
+  auto table = table_.load(std::memory_order_acquire);
+  if (!table || addr == nullptr) {
+    return true;
+  }
+  const uint8_t *bytes = nullptr;
+  bool v6 = false;
+  if (addr->sa_family == AF_INET) {
+    auto in4 =
+        reinterpret_cast<const boost::asio::detail::sockaddr_in4_type *>(addr);
+    bytes = reinterpret_cast<const uint8_t *>(&in4->sin_addr);
+  } else if (addr->sa_family == AF_INET6) {
+    auto in6 =
+        reinterpret_cast<const boost::asio::detail::sockaddr_in6_type *>(addr);
+    bytes = reinterpret_cast<const uint8_t *>(&in6->sin6_addr);
+    v6 = true;
+    // dual-stack sockets report IPv4 peers as ::ffff:a.b.c.d.
+    if (isV4Mapped(bytes)) {
+      bytes += 12;
+      v6 = false;
+    }
+  } else {
+    return true;
+  }
+  auto action = table->Lookup(bytes, v6);
+  if (action == IpAction::kNone) {
+    return !table->HasAllowRules();
+  }
+  return action == IpAction::kAllow;
+}
+
+} // namespace azugate
@@ -1,9 +1,16 @@
 #include "../../include/load_balancer.hpp"
+#include "common.hpp"
+#include "crequest.h"
+#include "metrics.hpp"
+#include "string_op.h"
 #include <algorithm>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <cctype>
+#include <cmath>
 #include <functional>
 #include <numeric>
+#include <random>
 
 namespace azugate {
 
@@ -11,30 +18,322 @@ namespace azugate {
 static std::unordered_map<std::string, std::shared_ptr<LoadBalancer>> load_balancer_registry;
 static std::mutex registry_mutex;
 
+std::optional<LoadBalancingStrategy>
+parse_load_balancing_strategy(std::string_view name) {
+  if (name == "round_robin") {
+    return LoadBalancingStrategy::RoundRobin;
+  }
+  if (name == "least_connections") {
+    return LoadBalancingStrategy::LeastConnections;
+  }
+  if (name == "weighted" || name == "weighted_round_robin") {
+    return LoadBalancingStrategy::WeightedRoundRobin;
+  }
+  if (name == "random") {
+    return LoadBalancingStrategy::Random;
+  }
+  if (name == "ip_hash") {
+    return LoadBalancingStrategy::IpHash;
+  }
+  if (name == "p2c" || name == "power_of_two_choices") {
+    return LoadBalancingStrategy::PowerOfTwoChoices;
+  }
+  if (name == "maglev") {
+    return LoadBalancingStrategy::Maglev;
+  }
+  if (name == "ring_hash") {
+    return LoadBalancingStrategy::RingHash;
+  }
+  return std::nullopt;
+}
+
+std::optional<HashKey> parse_hash_key(std::string_view spec) {
+  constexpr std::string_view kHeaderPrefix = "header:";
+  constexpr std::string_view kCookiePrefix = "cookie:";
+  if (spec == "client_ip") {
+    return HashKey{.type = HashKey::kClientIp};
+  }
+  if (spec == "path") {
+    return HashKey{.type = HashKey::kPath};
+  }
+  if (spec.starts_with(kHeaderPrefix) && spec.size() > kHeaderPrefix.size()) {
+    return HashKey{.type = HashKey::kHeader,
+                   .name = utils::toLower(spec.substr(kHeaderPrefix.size()))};
+  }
+  if (spec.starts_with(kCookiePrefix) && spec.size() > kCookiePrefix.size()) {
+    return HashKey{.type = HashKey::kCookie,
+                   .name = std::string(spec.substr(kCookiePrefix.size()))};
+  }
+  return std::nullopt;
+}
+
+// FNV-1a with the murmur3 finalizer: stable across processes, so every
+// gateway instance sends a key to the same server.
+static uint64_t stable_hash(std::string_view data, uint64_t seed = 0) {
+  uint64_t hash = 0xcbf29ce484222325ull ^ seed;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static std::string server_key(const UpstreamServer& server) {
+  return server.address() + ":" + std::to_string(server.port());
+}
+
+// Maglev: every server walks its own permutation of the table and claims
+// the next free slot, heavier servers take turns more often. Removing a
+// server only frees its own slots, plus a few reshuffled by the refill.
+static std::vector<uint32_t>
+build_maglev_table(const std::vector<std::shared_ptr<UpstreamServer>>& servers) {
+  const uint64_t size = kMaglevTableSize;
+  const size_t n = servers.size();
+  if (n == 0) {
+    return {};
+  }
+  std::vector<uint64_t> offsets(n), skips(n), next(n, 0);
+  std::vector<double> credits(n, 0.0);
+  int max_weight = 1;
+  for (size_t i = 0; i < n; ++i) {
+    auto key = server_key(*servers[i]);
+    offsets[i] = stable_hash(key, 0) % size;
+    skips[i] = stable_hash(key, 1) % (size - 1) + 1;
+    max_weight = std::max(max_weight, servers[i]->weight());
+  }
+  std::vector<uint32_t> table(size, UINT32_MAX);
+  uint64_t filled = 0;
+  while (true) {
+    for (size_t i = 0; i < n; ++i) {
+      credits[i] += static_cast<double>(servers[i]->weight()) / max_weight;
+      if (credits[i] < 1.0) {
+        continue;
+      }
+      credits[i] -= 1.0;
+      uint64_t slot = (offsets[i] + next[i] * skips[i]) % size;
+      while (table[slot] != UINT32_MAX) {
+        slot = (offsets[i] + ++next[i] * skips[i]) % size;
+      }
+      table[slot] = static_cast<uint32_t>(i);
+      ++next[i];
+      if (++filled == size) {
+        return table;
+      }
+    }
+  }
+}
+
+// Ketama style ring, every server gets virtual nodes in proportion to its
+// weight.
+static std::vector<std::pair<uint64_t, uint32_t>>
+build_hash_ring(const std::vector<std::shared_ptr<UpstreamServer>>& servers) {
+  int64_t total_weight = 0;
+  for (auto& server : servers) {
+    total_weight += server->weight();
+  }
+  // Only huge weights are scaled down, that reshuffles some keys.
+  int64_t nodes_per_weight = std::max<int64_t>(
+      1, std::min(kRingHashNodesPerWeight,
+                  kMaxRingHashSize / std::max<int64_t>(total_weight, 1)));
+  std::vector<std::pair<uint64_t, uint32_t>> ring;
+  ring.reserve(nodes_per_weight * total_weight);
+  for (size_t i = 0; i < servers.size(); ++i) {
+    auto key = server_key(*servers[i]) + "_";
+    int64_t num_nodes = nodes_per_weight * servers[i]->weight();
+    for (int64_t node = 0; node < num_nodes; ++node) {
+      ring.emplace_back(stable_hash(key + std::to_string(node)),
+                        static_cast<uint32_t>(i));
+    }
+  }
+  std::sort(ring.begin(), ring.end());
+  return ring;
+}
+
+static bool equals_ignore_case(std::string_view lhs, std::string_view rhs) {
+  return lhs.size() == rhs.size() &&
+         std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char a, char b) {
+           return std::tolower(static_cast<unsigned char>(a)) ==
+                  std::tolower(static_cast<unsigned char>(b));
+         });
+}
+
+// Points into the request, no copy.
+static std::string_view hash_key_value(const HashKey& key,
+                                       const std::string& client_ip,
+                                       const RequestView* request) {
+  if (request == nullptr || key.type == HashKey::kClientIp) {
+    return client_ip;
+  }
+  if (key.type == HashKey::kPath) {
+    return request->path.substr(0, request->path.find('?'));
+  }
+  for (size_t i = 0; i < request->num_headers; ++i) {
+    auto& header = request->headers[i];
+    std::string_view name(header.name, header.name_len);
+    std::string_view value(header.value, header.value_len);
+    if (key.type == HashKey::kHeader) {
+      if (equals_ignore_case(name, key.name)) {
+        return value;
+      }
+    } else if (equals_ignore_case(name, CRequest::kHeaderFieldCookie)) {
+      if (auto cookie = network::FindCookie(value, key.name)) {
+        return *cookie;
+      }
+    }
+  }
+  return client_ip;
+}
+
+static std::mt19937_64& thread_rng() {
+  thread_local std::mt19937_64 gen{std::random_device{}()};
+  return gen;
+}
+
+// Slow start of the strategies picking servers in sequence: the pick of
+// a ramping server stands with the probability of its ramp factor, else
+// the strategy picks again. The rejections scale its share down as its
+// weight would.
+constexpr int kSlowStartMaxPicks = 4;
+
+template <typename Pick>
+static std::shared_ptr<UpstreamServer> slow_start_pick(const SlowStartConfig* config,
+                                                       Pick pick) {
+  auto server = pick();
+  if (!config) {
+    return server;
+  }
+  for (int i = 1; server && i < kSlowStartMaxPicks; ++i) {
+    double factor = server->slow_start_factor(*config);
+    if (factor >= 1.0 ||
+        std::uniform_real_distribution<double>(0, 1)(thread_rng()) < factor) {
+      return server;
+    }
+    server = pick();
+  }
+  return server;
+}
+
+// Slow start of the consistent hash strategies: the keys whose fraction
+// is below the ramp factor of a server go to it, so its keys only grow as
+// it ramps up.
+static double key_fraction(uint64_t hash) {
+  hash *= 0x9e3779b97f4a7c15ULL;
+  return static_cast<double>(hash >> 11) * 0x1.0p-53;
+}
+
+// Walks the servers of a key in order of preference and returns the first
+// available one under the bounded load, or the first available one if
+// they are all full. See "Consistent Hashing with Bounded Loads".
+template <typename CandidateAt>
+static std::shared_ptr<UpstreamServer>
+bounded_walk(const std::vector<std::shared_ptr<UpstreamServer>>& servers,
+             size_t num_candidates, CandidateAt candidate_at,
+             double balance_factor, int total_connections,
+             const SlowStartConfig* slow_start, uint64_t hash) {
+  auto capacity_of = [&](size_t num_servers) {
+    return static_cast<int>(std::ceil(
+        balance_factor * (std::max(total_connections, 0) + 1) / num_servers));
+  };
+  // Dividing by all the servers rather than the available ones can only
+  // underestimate the capacity, the exact count is only taken when needed.
+  int capacity = capacity_of(servers.size());
+  bool exact = false;
+  std::shared_ptr<UpstreamServer> first;
+  // A ramping server passed over for the key, if it's the only one left.
+  std::shared_ptr<UpstreamServer> ramping;
+  double fraction = slow_start ? key_fraction(hash) : 0.0;
+  uint32_t previous = UINT32_MAX;
+  // The walk ends once every server was passed over, there can be far more
+  // candidates than servers. The bitmap is only needed past the first one.
+  std::vector<bool> seen;
+  uint32_t first_index = 0;
+  size_t num_seen = 0;
+  for (size_t i = 0; i < num_candidates && num_seen < servers.size(); ++i) {
+    uint32_t index = candidate_at(i);
+    if (index == previous) continue;
+    previous = index;
+    if (num_seen == 0) {
+      first_index = index;
+    } else {
+      if (seen.empty()) {
+        seen.resize(servers.size());
+        seen[first_index] = true;
+      }
+      if (seen[index]) continue;
+      seen[index] = true;
+    }
+    ++num_seen;
+    auto& server = servers[index];
+    if (!server->is_available()) continue;
+    if (slow_start && server->slow_start_factor(*slow_start) <= fraction) {
+      if (!ramping) ramping = server;
+      continue;
+    }
+    if (balance_factor <= 0) return server;
+    if (!first) first = server;
+    if (server->active_connections() < capacity) return server;
+    if (!exact) {
+      exact = true;
+      size_t available = std::count_if(servers.begin(), servers.end(),
+        [](const std::shared_ptr<UpstreamServer>& s) { return s->is_available(); });
+      capacity = capacity_of(std::max<size_t>(available, 1));
+      if (server->active_connections() < capacity) return server;
+    }
+  }
+  return first ? first : ramping;
+}
+
+static int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 // UpstreamServer Implementation
 UpstreamServer::UpstreamServer(const std::string& address, uint16_t port, int weight)
-    : address_(address), port_(port), weight_(weight), 
+    : UpstreamServer(ConnectionInfo{.type = ProtocolTypeHttp,
+                                    .address = address,
+                                    .port = port,
+                                    .remote = true},
+                     weight) {}
+
+UpstreamServer::UpstreamServer(const ConnectionInfo& target, int weight)
+    : target_(target), weight_(std::max(weight, 1)),
       health_status_(HealthStatus::Unknown), active_connections_(0),
-      consecutive_successes_(0), consecutive_failures_(0),
-      avg_response_time_ms_(0.0), total_checks_(0), total_successes_(0) {
+      avg_response_time_ms_(0.0), error_penalty_(0.0),
+      error_penalty_time_ns_(0), outcomes_(kOutlierDetectionWindow),
+      consecutive_errors_(0), ejected_until_ns_(0), ejection_count_(0),
+      slow_start_enabled_(false), slow_start_begin_ns_(0),
+      circuit_breaker_(CircuitBreakerRegistry::instance().get_for_upstream(
+          target.address, target.port)),
+      consecutive_successes_(0),
+      consecutive_failures_(0), total_checks_(0), total_successes_(0) {
+  // Don't keep a load balancer alive through its own servers.
+  target_.load_balancer.reset();
+  target_.upstream.reset();
   last_check_time_ = std::chrono::steady_clock::now();
 }
 
 void UpstreamServer::increment_connections() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  ++active_connections_;
+  active_connections_.fetch_add(1, std::memory_order_relaxed);
 }
 
 void UpstreamServer::decrement_connections() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (active_connections_ > 0) {
-    --active_connections_;
+  int current = active_connections_.load(std::memory_order_relaxed);
+  while (current > 0 &&
+         !active_connections_.compare_exchange_weak(
+             current, current - 1, std::memory_order_relaxed)) {
   }
 }
 
 void UpstreamServer::set_health_status(HealthStatus status) {
+  health_status_.store(status, std::memory_order_relaxed);
   std::lock_guard<std::mutex> lock(mutex_);
-  health_status_ = status;
   last_check_time_ = std::chrono::steady_clock::now();
 }
 
@@ -55,192 +354,209 @@ void UpstreamServer::record_health_check_failure() {
   last_check_time_ = std::chrono::steady_clock::now();
 }
 
-void UpstreamServer::update_response_time(std::chrono::milliseconds response_time) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  double response_time_ms = static_cast<double>(response_time.count());
+void UpstreamServer::update_response_time(std::chrono::nanoseconds response_time) {
+  double response_time_ms =
+      std::chrono::duration<double, std::milli>(response_time).count();
   
-  // Exponential moving average with alpha = 0.3
-  if (avg_response_time_ms_ == 0.0) {
-    avg_response_time_ms_ = response_time_ms;
-  } else {
-    avg_response_time_ms_ = 0.7 * avg_response_time_ms_ + 0.3 * response_time_ms;
+  double current = avg_response_time_ms_.load(std::memory_order_relaxed);
+  double updated;
+  do {
+    updated = current == 0.0 ? response_time_ms
+                             : (1 - kLatencyEwmaAlpha) * current +
+                                   kLatencyEwmaAlpha * response_time_ms;
+  } while (!avg_response_time_ms_.compare_exchange_weak(
+      current, updated, std::memory_order_relaxed));
+}
+
+// Exponential decay of `penalty` over `elapsed_ns`.
+static double decay_penalty(double penalty, int64_t elapsed_ns) {
+  if (penalty == 0.0 || elapsed_ns <= 0) {
+    return penalty;
+  }
+  constexpr double half_life_ns =
+      std::chrono::duration<double, std::nano>(kErrorPenaltyHalfLife).count();
+  return penalty * std::exp2(-static_cast<double>(elapsed_ns) / half_life_ns);
+}
+
+void UpstreamServer::record_error() {
+  // Two racing errors may count as one, which is fine for a heuristic.
+  int64_t now = steady_now_ns();
+  double penalty = decay_penalty(error_penalty_.load(std::memory_order_relaxed),
+                                 now - error_penalty_time_ns_.load(std::memory_order_relaxed));
+  error_penalty_.store(penalty + 1.0, std::memory_order_relaxed);
+  error_penalty_time_ns_.store(now, std::memory_order_relaxed);
+}
+
+double UpstreamServer::error_penalty() const {
+  double penalty = error_penalty_.load(std::memory_order_relaxed);
+  if (penalty == 0.0) {
+    return 0.0;
+  }
+  return decay_penalty(penalty, steady_now_ns() -
+                                    error_penalty_time_ns_.load(std::memory_order_relaxed));
+}
+
+double UpstreamServer::load_score() const {
+  // Servers without samples yet look as fast as possible, so they get some
+  // traffic and a latency estimate.
+  double latency = std::max(response_time_ms(), 1e-3);
+  return (active_connections() + 1) * latency *
+         (1.0 + kErrorPenaltyWeight * error_penalty());
+}
+
+HealthStatus UpstreamServer::health_status() const {
+  if (ejected_until_ns_.load(std::memory_order_relaxed) != 0 &&
+      ejected(steady_now_ns())) {
+    return HealthStatus::Ejected;
   }
+  return health_status_.load(std::memory_order_relaxed);
 }
 
 bool UpstreamServer::is_available() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return health_status_ == HealthStatus::Healthy || 
-         health_status_ == HealthStatus::Unknown ||
-         health_status_ == HealthStatus::Recovering;
+  auto status = health_status_.load(std::memory_order_relaxed);
+  if (status != HealthStatus::Healthy && status != HealthStatus::Unknown &&
+      status != HealthStatus::Recovering) {
+    return false;
+  }
+  // Only read the clock while an ejection is pending.
+  if (ejected_until_ns_.load(std::memory_order_relaxed) != 0 &&
+      ejected(steady_now_ns())) {
+    return false;
+  }
+  return !CircuitBreakerRegistry::instance().enabled() ||
+         circuit_breaker_->allows_requests();
 }
 
-// HealthChecker Implementation
-HealthChecker::HealthChecker(boost::asio::io_context& io_context, 
-                           const HealthCheckConfig& config)
-    : io_context_(io_context), config_(config), stopped_(false) {}
+int UpstreamServer::record_outcome(bool success, std::chrono::nanoseconds latency) {
+  outcomes_.Record(success, latency, steady_now_ns());
+  if (success) {
+    consecutive_errors_.store(0, std::memory_order_relaxed);
+    return 0;
+  }
+  return consecutive_errors_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
 
-void HealthChecker::start_health_check(std::shared_ptr<UpstreamServer> server) {
-  if (stopped_) return;
-  
-  auto timer = std::make_shared<boost::asio::steady_timer>(io_context_);
-  timers_.push_back(timer);
-  
-  // Start immediate check
-  perform_health_check(server);
+SlidingWindow::Totals UpstreamServer::outcomes() const {
+  return outcomes_.Sum(steady_now_ns());
+}
+
+void UpstreamServer::eject(int64_t until_ns) {
+  ejected_until_ns_.store(until_ns, std::memory_order_relaxed);
+  ejection_count_.fetch_add(1, std::memory_order_relaxed);
+  consecutive_errors_.store(0, std::memory_order_relaxed);
 }
 
-void HealthChecker::stop_health_checks() {
-  stopped_ = true;
-  for (auto& timer : timers_) {
-    timer->cancel();
+bool UpstreamServer::clear_expired_ejection(int64_t now_ns) {
+  int64_t until = ejected_until_ns_.load(std::memory_order_relaxed);
+  if (until == 0 || now_ns < until) {
+    return false;
   }
-  timers_.clear();
+  // The window still holds the errors that got the server ejected.
+  outcomes_.Reset();
+  return ejected_until_ns_.compare_exchange_strong(until, 0,
+                                                   std::memory_order_relaxed);
 }
 
-void HealthChecker::perform_health_check(std::shared_ptr<UpstreamServer> server) {
-  if (stopped_) return;
-  
-  auto start_time = std::chrono::steady_clock::now();
-  
-  // Create HTTP client for health check
-  auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(io_context_);
-  auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_context_);
-  
-  resolver->async_resolve(
-    server->address(), std::to_string(server->port()),
-    [this, server, socket, start_time](
-        boost::system::error_code ec,
-        boost::asio::ip::tcp::resolver::results_type results) {
-      
-      if (ec) {
-        SPDLOG_WARN("Health check DNS resolution failed for {}:{}: {}", 
-                   server->address(), server->port(), ec.message());
-        server->record_health_check_failure();
-        schedule_next_check(server);
-        return;
-      }
-      
-      // Connect to server
-      boost::asio::async_connect(*socket, results,
-        [this, server, socket, start_time](
-            boost::system::error_code ec, 
-            const boost::asio::ip::tcp::endpoint&) {
-          
-          if (ec) {
-            SPDLOG_WARN("Health check connection failed for {}:{}: {}", 
-                       server->address(), server->port(), ec.message());
-            server->record_health_check_failure();
-            schedule_next_check(server);
-            return;
-          }
-          
-          // Send HTTP GET request to health endpoint
-          namespace http = boost::beast::http;
-          
-          http::request<http::empty_body> req{http::verb::get, config_.path, 11};
-          req.set(http::field::host, server->address());
-          req.set(http::field::user_agent, AZUGATE_VERSION_STRING);
-          req.set(http::field::connection, "close");
-          
-          auto write_buffer = std::make_shared<boost::beast::flat_buffer>();
-          auto read_buffer = std::make_shared<boost::beast::flat_buffer>();
-          auto parser = std::make_shared<http::response_parser<http::string_body>>();
-          
-          // Write request
-          http::async_write(*socket, req,
-            [this, server, socket, start_time, read_buffer, parser](
-                boost::system::error_code ec, std::size_t) {
-              
-              if (ec) {
-                SPDLOG_WARN("Health check write failed for {}:{}: {}", 
-                           server->address(), server->port(), ec.message());
-                server->record_health_check_failure();
-                schedule_next_check(server);
-                return;
-              }
-              
-              // Read response
-              http::async_read(*socket, *read_buffer, *parser,
-                [this, server, socket, start_time, parser](
-                    boost::system::error_code ec, std::size_t) {
-                  
-                  auto end_time = std::chrono::steady_clock::now();
-                  auto response_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                      end_time - start_time);
-                  
-                  if (ec && ec != boost::beast::http::error::end_of_stream) {
-                    SPDLOG_WARN("Health check read failed for {}:{}: {}", 
-                               server->address(), server->port(), ec.message());
-                    server->record_health_check_failure();
-                  } else {
-                    auto& response = parser->get();
-                    bool success = static_cast<int>(response.result()) == config_.expected_status;
-                    
-                    if (!config_.expected_body.empty()) {
-                      success = success && (response.body() == config_.expected_body);
-                    }
-                    
-                    if (success) {
-                      server->record_health_check_success();
-                      server->update_response_time(response_time);
-                      SPDLOG_DEBUG("Health check success for {}:{} - {}ms", 
-                                  server->address(), server->port(), response_time.count());
-                    } else {
-                      server->record_health_check_failure();
-                      SPDLOG_WARN("Health check failed for {}:{} - status: {}, body: {}", 
-                                 server->address(), server->port(), 
-                                 static_cast<int>(response.result()), response.body());
-                    }
-                  }
-                  
-                  // Close socket
-                  socket->close();
-                  schedule_next_check(server);
-                });
-            });
-        });
-    });
+void UpstreamServer::decay_ejection_count() {
+  int count = ejection_count_.load(std::memory_order_relaxed);
+  while (count > 0 && !ejection_count_.compare_exchange_weak(
+                          count, count - 1, std::memory_order_relaxed)) {
+  }
 }
 
-void HealthChecker::schedule_next_check(std::shared_ptr<UpstreamServer> server) {
-  if (stopped_) return;
-  
-  auto timer = std::make_shared<boost::asio::steady_timer>(io_context_);
-  timer->expires_after(config_.interval);
-  
-  timer->async_wait([this, server, timer](boost::system::error_code ec) {
-    if (!ec && !stopped_) {
-      perform_health_check(server);
-    }
-  });
-  
-  timers_.push_back(timer);
+void UpstreamServer::set_slow_start(bool enabled) {
+  slow_start_enabled_.store(enabled, std::memory_order_relaxed);
+  int64_t begin = slow_start_begin_ns_.load(std::memory_order_relaxed);
+  if (!enabled && begin != 0) {
+    end_slow_start(begin);
+  }
+}
+
+void UpstreamServer::begin_slow_start() {
+  if (!slow_start_enabled_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  slow_start_begin_ns_.store(std::max<int64_t>(steady_now_ns(), 1),
+                             std::memory_order_relaxed);
+  // A server of unknown health stays unknown.
+  auto healthy = HealthStatus::Healthy;
+  health_status_.compare_exchange_strong(healthy, HealthStatus::Recovering,
+                                         std::memory_order_relaxed);
+}
+
+void UpstreamServer::end_slow_start(int64_t begin_ns) {
+  if (slow_start_begin_ns_.compare_exchange_strong(begin_ns, 0,
+                                                   std::memory_order_relaxed)) {
+    auto recovering = HealthStatus::Recovering;
+    health_status_.compare_exchange_strong(recovering, HealthStatus::Healthy,
+                                           std::memory_order_relaxed);
+  }
+}
+
+double UpstreamServer::slow_start_factor(const SlowStartConfig& config) {
+  // Only read the clock while ramping.
+  int64_t begin = slow_start_begin_ns_.load(std::memory_order_relaxed);
+  if (begin == 0) {
+    return 1.0;
+  }
+  int64_t window = std::chrono::nanoseconds(config.window).count();
+  int64_t elapsed = steady_now_ns() - begin;
+  if (elapsed >= window) {
+    end_slow_start(begin);
+    return 1.0;
+  }
+  double time_factor =
+      static_cast<double>(std::max<int64_t>(elapsed, 1)) / window;
+  double factor = std::pow(time_factor, 1.0 / std::max(config.aggression, 1e-3));
+  return std::max(factor, std::clamp(config.min_weight_percent, 0, 100) / 100.0);
 }
 
 // LoadBalancer Implementation
-LoadBalancer::LoadBalancer(boost::asio::io_context& io_context,
+LoadBalancer::LoadBalancer(boost::asio::io_context& /*io_context*/,
                          LoadBalancingStrategy strategy)
-    : io_context_(io_context), strategy_(strategy), round_robin_index_(0),
-      gen_(rd_()), health_checks_enabled_(false) {}
+    : LoadBalancer(strategy) {}
+
+LoadBalancer::LoadBalancer(LoadBalancingStrategy strategy)
+    : strategy_(strategy),
+      hash_balance_factor_(kDftHashBalanceFactor),
+      serving_(false), next_outlier_evaluation_ns_(0), total_connections_(0),
+      round_robin_index_(0), weighted_index_(0),
+      health_checks_enabled_(false) {
+  publish();
+}
 
 LoadBalancer::~LoadBalancer() {
-  if (health_checker_) {
-    health_checker_->stop_health_checks();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [_, id] : health_check_ids_) {
+    HealthCheckScheduler::Instance().Unregister(id);
   }
 }
 
 void LoadBalancer::add_server(const std::string& address, uint16_t port, int weight) {
+  add_server(ConnectionInfo{.type = ProtocolTypeHttp,
+                            .address = address,
+                            .port = port,
+                            .remote = true},
+             weight);
+}
+
+void LoadBalancer::add_server(const ConnectionInfo& target, int weight) {
   std::lock_guard<std::mutex> lock(mutex_);
   
-  auto server = std::make_shared<UpstreamServer>(address, port, weight);
+  auto server = std::make_shared<UpstreamServer>(target, weight);
+  server->set_slow_start(slow_start_ != nullptr);
+  if (serving_.load(std::memory_order_relaxed)) {
+    server->begin_slow_start();
+  }
   servers_.push_back(server);
-  weighted_current_weights_.push_back(0);
+  publish();
   
-  if (health_checker_ && health_checks_enabled_) {
-    health_checker_->start_health_check(server);
+  if (health_checks_enabled_) {
+    start_health_check(server);
   }
   
-  SPDLOG_INFO("Added upstream server {}:{} with weight {}", address, port, weight);
+  SPDLOG_INFO("Added upstream server {}:{} with weight {}", target.address,
+              target.port, server->weight());
 }
 
 void LoadBalancer::remove_server(const std::string& address, uint16_t port) {
@@ -252,200 +568,573 @@ void LoadBalancer::remove_server(const std::string& address, uint16_t port) {
     });
   
   if (it != servers_.end()) {
-    size_t removed_index = std::distance(servers_.begin(), it);
+    for (auto removed = it; removed != servers_.end(); ++removed) {
+      stop_health_check(*removed);
+    }
     servers_.erase(it, servers_.end());
-    
-    if (removed_index < weighted_current_weights_.size()) {
-      weighted_current_weights_.erase(weighted_current_weights_.begin() + removed_index);
+    publish();
+    SPDLOG_INFO("Removed upstream server {}:{}", address, port);
+  }
+}
+
+void LoadBalancer::set_strategy(LoadBalancingStrategy strategy) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (strategy_ != strategy) {
+    strategy_ = strategy;
+    publish();
+  }
+}
+
+void LoadBalancer::set_hash_policy(const HashKey& key, double balance_factor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (hash_key_.type == key.type && hash_key_.name == key.name &&
+      hash_balance_factor_ == balance_factor) {
+    return;
+  }
+  hash_key_ = key;
+  hash_balance_factor_ = balance_factor;
+  publish();
+}
+
+void LoadBalancer::set_outlier_detection(const OutlierDetectionConfig& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!config.enabled) {
+    if (outlier_detection_) {
+      outlier_detection_.reset();
+      publish();
     }
-    
-    if (round_robin_index_ >= servers_.size() && !servers_.empty()) {
-      round_robin_index_ = 0;
+    return;
+  }
+  if (outlier_detection_ && *outlier_detection_ == config) {
+    return;
+  }
+  outlier_detection_ = std::make_shared<const OutlierDetectionConfig>(config);
+  publish();
+}
+
+void LoadBalancer::set_slow_start(const SlowStartConfig& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!config.enabled) {
+    if (slow_start_) {
+      slow_start_.reset();
+      for (auto& server : servers_) {
+        server->set_slow_start(false);
+      }
+      publish();
     }
-    
-    SPDLOG_INFO("Removed upstream server {}:{}", address, port);
+    return;
+  }
+  if (slow_start_ && *slow_start_ == config) {
+    return;
+  }
+  slow_start_ = std::make_shared<const SlowStartConfig>(config);
+  for (auto& server : servers_) {
+    server->set_slow_start(true);
+  }
+  publish();
+}
+
+void LoadBalancer::publish() {
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->strategy = strategy_;
+  snapshot->servers = servers_;
+  snapshot->hash_key = hash_key_;
+  snapshot->hash_balance_factor = hash_balance_factor_;
+  snapshot->outlier_detection = outlier_detection_;
+  snapshot->slow_start = slow_start_;
+  if (strategy_ == LoadBalancingStrategy::Maglev ||
+      strategy_ == LoadBalancingStrategy::IpHash) {
+    snapshot->maglev_table = build_maglev_table(servers_);
+  } else if (strategy_ == LoadBalancingStrategy::RingHash) {
+    snapshot->ring = build_hash_ring(servers_);
   }
+  
+  // Reduce the weights by their gcd so the schedule stays short.
+  int divisor = 0;
+  for (auto& server : servers_) {
+    divisor = std::gcd(divisor, server->weight());
+  }
+  std::vector<int> weights;
+  int64_t total_weight = 0;
+  for (auto& server : servers_) {
+    weights.push_back(server->weight() / divisor);
+    total_weight += weights.back();
+  }
+  // Extreme weight ratios are approximated rather than building a huge
+  // schedule.
+  if (total_weight > kMaxWeightedScheduleSize) {
+    int64_t scaled_total = 0;
+    for (auto& weight : weights) {
+      weight = std::max<int>(1, weight * kMaxWeightedScheduleSize / total_weight);
+      scaled_total += weight;
+    }
+    total_weight = scaled_total;
+  }
+  // Smooth weighted round robin (as in nginx) computed once, so picking is
+  // a single atomic increment and heavy servers are interleaved.
+  std::vector<int> current_weights(weights.size(), 0);
+  snapshot->weighted_schedule.reserve(total_weight);
+  for (int64_t i = 0; i < total_weight; ++i) {
+    size_t best = 0;
+    for (size_t j = 0; j < weights.size(); ++j) {
+      current_weights[j] += weights[j];
+      if (current_weights[j] > current_weights[best]) {
+        best = j;
+      }
+    }
+    current_weights[best] -= static_cast<int>(total_weight);
+    snapshot->weighted_schedule.push_back(static_cast<uint32_t>(best));
+  }
+  
+  snapshot_.store(std::move(snapshot), std::memory_order_release);
 }
 
-std::shared_ptr<UpstreamServer> LoadBalancer::get_server(const std::string& client_ip) {
-  switch (strategy_) {
+std::shared_ptr<UpstreamServer> LoadBalancer::get_server(const std::string& client_ip,
+                                                         const RequestView* request) {
+  auto snapshot = snapshot_.load(std::memory_order_acquire);
+  if (snapshot->servers.empty()) return nullptr;
+  
+  // Servers added from now on slow start.
+  if (!serving_.load(std::memory_order_relaxed)) {
+    serving_.store(true, std::memory_order_relaxed);
+  }
+  
+  const auto* slow_start = snapshot->slow_start.get();
+  switch (snapshot->strategy) {
     case LoadBalancingStrategy::RoundRobin:
-      return round_robin_select();
+      return slow_start_pick(slow_start, [&] { return round_robin_select(*snapshot); });
     case LoadBalancingStrategy::LeastConnections:
-      return least_connections_select();
+      return least_connections_select(*snapshot);
     case LoadBalancingStrategy::WeightedRoundRobin:
-      return weighted_round_robin_select();
+      return slow_start_pick(slow_start,
+                             [&] { return weighted_round_robin_select(*snapshot); });
     case LoadBalancingStrategy::Random:
-      return random_select();
+      return slow_start_pick(slow_start, [&] { return random_select(*snapshot); });
     case LoadBalancingStrategy::IpHash:
-      return ip_hash_select(client_ip);
+      // Not bounded, a client sticks to its server while that one is up.
+      return maglev_select(*snapshot, stable_hash(client_ip), 0);
+    case LoadBalancingStrategy::PowerOfTwoChoices:
+      return p2c_select(*snapshot);
+    case LoadBalancingStrategy::Maglev:
+      return maglev_select(
+          *snapshot,
+          stable_hash(hash_key_value(snapshot->hash_key, client_ip, request)),
+          snapshot->hash_balance_factor);
+    case LoadBalancingStrategy::RingHash:
+      return ring_hash_select(
+          *snapshot,
+          stable_hash(hash_key_value(snapshot->hash_key, client_ip, request)),
+          snapshot->hash_balance_factor);
     default:
-      return round_robin_select();
+      return slow_start_pick(slow_start, [&] { return round_robin_select(*snapshot); });
+  }
+}
+
+std::shared_ptr<UpstreamServer> LoadBalancer::get_retry_server(
+    const std::shared_ptr<UpstreamServer>& previous, const std::string& client_ip,
+    const RequestView* request) {
+  for (int i = 0; i < kMaxRetryPicks; ++i) {
+    auto server = get_server(client_ip, request);
+    if (!server || server != previous) return server;
+  }
+  // The hash strategies map the key to the same server every time, move on
+  // to the next available one in the list.
+  auto snapshot = snapshot_.load(std::memory_order_acquire);
+  const auto& servers = snapshot->servers;
+  auto it = std::find(servers.begin(), servers.end(), previous);
+  size_t start = it == servers.end() ? 0 : it - servers.begin();
+  for (size_t i = 1; i <= servers.size(); ++i) {
+    const auto& server = servers[(start + i) % servers.size()];
+    if (server != previous && server->is_available()) return server;
   }
+  return previous && previous->is_available() ? previous : nullptr;
 }
 
 void LoadBalancer::set_health_check_config(const HealthCheckConfig& config) {
-  if (health_checker_) {
-    health_checker_->stop_health_checks();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (health_check_config_ == config) {
+    return;
   }
-  
-  health_checker_ = std::make_unique<HealthChecker>(io_context_, config);
-  
+  health_check_config_ = config;
   if (health_checks_enabled_) {
-    std::lock_guard<std::mutex> lock(mutex_);
     for (auto& server : servers_) {
-      health_checker_->start_health_check(server);
+      stop_health_check(server);
+      start_health_check(server);
     }
   }
 }
 
 void LoadBalancer::enable_health_checks(bool enable) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (health_checks_enabled_ == enable) {
+    return;
+  }
   health_checks_enabled_ = enable;
-  
-  if (enable && health_checker_) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto& server : servers_) {
-      health_checker_->start_health_check(server);
+  for (auto& server : servers_) {
+    if (enable) {
+      start_health_check(server);
+    } else {
+      stop_health_check(server);
     }
-  } else if (!enable && health_checker_) {
-    health_checker_->stop_health_checks();
   }
 }
 
+void LoadBalancer::start_health_check(const std::shared_ptr<UpstreamServer>& server) {
+  std::weak_ptr<UpstreamServer> weak_server = server;
+  auto id = HealthCheckScheduler::Instance().Register(
+      server->address(), server->port(), health_check_config_,
+      [weak_server](const HealthCheckResult& result) {
+        auto server = weak_server.lock();
+        if (!server) {
+          return;
+        }
+        if (result.success) {
+          server->record_health_check_success();
+        } else {
+          server->record_health_check_failure();
+        }
+        if (!result.status_changed) {
+          return;
+        }
+        bool recovered = server->health_status() == HealthStatus::Unhealthy &&
+                         result.status == HealthStatus::Healthy;
+        server->set_health_status(result.status);
+        if (recovered) {
+          server->begin_slow_start();
+        }
+        auto name = server->address() + ":" + std::to_string(server->port());
+        if (result.status == HealthStatus::Healthy) {
+          SPDLOG_INFO("upstream {} is healthy", name);
+        } else {
+          SPDLOG_WARN("upstream {} is {}", name,
+                      result.status == HealthStatus::Unhealthy ? "unhealthy"
+                                                               : "unknown");
+        }
+        GatewayMetrics::instance().record_upstream_health_check(
+            name, result.status == HealthStatus::Healthy);
+      });
+  health_check_ids_[server.get()] = id;
+}
+
+void LoadBalancer::stop_health_check(const std::shared_ptr<UpstreamServer>& server) {
+  auto it = health_check_ids_.find(server.get());
+  if (it == health_check_ids_.end()) {
+    return;
+  }
+  HealthCheckScheduler::Instance().Unregister(it->second);
+  health_check_ids_.erase(it);
+  // Without checks nothing would ever bring it back.
+  server->set_health_status(HealthStatus::Unknown);
+}
+
 size_t LoadBalancer::total_servers() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return servers_.size();
+  return snapshot_.load(std::memory_order_acquire)->servers.size();
 }
 
 size_t LoadBalancer::healthy_servers() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return std::count_if(servers_.begin(), servers_.end(),
+  auto snapshot = snapshot_.load(std::memory_order_acquire);
+  return std::count_if(snapshot->servers.begin(), snapshot->servers.end(),
     [](const std::shared_ptr<UpstreamServer>& server) {
       return server->is_available();
     });
 }
 
 std::vector<std::shared_ptr<UpstreamServer>> LoadBalancer::get_all_servers() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return servers_;
+  return snapshot_.load(std::memory_order_acquire)->servers;
 }
 
-void LoadBalancer::on_request_start(std::shared_ptr<UpstreamServer> server) {
+void LoadBalancer::on_request_start(const std::shared_ptr<UpstreamServer>& server) {
   if (server) {
     server->increment_connections();
+    total_connections_.fetch_add(1, std::memory_order_relaxed);
   }
 }
 
-void LoadBalancer::on_request_complete(std::shared_ptr<UpstreamServer> server,
-                                     std::chrono::milliseconds response_time,
+void LoadBalancer::on_request_complete(const std::shared_ptr<UpstreamServer>& server,
+                                     std::chrono::nanoseconds response_time,
                                      bool success) {
   if (server) {
     server->decrement_connections();
+    total_connections_.fetch_sub(1, std::memory_order_relaxed);
+    // Failures are often fast, they must not make the server look better.
     if (success) {
       server->update_response_time(response_time);
+    } else {
+      server->record_error();
     }
+    report_outcome(server, success,
+                   success ? response_time : std::chrono::nanoseconds(-1));
   }
 }
 
-// Private selection methods
-std::shared_ptr<UpstreamServer> LoadBalancer::round_robin_select() {
-  auto healthy_servers = get_healthy_servers();
-  if (healthy_servers.empty()) return nullptr;
-  
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (round_robin_index_ >= healthy_servers.size()) {
-    round_robin_index_ = 0;
+void LoadBalancer::on_stream_complete(const std::shared_ptr<UpstreamServer>& server,
+                                      bool success) {
+  if (server) {
+    server->decrement_connections();
+    total_connections_.fetch_sub(1, std::memory_order_relaxed);
+    if (!success) {
+      server->record_error();
+    }
+    report_outcome(server, success, std::chrono::nanoseconds(-1));
   }
-  
-  auto selected = healthy_servers[round_robin_index_++];
-  if (round_robin_index_ >= healthy_servers.size()) {
-    round_robin_index_ = 0;
+}
+
+void LoadBalancer::on_request_cancelled(const std::shared_ptr<UpstreamServer>& server) {
+  if (server) {
+    server->decrement_connections();
+    total_connections_.fetch_sub(1, std::memory_order_relaxed);
   }
-  
-  return selected;
 }
 
-std::shared_ptr<UpstreamServer> LoadBalancer::least_connections_select() {
-  auto healthy_servers = get_healthy_servers();
-  if (healthy_servers.empty()) return nullptr;
-  
-  return *std::min_element(healthy_servers.begin(), healthy_servers.end(),
-    [](const std::shared_ptr<UpstreamServer>& a, const std::shared_ptr<UpstreamServer>& b) {
-      return a->active_connections() < b->active_connections();
-    });
+void LoadBalancer::report_outcome(const std::shared_ptr<UpstreamServer>& server,
+                                  bool success, std::chrono::nanoseconds latency) {
+  int consecutive_errors = server->record_outcome(success, latency);
+  auto snapshot = snapshot_.load(std::memory_order_acquire);
+  if (!snapshot->outlier_detection) {
+    return;
+  }
+  int64_t now = steady_now_ns();
+  int threshold = snapshot->outlier_detection->consecutive_errors;
+  if (threshold > 0 && consecutive_errors >= threshold) {
+    try_eject(*snapshot, server, "consecutive_errors", now);
+  }
+  maybe_evaluate_outliers(*snapshot, now);
 }
 
-std::shared_ptr<UpstreamServer> LoadBalancer::weighted_round_robin_select() {
-  auto healthy_servers = get_healthy_servers();
-  if (healthy_servers.empty()) return nullptr;
-  
-  std::lock_guard<std::mutex> lock(mutex_);
-  
-  // Ensure weights vector is properly sized
-  while (weighted_current_weights_.size() < healthy_servers.size()) {
-    weighted_current_weights_.push_back(0);
+void LoadBalancer::try_eject(const Snapshot& snapshot,
+                             const std::shared_ptr<UpstreamServer>& server,
+                             const char* reason, int64_t now_ns) {
+  const auto& config = *snapshot.outlier_detection;
+  if (server->ejected(now_ns)) {
+    return;
   }
-  
-  int total_weight = 0;
-  std::shared_ptr<UpstreamServer> best = nullptr;
-  int best_current_weight = -1;
-  
-  for (size_t i = 0; i < healthy_servers.size(); ++i) {
-    auto server = healthy_servers[i];
-    int weight = server->weight();
-    
-    weighted_current_weights_[i] += weight;
-    total_weight += weight;
-    
-    if (weighted_current_weights_[i] > best_current_weight) {
-      best_current_weight = weighted_current_weights_[i];
-      best = server;
+  // As in Envoy, the ejection is allowed while the ejected share is below
+  // the max, so a small cluster can still eject one server.
+  size_t num_ejected = std::count_if(
+      snapshot.servers.begin(), snapshot.servers.end(),
+      [now_ns](const std::shared_ptr<UpstreamServer>& s) { return s->ejected(now_ns); });
+  if (num_ejected * 100 >=
+      static_cast<size_t>(std::max(config.max_ejection_percent, 0)) *
+          snapshot.servers.size()) {
+    SPDLOG_DEBUG("not ejecting {}:{} ({}), {} of {} servers already out",
+                 server->address(), server->port(), reason, num_ejected,
+                 snapshot.servers.size());
+    return;
+  }
+  auto duration = std::min(config.base_ejection_time * (server->ejection_count() + 1),
+                           std::max(config.max_ejection_time, config.base_ejection_time));
+  server->eject(now_ns + std::chrono::nanoseconds(duration).count());
+  SPDLOG_WARN("ejected upstream {}:{} for {}ms: {}", server->address(),
+              server->port(), duration.count(), reason);
+  auto name = server->address() + ":" + std::to_string(server->port());
+  GatewayMetrics::instance().record_outlier_ejection(name, reason);
+  GatewayMetrics::instance().record_upstream_health_check(name, false);
+}
+
+void LoadBalancer::maybe_evaluate_outliers(const Snapshot& snapshot, int64_t now_ns) {
+  int64_t next = next_outlier_evaluation_ns_.load(std::memory_order_relaxed);
+  if (now_ns < next) {
+    return;
+  }
+  int64_t interval = std::chrono::nanoseconds(snapshot.outlier_detection->interval).count();
+  if (!next_outlier_evaluation_ns_.compare_exchange_strong(
+          next, now_ns + std::max<int64_t>(interval, 1), std::memory_order_relaxed)) {
+    return;
+  }
+  // The first evaluation only arms the timer, the windows are still empty.
+  if (next != 0) {
+    evaluate_outliers(snapshot, now_ns);
+  }
+}
+
+void LoadBalancer::evaluate_outliers(const Snapshot& snapshot, int64_t now_ns) {
+  const auto& config = *snapshot.outlier_detection;
+  struct Candidate {
+    std::shared_ptr<UpstreamServer> server;
+    SlidingWindow::Totals totals;
+  };
+  std::vector<Candidate> candidates;
+  for (auto& server : snapshot.servers) {
+    if (server->clear_expired_ejection(now_ns)) {
+      SPDLOG_INFO("upstream {}:{} back from ejection", server->address(),
+                  server->port());
+      server->begin_slow_start();
+      GatewayMetrics::instance().record_upstream_health_check(
+          server->address() + ":" + std::to_string(server->port()), true);
+      continue;
+    }
+    if (server->ejected(now_ns)) {
+      continue;
+    }
+    // A quiet interval forgives one past ejection.
+    server->decay_ejection_count();
+    auto totals = server->outcomes();
+    if (totals.Requests() >= static_cast<uint64_t>(config.success_rate_request_volume)) {
+      candidates.push_back(Candidate{server, totals});
     }
   }
-  
-  if (best) {
-    // Find the index of the best server and reduce its current weight
-    for (size_t i = 0; i < healthy_servers.size(); ++i) {
-      if (healthy_servers[i] == best) {
-        weighted_current_weights_[i] -= total_weight;
-        break;
+
+  if (config.failure_percentage_threshold > 0) {
+    for (auto& candidate : candidates) {
+      if (candidate.totals.FailureRate() * 100 >= config.failure_percentage_threshold) {
+        try_eject(snapshot, candidate.server, "failure_percentage", now_ns);
       }
     }
   }
-  
+  if (candidates.size() < static_cast<size_t>(std::max(config.success_rate_minimum_hosts, 1))) {
+    return;
+  }
+
+  double sum = 0;
+  for (auto& candidate : candidates) {
+    sum += candidate.totals.SuccessRate();
+  }
+  double mean = sum / candidates.size();
+  double variance = 0;
+  for (auto& candidate : candidates) {
+    double diff = candidate.totals.SuccessRate() - mean;
+    variance += diff * diff;
+  }
+  double threshold = mean - config.success_rate_stdev_factor *
+                                std::sqrt(variance / candidates.size());
+  for (auto& candidate : candidates) {
+    if (candidate.totals.SuccessRate() < threshold) {
+      try_eject(snapshot, candidate.server, "success_rate", now_ns);
+    }
+  }
+
+  if (config.latency_factor > 0) {
+    std::vector<double> latencies;
+    for (auto& candidate : candidates) {
+      latencies.push_back(candidate.totals.MeanLatencyNs());
+    }
+    auto middle = latencies.begin() + latencies.size() / 2;
+    std::nth_element(latencies.begin(), middle, latencies.end());
+    double limit = config.latency_factor * *middle;
+    for (auto& candidate : candidates) {
+      if (limit > 0 && candidate.totals.MeanLatencyNs() > limit) {
+        try_eject(snapshot, candidate.server, "latency", now_ns);
+      }
+    }
+  }
+}
+
+// Private selection methods
+std::shared_ptr<UpstreamServer> LoadBalancer::next_available(const Snapshot& snapshot,
+                                                             size_t start) {
+  const size_t n = snapshot.servers.size();
+  for (size_t i = 0; i < n; ++i) {
+    auto& server = snapshot.servers[(start + i) % n];
+    if (server->is_available()) {
+      return server;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<UpstreamServer> LoadBalancer::round_robin_select(const Snapshot& snapshot) {
+  return next_available(snapshot,
+                        round_robin_index_.fetch_add(1, std::memory_order_relaxed));
+}
+
+std::shared_ptr<UpstreamServer> LoadBalancer::least_connections_select(const Snapshot& snapshot) {
+  // Start the scan at a rotating offset so ties don't all go to the first.
+  const size_t n = snapshot.servers.size();
+  size_t start = round_robin_index_.fetch_add(1, std::memory_order_relaxed);
+  std::shared_ptr<UpstreamServer> best;
+  double best_load = 0;
+  for (size_t i = 0; i < n; ++i) {
+    auto& server = snapshot.servers[(start + i) % n];
+    if (!server->is_available()) continue;
+    // Slow start divides the load by the ramp factor, as for a lower
+    // weight. One more request keeps idle servers apart.
+    double load = server->active_connections();
+    if (snapshot.slow_start) {
+      load = (load + 1) / server->slow_start_factor(*snapshot.slow_start);
+    }
+    if (!best || load < best_load) {
+      best = server;
+      best_load = load;
+    }
+  }
   return best;
 }
 
-std::shared_ptr<UpstreamServer> LoadBalancer::random_select() {
-  auto healthy_servers = get_healthy_servers();
-  if (healthy_servers.empty()) return nullptr;
-  
-  std::uniform_int_distribution<size_t> dis(0, healthy_servers.size() - 1);
-  return healthy_servers[dis(gen_)];
+std::shared_ptr<UpstreamServer> LoadBalancer::weighted_round_robin_select(const Snapshot& snapshot) {
+  const auto& schedule = snapshot.weighted_schedule;
+  size_t start = weighted_index_.fetch_add(1, std::memory_order_relaxed);
+  // Skip the slots of unavailable servers.
+  for (size_t i = 0; i < schedule.size(); ++i) {
+    auto& server = snapshot.servers[schedule[(start + i) % schedule.size()]];
+    if (server->is_available()) {
+      return server;
+    }
+  }
+  return nullptr;
 }
 
-std::shared_ptr<UpstreamServer> LoadBalancer::ip_hash_select(const std::string& client_ip) {
-  auto healthy_servers = get_healthy_servers();
-  if (healthy_servers.empty()) return nullptr;
-  
-  // Simple hash based on IP address
-  std::hash<std::string> hasher;
-  size_t hash = hasher(client_ip);
-  size_t index = hash % healthy_servers.size();
-  
-  return healthy_servers[index];
+std::shared_ptr<UpstreamServer> LoadBalancer::random_select(const Snapshot& snapshot) {
+  std::uniform_int_distribution<size_t> dis(0, snapshot.servers.size() - 1);
+  return next_available(snapshot, dis(thread_rng()));
 }
 
-std::vector<std::shared_ptr<UpstreamServer>> LoadBalancer::get_healthy_servers() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  std::vector<std::shared_ptr<UpstreamServer>> healthy;
-  
-  std::copy_if(servers_.begin(), servers_.end(), std::back_inserter(healthy),
-    [](const std::shared_ptr<UpstreamServer>& server) {
-      return server->is_available();
-    });
-  
-  return healthy;
+std::shared_ptr<UpstreamServer> LoadBalancer::p2c_select(const Snapshot& snapshot) {
+  const size_t n = snapshot.servers.size();
+  if (n == 1) {
+    return next_available(snapshot, 0);
+  }
+  // Two distinct random servers, unavailable ones are replaced by the next
+  // available server so the choice stays O(1) while most are healthy.
+  auto& gen = thread_rng();
+  size_t first = std::uniform_int_distribution<size_t>(0, n - 1)(gen);
+  size_t second = (first + std::uniform_int_distribution<size_t>(1, n - 1)(gen)) % n;
+  auto a = next_available(snapshot, first);
+  auto b = next_available(snapshot, second);
+  if (!a || !b || a == b) {
+    return a;
+  }
+  double score_a = a->load_score();
+  double score_b = b->load_score();
+  if (snapshot.slow_start) {
+    score_a /= a->slow_start_factor(*snapshot.slow_start);
+    score_b /= b->slow_start_factor(*snapshot.slow_start);
+  }
+  return score_a <= score_b ? a : b;
+}
+
+std::shared_ptr<UpstreamServer> LoadBalancer::maglev_select(const Snapshot& snapshot,
+                                                            uint64_t hash,
+                                                            double balance_factor) {
+  // The following slots of the table are a pseudo random order of the
+  // other servers, the keys of an unavailable server spread evenly.
+  const auto& table = snapshot.maglev_table;
+  if (table.empty()) {
+    return next_available(snapshot, hash % snapshot.servers.size());
+  }
+  size_t start = hash % table.size();
+  return bounded_walk(
+      snapshot.servers, table.size(),
+      [&](size_t i) { return table[(start + i) % table.size()]; },
+      balance_factor, total_connections_.load(std::memory_order_relaxed),
+      snapshot.slow_start.get(), hash);
+}
+
+std::shared_ptr<UpstreamServer> LoadBalancer::ring_hash_select(const Snapshot& snapshot,
+                                                               uint64_t hash,
+                                                               double balance_factor) {
+  const auto& ring = snapshot.ring;
+  if (ring.empty()) {
+    return next_available(snapshot, hash % snapshot.servers.size());
+  }
+  // First virtual node clockwise from the hash.
+  size_t start = std::lower_bound(ring.begin(), ring.end(),
+                                  std::make_pair(hash, uint32_t(0))) -
+                 ring.begin();
+  return bounded_walk(
+      snapshot.servers, ring.size(),
+      [&](size_t i) { return ring[(start + i) % ring.size()].second; },
+      balance_factor, total_connections_.load(std::memory_order_relaxed),
+      snapshot.slow_start.get(), hash);
 }
 
 // Utility functions
@@ -392,6 +392,9 @@ GatewayMetrics::GatewayMetrics() {
     upstream_healthy_ = std::make_unique<LabeledMetricFamily<Gauge>>(
         "azugate_upstream_healthy", "Health status of upstream servers (1=healthy, 0=unhealthy)");
     
+    outlier_ejections_total_ = std::make_unique<LabeledMetricFamily<Counter>>(
+        "azugate_outlier_ejections_total", "Upstream servers ejected by the outlier detection");
+    
     // Initialize circuit breaker metrics
     circuit_breaker_state_ = std::make_unique<LabeledMetricFamily<Gauge>>(
         "azugate_circuit_breaker_state", "Circuit breaker state (0=closed, 1=open, 2=half-open)");
@@ -399,6 +402,27 @@ GatewayMetrics::GatewayMetrics() {
     circuit_breaker_requests_total_ = std::make_unique<LabeledMetricFamily<Counter>>(
         "azugate_circuit_breaker_requests_total", "Total circuit breaker requests");
     
+    // Initialize concurrency limiter metrics
+    concurrency_limit_ = std::make_unique<LabeledMetricFamily<Gauge>>(
+        "azugate_concurrency_limit", "Current adaptive concurrency limit");
+    
+    concurrency_in_flight_ = std::make_unique<LabeledMetricFamily<Gauge>>(
+        "azugate_concurrency_in_flight", "Requests currently admitted by the concurrency limiter");
+    
+    concurrency_queue_depth_ = std::make_unique<LabeledMetricFamily<Gauge>>(
+        "azugate_concurrency_queue_depth", "Requests waiting for a concurrency slot");
+    
+    concurrency_shed_total_ = std::make_unique<LabeledMetricFamily<Counter>>(
+        "azugate_concurrency_shed_total", "Requests shed by the concurrency limiter");
+    
+    // Initialize retry metrics
+    upstream_retries_total_ = std::make_unique<LabeledMetricFamily<Counter>>(
+        "azugate_upstream_retries_total", "Upstream request retries, by outcome of the retry decision");
+    
+    // Initialize hedging metrics
+    upstream_hedges_total_ = std::make_unique<LabeledMetricFamily<Counter>>(
+        "azugate_upstream_hedges_total", "Hedged upstream requests, by outcome of the hedge");
+    
     // Initialize connection metrics
     active_connections_ = std::make_unique<Gauge>(
         "azugate_active_connections", "Current number of active connections");
@@ -472,6 +496,14 @@ void GatewayMetrics::record_upstream_health_check(const std::string& upstream, b
     upstream_healthy_->with_labels(labels).set(healthy ? 1.0 : 0.0);
 }
 
+void GatewayMetrics::record_outlier_ejection(const std::string& upstream, const std::string& reason) {
+    Labels labels = {
+        {"upstream", upstream},
+        {"reason", reason}
+    };
+    outlier_ejections_total_->with_labels(labels).increment();
+}
+
 void GatewayMetrics::record_circuit_breaker_state(const std::string& name, int state) {
     Labels labels = {{"name", name}};
     circuit_breaker_state_->with_labels(labels).set(static_cast<double>(state));
@@ -485,6 +517,38 @@ void GatewayMetrics::record_circuit_breaker_request(const std::string& name, con
     circuit_breaker_requests_total_->with_labels(labels).increment();
 }
 
+void GatewayMetrics::record_concurrency_limit(const std::string& name, size_t limit,
+                                              size_t in_flight, size_t queue_depth) {
+    Labels labels = {{"name", name}};
+    concurrency_limit_->with_labels(labels).set(static_cast<double>(limit));
+    concurrency_in_flight_->with_labels(labels).set(static_cast<double>(in_flight));
+    concurrency_queue_depth_->with_labels(labels).set(static_cast<double>(queue_depth));
+}
+
+void GatewayMetrics::record_concurrency_shed(const std::string& name, const std::string& reason) {
+    Labels labels = {
+        {"name", name},
+        {"reason", reason}
+    };
+    concurrency_shed_total_->with_labels(labels).increment();
+}
+
+void GatewayMetrics::record_upstream_retry(const std::string& upstream, const std::string& result) {
+    Labels labels = {
+        {"upstream", upstream},
+        {"result", result}
+    };
+    upstream_retries_total_->with_labels(labels).increment();
+}
+
+void GatewayMetrics::record_upstream_hedge(const std::string& upstream, const std::string& result) {
+    Labels labels = {
+        {"upstream", upstream},
+        {"result", result}
+    };
+    upstream_hedges_total_->with_labels(labels).increment();
+}
+
 void GatewayMetrics::record_active_connections(int count) {
     active_connections_->set(static_cast<double>(count));
 }
@@ -527,10 +591,19 @@ std::string GatewayMetrics::export_prometheus() const {
     oss << upstream_requests_total_->render_prometheus();
     oss << upstream_request_duration_->render_prometheus();
     oss << upstream_healthy_->render_prometheus();
+    oss << outlier_ejections_total_->render_prometheus();
     
     oss << circuit_breaker_state_->render_prometheus();
     oss << circuit_breaker_requests_total_->render_prometheus();
     
+    oss << concurrency_limit_->render_prometheus();
+    oss << concurrency_in_flight_->render_prometheus();
+    oss << concurrency_queue_depth_->render_prometheus();
+    oss << concurrency_shed_total_->render_prometheus();
+    
+    oss << upstream_retries_total_->render_prometheus();
+    oss << upstream_hedges_total_->render_prometheus();
+    
     oss << active_connections_->render_prometheus();
     oss << connection_duration_->render_prometheus();
     
@@ -563,10 +636,19 @@ void GatewayMetrics::reset_all() {
     upstream_requests_total_->reset();
     upstream_request_duration_->reset();
     upstream_healthy_->reset();
+    outlier_ejections_total_->reset();
     
     circuit_breaker_state_->reset();
     circuit_breaker_requests_total_->reset();
     
+    concurrency_limit_->reset();
+    concurrency_in_flight_->reset();
+    concurrency_queue_depth_->reset();
+    concurrency_shed_total_->reset();
+    
+    upstream_retries_total_->reset();
+    upstream_hedges_total_->reset();
+    
     active_connections_->reset();
     connection_duration_->reset();
     
@@ -1,66 +1,132 @@
 // this module is used for controlling bursty data.
 // ref:
-// https://www.geeksforgeeks.org/token-bucket-algorithm/
-// https://www.geeksforgeeks.org/leaky-bucket-algorithm/
-#include <boost/asio/detail/chrono.hpp>
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/steady_timer.hpp>
-#include <boost/smart_ptr/shared_ptr.hpp>
-#include <boost/system/detail/error_code.hpp>
-#include <cstddef>
-#include <spdlog/spdlog.h>
-
-#include "config.h"
+// https://en.wikipedia.org/wiki/Generic_cell_rate_algorithm
+// https://brandur.org/rate-limiting
 #include "rate_limiter.h"
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/steady_timer.hpp>
-#include <boost/smart_ptr/shared_ptr.hpp>
+#include "string_op.h"
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <functional>
 #include <spdlog/spdlog.h>
 
 namespace azugate {
 
-TokenBucketRateLimiter::TokenBucketRateLimiter(
-    const boost::shared_ptr<boost::asio::io_context> io_context_ptr)
-    : io_context_ptr_(io_context_ptr),
-      timer_(*io_context_ptr,
-             boost::asio::chrono::seconds(kDftTokenGenIntervalSec)) {
-  auto [num_token_max, _] = GetRateLimitorConfig();
-  n_token_ = num_token_max;
-};
+bool ParseRateLimitKey(std::string_view spec, RateLimitKey &key) {
+  constexpr std::string_view kHeaderPrefix = "header:";
+  if (spec == "client_ip") {
+    key = RateLimitKey{.type = RateLimitKey::kClientIp};
+  } else if (spec == "path") {
+    key = RateLimitKey{.type = RateLimitKey::kPath};
+  } else if (spec == "jwt_subject") {
+    key = RateLimitKey{.type = RateLimitKey::kJwtSubject};
+  } else if (spec.starts_with(kHeaderPrefix) &&
+             spec.size() > kHeaderPrefix.size()) {
+    key = RateLimitKey{
+        .type = RateLimitKey::kHeader,
+        .header_name = utils::toLower(spec.substr(kHeaderPrefix.size())),
+    };
+  } else {
+    SPDLOG_WARN("unknown rate limiter key: {}", spec);
+    return false;
+  }
+  return true;
+}
 
-// TODO: memory order.
-bool TokenBucketRateLimiter::GetToken() {
-  size_t current_tokens = n_token_.fetch_sub(1, std::memory_order_acq_rel);
-  if (current_tokens > 0) {
-    return true;
+TokenBucketRateLimiter::TokenBucketRateLimiter(size_t num_token_max,
+                                               size_t num_token_per_sec,
+                                               RateLimitKey key,
+                                               size_t num_shards,
+                                               size_t max_keys_per_shard)
+    : key_(std::move(key)),
+      max_keys_per_shard_(std::max<size_t>(max_keys_per_shard, 1)) {
+  num_token_per_sec = std::max<size_t>(num_token_per_sec, 1);
+  num_token_max = std::max<size_t>(num_token_max, 1);
+  emission_interval_ = std::max<int64_t>(
+      std::chrono::nanoseconds(std::chrono::seconds(1)).count() /
+          static_cast<int64_t>(num_token_per_sec),
+      1);
+  burst_tolerance_ = emission_interval_ * static_cast<int64_t>(num_token_max);
+  shards_.reserve(std::max<size_t>(num_shards, 1));
+  for (size_t i = 0; i < std::max<size_t>(num_shards, 1); ++i) {
+    shards_.emplace_back(std::make_unique<Shard>());
   }
-  n_token_.fetch_add(1, std::memory_order_acq_rel);
-  return false;
 }
 
-void TokenBucketRateLimiter::performTask() {
-  // TODO: low performance.
-  auto [num_token_max, num_token_per_sec] = GetRateLimitorConfig();
+bool TokenBucketRateLimiter::AttachSharedMemory(const std::string &path,
+                                                size_t num_slots) {
+  auto shared = std::make_unique<SharedRateLimitTable>();
+  if (!shared->Open(path, num_slots, emission_interval_, burst_tolerance_)) {
+    return false;
+  }
+  shared_ = std::move(shared);
+  return true;
+}
 
-  size_t new_token_num = n_token_.load() + num_token_per_sec;
-  if (new_token_num > num_token_max) {
-    new_token_num = num_token_max;
+// FNV-1a, unlike std::hash it's stable across processes and builds.
+static uint64_t stableHash(std::string_view key) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
   }
-  n_token_.store(new_token_num);
-  // TODO: rm this line.
-  // SPDLOG_INFO("current tokens number: {}", new_token_num);
+  return hash;
 }
 
-void TokenBucketRateLimiter::tick(boost::asio::steady_timer &t) {
-  performTask();
-  t.expires_at(t.expiry() +
-               boost::asio::chrono::seconds(kDftTokenGenIntervalSec));
-  t.async_wait([&](const boost::system::error_code &) { tick(t); });
+RateLimitDecision TokenBucketRateLimiter::Acquire(std::string_view key) {
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  if (shared_) {
+    RateLimitDecision decision{};
+    bool tracked = false;
+    decision.allowed =
+        shared_->Acquire(stableHash(key), now, emission_interval_,
+                         burst_tolerance_, decision.retry_after, tracked);
+    if (tracked) {
+      shared_->AddCounter(decision.allowed ? kSharedCounterAllowed
+                                           : kSharedCounterRejected,
+                          1);
+      return decision;
+    }
+  }
+  auto &shard = *shards_[std::hash<std::string_view>{}(key) % shards_.size()];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    // a new key starts with a full bucket.
+    if (shard.lru.size() >= max_keys_per_shard_) {
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+    }
+    shard.lru.emplace_front(Entry{std::string(key), now});
+    it = shard.index.emplace(shard.lru.front().key, shard.lru.begin()).first;
+  } else {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  }
+
+  auto &entry = *it->second;
+  int64_t new_tat = std::max(entry.tat, now) + emission_interval_;
+  int64_t allow_at = new_tat - burst_tolerance_;
+  if (allow_at > now) {
+    return RateLimitDecision{
+        .allowed = false,
+        .retry_after = std::chrono::nanoseconds(allow_at - now),
+    };
+  }
+  entry.tat = new_tat;
+  return RateLimitDecision{.allowed = true,
+                           .retry_after = std::chrono::nanoseconds(0)};
 }
 
-void TokenBucketRateLimiter::Start() {
-  timer_.async_wait([&](const boost::system::error_code &) { tick(timer_); });
+size_t TokenBucketRateLimiter::Size() const {
+  size_t size = 0;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    size += shard->lru.size();
+  }
+  return size;
 }
 
-} // namespace azugate
\ No newline at end of file
+} // namespace azugate
@@ -0,0 +1,116 @@
+#include "../../include/retry_policy.hpp"
+#include <algorithm>
+#include <charconv>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <yaml-cpp/yaml.h>
+
+namespace azugate {
+
+bool RetryPolicy::Retriable(UpstreamFailure failure, int status) const {
+  switch (failure) {
+  case UpstreamFailure::kConnectFailure:
+    return retry_on_connect_failure;
+  case UpstreamFailure::kReset:
+    return retry_on_reset;
+  case UpstreamFailure::kNone:
+    break;
+  }
+  return status != 0 && std::find(retry_status_codes.begin(),
+                                  retry_status_codes.end(),
+                                  status) != retry_status_codes.end();
+}
+
+bool ParseRetryOn(const std::vector<std::string_view> &conditions,
+                  RetryPolicy &policy) {
+  policy.retry_on_connect_failure = false;
+  policy.retry_on_reset = false;
+  policy.retry_status_codes.clear();
+  for (auto condition : conditions) {
+    int status = 0;
+    auto [end, ec] = std::from_chars(
+        condition.data(), condition.data() + condition.size(), status);
+    if (ec == std::errc() && end == condition.data() + condition.size()) {
+      if (status < 100 || status > 599) {
+        SPDLOG_WARN("invalid retry status code: {}", condition);
+        return false;
+      }
+      policy.retry_status_codes.push_back(status);
+    } else if (condition == "connect_failure") {
+      policy.retry_on_connect_failure = true;
+    } else if (condition == "reset") {
+      policy.retry_on_reset = true;
+    } else {
+      SPDLOG_WARN("unknown retry condition: {}", condition);
+      return false;
+    }
+  }
+  return true;
+}
+
+std::chrono::nanoseconds RetryBackoff(const RetryPolicy &policy, int retry) {
+  thread_local std::mt19937_64 rng{std::random_device{}()};
+  auto cap = std::chrono::nanoseconds(policy.max_backoff).count();
+  auto backoff = std::chrono::nanoseconds(policy.base_backoff).count();
+  // doubling past the cap is pointless and could overflow.
+  for (int i = 1; i < retry && backoff < cap; ++i) {
+    backoff *= 2;
+  }
+  backoff = std::min(backoff, cap);
+  if (backoff <= 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::nanoseconds(
+      std::uniform_int_distribution<int64_t>(0, backoff)(rng));
+}
+
+RetryBudget &RetryBudget::Instance() {
+  static RetryBudget instance;
+  return instance;
+}
+
+bool RetryBudget::LoadFromConfig(const YAML::Node &config) {
+  auto budget = config["retry"] ? config["retry"]["budget"] : YAML::Node();
+  if (!budget) {
+    Configure(kDftRetryBudgetPercent, kDftMinRetryConcurrency);
+    return true;
+  }
+  try {
+    auto percent = budget["percent"].as<double>(kDftRetryBudgetPercent);
+    if (percent < 0 || percent > 100) {
+      SPDLOG_ERROR("retry.budget.percent must be between 0 and 100");
+      return false;
+    }
+    Configure(percent,
+              budget["min_concurrency"].as<size_t>(kDftMinRetryConcurrency));
+  } catch (const YAML::Exception &e) {
+    SPDLOG_ERROR("failed to load retry budget: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+void RetryBudget::Configure(double budget_percent,
+                            size_t min_retry_concurrency) {
+  budget_percent_.store(budget_percent, std::memory_order_relaxed);
+  min_retry_concurrency_.store(min_retry_concurrency,
+                               std::memory_order_relaxed);
+}
+
+bool RetryBudget::TryAcquireRetry() {
+  auto allowed = std::max(
+      static_cast<size_t>(ActiveRequests() *
+                          budget_percent_.load(std::memory_order_relaxed) /
+                          100.0),
+      min_retry_concurrency_.load(std::memory_order_relaxed));
+  auto retries = active_retries_.load(std::memory_order_relaxed);
+  do {
+    if (retries >= allowed) {
+      return false;
+    }
+  } while (!active_retries_.compare_exchange_weak(retries, retries + 1,
+                                                  std::memory_order_relaxed));
+  return true;
+}
+
+} // namespace azugate
@@ -0,0 +1,146 @@
+#include "../../include/route_matcher.hpp"
+#include "common.hpp"
+#include "crequest.h"
+#include <array>
+#include <cctype>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <string_view>
+
+namespace azugate {
+
+namespace {
+
+constexpr std::array<std::string_view, 9> kKnownMethods = {
+    "GET",     "HEAD",    "POST",  "PUT",   "DELETE",
+    "CONNECT", "OPTIONS", "TRACE", "PATCH",
+};
+
+inline bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (std::tolower(static_cast<unsigned char>(lhs[i])) !=
+        std::tolower(static_cast<unsigned char>(rhs[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool matchValue(MatchOp op, std::string_view actual,
+                       std::string_view expected) {
+  switch (op) {
+  case MatchOp::kPresent:
+    return true;
+  case MatchOp::kExact:
+    return actual == expected;
+  case MatchOp::kPrefix:
+    return actual.starts_with(expected);
+  case MatchOp::kSuffix:
+    return actual.ends_with(expected);
+  case MatchOp::kContains:
+    return actual.find(expected) != std::string_view::npos;
+  }
+  return false;
+}
+
+} // namespace
+
+bool RequestMatcher::AddMethod(std::string_view method) {
+  for (size_t i = 0; i < kKnownMethods.size(); ++i) {
+    if (equalsIgnoreCase(kKnownMethods[i], method)) {
+      methods_ |= 1u << i;
+      return true;
+    }
+  }
+  SPDLOG_WARN("unknown http method: {}", method);
+  return false;
+}
+
+void RequestMatcher::AddCondition(MatchSource source, std::string_view name,
+                                  MatchOp op, std::string_view value,
+                                  bool invert) {
+  Predicate predicate{
+      .source = source,
+      .op = op,
+      .invert = invert,
+      .name_offset = static_cast<uint32_t>(pool_.size()),
+      .name_len = static_cast<uint32_t>(name.size()),
+      // set once the name is pooled.
+      .value_offset = 0,
+      .value_len = 0,
+  };
+  if (source == MatchSource::kHeader) {
+    for (unsigned char c : name) {
+      pool_.push_back(static_cast<char>(std::tolower(c)));
+    }
+  } else {
+    pool_.append(name);
+  }
+  predicate.value_offset = static_cast<uint32_t>(pool_.size());
+  predicate.value_len = static_cast<uint32_t>(value.size());
+  pool_.append(value);
+  program_.emplace_back(predicate);
+}
+
+bool RequestMatcher::evalPredicate(const Predicate &predicate,
+                                   const RequestView &request) const {
+  auto name = poolView(predicate.name_offset, predicate.name_len);
+  auto value = poolView(predicate.value_offset, predicate.value_len);
+  switch (predicate.source) {
+  case MatchSource::kQuery: {
+    auto actual = network::FindQueryParam(request.path, name);
+    return actual && matchValue(predicate.op, *actual, value);
+  }
+  case MatchSource::kHeader:
+  case MatchSource::kCookie: {
+    // a header may be repeated, any of them is enough.
+    for (size_t i = 0; i < request.num_headers; ++i) {
+      auto &header = request.headers[i];
+      std::string_view header_name(header.name, header.name_len);
+      std::string_view header_value(header.value, header.value_len);
+      if (predicate.source == MatchSource::kCookie) {
+        if (!equalsIgnoreCase(header_name, CRequest::kHeaderFieldCookie)) {
+          continue;
+        }
+        auto actual = network::FindCookie(header_value, name);
+        if (actual && matchValue(predicate.op, *actual, value)) {
+          return true;
+        }
+        continue;
+      }
+      if (equalsIgnoreCase(header_name, name) &&
+          matchValue(predicate.op, header_value, value)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  }
+  return false;
+}
+
+bool RequestMatcher::Matches(const RequestView &request) const {
+  if (methods_ != 0) {
+    bool method_match = false;
+    for (size_t i = 0; i < kKnownMethods.size(); ++i) {
+      if ((methods_ & (1u << i)) && request.method == kKnownMethods[i]) {
+        method_match = true;
+        break;
+      }
+    }
+    if (!method_match) {
+      return false;
+    }
+  }
+  for (auto &predicate : program_) {
+    if (evalPredicate(predicate, request) == predicate.invert) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace azugate
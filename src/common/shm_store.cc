@@ -0,0 +1,190 @@
+#include "../../include/shm_store.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <spdlog/spdlog.h>
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace azugate {
+
+namespace {
+// "AZGSHMRL".
+constexpr uint64_t kSharedRateLimiterMagic = 0x415a4753484d524cull;
+constexpr uint32_t kSharedRateLimiterVersion = 1;
+} // namespace
+
+SharedRateLimitTable::~SharedRateLimitTable() {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+  if (header_ != nullptr) {
+    munmap(header_, mapped_size_);
+  }
+#endif
+}
+
+bool SharedRateLimitTable::Open(const std::string &path, size_t num_slots,
+                                int64_t emission_interval,
+                                int64_t burst_tolerance) {
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+  if (header_ != nullptr || num_slots == 0) {
+    return false;
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    SPDLOG_ERROR("failed to open {}: {}", path, std::strerror(errno));
+    return false;
+  }
+  // serialize the initialization among processes.
+  if (flock(fd, LOCK_EX) != 0) {
+    SPDLOG_ERROR("failed to lock {}: {}", path, std::strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  auto fail = [&](const char *what) {
+    SPDLOG_ERROR("failed to attach shared rate limiter {}: {}", path, what);
+    flock(fd, LOCK_UN);
+    ::close(fd);
+    return false;
+  };
+
+  struct stat st{};
+  if (fstat(fd, &st) != 0) {
+    return fail(std::strerror(errno));
+  }
+  bool fresh = st.st_size == 0;
+  size_t expected_size = sizeof(Header) + num_slots * sizeof(Slot);
+  size_t size = fresh ? expected_size : static_cast<size_t>(st.st_size);
+  if (size < sizeof(Header)) {
+    return fail("file too small");
+  }
+  // the new pages are zero filled, i.e. all the slots are free.
+  if (fresh && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    return fail(std::strerror(errno));
+  }
+  void *addr =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return fail(std::strerror(errno));
+  }
+  auto header = static_cast<Header *>(addr);
+  // the magic is written last, a process that died while initializing the
+  // file left it at 0. nobody else could attach since then, start over.
+  if (!fresh && size == expected_size && header->magic == 0) {
+    SPDLOG_WARN("reinitializing the half initialized shared rate limiter {}",
+                path);
+    std::memset(addr, 0, size);
+    fresh = true;
+  }
+  if (fresh) {
+    header->num_slots = static_cast<uint32_t>(num_slots);
+    header->emission_interval = emission_interval;
+    header->burst_tolerance = burst_tolerance;
+    header->version = kSharedRateLimiterVersion;
+    header->magic = kSharedRateLimiterMagic;
+  } else if (header->magic != kSharedRateLimiterMagic ||
+             header->version != kSharedRateLimiterVersion ||
+             size < sizeof(Header) + header->num_slots * sizeof(Slot)) {
+    munmap(addr, size);
+    return fail("not a shared rate limiter file");
+  }
+  if (header->emission_interval != emission_interval ||
+      header->burst_tolerance != burst_tolerance) {
+    SPDLOG_WARN("rate limiter config differs from the other processes "
+                "sharing {}",
+                path);
+  }
+  flock(fd, LOCK_UN);
+  // the mapping outlives the descriptor.
+  ::close(fd);
+
+  header_ = header;
+  slots_ = reinterpret_cast<Slot *>(static_cast<char *>(addr) +
+                                    sizeof(Header));
+  mapped_size_ = size;
+  SPDLOG_INFO("shared rate limiter attached to {} ({} slots)", path,
+              header_->num_slots);
+  return true;
+#else
+  SPDLOG_WARN("shared memory rate limiting is not supported on this platform");
+  return false;
+#endif
+}
+
+bool SharedRateLimitTable::Acquire(uint64_t key_hash, int64_t now,
+                                   int64_t emission_interval,
+                                   int64_t burst_tolerance,
+                                   std::chrono::nanoseconds &retry_after,
+                                   bool &tracked) {
+  tracked = true;
+  retry_after = std::chrono::nanoseconds(0);
+  // 0 marks a free slot.
+  key_hash = key_hash == 0 ? 1 : key_hash;
+
+  auto update = [&](Slot &slot) {
+    int64_t tat = slot.tat.load(std::memory_order_relaxed);
+    for (;;) {
+      int64_t new_tat = std::max(tat, now) + emission_interval;
+      int64_t allow_at = new_tat - burst_tolerance;
+      if (allow_at > now) {
+        retry_after = std::chrono::nanoseconds(allow_at - now);
+        return false;
+      }
+      if (slot.tat.compare_exchange_weak(tat, new_tat,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  };
+
+  size_t num_slots = header_->num_slots;
+  size_t first = key_hash % num_slots;
+  Slot *victim = nullptr;
+  uint64_t victim_hash = 0;
+  int64_t victim_tat = std::numeric_limits<int64_t>::max();
+  for (size_t i = 0; i < std::min(kSharedRateLimiterMaxProbes, num_slots);
+       ++i) {
+    auto &slot = slots_[(first + i) % num_slots];
+    uint64_t hash = slot.key_hash.load(std::memory_order_acquire);
+    if (hash == 0) {
+      if (slot.key_hash.compare_exchange_strong(hash, key_hash,
+                                                std::memory_order_acq_rel)) {
+        return update(slot);
+      }
+      // claimed by another process meanwhile, maybe for the same key.
+    }
+    if (hash == key_hash) {
+      return update(slot);
+    }
+    int64_t tat = slot.tat.load(std::memory_order_relaxed);
+    if (tat < victim_tat) {
+      victim = &slot;
+      victim_hash = hash;
+      victim_tat = tat;
+    }
+  }
+  // an idle key has a full bucket again, its slot can be taken over.
+  if (victim != nullptr && victim_tat <= now &&
+      victim->key_hash.compare_exchange_strong(victim_hash, key_hash,
+                                               std::memory_order_acq_rel)) {
+    return update(*victim);
+  }
+  tracked = false;
+  return true;
+}
+
+void SharedRateLimitTable::AddCounter(SharedCounter counter, uint64_t delta) {
+  header_->counters[counter].fetch_add(delta, std::memory_order_relaxed);
+}
+
+uint64_t SharedRateLimitTable::LoadCounter(SharedCounter counter) const {
+  return header_->counters[counter].load(std::memory_order_relaxed);
+}
+
+} // namespace azugate
@@ -0,0 +1,83 @@
+#include "../../include/sliding_window.hpp"
+#include <algorithm>
+
+namespace azugate {
+
+double SlidingWindow::Totals::SuccessRate() const {
+  auto requests = Requests();
+  return requests == 0 ? 1.0 : static_cast<double>(successes) / requests;
+}
+
+double SlidingWindow::Totals::FailureRate() const {
+  auto requests = Requests();
+  return requests == 0 ? 0.0 : static_cast<double>(failures) / requests;
+}
+
+double SlidingWindow::Totals::MeanLatencyNs() const {
+  return num_latencies == 0
+             ? 0.0
+             : static_cast<double>(latency_ns) / num_latencies;
+}
+
+SlidingWindow::SlidingWindow(std::chrono::nanoseconds window,
+                             size_t num_buckets)
+    : num_buckets_(std::max<size_t>(num_buckets, 1)),
+      buckets_(std::make_unique<Bucket[]>(std::max<size_t>(num_buckets, 1))) {
+  bucket_width_ns_ = std::max<int64_t>(
+      window.count() / static_cast<int64_t>(num_buckets_), 1);
+}
+
+SlidingWindow::Bucket &SlidingWindow::bucketFor(int64_t epoch) {
+  auto &bucket = buckets_[static_cast<size_t>(epoch) % num_buckets_];
+  int64_t current = bucket.epoch.load(std::memory_order_acquire);
+  while (current < epoch) {
+    if (bucket.epoch.compare_exchange_weak(current, epoch,
+                                           std::memory_order_acq_rel)) {
+      bucket.successes.store(0, std::memory_order_relaxed);
+      bucket.failures.store(0, std::memory_order_relaxed);
+      bucket.latency_ns.store(0, std::memory_order_relaxed);
+      bucket.num_latencies.store(0, std::memory_order_relaxed);
+      break;
+    }
+  }
+  return bucket;
+}
+
+void SlidingWindow::Record(bool success, std::chrono::nanoseconds latency,
+                           int64_t now_ns) {
+  auto &bucket = bucketFor(now_ns / bucket_width_ns_);
+  (success ? bucket.successes : bucket.failures)
+      .fetch_add(1, std::memory_order_relaxed);
+  if (latency.count() >= 0) {
+    bucket.latency_ns.fetch_add(static_cast<uint64_t>(latency.count()),
+                                std::memory_order_relaxed);
+    bucket.num_latencies.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+SlidingWindow::Totals SlidingWindow::Sum(int64_t now_ns) const {
+  Totals totals;
+  int64_t epoch = now_ns / bucket_width_ns_;
+  for (size_t i = 0; i < num_buckets_; ++i) {
+    auto &bucket = buckets_[i];
+    int64_t bucket_epoch = bucket.epoch.load(std::memory_order_acquire);
+    if (bucket_epoch > epoch ||
+        bucket_epoch <= epoch - static_cast<int64_t>(num_buckets_)) {
+      continue;
+    }
+    totals.successes += bucket.successes.load(std::memory_order_relaxed);
+    totals.failures += bucket.failures.load(std::memory_order_relaxed);
+    totals.latency_ns += bucket.latency_ns.load(std::memory_order_relaxed);
+    totals.num_latencies +=
+        bucket.num_latencies.load(std::memory_order_relaxed);
+  }
+  return totals;
+}
+
+void SlidingWindow::Reset() {
+  for (size_t i = 0; i < num_buckets_; ++i) {
+    buckets_[i].epoch.store(-1, std::memory_order_release);
+  }
+}
+
+} // namespace azugate
@@ -15,18 +15,35 @@ public:
         boost::shared_ptr<boost::asio::io_context> io_context_ptr,
         boost::shared_ptr<boost::asio::ip::tcp::socket> source_sock_ptr,
         const std::string& target_host,
-        uint16_t target_port
+        uint16_t target_port,
+        std::shared_ptr<LoadBalancer> load_balancer = nullptr,
+        std::shared_ptr<UpstreamServer> upstream = nullptr,
+        std::shared_ptr<CircuitBreaker> circuit_breaker = nullptr
     ) : io_context_ptr_(io_context_ptr), 
         source_sock_ptr_(source_sock_ptr),
         target_sock_ptr_(boost::make_shared<boost::asio::ip::tcp::socket>(*io_context_ptr)),
         target_host_(target_host),
         target_port_(target_port),
         source_buffer_(std::make_unique<std::array<char, 8192>>()),
-        target_buffer_(std::make_unique<std::array<char, 8192>>()) {
+        target_buffer_(std::make_unique<std::array<char, 8192>>()),
+        load_balancer_(std::move(load_balancer)),
+        upstream_(std::move(upstream)),
+        circuit_breaker_(std::move(circuit_breaker)) {
+    }
+
+    ~AsyncTcpProxy() {
+        // The connection counts against the upstream for its whole lifetime.
+        if (load_balancer_) {
+            load_balancer_->on_stream_complete(upstream_, connected_);
+        }
     }
 
     void Start() {
+        if (load_balancer_) {
+            load_balancer_->on_request_start(upstream_);
+        }
         // Connect to target server
+        connect_start_ = std::chrono::steady_clock::now();
         ConnectToTarget();
     }
 
@@ -38,20 +55,24 @@ private:
         auto resolver = boost::make_shared<ip::tcp::resolver>(*io_context_ptr_);
         resolver->async_resolve(
             target_host_, std::to_string(target_port_),
-            [this, resolver](boost::system::error_code ec, ip::tcp::resolver::results_type endpoints) {
+            [this, self = shared_from_this(), resolver](boost::system::error_code ec, ip::tcp::resolver::results_type endpoints) {
                 if (ec) {
                     SPDLOG_ERROR("Failed to resolve target {}:{} - {}", target_host_, target_port_, ec.message());
+                    RecordConnectOutcome(false);
                     return;
                 }
                 
                 // Connect to target
                 async_connect(
                     *target_sock_ptr_, endpoints,
-                    [this](boost::system::error_code ec, ip::tcp::endpoint) {
+                    [this, self](boost::system::error_code ec, ip::tcp::endpoint) {
                         if (ec) {
                             SPDLOG_ERROR("Failed to connect to target {}:{} - {}", target_host_, target_port_, ec.message());
+                            RecordConnectOutcome(false);
                             return;
                         }
+                        connected_ = true;
+                        RecordConnectOutcome(true);
                         
                         SPDLOG_INFO("TCP proxy established: client -> {}:{}", target_host_, target_port_);
                         
@@ -63,6 +84,21 @@ private:
         );
     }
 
+    // A raw TCP stream has no status code, the breaker only learns whether
+    // the upstream accepted the connection.
+    void RecordConnectOutcome(bool success) {
+        if (!circuit_breaker_) {
+            return;
+        }
+        if (success) {
+            circuit_breaker_->record_success(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - connect_start_));
+        } else {
+            circuit_breaker_->record_failure();
+        }
+        circuit_breaker_.reset();
+    }
+
     void StartForwarding() {
         // Start reading from both source and target simultaneously
         ReadFromSource();
@@ -173,6 +209,15 @@ private:
     // Separate buffers for bidirectional communication
     std::unique_ptr<std::array<char, 8192>> source_buffer_;
     std::unique_ptr<std::array<char, 8192>> target_buffer_;
+    
+    // Picked by the route's load balancer, if any.
+    std::shared_ptr<LoadBalancer> load_balancer_;
+    std::shared_ptr<UpstreamServer> upstream_;
+    bool connected_ = false;
+    
+    // Admitted the connection, until the connect outcome is recorded.
+    std::shared_ptr<CircuitBreaker> circuit_breaker_;
+    std::chrono::steady_clock::time_point connect_start_;
 };
 
 } // namespace azugate
@@ -191,7 +236,11 @@ void TcpProxyHandler(
     const auto& target_info = *target_connection_info_opt;
     
     if (target_info.address.empty()) {
-        SPDLOG_ERROR("Empty target address for TCP proxy");
+        if (target_info.load_balancer) {
+            SPDLOG_WARN("No available upstream for TCP proxy");
+        } else {
+            SPDLOG_ERROR("Empty target address for TCP proxy");
+        }
         return;
     }
 
@@ -200,6 +249,22 @@ void TcpProxyHandler(
         return;
     }
 
+    // Fail fast instead of waiting for a connect timeout
+    std::shared_ptr<azugate::CircuitBreaker> circuit_breaker;
+    auto& registry = azugate::CircuitBreakerRegistry::instance();
+    if (registry.enabled()) {
+        circuit_breaker = target_info.upstream
+            ? target_info.upstream->circuit_breaker()
+            : registry.get_for_upstream(target_info.address, target_info.port);
+        if (!circuit_breaker->can_proceed()) {
+            SPDLOG_DEBUG("Circuit breaker of {}:{} is open, TCP connection rejected",
+                         target_info.address, target_info.port);
+            boost::system::error_code ec;
+            source_sock_ptr->close(ec);
+            return;
+        }
+    }
+
     SPDLOG_INFO("Starting TCP proxy to {}:{}", target_info.address, target_info.port);
 
     // Create and start the async TCP proxy
@@ -207,7 +272,10 @@ void TcpProxyHandler(
         io_context_ptr, 
         source_sock_ptr, 
         target_info.address, 
-        target_info.port
+        target_info.port,
+        target_info.load_balancer,
+        target_info.upstream,
+        std::move(circuit_breaker)
     );
     
     proxy->Start();
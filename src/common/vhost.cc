@@ -0,0 +1,135 @@
+#include "../../include/vhost.hpp"
+#include <cctype>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
+
+namespace azugate {
+
+std::string NormalizeHost(std::string_view authority) {
+  // trim optional whitespace.
+  while (!authority.empty() &&
+         (authority.front() == ' ' || authority.front() == '\t')) {
+    authority.remove_prefix(1);
+  }
+  while (!authority.empty() &&
+         (authority.back() == ' ' || authority.back() == '\t')) {
+    authority.remove_suffix(1);
+  }
+  if (authority.empty()) {
+    return "";
+  }
+  std::string_view host = authority;
+  if (host.front() == '[') {
+    // IPv6 literal: [::1]:8080.
+    auto end = host.find(']');
+    if (end == std::string_view::npos) {
+      return "";
+    }
+    host = host.substr(0, end + 1);
+  } else {
+    auto colon = host.find(':');
+    if (colon != std::string_view::npos) {
+      host = host.substr(0, colon);
+    }
+    if (!host.empty() && host.back() == '.') {
+      host.remove_suffix(1);
+    }
+  }
+  std::string result;
+  result.reserve(host.size());
+  for (unsigned char c : host) {
+    if (c <= ' ' || c == '/' || c == '@') {
+      return "";
+    }
+    result.push_back(static_cast<char>(std::tolower(c)));
+  }
+  return result;
+}
+
+VirtualHostIndex::VirtualHostIndex() : nodes_(1), num_entries_(0) {}
+
+bool VirtualHostIndex::Insert(std::string_view pattern, size_t id) {
+  if (pattern.starts_with("*.")) {
+    std::string_view suffix = pattern.substr(2);
+    if (suffix.empty() || suffix.find('*') != std::string_view::npos) {
+      SPDLOG_WARN("invalid wildcard virtual host: {}", pattern);
+      return false;
+    }
+    // walk the labels from right to left.
+    size_t node = 0;
+    while (!suffix.empty()) {
+      auto dot = suffix.rfind('.');
+      std::string_view label =
+          dot == std::string_view::npos ? suffix : suffix.substr(dot + 1);
+      suffix = dot == std::string_view::npos ? std::string_view{}
+                                             : suffix.substr(0, dot);
+      if (label.empty()) {
+        SPDLOG_WARN("invalid wildcard virtual host: {}", pattern);
+        return false;
+      }
+      auto it = nodes_[node].children.find(label);
+      if (it == nodes_[node].children.end()) {
+        size_t next = nodes_.size();
+        nodes_[node].children.emplace(std::string(label), next);
+        nodes_.emplace_back();
+        node = next;
+      } else {
+        node = it->second;
+      }
+    }
+    if (nodes_[node].wildcard_id) {
+      return false;
+    }
+    nodes_[node].wildcard_id = id;
+    ++num_entries_;
+    return true;
+  }
+  if (pattern.empty() || pattern.find('*') != std::string_view::npos) {
+    SPDLOG_WARN("invalid virtual host: {}", pattern);
+    return false;
+  }
+  if (!exact_.emplace(std::string(pattern), id).second) {
+    return false;
+  }
+  ++num_entries_;
+  return true;
+}
+
+std::optional<size_t> VirtualHostIndex::Lookup(std::string_view host) const {
+  if (host.empty()) {
+    return std::nullopt;
+  }
+  auto exact_it = exact_.find(host);
+  if (exact_it != exact_.end()) {
+    return exact_it->second;
+  }
+  std::optional<size_t> best;
+  size_t node = 0;
+  while (!host.empty()) {
+    auto dot = host.rfind('.');
+    std::string_view label =
+        dot == std::string_view::npos ? host : host.substr(dot + 1);
+    host = dot == std::string_view::npos ? std::string_view{}
+                                         : host.substr(0, dot);
+    auto it = nodes_[node].children.find(label);
+    if (it == nodes_[node].children.end()) {
+      break;
+    }
+    node = it->second;
+    // "*.example.com" needs at least one more label on the left.
+    if (!host.empty() && nodes_[node].wildcard_id) {
+      best = nodes_[node].wildcard_id;
+    }
+  }
+  return best;
+}
+
+void VirtualHostIndex::Clear() {
+  exact_.clear();
+  nodes_.clear();
+  nodes_.emplace_back();
+  num_entries_ = 0;
+}
+
+} // namespace azugate